@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "agc_stage.h"
+#include "wav_block_reader.h"
+
+extern "C"
+{
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+
+static void help(const char *argv0) {
+    cout << "agc_bench [options]" << endl;
+    cout << "Measures the AGC stage on recordings: how close each recording, played at several input levels," << endl;
+    cout << "comes out to the target level, and what the stage costs per block next to a per-sample AGC." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=WAV_FILE                      A recording, may be repeated, default is a beamformer output," << endl;
+    cout << "                                           anusha/vep_aec_beamforming_node_out.wav, and audio_angletest.wav" << endl;
+    cout << "  -t, --targets=DBFS,...                   Target levels, default is -10,-20" << endl;
+    cout << "  -i, --inputs=DB,...                      Input level offsets the recordings are played at, default is -10,0,10" << endl;
+    cout << "  -e, --tolerance=DB                       Largest level error that passes, default is 2" << endl;
+    cout << "  -r, --repeat=TIMES                       Passes over each file for the timing, default is 20" << endl;
+}
+
+static double ThreadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool ParseList(const string &text, vector<float> *values) {
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ',')) {
+        char *end = nullptr;
+        values->push_back(strtof(item.c_str(), &end));
+        if (item.empty() || *end != '\0') return false;
+    }
+    return !values->empty();
+}
+
+// The textbook AGC the stage is measured against: the same envelope and gain
+// law, but run sample by sample, so nothing in it vectorizes.
+class PerSampleAgc {
+public:
+    PerSampleAgc(const AgcOptions &options, int rate) : options_(options), gain_(1), activity_(0), level_(0) {
+        float sample_ms = 1000.0f / rate;
+        activity_decay_ = exp(-sample_ms / 50.0f);
+        level_decay_ = exp(-sample_ms / options.level_ms);
+        noise_decay_ = exp(-sample_ms / (4 * options.level_ms));
+        rise_ = pow(10.0f, options.gain_rise_db_per_s / rate / 20);
+        fall_ = pow(10.0f, -options.gain_fall_db_per_s / rate / 20);
+    }
+
+    void Process(float *planar, size_t num_channels, size_t frames) {
+        float target = pow(10.0f, options_.target_dbfs / 20), gate = pow(10.0f, options_.gate_dbfs / 10);
+        float limit = pow(10.0f, options_.limit_dbfs / 20);
+        float max_gain = pow(10.0f, options_.max_gain_db / 20), min_gain = pow(10.0f, options_.min_gain_db / 20);
+        for (size_t n = 0; n < frames; n++) {
+            float power = 0, peak = 0;
+            for (size_t c = 0; c < num_channels; c++) {
+                float x = planar[c * frames + n];
+                power += x * x / num_channels;
+                peak = max(peak, fabs(x));
+            }
+            activity_ = power > activity_ ? power : power + activity_decay_ * (activity_ - power);
+            if (activity_ > gate) {
+                if (level_ == 0) level_ = activity_;
+                level_ = power + (activity_ > level_ * 0.03f ? level_decay_ : noise_decay_) * (level_ - power);
+                float wanted = min(max_gain, max(min_gain, target / sqrt(level_)));
+                gain_ = wanted > gain_ ? min(wanted, gain_ * rise_) : max(wanted, gain_ * fall_);
+            }
+            // The limiter cuts only what is applied, as in the stage.
+            float applied = peak * gain_ > limit ? limit / peak : gain_;
+            for (size_t c = 0; c < num_channels; c++) planar[c * frames + n] *= applied;
+        }
+    }
+
+private:
+    AgcOptions options_;
+    float gain_, activity_, level_, activity_decay_, level_decay_, noise_decay_, rise_, fall_;
+};
+
+// Speech level of mono float audio: the power of the 100 ms frames that are
+// within 15 dB of the loudest tenth of frames, skipping skip_s of
+// convergence. active, when not empty, says which frames count, so the
+// output is judged on the frames that were speech at the input.
+static double ActiveLevelDbfs(const vector<float> &x, int rate, double skip_s, vector<bool> *active) {
+    size_t frame = rate / 10, skip = static_cast<size_t>(skip_s * 10);
+    size_t num_frames = x.size() / frame;
+    vector<double> levels(num_frames);
+    for (size_t f = 0; f < num_frames; f++) {
+        double sum = 0;
+        for (size_t i = 0; i < frame; i++) sum += double(x[f * frame + i]) * x[f * frame + i];
+        levels[f] = 10 * log10(sum / frame + 1e-20);
+    }
+    if (active->empty()) {
+        vector<double> sorted(levels);
+        sort(sorted.begin(), sorted.end());
+        double loud = sorted.empty() ? 0 : sorted[sorted.size() * 9 / 10];
+        active->resize(num_frames);
+        for (size_t f = 0; f < num_frames; f++) (*active)[f] = f >= skip && levels[f] > loud - 15;
+    }
+    double power = 0;
+    size_t count = 0;
+    for (size_t f = 0; f < num_frames; f++) {
+        if (!(*active)[f]) continue;
+        power += pow(10.0, levels[f] / 10);
+        count++;
+    }
+    return count ? 10 * log10(power / count) : -200;
+}
+
+static bool LoadBlocks(const string &path, vector<AudioBlock> *blocks) {
+    unique_ptr<WavBlockReader> reader(WavBlockReader::Create(path, BLOCK_SIZE_MS));
+    if (!reader) return false;
+    AudioBlock block;
+    while (reader->Read(&block)) {
+        if (block.NumFrames() * 1000 == static_cast<size_t>(block.rate) * BLOCK_SIZE_MS) blocks->push_back(block);
+    }
+    return !blocks->empty();
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    vector<string> files;
+    vector<float> targets, offsets;
+    float tolerance = 2.0f;
+    int repeat = 20;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"targets",      1, NULL, 't'},
+        {"inputs",       1, NULL, 'i'},
+        {"tolerance",    1, NULL, 'e'},
+        {"repeat",       1, NULL, 'r'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:t:i:e:r:h", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            files.push_back(string(optarg));
+            break;
+        case 't':
+            if (!ParseList(optarg, &targets)) {
+                cout << "Error : bad target list " << optarg << endl;
+                return -1;
+            }
+            break;
+        case 'i':
+            if (!ParseList(optarg, &offsets)) {
+                cout << "Error : bad input level list " << optarg << endl;
+                return -1;
+            }
+            break;
+        case 'e':
+            tolerance = stof(optarg);
+            break;
+        case 'r':
+            repeat = max(1, stoi(optarg));
+            break;
+        default:
+            return 0;
+        }
+    }
+    if (files.empty()) {
+        files.push_back("anusha/vep_aec_beamforming_node_out.wav");
+        files.push_back("audio_angletest.wav");
+    }
+    if (targets.empty()) targets = {-10, -20};
+    if (offsets.empty()) offsets = {-10, 0, 10};
+
+    bool all_pass = true;
+    int judged = 0, cases = 0;
+    AgcOptions defaults;
+    cout << fixed << setprecision(2);
+    for (size_t f = 0; f < files.size(); f++) {
+        vector<AudioBlock> blocks;
+        if (!LoadBlocks(files[f], &blocks)) {
+            cout << "Error : can not read " << files[f] << endl;
+            return -1;
+        }
+        size_t num_channels = blocks[0].num_channels, frames = blocks[0].NumFrames();
+        int rate = blocks[0].rate;
+        cout << files[f] << ": " << num_channels << " ch at " << rate << " Hz, " << blocks.size() * BLOCK_SIZE_MS / 1000.0
+             << " s" << endl;
+
+        // Level accuracy: the recording scaled to each input level, through
+        // the stage as int16 blocks, the way a chain would run it. Levels are
+        // taken on channel 0. A case is only judged when the stage can reach
+        // the target: the gain it needs is within max_gain_db and the speech
+        // is clear of the gate. The limiter's ceiling is part of what is
+        // judged. Input levels that would push the recording past full scale
+        // are not run; clipping the input is not a test of the AGC.
+        int peak = 0;
+        for (size_t b = 0; b < blocks.size(); b++) {
+            const int16_t *samples = blocks[b].Samples();
+            for (size_t i = 0; i < frames * num_channels; i++) peak = max(peak, abs(static_cast<int>(samples[i])));
+        }
+        double headroom = 20 * log10(32767.0 / max(peak, 1));
+        cout << setw(12) << "target dBFS" << setw(11) << "input dB" << setw(11) << "in dBFS" << setw(11) << "out dBFS"
+             << setw(9) << "error" << setw(10) << "clipped" << endl;
+        for (size_t t = 0; t < targets.size(); t++) {
+            for (size_t o = 0; o < offsets.size(); o++) {
+                if (offsets[o] > headroom + 0.05) {
+                    cout << setw(12) << targets[t] << setw(11) << offsets[o] << "   skipped, the input peaks at "
+                         << setprecision(1) << offsets[o] - headroom << " dB over full scale" << setprecision(2) << endl;
+                    continue;
+                }
+                unique_ptr<AgcStage> agc(AgcStage::Create(targets[t]));
+                agc->Prepare(num_channels, rate, BLOCK_SIZE_MS);
+                float scale = pow(10.0f, offsets[o] / 20);
+                vector<float> in, out;
+                size_t clipped = 0;
+                for (size_t b = 0; b < blocks.size(); b++) {
+                    AudioBlock block = blocks[b];
+                    int16_t *samples = block.Samples();
+                    for (size_t i = 0; i < frames * num_channels; i++) samples[i] = static_cast<int16_t>(max(-32768.0f, min(32767.0f, samples[i] * scale)));
+                    for (size_t i = 0; i < frames; i++) in.push_back(samples[i * num_channels] / 32768.0f);
+                    agc->ProcessBlock(&block);
+                    for (size_t i = 0; i < frames; i++) out.push_back(samples[i * num_channels] / 32768.0f);
+                    for (size_t i = 0; i < frames * num_channels; i++) clipped += samples[i] == 32767 || samples[i] == -32768;
+                }
+                vector<bool> active;
+                double in_level = ActiveLevelDbfs(in, rate, 3.0, &active);
+                double out_level = ActiveLevelDbfs(out, rate, 3.0, &active);
+                double error = out_level - targets[t];
+                ostringstream reason;
+                reason << fixed << setprecision(1);
+                if (targets[t] - in_level > defaults.max_gain_db) {
+                    reason << "out of range, needs " << targets[t] - in_level << " dB of gain";
+                }
+                else if (in_level < defaults.gate_dbfs + 10) {
+                    reason << "out of range, speech near the gate";
+                }
+                bool pass = fabs(error) <= tolerance;
+                cases++;
+                if (reason.str().empty()) {
+                    judged++;
+                    all_pass = all_pass && pass;
+                    if (!pass) reason << "FAIL";
+                }
+                cout << setw(12) << targets[t] << setw(11) << offsets[o] << setw(11) << in_level << setw(11) << out_level
+                     << setw(9) << error << setw(10) << clipped << "   " << reason.str() << endl;
+            }
+        }
+
+        // Cost: the stage on int16 and float planar blocks, and the
+        // per-sample AGC, each over the whole file repeat times.
+        vector<AudioBlock> planar(blocks);
+        for (size_t b = 0; b < planar.size(); b++) ConvertToFloatPlanar(&planar[b]);
+        AgcOptions options;
+        double int16_s = 0, float_s = 0, sample_s = 0;
+        for (int r = 0; r < repeat; r++) {
+            unique_ptr<AgcStage> agc(AgcStage::Create(options));
+            agc->Prepare(num_channels, rate, BLOCK_SIZE_MS);
+            vector<AudioBlock> work(blocks);
+            double start = ThreadCpuSeconds();
+            for (size_t b = 0; b < work.size(); b++) agc->ProcessBlock(&work[b]);
+            int16_s += ThreadCpuSeconds() - start;
+
+            agc->Prepare(num_channels, rate, BLOCK_SIZE_MS);
+            work = planar;
+            start = ThreadCpuSeconds();
+            for (size_t b = 0; b < work.size(); b++) agc->ProcessBlock(&work[b]);
+            float_s += ThreadCpuSeconds() - start;
+
+            PerSampleAgc reference(options, rate);
+            work = planar;
+            start = ThreadCpuSeconds();
+            for (size_t b = 0; b < work.size(); b++) reference.Process(&work[b].planar[0], num_channels, frames);
+            sample_s += ThreadCpuSeconds() - start;
+        }
+        double per_block = 1e6 / (repeat * blocks.size());
+        cout << "cost per " << BLOCK_SIZE_MS << " ms block: stage " << int16_s * per_block << " us on int16, "
+             << float_s * per_block << " us on float planar, per-sample AGC " << sample_s * per_block << " us ("
+             << setprecision(1) << sample_s / max(float_s, 1e-12) << "x the stage)" << setprecision(2) << endl;
+    }
+    all_pass = all_pass && judged > 0;
+    cout << "level accuracy " << (all_pass ? "within" : "OUTSIDE") << " +-" << tolerance << " dB in the " << judged
+         << " of " << cases << " cases in range" << endl;
+    return all_pass ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+#ifndef AGC_STAGE_H_
+#define AGC_STAGE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "chain_stage.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+// Levels are dB relative to full scale; target_dbfs is the RMS the AGC
+// aims speech at, the same sense as the -N of SetAgcTargetLevelDbfs(N).
+struct AgcOptions {
+    float target_dbfs = -10.0f;
+    float max_gain_db = 45.0f;          // the beamformer output sits near -49 dBFS
+    float min_gain_db = -20.0f;
+    float gate_dbfs = -60.0f;           // below this the level and gain are held, so pauses are not pulled up
+    float limit_dbfs = -1.0f;           // peak ceiling after the gain
+    float level_ms = 500.0f;            // averaging time of the speech level
+    float gain_rise_db_per_s = 12.0f;
+    float gain_fall_db_per_s = 60.0f;
+};
+
+// Automatic gain control as a stage of its own, so any chain can have it, not
+// only one that ends in a KWS node with AGC built in. The block is cut into
+// sub-blocks of about a millisecond; for each, one SIMD pass per channel gives
+// its power and peak. A fast envelope of the power tells speech from pauses;
+// while it is above the gate, a slow one follows the speech level, and the
+// gain steps towards target / level at a limited rate. Syllable peaks are
+// left to the limiter rather than the level, so the gain does not pump with
+// them. The gain applied is ramped linearly across the sub-block (no
+// per-sample recursion, so the whole sample path vectorizes) and cut further
+// where the sub-block's peak would pass the ceiling; that cut is not fed back
+// into the controller's gain, so a peak does not drag the gain down and make
+// it climb back afterwards. One gain is shared by all channels, which keeps
+// the level and phase relations a beamformer downstream depends on.
+class AgcStage : public ChainStage {
+public:
+    static AgcStage *Create(const AgcOptions &options) {
+        if (options.max_gain_db < options.min_gain_db || options.level_ms <= 0) return nullptr;
+        return new AgcStage(options);
+    }
+
+    static AgcStage *Create(float target_dbfs) {
+        AgcOptions options;
+        options.target_dbfs = target_dbfs;
+        return Create(options);
+    }
+
+    std::string Name() const override { return "agc"; }
+    bool SupportsFloatPlanar() const override { return true; }
+
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override {
+        // About 1 ms, a multiple of 4 so the SIMD loops have no tail.
+        sub_frames_ = std::max<size_t>(4, static_cast<size_t>(rate) / 1000 / 4 * 4);
+        float sub_ms = 1000.0f * sub_frames_ / rate;
+        activity_decay_ = std::exp(-sub_ms / kActivityMs);
+        level_decay_ = std::exp(-sub_ms / options_.level_ms);
+        noise_decay_ = std::exp(-sub_ms / (4 * options_.level_ms));
+        rise_ = DbToGain(options_.gain_rise_db_per_s * sub_ms / 1000);
+        fall_ = DbToGain(-options_.gain_fall_db_per_s * sub_ms / 1000);
+        target_ = DbToGain(options_.target_dbfs);
+        gate_power_ = DbToGain(2 * options_.gate_dbfs);
+        limit_ = DbToGain(options_.limit_dbfs);
+        max_gain_ = DbToGain(options_.max_gain_db);
+        min_gain_ = DbToGain(options_.min_gain_db);
+        gain_ = 1.0f;
+        applied_ = 1.0f;
+        activity_ = 0;
+        level_ = 0;
+        scratch_.resize(num_channels * (static_cast<size_t>(rate) * block_size_ms / 1000));
+        return true;
+    }
+
+    void ProcessBlock(AudioBlock *block) override {
+        size_t frames = block->NumFrames();
+        if (frames == 0) return;
+        if (block->format == kFloat32Planar) {
+            Process(&block->planar[0], block->num_channels, frames);
+            return;
+        }
+        scratch_.resize(frames * block->num_channels);
+        for (size_t c = 0; c < block->num_channels; c++) {
+            simd::DeinterleaveToFloat(block->Samples(), block->num_channels, c, frames, 1.0f / 32768, &scratch_[c * frames]);
+        }
+        Process(&scratch_[0], block->num_channels, frames);
+        for (size_t c = 0; c < block->num_channels; c++) {
+            simd::InterleaveFromFloat(&scratch_[c * frames], frames, 32768.0f, block->num_channels, c, block->Samples());
+        }
+    }
+
+    // planar holds num_channels runs of frames floats, full scale 1.0.
+    void Process(float *planar, size_t num_channels, size_t frames) {
+        for (size_t begin = 0; begin < frames; begin += sub_frames_) {
+            size_t n = std::min(sub_frames_, frames - begin);
+            float sum = 0, sum_sq = 0, peak = 0;
+            uint32_t clipped = 0;
+            for (size_t c = 0; c < num_channels; c++) {
+                simd::Moments(planar + c * frames + begin, n, 2.0f, &sum, &sum_sq, &peak, &clipped);
+            }
+            float power = sum_sq / (n * num_channels);
+            activity_ = power > activity_ ? power : power + activity_decay_ * (activity_ - power);
+
+            float gain = gain_;
+            if (activity_ > gate_power_) {
+                // The first speech sets the level outright instead of
+                // rising to it from silence.
+                if (level_ == 0) level_ = activity_;
+                // A plain average of the power, the same time constant up
+                // and down, so it does not lean to the peaks. Noise in
+                // pauses that passes the gate is well under the speech
+                // level and only pulls it down slowly.
+                float decay = activity_ > level_ * kSpeechMargin ? level_decay_ : noise_decay_;
+                level_ = power + decay * (level_ - power);
+                float wanted = std::min(max_gain_, std::max(min_gain_, target_ / std::sqrt(level_)));
+                gain = wanted > gain_ ? std::min(wanted, gain_ * rise_) : std::max(wanted, gain_ * fall_);
+            }
+            gain_ = gain;
+            // The ceiling holds for the whole ramp, both ends included. The
+            // ramp starts where the last one ended, so a cut is released
+            // over the next sub-block instead of stepping back.
+            float start = applied_, end = gain_;
+            if (peak * end > limit_) end = limit_ / peak;
+            if (peak * start > limit_) start = limit_ / peak;
+            float step = (end - start) / n;
+            for (size_t c = 0; c < num_channels; c++) simd::Ramp(start, step, planar + c * frames + begin, n);
+            applied_ = end;
+        }
+    }
+
+    // The controller's gain; the limiter may apply less on a peak.
+    float GetGainDb() const { return 20 * std::log10(gain_); }
+    // The speech level the gain is set from, before the gain.
+    float GetLevelDbfs() const { return level_ > 1e-20f ? 10 * std::log10(level_) : -200; }
+
+private:
+    explicit AgcStage(const AgcOptions &options)
+        : options_(options), sub_frames_(16), level_decay_(0), noise_decay_(0), rise_(1), fall_(1), target_(1), gate_power_(0),
+          limit_(1), max_gain_(1), min_gain_(1), activity_decay_(0), gain_(1), applied_(1), activity_(0), level_(0) {}
+
+    static constexpr float kActivityMs = 50.0f;    // release of the speech/pause envelope
+    static constexpr float kSpeechMargin = 0.03f;  // -15 dB, power under the level taken for noise
+
+    static float DbToGain(float db) { return std::pow(10.0f, db / 20); }
+
+    AgcOptions options_;
+    size_t sub_frames_;
+    float level_decay_, noise_decay_, rise_, fall_;
+    float target_, gate_power_, limit_, max_gain_, min_gain_;
+    float activity_decay_;
+    float gain_, applied_, activity_, level_;
+    std::vector<float> scratch_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // AGC_STAGE_H_
@@ -0,0 +1,319 @@
+#ifndef ASYNC_LOG_H_
+#define ASYNC_LOG_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture_clock.h"
+#include "rt_check.h"
+
+namespace respeaker_ext {
+
+enum LogLevel { kLogDebug, kLogInfo, kLogWarn, kLogError, kLogOff };
+
+// One argument of a record, captured by value. Strings are kept as pointers
+// and formatted later on the drain thread, so they must outlive it: string
+// literals, node names, anything that lives until the log is destroyed.
+struct LogArg {
+    enum Type : uint8_t { kInt, kUint, kDouble, kString };
+    Type type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const char *s;
+    };
+
+    LogArg(int v) : type(kInt), i(v) {}
+    LogArg(long v) : type(kInt), i(v) {}
+    LogArg(long long v) : type(kInt), i(v) {}
+    LogArg(unsigned v) : type(kUint), u(v) {}
+    LogArg(unsigned long v) : type(kUint), u(v) {}
+    LogArg(unsigned long long v) : type(kUint), u(v) {}
+    LogArg(double v) : type(kDouble), d(v) {}
+    LogArg(const char *v) : type(kString), s(v) {}
+    LogArg() : type(kInt), i(0) {}
+};
+
+// Lets one call site through at most once per interval and counts what it
+// held back; the next record that gets through says how many. Keep one per
+// call site, e.g. as a static or a member.
+class LogRateLimit {
+public:
+    explicit LogRateLimit(int interval_ms) : interval_ns_(interval_ms * 1000000LL), next_ns_(0), suppressed_(0) {}
+
+    // Returns the number of records suppressed since the last one allowed,
+    // or -1 if this one is suppressed too.
+    int64_t Allow(int64_t now_ns) {
+        int64_t next = next_ns_.load(std::memory_order_relaxed);
+        if (now_ns < next || !next_ns_.compare_exchange_strong(next, now_ns + interval_ns_, std::memory_order_relaxed)) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return -1;
+        }
+        return suppressed_.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    int64_t interval_ns_;
+    std::atomic<int64_t> next_ns_;
+    std::atomic<int64_t> suppressed_;
+};
+
+// A logger for threads that poll audio. A record is a timestamp, a format
+// string and up to kMaxArgs arguments, copied into a ring the calling thread
+// owns; a drain thread formats and writes the records every drain_ms. The
+// calling thread never takes a lock, allocates, formats or makes a system
+// call after its first record, and when its ring is full the record is
+// dropped and counted instead of blocking. Formats are literals with {} for
+// each argument:
+//
+//   log->Info("collector: {}, vep_1beam: {}", collector_depth, beam_depth);
+//
+// Records from different threads are merged by time within a drain. The demos
+// print their queue depths through it, so a status line costs the polling
+// thread a copy into its ring instead of a flushed write to the console.
+class AsyncLog {
+public:
+    static const size_t kMaxArgs = 6;
+
+    struct Options {
+        FILE *out = stdout;
+        LogLevel level = kLogInfo;
+        int drain_ms = 50;
+        // Records per thread ring, rounded up to a power of two.
+        size_t ring_records = 1024;
+    };
+
+    static AsyncLog *Create(const Options &options) { return new AsyncLog(options); }
+    static AsyncLog *Create() { return new AsyncLog(Options()); }
+
+    // Drains whatever is left and stops the drain thread.
+    ~AsyncLog() {
+        stopping_.store(true);
+        drain_thread_.join();
+        DrainOnce();
+    }
+
+    void SetLevel(LogLevel level) { level_.store(level, std::memory_order_relaxed); }
+    bool Enabled(LogLevel level) const { return level >= level_.load(std::memory_order_relaxed); }
+
+    template <typename... Args>
+    void Debug(const char *format, Args... args) { Log(kLogDebug, format, args...); }
+    template <typename... Args>
+    void Info(const char *format, Args... args) { Log(kLogInfo, format, args...); }
+    template <typename... Args>
+    void Warn(const char *format, Args... args) { Log(kLogWarn, format, args...); }
+    template <typename... Args>
+    void Error(const char *format, Args... args) { Log(kLogError, format, args...); }
+
+    template <typename... Args>
+    void Log(LogLevel level, const char *format, Args... args) {
+        static_assert(sizeof...(Args) <= kMaxArgs, "too many log arguments");
+        if (!Enabled(level)) return;
+        const LogArg packed[] = {LogArg(), LogArg(args)...};
+        Write(level, MonotonicNs(), 0, format, packed + 1, sizeof...(Args));
+    }
+
+    // Rate-limited Log(): at most one record per limit interval.
+    template <typename... Args>
+    void Log(LogLevel level, LogRateLimit *limit, const char *format, Args... args) {
+        static_assert(sizeof...(Args) <= kMaxArgs, "too many log arguments");
+        if (!Enabled(level)) return;
+        int64_t now = MonotonicNs();
+        int64_t suppressed = limit->Allow(now);
+        if (suppressed < 0) return;
+        const LogArg packed[] = {LogArg(), LogArg(args)...};
+        Write(level, now, suppressed, format, packed + 1, sizeof...(Args));
+    }
+
+    // For argument lists built at run time.
+    void Write(LogLevel level, int64_t ns, int64_t suppressed, const char *format, const LogArg *args, size_t num_args) {
+        Ring *ring = ThreadRing();
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        if (tail - ring->head.load(std::memory_order_acquire) == ring->records.size()) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Record &record = ring->records[tail & ring->mask];
+        record.ns = ns;
+        record.format = format;
+        record.level = level;
+        record.suppressed = suppressed;
+        record.num_args = num_args < kMaxArgs ? num_args : kMaxArgs;
+        for (size_t i = 0; i < record.num_args; i++) record.args[i] = args[i];
+        ring->tail.store(tail + 1, std::memory_order_release);
+    }
+
+    // Creates the calling thread's ring now, so its first record does not
+    // allocate. Audio threads call this before their loop.
+    void AttachThread() { ThreadRing(); }
+
+    // Records lost to full rings so far.
+    uint64_t GetDropped() const {
+        std::lock_guard<std::mutex> guard(rings_lock_);
+        uint64_t dropped = 0;
+        for (size_t i = 0; i < rings_.size(); i++) dropped += rings_[i]->dropped.load(std::memory_order_relaxed);
+        return dropped;
+    }
+
+private:
+    struct Record {
+        int64_t ns;
+        const char *format;
+        int64_t suppressed;
+        LogArg args[kMaxArgs];
+        uint8_t level;
+        uint8_t num_args;
+    };
+
+    // Single producer (the owning thread), single consumer (the drain).
+    struct Ring {
+        std::vector<Record> records;
+        uint64_t mask;
+        std::thread::id owner;
+        std::atomic<uint64_t> dropped{0};
+        // Padding keeps the drain's head and the producer's tail on separate
+        // cache lines (alignas would need C++17's aligned new).
+        char pad0[64];
+        std::atomic<uint64_t> head{0};
+        char pad1[64];
+        std::atomic<uint64_t> tail{0};
+    };
+
+    explicit AsyncLog(const Options &options)
+        : out_(options.out), level_(options.level), drain_ms_(options.drain_ms), ring_records_(1),
+          origin_ns_(MonotonicNs()), id_(NextId()), stopping_(false) {
+        while (ring_records_ < options.ring_records) ring_records_ <<= 1;
+        drain_thread_ = std::thread(&AsyncLog::DrainLoop, this);
+    }
+
+    // Ids rather than addresses key the per-thread cache, since a new log can
+    // be allocated where a destroyed one was.
+    static uint64_t NextId() {
+        static std::atomic<uint64_t> next(1);
+        return next.fetch_add(1);
+    }
+
+    // The calling thread's ring, created on its first record. A thread that
+    // logs to several loggers in turn looks its ring up again on each switch.
+    Ring *ThreadRing() {
+        struct Cache {
+            uint64_t log_id;
+            Ring *ring;
+        };
+        static thread_local Cache cache = {0, nullptr};
+        if (cache.log_id == id_) return cache.ring;
+        std::lock_guard<std::mutex> guard(rings_lock_);
+        std::thread::id self = std::this_thread::get_id();
+        Ring *ring = nullptr;
+        for (size_t i = 0; i < rings_.size() && !ring; i++) {
+            if (rings_[i]->owner == self) ring = rings_[i].get();
+        }
+        if (!ring) {
+            rings_.push_back(std::unique_ptr<Ring>(new Ring));
+            ring = rings_.back().get();
+            ring->records.resize(ring_records_);
+            ring->mask = ring_records_ - 1;
+            ring->owner = self;
+        }
+        cache.log_id = id_;
+        cache.ring = ring;
+        return ring;
+    }
+
+    // Sleeps rather than waiting on a condition variable, so that logging
+    // never has to notify anyone.
+    void DrainLoop() {
+        RtCheck::Exempt();
+        while (!stopping_.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(drain_ms_));
+            DrainOnce();
+        }
+    }
+
+    void DrainOnce() {
+        batch_.clear();
+        {
+            std::lock_guard<std::mutex> guard(rings_lock_);
+            for (size_t i = 0; i < rings_.size(); i++) {
+                Ring *ring = rings_[i].get();
+                uint64_t head = ring->head.load(std::memory_order_relaxed);
+                uint64_t tail = ring->tail.load(std::memory_order_acquire);
+                for (; head != tail; head++) batch_.push_back(ring->records[head & ring->mask]);
+                ring->head.store(head, std::memory_order_release);
+            }
+        }
+        if (batch_.empty()) return;
+        std::stable_sort(batch_.begin(), batch_.end(), [](const Record &a, const Record &b) { return a.ns < b.ns; });
+        for (size_t i = 0; i < batch_.size(); i++) Format(batch_[i]);
+        fflush(out_);
+    }
+
+    void Format(const Record &record) {
+        static const char kLevels[] = "DIWE";
+        char line[512];
+        int n = snprintf(line, sizeof(line), "[%11.6f] %c ", (record.ns - origin_ns_) / 1e9, kLevels[record.level]);
+        size_t arg = 0;
+        for (const char *p = record.format; *p && n < static_cast<int>(sizeof(line)) - 1; p++) {
+            if (p[0] == '{' && p[1] == '}' && arg < record.num_args) {
+                n += FormatArg(record.args[arg++], line + n, sizeof(line) - n);
+                p++;
+            }
+            else {
+                line[n++] = *p;
+            }
+        }
+        n = std::min(n, static_cast<int>(sizeof(line)) - 1);
+        line[n] = '\0';
+        if (record.suppressed > 0) {
+            fprintf(out_, "%s (%lld suppressed)\n", line, static_cast<long long>(record.suppressed));
+        }
+        else {
+            fprintf(out_, "%s\n", line);
+        }
+    }
+
+    static int FormatArg(const LogArg &arg, char *out, size_t size) {
+        int n;
+        switch (arg.type) {
+        case LogArg::kInt:
+            n = snprintf(out, size, "%lld", static_cast<long long>(arg.i));
+            break;
+        case LogArg::kUint:
+            n = snprintf(out, size, "%llu", static_cast<unsigned long long>(arg.u));
+            break;
+        case LogArg::kDouble:
+            n = snprintf(out, size, "%g", arg.d);
+            break;
+        default:
+            n = snprintf(out, size, "%s", arg.s ? arg.s : "(null)");
+            break;
+        }
+        return std::max(0, std::min(n, static_cast<int>(size) - 1));
+    }
+
+    FILE *out_;
+    std::atomic<int> level_;
+    int drain_ms_;
+    size_t ring_records_;
+    int64_t origin_ns_;
+    uint64_t id_;
+    mutable std::mutex rings_lock_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+    std::vector<Record> batch_;
+    std::atomic<bool> stopping_;
+    std::thread drain_thread_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // ASYNC_LOG_H_
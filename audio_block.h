@@ -0,0 +1,80 @@
+#ifndef AUDIO_BLOCK_H_
+#define AUDIO_BLOCK_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+enum SampleFormat {
+    // Interleaved int16 in AudioBlock::data.
+    kInt16Interleaved,
+    // One float run per channel in AudioBlock::planar, full scale is 1.0 and
+    // values may exceed it until the block is converted back.
+    kFloat32Planar,
+};
+
+// One block of audio as it travels between in-process stages. Blocks enter
+// and leave a chain as interleaved int16, the same layout librespeaker hands
+// out from Listen() and DetectHotword(), so a block can be filled straight
+// from a chain's output. Between stages that support it, the block may be
+// carried as float32 planar instead; see ChainExecutor::SetSampleFormat().
+struct AudioBlock {
+    std::string data;
+    std::vector<float> planar;
+    SampleFormat format = kInt16Interleaved;
+    size_t num_channels = 0;
+    int rate = 0;
+    uint64_t sequence = 0;
+    // Where the block's first frame sits in the capture: its index, counted
+    // at the block's current rate, and its CLOCK_MONOTONIC capture time (see
+    // capture_clock.h). Set by the source and passed through by stages; a
+    // stage that changes the rate rescales sample_index.
+    uint64_t sample_index = 0;
+    int64_t capture_ns = 0;
+
+    size_t NumFrames() const {
+        if (!num_channels) return 0;
+        if (format == kFloat32Planar) return planar.size() / num_channels;
+        return data.size() / (sizeof(int16_t) * num_channels);
+    }
+    int16_t *Samples() { return reinterpret_cast<int16_t *>(&data[0]); }
+    const int16_t *Samples() const { return reinterpret_cast<const int16_t *>(data.data()); }
+
+    // Channel c of a float32 planar block, NumFrames() floats.
+    float *Channel(size_t c) { return &planar[c * NumFrames()]; }
+    const float *Channel(size_t c) const { return &planar[c * NumFrames()]; }
+};
+
+// Converts the block to float32 planar. Exact: every int16 value is
+// representable.
+inline void ConvertToFloatPlanar(AudioBlock *block) {
+    if (block->format == kFloat32Planar) return;
+    size_t frames = block->NumFrames();
+    block->planar.resize(frames * block->num_channels);
+    for (size_t c = 0; c < block->num_channels; c++) {
+        simd::DeinterleaveToFloat(block->Samples(), block->num_channels, c, frames, 1.0f / 32768,
+                                  &block->planar[c * frames]);
+    }
+    block->format = kFloat32Planar;
+}
+
+// Converts the block back to interleaved int16, rounding and saturating. This
+// is the only lossy step of a float32 chain.
+inline void ConvertToInt16Interleaved(AudioBlock *block) {
+    if (block->format == kInt16Interleaved) return;
+    size_t frames = block->NumFrames();
+    block->data.resize(frames * block->num_channels * sizeof(int16_t));
+    for (size_t c = 0; c < block->num_channels; c++) {
+        simd::InterleaveFromFloat(&block->planar[c * frames], frames, 32768.0f, block->num_channels, c,
+                                  block->Samples());
+    }
+    block->format = kInt16Interleaved;
+}
+
+}  // namespace respeaker_ext
+
+#endif  // AUDIO_BLOCK_H_
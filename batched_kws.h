@@ -0,0 +1,243 @@
+#ifndef BATCHED_KWS_H_
+#define BATCHED_KWS_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "chain_stage.h"
+#include "kws_features.h"
+#include "kws_template_model.h"
+
+namespace respeaker_ext {
+
+struct KwsResult {
+    size_t stream;
+    uint64_t sequence;
+    float score;      // best window score inside the block, -1 if none was scored
+    bool detected;
+};
+
+// Keyword spotting for many streams on one thread. Blocks submitted by any
+// number of chains are queued per stream; the worker runs a batch as soon as
+// every stream has a block waiting, or when the oldest waiting block has
+// waited max_wait_ms, whichever comes first. All frames of a batch go through
+// the log-mel front end together and are then scored stream by stream, in
+// order, so per-stream results are identical to running the streams alone.
+class BatchingKwsStage {
+public:
+    typedef std::function<void(const KwsResult &)> Callback;
+
+    // Returns nullptr if the model was enrolled with another front end.
+    static BatchingKwsStage *Create(std::shared_ptr<const KwsTemplateModel> model, float sensitivity,
+                                    int max_wait_ms, Callback callback) {
+        if (!model || !model->Fits(KwsFrontendConfig())) return nullptr;
+        return new BatchingKwsStage(model, sensitivity, max_wait_ms, callback);
+    }
+
+    ~BatchingKwsStage() { Stop(); }
+
+    // Registers a stream and returns its id. Only valid before Start().
+    size_t AddStream(size_t channel = 0) {
+        streams_.push_back(std::unique_ptr<Stream>(new Stream(frontend_, channel)));
+        return streams_.size() - 1;
+    }
+
+    bool Start() {
+        if (streams_.empty() || worker_.joinable()) return false;
+        stopping_ = false;
+        worker_ = std::thread(&BatchingKwsStage::WorkerLoop, this);
+        return true;
+    }
+
+    // Processes every block already submitted, then joins the worker.
+    void Stop() {
+        if (!worker_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        worker_.join();
+    }
+
+    void Submit(size_t stream, const AudioBlock &block) {
+        Pending pending;
+        pending.block = block;
+        pending.submitted = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            Stream *s = streams_[stream].get();
+            if (s->pending.empty()) waiting_streams_++;
+            s->pending.push_back(std::move(pending));
+        }
+        wake_.notify_one();
+    }
+
+    uint64_t GetNumBatches() const { return num_batches_.load(); }
+    uint64_t GetNumBlocks() const { return num_blocks_.load(); }
+    uint64_t GetNumFrames() const { return num_frames_.load(); }
+
+    size_t GetQueueDeepth() {
+        std::lock_guard<std::mutex> guard(lock_);
+        size_t depth = 0;
+        for (size_t i = 0; i < streams_.size(); i++) depth += streams_[i]->pending.size();
+        return depth;
+    }
+
+private:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    struct Pending {
+        AudioBlock block;
+        TimePoint submitted;
+    };
+
+    struct Stream {
+        Stream(const LogMelFrontend &frontend, size_t channel) : state(frontend), channel(channel) {}
+        KwsStream state;
+        size_t channel;
+        std::deque<Pending> pending;
+    };
+
+    // One block's share of the batch: which frames of the feature matrix it
+    // produced.
+    struct BlockSlot {
+        size_t stream;
+        uint64_t sequence;
+        size_t first_frame, num_frames;
+    };
+
+    BatchingKwsStage(std::shared_ptr<const KwsTemplateModel> model, float sensitivity, int max_wait_ms,
+                     Callback callback)
+        : model_(model), threshold_(KwsThresholdForSensitivity(sensitivity)),
+          max_wait_(std::chrono::milliseconds(max_wait_ms)), callback_(callback),
+          waiting_streams_(0), stopping_(false), num_batches_(0), num_blocks_(0), num_frames_(0) {}
+
+    void WorkerLoop() {
+        std::vector<std::vector<Pending> > batch(streams_.size());
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock_);
+                while (true) {
+                    if (waiting_streams_ == streams_.size() || (stopping_ && waiting_streams_ > 0)) break;
+                    if (stopping_) return;
+                    if (waiting_streams_ > 0) {
+                        TimePoint deadline = OldestLocked() + max_wait_;
+                        if (std::chrono::steady_clock::now() >= deadline) break;
+                        wake_.wait_until(guard, deadline);
+                    }
+                    else {
+                        wake_.wait(guard);
+                    }
+                }
+                for (size_t i = 0; i < streams_.size(); i++) {
+                    batch[i].assign(std::make_move_iterator(streams_[i]->pending.begin()),
+                                    std::make_move_iterator(streams_[i]->pending.end()));
+                    streams_[i]->pending.clear();
+                }
+                waiting_streams_ = 0;
+            }
+            RunBatch(&batch);
+        }
+    }
+
+    TimePoint OldestLocked() const {
+        TimePoint oldest = TimePoint::max();
+        for (size_t i = 0; i < streams_.size(); i++) {
+            if (!streams_[i]->pending.empty() && streams_[i]->pending.front().submitted < oldest) {
+                oldest = streams_[i]->pending.front().submitted;
+            }
+        }
+        return oldest;
+    }
+
+    void RunBatch(std::vector<std::vector<Pending> > *batch) {
+        samples_.clear();
+        slots_.clear();
+        size_t total_frames = 0;
+        for (size_t s = 0; s < batch->size(); s++) {
+            Stream *stream = streams_[s].get();
+            for (size_t b = 0; b < (*batch)[s].size(); b++) {
+                const AudioBlock &block = (*batch)[s][b].block;
+                size_t channel = stream->channel < block.num_channels ? stream->channel : 0;
+                stream->state.Append(block.Samples(), block.NumFrames(), block.num_channels, channel);
+                BlockSlot slot = {s, block.sequence, total_frames, stream->state.TakeFrames(&samples_)};
+                total_frames += slot.num_frames;
+                slots_.push_back(slot);
+            }
+            (*batch)[s].clear();
+        }
+
+        size_t num_mel = frontend_.NumMel();
+        frame_ptrs_.resize(total_frames);
+        for (size_t f = 0; f < total_frames; f++) frame_ptrs_[f] = &samples_[f * frontend_.FrameLength()];
+        features_.resize(total_frames * num_mel);
+        if (total_frames > 0) {
+            frontend_.ComputeBatch(&frame_ptrs_[0], total_frames, &features_[0]);
+        }
+
+        for (size_t i = 0; i < slots_.size(); i++) {
+            const BlockSlot &slot = slots_[i];
+            KwsResult result = {slot.stream, slot.sequence, -1.0f, false};
+            for (size_t f = 0; f < slot.num_frames; f++) {
+                float score;
+                bool detected;
+                KwsStream &state = streams_[slot.stream]->state;
+                state.PushFeatures(&features_[(slot.first_frame + f) * num_mel], model_->NumFrames());
+                if (state.Score(*model_, threshold_, &score, &detected)) {
+                    result.score = std::max(result.score, score);
+                    result.detected = result.detected || detected;
+                }
+            }
+            if (callback_) callback_(result);
+        }
+
+        num_batches_++;
+        num_blocks_ += slots_.size();
+        num_frames_ += total_frames;
+    }
+
+    LogMelFrontend frontend_;
+    std::shared_ptr<const KwsTemplateModel> model_;
+    float threshold_;
+    std::chrono::milliseconds max_wait_;
+    Callback callback_;
+
+    std::vector<std::unique_ptr<Stream> > streams_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    size_t waiting_streams_;
+    bool stopping_;
+    std::thread worker_;
+
+    std::vector<float> samples_, features_;
+    std::vector<const float *> frame_ptrs_;
+    std::vector<BlockSlot> slots_;
+    std::atomic<uint64_t> num_batches_, num_blocks_, num_frames_;
+};
+
+// Chain stage that hands each block to a BatchingKwsStage and passes it on
+// unchanged, so a chain run by any executor can feed a shared batcher.
+class KwsSubmitStage : public ChainStage {
+public:
+    KwsSubmitStage(BatchingKwsStage *batcher, size_t stream) : batcher_(batcher), stream_(stream) {}
+
+    std::string Name() const override { return "kws_submit"; }
+
+    void ProcessBlock(AudioBlock *block) override { batcher_->Submit(stream_, *block); }
+
+private:
+    BatchingKwsStage *batcher_;
+    size_t stream_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // BATCHED_KWS_H_
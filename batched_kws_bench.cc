@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <csignal>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "batched_kws.h"
+#include "wav_block_reader.h"
+
+extern "C"
+{
+#include <sys/resource.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+static bool stop = false;
+
+
+void SignalHandler(int signal){
+  cerr << "Caught signal " << signal << ", terminating..." << endl;
+  stop = true;
+}
+
+static void help(const char *argv0) {
+    cout << "batched_kws_bench [options]" << endl;
+    cout << "Runs keyword spotting for many real-time streams, one detector per stream versus" << endl;
+    cout << "one batching detector for all of them, and reports CPU cost and latency." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=INPUT_FILE_NAME               Mono 16k input, looped, default is vep_aec_beamforming_node_out.wav" << endl;
+    cout << "  -m, --model=MODEL_FILE_NAME              Template model from kws_enroll, default enrolls the first second of the input" << endl;
+    cout << "  -n, --streams=NUM_STREAMS                Number of streams, default is 16" << endl;
+    cout << "  -l, --latency=MS                         Longest time a block may wait for its batch, default is 32" << endl;
+    cout << "  -d, --duration=SECONDS                   Run time of each mode, default is 10" << endl;
+}
+
+static double CpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static int64_t NowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct StreamClock {
+    vector<int64_t> pushed_ns;
+    vector<int64_t> latency_ns;
+    int detections = 0;
+};
+
+static void RunMode(const string &file_path, shared_ptr<const KwsTemplateModel> model, size_t num_streams,
+                    bool batched, int max_wait_ms, int duration_s) {
+    size_t num_blocks = duration_s * 1000 / BLOCK_SIZE_MS;
+    vector<StreamClock> clocks(num_streams);
+    mutex clocks_lock;
+    vector<unique_ptr<WavBlockReader>> readers;
+    for (size_t i = 0; i < num_streams; i++) {
+        readers.push_back(unique_ptr<WavBlockReader>(WavBlockReader::Create(file_path, BLOCK_SIZE_MS, true)));
+        clocks[i].pushed_ns.assign(num_blocks, 0);
+    }
+
+    // In single mode stream i is stream 0 of detector i.
+    vector<unique_ptr<BatchingKwsStage>> detectors;
+    size_t num_detectors = batched ? 1 : num_streams;
+    for (size_t d = 0; d < num_detectors; d++) {
+        detectors.push_back(unique_ptr<BatchingKwsStage>(BatchingKwsStage::Create(model, 0.5f, batched ? max_wait_ms : 0,
+            [&clocks, &clocks_lock, batched, d](const KwsResult &result) {
+                size_t stream = batched ? result.stream : d;
+                lock_guard<mutex> guard(clocks_lock);
+                clocks[stream].latency_ns.push_back(NowNs() - clocks[stream].pushed_ns[result.sequence]);
+                if (result.detected) clocks[stream].detections++;
+            })));
+        for (size_t i = 0; i < (batched ? num_streams : 1); i++) detectors[d]->AddStream();
+        detectors[d]->Start();
+    }
+
+    double cpu_start = CpuSeconds();
+    auto next = chrono::steady_clock::now();
+    size_t sent = 0;
+    for (size_t b = 0; b < num_blocks && !stop; b++, sent++) {
+        for (size_t i = 0; i < num_streams; i++) {
+            AudioBlock block;
+            readers[i]->Read(&block);
+            block.sequence = b;
+            {
+                lock_guard<mutex> guard(clocks_lock);
+                clocks[i].pushed_ns[b] = NowNs();
+            }
+            if (batched) detectors[0]->Submit(i, block);
+            else detectors[i]->Submit(0, block);
+        }
+        next += chrono::milliseconds(BLOCK_SIZE_MS);
+        this_thread::sleep_until(next);
+    }
+    uint64_t batches = 0, blocks = 0;
+    for (size_t d = 0; d < num_detectors; d++) {
+        detectors[d]->Stop();
+        batches += detectors[d]->GetNumBatches();
+        blocks += detectors[d]->GetNumBlocks();
+    }
+    double cpu = CpuSeconds() - cpu_start;
+
+    vector<int64_t> all;
+    int detections = 0;
+    for (size_t i = 0; i < num_streams; i++) {
+        all.insert(all.end(), clocks[i].latency_ns.begin(), clocks[i].latency_ns.end());
+        detections += clocks[i].detections;
+    }
+    sort(all.begin(), all.end());
+    double audio_s = sent * BLOCK_SIZE_MS / 1000.0 * num_streams;
+    cout << setw(9) << (batched ? "batched" : "single") << setw(9) << num_streams
+         << setw(11) << fixed << setprecision(1) << (batches ? (double)blocks / batches : 0)
+         << setw(14) << setprecision(2) << cpu * 1000 / audio_s
+         << setw(14) << setprecision(1) << (cpu > 0 ? audio_s / cpu : 0)
+         << setw(11) << (all.empty() ? 0 : all[all.size() * 99 / 100] / 1000)
+         << setw(11) << (all.empty() ? 0 : all.back() / 1000)
+         << setw(8) << detections << endl;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // Configures signal handling.
+    struct sigaction sig_int_handler;
+    sig_int_handler.sa_handler = SignalHandler;
+    sigemptyset(&sig_int_handler.sa_mask);
+    sig_int_handler.sa_flags = 0;
+    sigaction(SIGINT, &sig_int_handler, NULL);
+    sigaction(SIGTERM, &sig_int_handler, NULL);
+
+    // parse opts
+    int c;
+    string file_path = "vep_aec_beamforming_node_out.wav", model_path;
+    size_t num_streams = 16;
+    int max_wait_ms = 32;
+    int duration_s = 10;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"model",        1, NULL, 'm'},
+        {"streams",      1, NULL, 'n'},
+        {"latency",      1, NULL, 'l'},
+        {"duration",     1, NULL, 'd'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:m:n:l:d:h", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            file_path = string(optarg);
+            break;
+        case 'm':
+            model_path = string(optarg);
+            break;
+        case 'n':
+            num_streams = stoi(optarg);
+            break;
+        case 'l':
+            max_wait_ms = stoi(optarg);
+            break;
+        case 'd':
+            duration_s = stoi(optarg);
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    unique_ptr<WavBlockReader> probe(WavBlockReader::Create(file_path, 1000));
+    if (!probe || probe->GetNumChannels() != 1) {
+        cout << "Error : Not able to open mono input file " << file_path << endl;
+        return -1;
+    }
+    shared_ptr<const KwsTemplateModel> model;
+    if (!model_path.empty()) {
+        model.reset(KwsTemplateModel::Load(model_path));
+    }
+    else {
+        AudioBlock first_second;
+        probe->Read(&first_second);
+        model.reset(KwsTemplateModel::Enroll(first_second.Samples(), first_second.NumFrames()));
+    }
+    if (!model) {
+        cout << "Error : Not able to load the keyword model." << endl;
+        return -1;
+    }
+    if (!model->Fits(KwsFrontendConfig())) {
+        cout << "Error : " << model_path << " was enrolled with a different front end" << endl;
+        return -1;
+    }
+
+    cout << "block: " << BLOCK_SIZE_MS << " ms, latency cap: " << max_wait_ms << " ms, model frames: "
+         << model->NumFrames() << ", latency in us" << endl;
+    cout << setw(9) << "mode" << setw(9) << "streams" << setw(11) << "blk/batch" << setw(14) << "cpu ms/aud s"
+         << setw(14) << "aud s/cpu s" << setw(11) << "p99" << setw(11) << "max" << setw(8) << "hits" << endl;
+    RunMode(file_path, model, num_streams, false, max_wait_ms, duration_s);
+    RunMode(file_path, model, num_streams, true, max_wait_ms, duration_s);
+    return 0;
+}
@@ -9,6 +9,8 @@
 #include <chain_nodes/vep_aec_beamforming_node.h>
 #include <chain_nodes/snowboy_1b_doa_kws_node.h>
 #include <chain_nodes/direction_manager_node.h>
+#include "async_log.h"
+#include "capture_log_sink.h"
 extern "C"
 {
 #include <sndfile.h>
@@ -17,6 +19,7 @@ extern "C"
 }
 using namespace std;
 using namespace respeaker;
+using namespace respeaker_ext;
 #define BLOCK_SIZE_MS    8
 static bool stop = false;
 void SignalHandler(int signal){
@@ -33,6 +36,7 @@ static void help(const char *argv0) {
     cout << "  -t, --type=MIC_TYPE                      The MICROPHONE TYPE, support: CIRCULAR_6MIC_7BEAM, LINEAR_6MIC_8BEAM, LINEAR_4MIC_1BEAM, CIRCULAR_4MIC_9BEAM" << endl;
     cout << "  -g, --agc=NEGTIVE INTEGER                The target gain level of output, [-31, 0]" << endl;
     cout << "  -w, --wav                                Enable output wav log, default is false." << endl;
+    PrintCaptureLogHelp();
     cout << "  -k, --kws=KWS_NAME                       The keyword name: snowboy or alexa, default is snowboy" << endl;
 }
 int main(int argc, char *argv[]) {
@@ -48,6 +52,7 @@ int main(int argc, char *argv[]) {
     string source = "default";
     bool enable_agc = false;
     bool enable_wav = true;
+    CaptureLogOptions log_options;
     int agc_level = 10;
     string mic_type, kws;
     static const struct option long_options[] = {
@@ -57,9 +62,10 @@ int main(int argc, char *argv[]) {
         {"type",         1, NULL, 't'},
         {"agc",          1, NULL, 'g'},
         {"wav",          0, NULL, 'w'},
+        CAPTURE_LOG_LONG_OPTIONS,
         {NULL,           0, NULL,  0}
     };
-    while ((c = getopt_long(argc, argv, "k:t:g:s:hw", long_options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "k:t:g:s:" CAPTURE_LOG_SHORT_OPTIONS "hw", long_options, NULL)) != -1) {
         switch (c) {
         case 'h' :
             help(argv[0]);
@@ -83,6 +89,7 @@ int main(int argc, char *argv[]) {
             enable_wav = true;
             break;
         default:
+            if (ParseCaptureLogOption(c, optarg, &log_options)) break;
             return 0;
         }
     }
@@ -142,25 +149,22 @@ int main(int argc, char *argv[]) {
         return -1;
     }
     string data;
-    int frames;
     size_t num_channels = respeaker->GetNumOutputChannels();
     int rate = respeaker->GetNumOutputRate();
     cout << "num channels: " << num_channels << ", rate: " << rate << endl;
-    // init libsndfile
-    SNDFILE *file ;
-    SF_INFO sfinfo ;
+    // init the output log
+    unique_ptr<CaptureLogSink> log_sink;
     if (enable_wav) {
-        memset (&sfinfo, 0, sizeof (sfinfo));
-        sfinfo.samplerate   = rate ;
-        sfinfo.channels     = num_channels ;
-        sfinfo.format       = (SF_FORMAT_WAV | SF_FORMAT_PCM_16) ;
-        if (! (file = sf_open ("audio_test001.wav", SFM_WRITE, &sfinfo)))
+        string log_path = log_options.flac_level >= 0 ? "audio_test001.flac" : "audio_test001.wav";
+        log_sink.reset(CaptureLogSink::Create(log_path, rate, num_channels, log_options));
+        if (!log_sink)
         {
-            cout << sf_strerror(file) << endl;
             cout << "Error : Not able to open output file." << endl;
             return -1 ;
         }
     }
+    unique_ptr<AsyncLog> async_log(AsyncLog::Create());
+    async_log->AttachThread();
     int tick;
     int hotword_index = 0, hotword_count = 0;
     while (!stop)
@@ -171,21 +175,19 @@ int main(int argc, char *argv[]) {
             cout << "hotword_count = " << hotword_count << endl;
         }
         if (enable_wav) {
-            frames = data.length() / (sizeof(int16_t) * num_channels);
-            sf_writef_short(file, (const int16_t *)(data.data()), frames);
+            log_sink->Write(data);
         }
         if (tick++ % 5 == 0) {
-            std::cout << "collector: " << collector->GetQueueDeepth() << ", vep_1beam: " <<
-            vep_1beam->GetQueueDeepth() << ", snowboy_kws: " << snowboy_kws->GetQueueDeepth() <<
-            std::endl;
+            async_log->Info("collector: {}, vep_1beam: {}, snowboy_kws: {}", collector->GetQueueDeepth(),
+                            vep_1beam->GetQueueDeepth(), snowboy_kws->GetQueueDeepth());
         }
     }
+    async_log.reset();
     cout << "stopping the respeaker worker thread..." << endl;
     respeaker->Stop();
     cout << "cleanup done." << endl;
     if (enable_wav) {
-        sf_close (file);
-        cout << "wav file closed." << endl;
+        CloseAndReport(log_sink.get());
     }
     return 0;
 }
@@ -0,0 +1,175 @@
+#ifndef BLOCK_POOL_H_
+#define BLOCK_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "audio_block.h"
+
+namespace respeaker_ext {
+
+// A fixed set of AudioBlocks, allocated and sized once when a chain starts,
+// that the chain leases and returns instead of allocating a block per period.
+// Lease() hands out a shared_ptr like ChainExecutor::BlockPtr whose last
+// release puts the block back; the shared_ptr control block also comes from
+// the pool, so a lease in steady state makes no heap allocation at all.
+//
+// Every block reserves room for the chain's input block both as int16
+// interleaved and as float32 planar. Stages shrink a block in place,
+// which keeps the reservation. Fill data with assign() or resize(); assigning
+// a temporary string (block->data = Listen()) steals that string's buffer and
+// frees the reserved one.
+//
+// When every block is out, Lease() falls back to a plain heap block and
+// counts it, so a too-small pool shows up in GetFallbacks() rather than as a
+// stall.
+class BlockPool {
+public:
+    static BlockPool *Create(size_t num_channels, int rate, int block_size_ms, size_t num_blocks) {
+        if (num_channels == 0 || rate <= 0 || block_size_ms <= 0 || num_blocks == 0) return nullptr;
+        return new BlockPool(num_channels, static_cast<size_t>(rate) * block_size_ms / 1000, num_blocks);
+    }
+
+    // Blocks still leased when the pool goes away stay valid and are freed
+    // when their last reference drops.
+    ~BlockPool() {}
+
+    std::shared_ptr<AudioBlock> Lease() {
+        AudioBlock *block = state_->Pop();
+        if (!block) {
+            state_->fallbacks.fetch_add(1, std::memory_order_relaxed);
+            block = new AudioBlock;
+            block->data.reserve(state_->max_bytes);
+            return std::shared_ptr<AudioBlock>(block);
+        }
+        block->data.clear();
+        block->planar.clear();
+        block->format = kInt16Interleaved;
+        block->num_channels = 0;
+        block->rate = 0;
+        block->sequence = 0;
+        block->sample_index = 0;
+        block->capture_ns = 0;
+        return std::shared_ptr<AudioBlock>(block, Returner(state_), ControlAllocator<AudioBlock>(state_));
+    }
+
+    size_t GetNumBlocks() const { return state_->blocks.size(); }
+    size_t GetInUse() const { return state_->in_use.load(std::memory_order_relaxed); }
+    // Most blocks leased at once since Create().
+    size_t GetHighWater() const { return state_->high_water.load(std::memory_order_relaxed); }
+    // Leases served from the heap because the pool was empty.
+    uint64_t GetFallbacks() const { return state_->fallbacks.load(std::memory_order_relaxed); }
+    size_t GetBlockBytes() const { return state_->max_bytes; }
+
+private:
+    // Sized for libstdc++'s and libc++'s _Sp_counted_deleter / __shared_ptr_pointer
+    // with a one-pointer deleter and allocator; a larger control block is
+    // still correct, it just comes from the heap.
+    static const size_t kControlBytes = 128;
+
+    struct State {
+        std::vector<std::unique_ptr<AudioBlock> > blocks;
+        std::vector<AudioBlock *> free_blocks;
+        std::vector<void *> free_controls;
+        std::vector<char> control_arena;
+        std::mutex lock;
+        size_t max_bytes = 0;
+        std::atomic<size_t> in_use{0}, high_water{0};
+        std::atomic<uint64_t> fallbacks{0};
+
+        AudioBlock *Pop() {
+            std::lock_guard<std::mutex> guard(lock);
+            if (free_blocks.empty() || free_controls.empty()) return nullptr;
+            AudioBlock *block = free_blocks.back();
+            free_blocks.pop_back();
+            size_t n = in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (n > high_water.load(std::memory_order_relaxed)) high_water.store(n, std::memory_order_relaxed);
+            return block;
+        }
+
+        // Neither vector grows past the capacity reserved in the constructor.
+        void Push(AudioBlock *block) {
+            std::lock_guard<std::mutex> guard(lock);
+            free_blocks.push_back(block);
+            in_use.fetch_sub(1, std::memory_order_relaxed);
+        }
+    };
+
+    struct Returner {
+        explicit Returner(const std::shared_ptr<State> &s) : state(s.get()) {}
+        void operator()(AudioBlock *block) const { state->Push(block); }
+        State *state;
+    };
+
+    // Hands out control blocks from the pool's arena. The copy stored in
+    // each control block owns the State, so the arena and the blocks outlive
+    // the BlockPool for as long as any lease is out.
+    template <typename T>
+    struct ControlAllocator {
+        typedef T value_type;
+        explicit ControlAllocator(const std::shared_ptr<State> &s) : state(s.get()), owner(s) {}
+        template <typename U>
+        ControlAllocator(const ControlAllocator<U> &other) : state(other.state), owner(other.owner) {}
+
+        T *allocate(size_t n) {
+            if (n * sizeof(T) <= kControlBytes) {
+                std::lock_guard<std::mutex> guard(state->lock);
+                if (!state->free_controls.empty()) {
+                    void *p = state->free_controls.back();
+                    state->free_controls.pop_back();
+                    return static_cast<T *>(p);
+                }
+            }
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(T *p, size_t n) {
+            char *c = reinterpret_cast<char *>(p);
+            std::vector<char> &arena = state->control_arena;
+            if (!arena.empty() && c >= &arena[0] && c < &arena[0] + arena.size()) {
+                std::lock_guard<std::mutex> guard(state->lock);
+                state->free_controls.push_back(p);
+                return;
+            }
+            ::operator delete(p);
+        }
+
+        template <typename U>
+        bool operator==(const ControlAllocator<U> &other) const { return state == other.state; }
+        template <typename U>
+        bool operator!=(const ControlAllocator<U> &other) const { return state != other.state; }
+
+        State *state;
+        std::shared_ptr<State> owner;
+    };
+
+    BlockPool(size_t num_channels, size_t frames, size_t num_blocks) : state_(new State) {
+        state_->max_bytes = frames * num_channels * sizeof(int16_t);
+        state_->blocks.reserve(num_blocks);
+        state_->free_blocks.reserve(num_blocks);
+        state_->free_controls.reserve(num_blocks);
+        state_->control_arena.resize(num_blocks * kControlBytes);
+        for (size_t i = 0; i < num_blocks; i++) {
+            std::unique_ptr<AudioBlock> block(new AudioBlock);
+            block->data.reserve(state_->max_bytes);
+            block->planar.reserve(frames * num_channels);
+            // Touch both payloads so their pages are mapped before audio starts.
+            block->data.assign(state_->max_bytes, '\0');
+            block->planar.assign(frames * num_channels, 0.0f);
+            block->planar.clear();
+            state_->free_blocks.push_back(block.get());
+            state_->free_controls.push_back(&state_->control_arena[i * kControlBytes]);
+            state_->blocks.push_back(std::move(block));
+        }
+    }
+
+    std::shared_ptr<State> state_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // BLOCK_POOL_H_
@@ -0,0 +1,126 @@
+#ifndef CAPTURE_CLOCK_H_
+#define CAPTURE_CLOCK_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+extern "C"
+{
+#include <time.h>
+}
+
+namespace respeaker_ext {
+
+// CLOCK_MONOTONIC in nanoseconds, the clock every capture stamp uses.
+inline int64_t MonotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+// Capture stamps for blocks read out of a librespeaker chain, whose nodes do
+// not carry any. The sample index is exact: the chain neither drops nor
+// repeats samples, so it is the count of frames handed out so far. The
+// capture time of sample n is origin + n / rate. A block's last sample was
+// captured no later than the block came out of the chain, so every block
+// bounds origin from above by arrival - end_index / rate; origin is the
+// lowest such bound, which the quickest block through the chain sets.
+//
+// The audio clock drifts against CLOCK_MONOTONIC by some ppm, which moves the
+// bound over time, so origin is the minimum over the last one or two windows
+// of window_s seconds of audio instead of over the whole run. A window needs
+// one quick block for the bound to be tight. The error is then the chain's
+// fastest pass-through time in that window, a few milliseconds, so the stamps
+// slightly overstate latency, never understate it.
+class CaptureTimeline {
+public:
+    explicit CaptureTimeline(int rate, double window_s = 10.0)
+        : rate_(rate), window_frames_(static_cast<uint64_t>(window_s * rate)), next_index_(0), window_end_(0),
+          last_min_ns_(kNone), window_min_ns_(kNone) {
+        if (window_frames_ == 0) window_frames_ = 1;
+        window_end_ = window_frames_;
+    }
+
+    // Stamps the num_frames block that just came out of the chain.
+    void Stamp(size_t num_frames, uint64_t *sample_index, int64_t *capture_ns) {
+        int64_t arrival = MonotonicNs();
+        uint64_t end = next_index_ + num_frames;
+        if (end > window_end_) {
+            // Re-anchor: the window before the last one is dropped.
+            last_min_ns_ = window_min_ns_;
+            window_min_ns_ = kNone;
+            window_end_ = end + window_frames_;
+        }
+        window_min_ns_ = std::min(window_min_ns_, arrival - FramesToNs(end));
+        *sample_index = next_index_;
+        *capture_ns = std::min(last_min_ns_, window_min_ns_) + FramesToNs(next_index_);
+        next_index_ = end;
+    }
+
+    int64_t FramesToNs(uint64_t frames) const { return static_cast<int64_t>(frames * 1000000000.0 / rate_); }
+    uint64_t GetNumFrames() const { return next_index_; }
+
+private:
+    static constexpr int64_t kNone = std::numeric_limits<int64_t>::max();
+
+    int rate_;
+    uint64_t window_frames_;
+    uint64_t next_index_, window_end_;
+    int64_t last_min_ns_, window_min_ns_;
+};
+
+// One detection, stamped with where it sits in the capture. sample_index and
+// capture_ns are those of the first frame of the block the keyword completed
+// in; block_frames is that block's length.
+struct HotwordEvent {
+    int count = 0;
+    int beam = -1;
+    int rate = 0;
+    uint64_t sample_index = 0;
+    size_t block_frames = 0;
+    int64_t capture_ns = 0;
+    int64_t detect_ns = 0;
+
+    // Capture of the block's last sample to the detection being reported.
+    double LatencyMs() const {
+        double block_ns = rate ? block_frames * 1e9 / rate : 0;
+        return (detect_ns - capture_ns - block_ns) / 1e6;
+    }
+    double CaptureSeconds() const { return rate ? double(sample_index) / rate : 0; }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const HotwordEvent &event) {
+    out << "hotword " << event.count << " at sample " << event.sample_index << " (" << event.CaptureSeconds()
+        << " s)";
+    if (event.beam >= 0) out << ", beam " << event.beam;
+    out << ", captured " << event.capture_ns << " ns, latency " << event.LatencyMs() << " ms";
+    return out;
+}
+
+// Collects capture-to-detection latencies for a summary at exit.
+class LatencyReport {
+public:
+    void Add(double latency_ms) { latencies_.push_back(latency_ms); }
+
+    void Print(std::ostream &out) const {
+        if (latencies_.empty()) {
+            out << "capture-to-hotword latency: no detections" << std::endl;
+            return;
+        }
+        std::vector<double> sorted(latencies_);
+        std::sort(sorted.begin(), sorted.end());
+        out << "capture-to-hotword latency over " << sorted.size() << " detections: min " << sorted.front()
+            << " ms, p50 " << sorted[sorted.size() / 2] << " ms, p95 " << sorted[sorted.size() * 95 / 100]
+            << " ms, max " << sorted.back() << " ms" << std::endl;
+    }
+
+private:
+    std::vector<double> latencies_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // CAPTURE_CLOCK_H_
@@ -0,0 +1,485 @@
+#ifndef CAPTURE_LOG_SINK_H_
+#define CAPTURE_LOG_SINK_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "rt_check.h"
+
+extern "C"
+{
+#include <sndfile.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace respeaker_ext {
+
+struct CaptureLogOptions {
+    // FLAC compression level in [0, 8]; negative writes wav.
+    int flac_level = -1;
+    // A live source must never wait on the disk, so by default a block that
+    // finds the queue full is dropped and counted. Replays that run faster
+    // than real time (FileCollectorNode) set this to false and wait instead.
+    bool drop_when_full = true;
+    int max_queue_ms = 2000;
+    // Samples reach the encoder in multiples of this many frames, the FLAC
+    // block size libsndfile uses at the default levels.
+    size_t frame_alignment = 4096;
+    // Start a new file once the current one holds this much audio or takes
+    // this many bytes. 0 disables the limit; with both 0 the log is a single
+    // file at the given path.
+    double segment_seconds = 0;
+    uint64_t segment_bytes = 0;
+};
+
+// The output log flags the demos share: -l/--flac, -d/--segment and
+// -z/--segment-mb. The two macros go into the getopt_long tables, and the
+// default case hands the option to ParseCaptureLogOption().
+#define CAPTURE_LOG_SHORT_OPTIONS "l:d:z:"
+#define CAPTURE_LOG_LONG_OPTIONS \
+        {"flac",         1, NULL, 'l'}, \
+        {"segment",      1, NULL, 'd'}, \
+        {"segment-mb",   1, NULL, 'z'}
+
+inline void PrintCaptureLogHelp() {
+    std::cout << "  -l, --flac=LEVEL                         Write the output log as FLAC at compression LEVEL [0, 8] instead of wav" << std::endl;
+    std::cout << "  -d, --segment=SECONDS                    Rotate the output log into numbered files of SECONDS each" << std::endl;
+    std::cout << "  -z, --segment-mb=MB                      Rotate the output log into numbered files of at most MB each" << std::endl;
+}
+
+// Returns false when c is not one of the flags above.
+inline bool ParseCaptureLogOption(int c, const char *arg, CaptureLogOptions *options) {
+    switch (c) {
+    case 'l':
+        options->flac_level = std::stoi(arg);
+        return true;
+    case 'd':
+        options->segment_seconds = std::stod(arg);
+        return true;
+    case 'z':
+        options->segment_bytes = std::stoull(arg) << 20;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Writes the chain output to a log file on a thread of its own, so the loop
+// that calls DetectHotword() only copies the block into a queue. With a FLAC
+// level the log is FLAC (lossless, typically well under half the size of
+// PCM_16 wav), otherwise it is wav.
+//
+// Every write ends on an encoder frame boundary, and wav headers are
+// rewritten after each write, so a crash loses at most the audio still
+// queued. Wav logs that may grow past 4 GB are opened as RF64 and downgraded
+// to plain wav on close if they stay smaller.
+//
+// With a segment limit the log rotates through <stem>_0000.<ext>,
+// <stem>_0001.<ext>, ... A helper thread opens and preallocates the next
+// segment while the current one is being written and closes finished ones,
+// so rotation costs the writer a pointer swap and the audio loop nothing.
+class CaptureLogSink {
+public:
+    static CaptureLogSink *Create(const std::string &path, int rate, size_t num_channels,
+                                  const CaptureLogOptions &options) {
+        CaptureLogSink *sink = new CaptureLogSink(path, rate, num_channels, options);
+        if (!sink->OpenSegment(0, &sink->current_)) {
+            delete sink;
+            return nullptr;
+        }
+        sink->Start();
+        return sink;
+    }
+
+    static CaptureLogSink *Create(const std::string &path, int rate, size_t num_channels, int flac_level = -1,
+                                  bool drop_when_full = true, int max_queue_ms = 2000,
+                                  size_t frame_alignment = 4096) {
+        CaptureLogOptions options;
+        options.flac_level = flac_level;
+        options.drop_when_full = drop_when_full;
+        options.max_queue_ms = max_queue_ms;
+        options.frame_alignment = frame_alignment;
+        return Create(path, rate, num_channels, options);
+    }
+
+    ~CaptureLogSink() { Close(); }
+
+    // Queues one interleaved int16 block as returned by DetectHotword().
+    // Returns false if the block was dropped because the writer has fallen
+    // max_queue_ms behind.
+    bool Write(const std::string &data) {
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            if (!options_.drop_when_full) {
+                space_.wait(guard, [this, &data] {
+                    return closing_ || queued_frames_ == 0 || queued_frames_ + FramesOf(data) <= max_queue_frames_;
+                });
+            }
+            if (closing_ || queued_frames_ + FramesOf(data) > max_queue_frames_) {
+                dropped_blocks_++;
+                return false;
+            }
+            queued_frames_ += FramesOf(data);
+            queue_.push_back(data);
+        }
+        ready_.notify_one();
+        return true;
+    }
+
+    bool Write(const int16_t *samples, size_t num_frames) {
+        return Write(std::string(reinterpret_cast<const char *>(samples), num_frames * num_channels_ * sizeof(int16_t)));
+    }
+
+    // Writes out everything queued and closes the file. Safe to call twice.
+    void Close() {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            if (closing_) return;
+            closing_ = true;
+        }
+        ready_.notify_one();
+        space_.notify_all();
+        if (writer_.joinable()) writer_.join();
+        {
+            std::lock_guard<std::mutex> guard(segment_lock_);
+            if (current_.file) retired_.push_back(current_);
+            current_ = Segment();
+            stopping_segments_ = true;
+        }
+        segment_changed_.notify_all();
+        if (segment_thread_.joinable()) segment_thread_.join();
+    }
+
+    // The path given to Create(); with rotation, the stem of the segments.
+    const std::string &GetPath() const { return path_; }
+    std::string GetSegmentPath() {
+        std::lock_guard<std::mutex> guard(segment_lock_);
+        return current_.path;
+    }
+    uint64_t GetNumSegments() const { return segments_opened_.load(); }
+    // Rotations where the next segment was not ready yet; the writer waited,
+    // the audio loop did not.
+    uint64_t GetLateRotations() const { return late_rotations_.load(); }
+    uint64_t GetFramesWritten() const { return frames_written_.load(); }
+    uint64_t GetDroppedBlocks() const { return dropped_blocks_.load(); }
+    // Frames the encoder did not take (disk full, I/O error); they are lost.
+    uint64_t GetLostFrames() const { return lost_frames_.load(); }
+
+    // CPU seconds the writer thread spent encoding and writing per second of
+    // audio written.
+    double GetEncodeCpuPerAudioSecond() const {
+        uint64_t frames = frames_written_.load();
+        return frames ? (encode_cpu_ns_.load() / 1e9) / (static_cast<double>(frames) / rate_) : 0.0;
+    }
+
+    // Size of the log on disk over all segments, and the same audio as PCM_16.
+    uint64_t GetBytesOnDisk() {
+        std::lock_guard<std::mutex> guard(segment_lock_);
+        struct stat st;
+        return closed_bytes_ + (current_.fd >= 0 && fstat(current_.fd, &st) == 0 ? st.st_size : 0);
+    }
+    uint64_t GetPcmBytes() const { return frames_written_.load() * num_channels_ * sizeof(int16_t); }
+
+private:
+    struct Segment {
+        std::string path;
+        int fd = -1;
+        SNDFILE *file = nullptr;
+        uint64_t frames = 0;
+    };
+
+    CaptureLogSink(const std::string &path, int rate, size_t num_channels, const CaptureLogOptions &options)
+        : path_(path), rate_(rate), num_channels_(num_channels), options_(options),
+          max_queue_frames_(static_cast<size_t>(rate) * options.max_queue_ms / 1000), segment_frames_(0),
+          queued_frames_(0), closing_(false), next_index_(1), want_next_(false), stopping_segments_(false),
+          closed_bytes_(0), segments_opened_(0), late_rotations_(0), frames_written_(0), dropped_blocks_(0),
+          lost_frames_(0), encode_cpu_ns_(0) {
+        if (options_.frame_alignment == 0) options_.frame_alignment = 1;
+        rotating_ = options_.segment_seconds > 0 || options_.segment_bytes > 0;
+
+        // Segments hold a whole number of aligned writes, so the encoder
+        // frame alignment carries over from one segment to the next.
+        size_t frame_bytes = num_channels_ * sizeof(int16_t);
+        // A byte limit is a ceiling, so it rounds down; a time limit rounds
+        // to the nearest write.
+        bool by_bytes = false;
+        if (options_.segment_seconds > 0) segment_frames_ = static_cast<uint64_t>(options_.segment_seconds * rate_);
+        if (options_.segment_bytes > 0 && options_.flac_level < 0) {
+            uint64_t by_size = options_.segment_bytes > 4096 ? (options_.segment_bytes - 4096) / frame_bytes : 1;
+            if (segment_frames_ == 0 || by_size < segment_frames_) {
+                segment_frames_ = by_size;
+                by_bytes = true;
+            }
+        }
+        if (segment_frames_ > 0) {
+            uint64_t align = options_.frame_alignment;
+            uint64_t writes = by_bytes ? segment_frames_ / align : (segment_frames_ + align / 2) / align;
+            segment_frames_ = std::max<uint64_t>(1, writes) * align;
+        }
+        // RF64 only when a segment can reach the 4 GB wav limit.
+        rf64_ = options_.flac_level < 0 && (segment_frames_ == 0 || segment_frames_ * frame_bytes >= 0xFFFF0000ULL);
+    }
+
+    void Start() {
+        writer_ = std::thread(&CaptureLogSink::WriterLoop, this);
+        segment_thread_ = std::thread(&CaptureLogSink::SegmentLoop, this);
+        if (rotating_) {
+            {
+                std::lock_guard<std::mutex> guard(segment_lock_);
+                want_next_ = true;
+            }
+            segment_changed_.notify_all();
+        }
+    }
+
+    size_t FramesOf(const std::string &data) const { return data.size() / (num_channels_ * sizeof(int16_t)); }
+
+    std::string SegmentPath(uint64_t index) const {
+        if (!rotating_) return path_;
+        size_t dot = path_.find_last_of('.'), slash = path_.find_last_of('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = path_.size();
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "_%04llu", static_cast<unsigned long long>(index));
+        return path_.substr(0, dot) + suffix + path_.substr(dot);
+    }
+
+    bool OpenSegment(uint64_t index, Segment *segment) {
+        segment->path = SegmentPath(index);
+        segment->fd = open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (segment->fd < 0) return false;
+        // Reserve the blocks up front, without changing the file size; any
+        // left over are given back when the segment is closed.
+        uint64_t expected = segment_frames_ * num_channels_ * sizeof(int16_t);
+        if (options_.flac_level >= 0) expected /= 2;
+        if (expected > 0) fallocate(segment->fd, FALLOC_FL_KEEP_SIZE, 0, expected);
+
+        SF_INFO sfinfo;
+        memset(&sfinfo, 0, sizeof(sfinfo));
+        sfinfo.samplerate = rate_;
+        sfinfo.channels = num_channels_;
+        sfinfo.format = options_.flac_level >= 0 ? (SF_FORMAT_FLAC | SF_FORMAT_PCM_16)
+                        : rf64_                  ? (SF_FORMAT_RF64 | SF_FORMAT_PCM_16)
+                                                 : (SF_FORMAT_WAV | SF_FORMAT_PCM_16);
+        segment->file = sf_open_fd(segment->fd, SFM_WRITE, &sfinfo, SF_FALSE);
+        if (!segment->file) {
+            close(segment->fd);
+            unlink(segment->path.c_str());
+            segment->fd = -1;
+            return false;
+        }
+        if (options_.flac_level >= 0) {
+            double level = (options_.flac_level > 8 ? 8 : options_.flac_level) / 8.0;
+            sf_command(segment->file, SFC_SET_COMPRESSION_LEVEL, &level, sizeof(level));
+        }
+        if (rf64_) sf_command(segment->file, SFC_RF64_AUTO_DOWNGRADE, NULL, SF_TRUE);
+        segments_opened_++;
+        return true;
+    }
+
+    // Finalizes the header, gives back unused preallocated blocks.
+    uint64_t CloseSegment(Segment *segment) {
+        sf_close(segment->file);
+        struct stat st;
+        uint64_t size = 0;
+        if (fstat(segment->fd, &st) == 0) {
+            size = st.st_size;
+            if (ftruncate(segment->fd, st.st_size) != 0) {}
+        }
+        close(segment->fd);
+        if (rotating_ && segment->frames == 0) {
+            unlink(segment->path.c_str());
+            return 0;
+        }
+        return size;
+    }
+
+    bool SegmentFull(const Segment &segment) const {
+        if (segment_frames_ > 0 && segment.frames >= segment_frames_) return true;
+        if (options_.flac_level >= 0 && options_.segment_bytes > 0) {
+            struct stat st;
+            return fstat(segment.fd, &st) == 0 && static_cast<uint64_t>(st.st_size) >= options_.segment_bytes;
+        }
+        return false;
+    }
+
+    // Runs on the writer thread: swaps in the prepared segment and hands the
+    // full one to the segment thread for closing.
+    void Rotate() {
+        std::unique_lock<std::mutex> guard(segment_lock_);
+        if (!next_.file) {
+            late_rotations_++;
+            if (!want_next_) {
+                // The last open failed; try again.
+                want_next_ = true;
+                segment_changed_.notify_all();
+            }
+            segment_changed_.wait(guard, [this] { return next_.file != nullptr || !want_next_ || stopping_segments_; });
+            // Still nothing: keep writing to the current segment.
+            if (!next_.file) return;
+        }
+        retired_.push_back(current_);
+        current_ = next_;
+        next_ = Segment();
+        want_next_ = true;
+        guard.unlock();
+        segment_changed_.notify_all();
+    }
+
+    void SegmentLoop() {
+        RtCheck::Exempt();
+        while (true) {
+            std::unique_lock<std::mutex> guard(segment_lock_);
+            segment_changed_.wait(guard, [this] {
+                return stopping_segments_ || !retired_.empty() || (want_next_ && !next_.file);
+            });
+            if (!retired_.empty()) {
+                Segment old = retired_.front();
+                retired_.pop_front();
+                guard.unlock();
+                uint64_t size = CloseSegment(&old);
+                guard.lock();
+                closed_bytes_ += size;
+                continue;
+            }
+            if (stopping_segments_) {
+                if (next_.file) {
+                    Segment unused = next_;
+                    next_ = Segment();
+                    guard.unlock();
+                    CloseSegment(&unused);
+                    segments_opened_--;
+                }
+                break;
+            }
+            uint64_t index = next_index_++;
+            guard.unlock();
+            Segment segment;
+            bool ok = OpenSegment(index, &segment);
+            guard.lock();
+            want_next_ = false;
+            if (ok) next_ = segment;
+            else fprintf(stderr, "CaptureLogSink: can not open %s, staying on the current segment\n", segment.path.c_str());
+            guard.unlock();
+            segment_changed_.notify_all();
+        }
+    }
+
+    static int64_t ThreadCpuNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    void WriterLoop() {
+        RtCheck::Exempt();
+        std::string staged;
+        size_t frame_bytes = num_channels_ * sizeof(int16_t);
+        size_t aligned_bytes = options_.frame_alignment * frame_bytes;
+        while (true) {
+            std::deque<std::string> blocks;
+            bool closing;
+            size_t taken;
+            {
+                std::unique_lock<std::mutex> guard(lock_);
+                ready_.wait(guard, [this] { return closing_ || !queue_.empty(); });
+                blocks.swap(queue_);
+                // The blocks count against the queue until they are written,
+                // so max_queue_ms bounds what is not on disk yet.
+                taken = queued_frames_;
+                closing = closing_;
+            }
+            for (size_t i = 0; i < blocks.size(); i++) staged += blocks[i];
+            size_t whole = closing ? staged.size() / frame_bytes * frame_bytes : staged.size() / aligned_bytes * aligned_bytes;
+            size_t done = 0;
+            int64_t start = ThreadCpuNs();
+            while (done < whole) {
+                uint64_t frames = (whole - done) / frame_bytes;
+                if (current_.frames < segment_frames_) frames = std::min(frames, segment_frames_ - current_.frames);
+                const int16_t *samples = reinterpret_cast<const int16_t *>(staged.data() + done);
+                sf_count_t written = sf_writef_short(current_.file, samples, frames);
+                if (written < 0) written = 0;
+                if (static_cast<uint64_t>(written) < frames) {
+                    // Skip what did not go in rather than retry it forever.
+                    if (lost_frames_.load() == 0) {
+                        fprintf(stderr, "CaptureLogSink: short write to %s: %s\n", current_.path.c_str(),
+                                sf_strerror(current_.file));
+                    }
+                    lost_frames_ += frames - written;
+                }
+                current_.frames += written;
+                frames_written_ += written;
+                done += frames * frame_bytes;
+                if (rotating_ && SegmentFull(current_) && !(closing && done == whole)) {
+                    Rotate();
+                }
+                else {
+                    sf_command(current_.file, SFC_UPDATE_HEADER_NOW, NULL, 0);
+                }
+            }
+            encode_cpu_ns_ += ThreadCpuNs() - start;
+            staged.erase(0, done);
+            {
+                std::lock_guard<std::mutex> guard(lock_);
+                queued_frames_ -= taken;
+            }
+            space_.notify_all();
+            if (closing) break;
+        }
+    }
+
+    std::string path_;
+    int rate_;
+    size_t num_channels_;
+    CaptureLogOptions options_;
+    size_t max_queue_frames_;
+    bool rotating_, rf64_;
+    uint64_t segment_frames_;
+
+    std::mutex lock_;
+    std::condition_variable ready_, space_;
+    std::deque<std::string> queue_;
+    size_t queued_frames_;
+    bool closing_;
+    std::thread writer_;
+
+    // current_ is only touched by the writer thread while it runs; next_,
+    // retired_ and the flags belong to segment_lock_.
+    std::mutex segment_lock_;
+    std::condition_variable segment_changed_;
+    Segment current_, next_;
+    std::deque<Segment> retired_;
+    uint64_t next_index_;
+    bool want_next_, stopping_segments_;
+    uint64_t closed_bytes_;
+    std::thread segment_thread_;
+
+    std::atomic<uint64_t> segments_opened_, late_rotations_;
+    std::atomic<uint64_t> frames_written_, dropped_blocks_, lost_frames_;
+    std::atomic<int64_t> encode_cpu_ns_;
+};
+
+// Closes the log and prints what it wrote, as the demos do on exit.
+inline void CloseAndReport(CaptureLogSink *sink) {
+    sink->Close();
+    std::cout << "log file closed: " << sink->GetPath() << ", " << sink->GetBytesOnDisk() << " bytes ("
+              << sink->GetPcmBytes() << " as PCM_16), encode cpu: " << sink->GetEncodeCpuPerAudioSecond() * 1000
+              << " ms per second of audio, dropped blocks: " << sink->GetDroppedBlocks() << ", segments: "
+              << sink->GetNumSegments();
+    if (sink->GetLostFrames() > 0) std::cout << ", frames lost to write errors: " << sink->GetLostFrames();
+    std::cout << std::endl;
+}
+
+}  // namespace respeaker_ext
+
+#endif  // CAPTURE_LOG_SINK_H_
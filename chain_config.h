@@ -0,0 +1,166 @@
+#ifndef CHAIN_CONFIG_H_
+#define CHAIN_CONFIG_H_
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace respeaker_ext {
+
+// A small INI reader for chain descriptions:
+//
+//   # comment
+//   [section]
+//   key = value        ; trailing comment
+//
+// A comment runs from a '#' or ';' that starts the line or follows a blank,
+// so values such as "a#b" or "x;y" are kept whole. Numbers that do not parse,
+// or that are negative where a size is asked for, are reported by Errors()
+// and read as the fallback.
+//
+// Later lines override earlier ones, and Set() overrides both, so a command
+// line can tweak one knob of a checked-in config. Every key that is read is
+// remembered; UnusedKeys() then lists the ones nothing asked for, which is
+// how a misspelt knob gets caught instead of silently ignored.
+class ChainConfig {
+public:
+    static ChainConfig *Load(const std::string &path, std::string *error) {
+        std::ifstream in(path.c_str());
+        if (!in) {
+            *error = "can not open " + path;
+            return nullptr;
+        }
+        ChainConfig *config = new ChainConfig;
+        std::string line, section;
+        for (int number = 1; std::getline(in, line); number++) {
+            size_t comment = FindComment(line);
+            if (comment != std::string::npos) line.erase(comment);
+            line = Trim(line);
+            if (line.empty()) continue;
+            if (line[0] == '[' && line[line.size() - 1] == ']') {
+                section = Trim(line.substr(1, line.size() - 2));
+                config->sections_.insert(section);
+                continue;
+            }
+            size_t eq = line.find('=');
+            if (eq == std::string::npos || section.empty()) {
+                *error = path + ":" + std::to_string(number) + ": expected [section] or key = value";
+                delete config;
+                return nullptr;
+            }
+            config->values_[section + "." + Trim(line.substr(0, eq))] = Trim(line.substr(eq + 1));
+        }
+        config->path_ = path;
+        return config;
+    }
+
+    // Takes "section.key=value".
+    bool Set(const std::string &assignment) {
+        size_t dot = assignment.find('.'), eq = assignment.find('=');
+        if (dot == std::string::npos || eq == std::string::npos || dot > eq) return false;
+        sections_.insert(Trim(assignment.substr(0, dot)));
+        values_[Trim(assignment.substr(0, eq))] = Trim(assignment.substr(eq + 1));
+        return true;
+    }
+
+    bool HasSection(const std::string &section) const { return sections_.count(section) > 0; }
+
+    std::string GetString(const std::string &section, const std::string &key, const std::string &fallback) const {
+        std::string name = section + "." + key;
+        used_.insert(name);
+        auto it = values_.find(name);
+        return it == values_.end() ? fallback : it->second;
+    }
+
+    int GetInt(const std::string &section, const std::string &key, int fallback) const {
+        std::string value = GetString(section, key, "");
+        if (value.empty()) return fallback;
+        char *end;
+        errno = 0;
+        long number = strtol(value.c_str(), &end, 10);
+        if (*end != '\0' || errno == ERANGE || number < INT_MIN || number > INT_MAX) {
+            return Invalid(section, key, value, "an integer", fallback);
+        }
+        return static_cast<int>(number);
+    }
+
+    // A count or size: an integer that must not be negative.
+    size_t GetSize(const std::string &section, const std::string &key, size_t fallback) const {
+        std::string value = GetString(section, key, "");
+        if (value.empty()) return fallback;
+        char *end;
+        errno = 0;
+        long long number = strtoll(value.c_str(), &end, 10);
+        if (*end != '\0' || errno == ERANGE || number < 0) {
+            return Invalid(section, key, value, "a size (an integer >= 0)", fallback);
+        }
+        return static_cast<size_t>(number);
+    }
+
+    double GetDouble(const std::string &section, const std::string &key, double fallback) const {
+        std::string value = GetString(section, key, "");
+        if (value.empty()) return fallback;
+        char *end;
+        errno = 0;
+        double number = strtod(value.c_str(), &end);
+        if (*end != '\0' || errno == ERANGE) return Invalid(section, key, value, "a number", fallback);
+        return number;
+    }
+
+    bool GetBool(const std::string &section, const std::string &key, bool fallback) const {
+        std::string value = GetString(section, key, "");
+        if (value.empty()) return fallback;
+        return value == "true" || value == "yes" || value == "on" || value == "1";
+    }
+
+    std::vector<std::string> UnusedKeys() const {
+        std::vector<std::string> unused;
+        for (auto it = values_.begin(); it != values_.end(); ++it) {
+            if (!used_.count(it->first)) unused.push_back(it->first);
+        }
+        return unused;
+    }
+
+    // Values read so far that did not parse, one message per key.
+    const std::vector<std::string> &Errors() const { return errors_; }
+
+    const std::string &GetPath() const { return path_; }
+
+private:
+    ChainConfig() {}
+
+    static size_t FindComment(const std::string &line) {
+        for (size_t i = 0; i < line.size(); i++) {
+            if ((line[i] == '#' || line[i] == ';') && (i == 0 || line[i - 1] == ' ' || line[i - 1] == '\t')) return i;
+        }
+        return std::string::npos;
+    }
+
+    template <typename T>
+    T Invalid(const std::string &section, const std::string &key, const std::string &value, const char *expected,
+              T fallback) const {
+        errors_.push_back(section + "." + key + " = " + value + ": expected " + expected);
+        return fallback;
+    }
+
+    static std::string Trim(const std::string &s) {
+        size_t first = s.find_first_not_of(" \t\r");
+        if (first == std::string::npos) return "";
+        return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+    }
+
+    std::string path_;
+    std::set<std::string> sections_;
+    std::map<std::string, std::string> values_;
+    mutable std::set<std::string> used_;
+    mutable std::vector<std::string> errors_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // CHAIN_CONFIG_H_
@@ -0,0 +1,314 @@
+#ifndef CHAIN_EXECUTOR_H_
+#define CHAIN_EXECUTOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "chain_stage.h"
+#include "rt_check.h"
+#include "thread_stats.h"
+#include "work_stealing_pool.h"
+
+namespace respeaker_ext {
+
+// Drives the stages of one chain. Blocks pushed into the executor pass through
+// every stage in order and are then handed to the sink. Implementations differ
+// only in how they schedule the stages.
+class ChainExecutor {
+public:
+    typedef std::shared_ptr<AudioBlock> BlockPtr;
+    typedef std::function<void(const BlockPtr &)> Sink;
+
+    virtual ~ChainExecutor() {}
+
+    // The format blocks are carried in between stages. With kFloat32Planar a
+    // block is converted once before the first stage that supports it and
+    // back to int16 before the sink, or around a stage that does not support
+    // it. With kInt16Interleaved (the default) every stage requantizes its
+    // own output, as librespeaker nodes do. Set before Prepare().
+    void SetSampleFormat(SampleFormat format) { format_ = format; }
+    SampleFormat GetSampleFormat() const { return format_; }
+
+    // Format conversions done by the executor so far, over all blocks.
+    uint64_t GetNumConversions() const { return conversions_.load(); }
+
+    // Measure the usage of every interval-th block of each stage; 0 (the
+    // default) measures none. A measurement is two ThreadUsage::Current()
+    // calls, a syscall each, around the stage, so live chains leave it off
+    // and benches turn it on. Set before Prepare().
+    void SetUsageInterval(unsigned interval) { usage_interval_ = interval; }
+
+    // Stages are not owned and must outlive the executor.
+    bool Prepare(const std::vector<ChainStage *> &stages, size_t num_channels, int rate, int block_size_ms,
+                 Sink sink) {
+        stages_ = stages;
+        sink_ = sink;
+        usage_.clear();
+        for (size_t i = 0; i < stages_.size(); i++) usage_.push_back(std::unique_ptr<NodeUsageCounter>(new NodeUsageCounter));
+        stage_blocks_.assign(stages_.size(), 0);
+        for (size_t i = 0; i < stages_.size(); i++) {
+            if (!stages_[i]->Prepare(num_channels, rate, block_size_ms)) {
+                return false;
+            }
+            num_channels = stages_[i]->GetNumOutputChannels(num_channels);
+            rate = stages_[i]->GetOutputRate(rate);
+        }
+        return OnPrepared();
+    }
+
+    // Queues a block at the head of the chain. Must be called from one
+    // producer thread at a time.
+    void Push(const BlockPtr &block) {
+        in_flight_.fetch_add(1);
+        OnPush(block);
+    }
+
+    // Blocks until every pushed block has reached the sink.
+    void WaitIdle() {
+        std::unique_lock<std::mutex> guard(idle_lock_);
+        idle_.wait(guard, [this] { return in_flight_.load() == 0; });
+    }
+
+    virtual size_t GetQueueDeepth(size_t stage_index) = 0;
+
+    // CPU time, context switches and page faults spent inside each stage's
+    // ProcessBlock(), measured by the thread that ran it, as running totals
+    // over the measured blocks (see SetUsageInterval()). Rates come from the
+    // difference of two readings.
+    NodeUsageCounter::Totals GetStageUsage(size_t stage_index) const {
+        return stage_index < usage_.size() ? usage_[stage_index]->Get() : NodeUsageCounter::Totals();
+    }
+
+    size_t GetNumStages() const { return stages_.size(); }
+
+protected:
+    virtual bool OnPrepared() { return true; }
+    virtual void OnPush(const BlockPtr &block) = 0;
+
+    void RunStage(size_t index, AudioBlock *block) {
+        SampleFormat wanted =
+            format_ == kFloat32Planar && stages_[index]->SupportsFloatPlanar() ? kFloat32Planar : kInt16Interleaved;
+        Convert(block, wanted);
+        // A stage runs on one thread at a time, so its count needs no lock.
+        bool measure = usage_interval_ > 0 && stage_blocks_[index]++ % usage_interval_ == 0;
+        ThreadUsage before;
+        if (measure) before = ThreadUsage::Current();
+        {
+            RtCheckScope realtime;
+            stages_[index]->ProcessBlock(block);
+        }
+        if (measure) usage_[index]->Add(ThreadUsage::Current() - before);
+    }
+
+    void Deliver(const BlockPtr &block) {
+        Convert(block.get(), kInt16Interleaved);
+        if (sink_) sink_(block);
+        std::lock_guard<std::mutex> guard(idle_lock_);
+        if (in_flight_.fetch_sub(1) == 1) {
+            idle_.notify_all();
+        }
+    }
+
+    std::vector<ChainStage *> stages_;
+
+private:
+    void Convert(AudioBlock *block, SampleFormat format) {
+        if (block->format == format) return;
+        if (format == kFloat32Planar) ConvertToFloatPlanar(block);
+        else ConvertToInt16Interleaved(block);
+        conversions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::vector<std::unique_ptr<NodeUsageCounter>> usage_;
+    std::vector<uint64_t> stage_blocks_;
+    unsigned usage_interval_ = 0;
+    SampleFormat format_ = kInt16Interleaved;
+    std::atomic<uint64_t> conversions_{0};
+    Sink sink_;
+    std::atomic<size_t> in_flight_{0};
+    std::mutex idle_lock_;
+    std::condition_variable idle_;
+};
+
+// Runs each stage on a SerialStrand of a shared WorkStealingPool. Blocks of
+// one chain keep their order at every stage and consecutive stages still
+// pipeline, while any number of chains share the pool's fixed set of threads.
+class PooledExecutor : public ChainExecutor {
+public:
+    explicit PooledExecutor(WorkStealingPool *pool) : pool_(pool) {}
+
+    ~PooledExecutor() {
+        WaitIdle();
+        // The last Drain() may still be unwinding on a worker.
+        for (size_t i = 0; i < strands_.size(); i++) {
+            while (!strands_[i]->IsIdle()) std::this_thread::yield();
+        }
+    }
+
+    size_t GetQueueDeepth(size_t stage_index) override {
+        return stage_index < strands_.size() ? strands_[stage_index]->GetQueueDeepth() : 0;
+    }
+
+protected:
+    bool OnPrepared() override {
+        strands_.clear();
+        for (size_t i = 0; i < stages_.size(); i++) {
+            strands_.push_back(std::unique_ptr<SerialStrand>(new SerialStrand(pool_)));
+        }
+        return true;
+    }
+
+    void OnPush(const BlockPtr &block) override { RunFrom(0, block); }
+
+private:
+    void RunFrom(size_t index, const BlockPtr &block) {
+        if (index == stages_.size()) {
+            Deliver(block);
+            return;
+        }
+        strands_[index]->Post([this, index, block] {
+            RunStage(index, block.get());
+            RunFrom(index + 1, block);
+        });
+    }
+
+    WorkStealingPool *pool_;
+    std::vector<std::unique_ptr<SerialStrand>> strands_;
+};
+
+// Runs every stage on the thread that pushes, one block at a time: a block
+// has been through the whole chain and reached the sink when Push()
+// returns. With no queues and no hand-offs the stage totals are compute cost
+// alone, repeated runs over the same input give the same output bit for bit,
+// and the gap to a threaded executor on that input is what scheduling costs.
+class LockstepExecutor : public ChainExecutor {
+public:
+    size_t GetQueueDeepth(size_t stage_index) override { return 0; }
+
+protected:
+    void OnPush(const BlockPtr &block) override {
+        for (size_t i = 0; i < stages_.size(); i++) RunStage(i, block.get());
+        Deliver(block);
+    }
+};
+
+// The librespeaker model: one thread and one queue per stage.
+class ThreadPerNodeExecutor : public ChainExecutor {
+public:
+    ThreadPerNodeExecutor() {}
+
+    ~ThreadPerNodeExecutor() {
+        WaitIdle();
+        for (size_t i = 0; i < nodes_.size(); i++) {
+            {
+                std::lock_guard<std::mutex> guard(nodes_[i]->lock);
+                nodes_[i]->stopping = true;
+            }
+            nodes_[i]->ready.notify_one();
+            nodes_[i]->thread.join();
+        }
+    }
+
+    size_t GetQueueDeepth(size_t stage_index) override {
+        if (stage_index >= nodes_.size()) return 0;
+        std::lock_guard<std::mutex> guard(nodes_[stage_index]->lock);
+        return nodes_[stage_index]->queue.Size();
+    }
+
+protected:
+    bool OnPrepared() override {
+        for (size_t i = 0; i < stages_.size(); i++) {
+            nodes_.push_back(std::unique_ptr<Node>(new Node));
+        }
+        for (size_t i = 0; i < stages_.size(); i++) {
+            nodes_[i]->thread = std::thread(&ThreadPerNodeExecutor::NodeLoop, this, i);
+        }
+        return true;
+    }
+
+    void OnPush(const BlockPtr &block) override {
+        if (nodes_.empty()) {
+            Deliver(block);
+            return;
+        }
+        Enqueue(0, block);
+    }
+
+private:
+    // A ring that only allocates when it has to grow, unlike std::deque,
+    // which allocates and frees a chunk every few dozen blocks even at a
+    // steady depth.
+    class BlockQueue {
+    public:
+        BlockQueue() : ring_(16), head_(0), size_(0) {}
+        bool Empty() const { return size_ == 0; }
+        size_t Size() const { return size_; }
+        void Push(const BlockPtr &block) {
+            if (size_ == ring_.size()) {
+                std::vector<BlockPtr> bigger(ring_.size() * 2);
+                for (size_t i = 0; i < size_; i++) bigger[i].swap(ring_[(head_ + i) % ring_.size()]);
+                ring_.swap(bigger);
+                head_ = 0;
+            }
+            ring_[(head_ + size_++) % ring_.size()] = block;
+        }
+        BlockPtr Pop() {
+            BlockPtr block;
+            block.swap(ring_[head_]);
+            head_ = (head_ + 1) % ring_.size();
+            size_--;
+            return block;
+        }
+
+    private:
+        std::vector<BlockPtr> ring_;
+        size_t head_, size_;
+    };
+
+    struct Node {
+        std::mutex lock;
+        std::condition_variable ready;
+        BlockQueue queue;
+        bool stopping = false;
+        std::thread thread;
+    };
+
+    void Enqueue(size_t index, const BlockPtr &block) {
+        {
+            std::lock_guard<std::mutex> guard(nodes_[index]->lock);
+            nodes_[index]->queue.Push(block);
+        }
+        nodes_[index]->ready.notify_one();
+    }
+
+    void NodeLoop(size_t index) {
+        Node *node = nodes_[index].get();
+        while (true) {
+            BlockPtr block;
+            {
+                std::unique_lock<std::mutex> guard(node->lock);
+                node->ready.wait(guard, [node] { return node->stopping || !node->queue.Empty(); });
+                if (node->queue.Empty()) break;
+                block = node->queue.Pop();
+            }
+            RunStage(index, block.get());
+            if (index + 1 < nodes_.size()) {
+                Enqueue(index + 1, block);
+            }
+            else {
+                Deliver(block);
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Node>> nodes_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // CHAIN_EXECUTOR_H_
@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <iostream>
+#include <iomanip>
+#include <csignal>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "block_pool.h"
+#include "chain_executor.h"
+#include "interleaved_wav_reader.h"
+#include "memory_lock.h"
+#include "thread_stats.h"
+
+extern "C"
+{
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+static bool stop = false;
+
+
+void SignalHandler(int signal){
+  cerr << "Caught signal " << signal << ", terminating..." << endl;
+  stop = true;
+}
+
+static void help(const char *argv0) {
+    cout << "chain_pool_bench [options]" << endl;
+    cout << "Runs many simulated mic-array chains in one process and reports per-block latency" << endl;
+    cout << "for the thread-per-node executor, the shared work-stealing pool and lockstep (every chain run on the" << endl;
+    cout << "pushing thread, the compute cost without scheduling)." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=INPUT_FILE_NAME               The 8-chl input wav file, or a directory of beamformer dumps," << endl;
+    cout << "                                           looped, default is athing.wav" << endl;
+    cout << "  -n, --chains=MAX_CHAINS                  Largest number of chains in the sweep, default is 16" << endl;
+    cout << "  -w, --workers=NUM_WORKERS                Pool size, default is the number of cores" << endl;
+    cout << "  -d, --duration=SECONDS                   Run time of each point in the sweep, default is 5" << endl;
+    cout << "  -m, --mode=MODE                          pool, threads, lockstep, both (threads and pool) or all, default is both" << endl;
+    cout << "  -a, --alloc=ALLOC                        Where blocks come from: pool (a BlockPool per chain) or heap," << endl;
+    cout << "                                           default is pool" << endl;
+    cout << "  -L, --lock                               mlock and pre-fault the process first (see memory_lock.h)" << endl;
+}
+
+// Every operator new and new[] in the process is counted, so the alloc/b
+// column shows what a block costs the allocator across the whole chain.
+static atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void *operator new(size_t size, const nothrow_t &) noexcept {
+    allocations.fetch_add(1, memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const nothrow_t &) noexcept {
+    allocations.fetch_add(1, memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+// Every form of delete has to pair with the malloc above, or a library
+// default would free memory it did not allocate.
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { free(p); }
+#if defined(__cpp_sized_deallocation)
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+#endif
+
+static long ResidentKb() {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Stand-ins for the collector / beamformer / kws nodes: cheap but real work
+// with roughly the same shape, so the benchmark measures scheduling rather
+// than any particular algorithm.
+class DecimateStage : public ChainStage {
+public:
+    string Name() const override { return "decimate"; }
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override {
+        factor_ = rate > 16000 ? rate / 16000 : 1;
+        taps_.resize(16 * factor_);
+        for (size_t i = 0; i < taps_.size(); i++) {
+            taps_[i] = 0.54f - 0.46f * cos(2 * M_PI * i / (taps_.size() - 1));
+        }
+        history_.assign(taps_.size() * num_channels, 0);
+        return true;
+    }
+    void ProcessBlock(AudioBlock *block) override {
+        size_t ch = block->num_channels, frames = block->NumFrames(), ntaps = taps_.size();
+        vector<float> &in = input_;
+        in.assign(history_.begin(), history_.end());
+        const int16_t *s = block->Samples();
+        for (size_t i = 0; i < frames * ch; i++) in.push_back(s[i]);
+        size_t out_frames = frames / factor_;
+        float norm = 0;
+        for (size_t k = 0; k < ntaps; k++) norm += taps_[k];
+        int16_t *d = block->Samples();
+        for (size_t n = 0; n < out_frames; n++) {
+            for (size_t c = 0; c < ch; c++) {
+                float acc = 0;
+                for (size_t k = 0; k < ntaps; k++) acc += taps_[k] * in[(n * factor_ + k + 1) * ch + c];
+                d[n * ch + c] = (int16_t)(acc / norm);
+            }
+        }
+        copy(in.end() - ntaps * ch, in.end(), history_.begin());
+        block->data.resize(out_frames * ch * sizeof(int16_t));
+        block->rate /= factor_;
+        block->sample_index /= factor_;
+    }
+private:
+    size_t factor_;
+    vector<float> taps_, history_, input_;
+};
+
+class BeamSumStage : public ChainStage {
+public:
+    string Name() const override { return "beam_sum"; }
+    size_t GetNumOutputChannels(size_t num_input_channels) const override { return 1; }
+    void ProcessBlock(AudioBlock *block) override {
+        size_t ch = block->num_channels, frames = block->NumFrames(), mics = min<size_t>(ch, 6);
+        int16_t *s = block->Samples();
+        for (size_t n = 0; n < frames; n++) {
+            int acc = 0;
+            for (size_t c = 0; c < mics; c++) acc += s[n * ch + c];
+            s[n] = (int16_t)(acc / (int)mics);
+        }
+        block->num_channels = 1;
+        block->data.resize(frames * sizeof(int16_t));
+    }
+};
+
+class EnergyStage : public ChainStage {
+public:
+    string Name() const override { return "energy"; }
+    void ProcessBlock(AudioBlock *block) override {
+        const int16_t *s = block->Samples();
+        double e = 0;
+        for (size_t i = 0; i < block->NumFrames() * block->num_channels; i++) e += (double)s[i] * s[i];
+        energy_ = 0.9 * energy_ + 0.1 * e;
+    }
+private:
+    double energy_ = 0;
+};
+
+struct SimulatedChain {
+    unique_ptr<BlockSource> reader;
+    unique_ptr<ChainExecutor> executor;
+    unique_ptr<BlockPool> blocks;
+    DecimateStage decimate;
+    BeamSumStage beam;
+    EnergyStage energy;
+    vector<int64_t> pushed_ns;
+    vector<int64_t> latency_ns;
+};
+
+static int64_t NowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs num_chains chains in real time for duration_s and prints one row.
+static bool RunPoint(const string &file_path, size_t num_chains, const string &mode, size_t num_workers, int duration_s,
+                     bool block_pool) {
+    bool pooled = mode == "pool";
+    unique_ptr<WorkStealingPool> pool;
+    if (pooled) pool.reset(new WorkStealingPool(num_workers));
+
+    size_t num_blocks = duration_s * 1000 / BLOCK_SIZE_MS;
+    vector<unique_ptr<SimulatedChain>> chains;
+    for (size_t i = 0; i < num_chains; i++) {
+        unique_ptr<SimulatedChain> chain(new SimulatedChain);
+        string error;
+        chain->reader.reset(OpenRecording(file_path, BLOCK_SIZE_MS, true, &error));
+        if (!chain->reader) {
+            cout << "Error : " << error << endl;
+            return false;
+        }
+        if (pooled) chain->executor.reset(new PooledExecutor(pool.get()));
+        else if (mode == "lockstep") chain->executor.reset(new LockstepExecutor());
+        else chain->executor.reset(new ThreadPerNodeExecutor());
+        chain->executor->SetUsageInterval(1);
+        // A block lives from Push() to the sink, a few periods at most; the
+        // high-water column shows how many were actually needed.
+        if (block_pool) {
+            chain->blocks.reset(BlockPool::Create(chain->reader->GetNumChannels(), chain->reader->GetRate(), BLOCK_SIZE_MS, 32));
+        }
+        chain->pushed_ns.assign(num_blocks, 0);
+        chain->latency_ns.reserve(num_blocks);
+        SimulatedChain *c = chain.get();
+        vector<ChainStage *> stages = {&c->decimate, &c->beam, &c->energy};
+        chain->executor->Prepare(stages, c->reader->GetNumChannels(), c->reader->GetRate(), BLOCK_SIZE_MS,
+            [c](const ChainExecutor::BlockPtr &block) {
+                c->latency_ns.push_back(NowNs() - c->pushed_ns[block->sequence]);
+            });
+        chains.push_back(std::move(chain));
+    }
+
+    ProcessThreadSampler sampler;
+    ThreadUsage process_before;
+    vector<ProcessThreadSampler::TaskSample> tasks = sampler.Sample();
+    for (size_t i = 0; i < tasks.size(); i++) process_before.cpu_ns += tasks[i].usage.cpu_ns;
+
+    long rss_before = ResidentKb();
+    uint64_t allocations_before = allocations.load();
+    auto next = chrono::steady_clock::now();
+    size_t pushed = 0;
+    for (size_t b = 0; b < num_blocks && !stop; b++, pushed++) {
+        for (size_t i = 0; i < num_chains; i++) {
+            ChainExecutor::BlockPtr block(block_pool ? chains[i]->blocks->Lease() : ChainExecutor::BlockPtr(new AudioBlock));
+            chains[i]->reader->Read(block.get());
+            block->sequence = b;
+            chains[i]->pushed_ns[b] = NowNs();
+            chains[i]->executor->Push(block);
+        }
+        next += chrono::milliseconds(BLOCK_SIZE_MS);
+        this_thread::sleep_until(next);
+    }
+
+    for (size_t i = 0; i < num_chains; i++) chains[i]->executor->WaitIdle();
+    uint64_t block_allocations = allocations.load() - allocations_before;
+    long rss_growth = ResidentKb() - rss_before;
+
+    vector<int64_t> all;
+    ThreadUsage stage_usage;
+    size_t high_water = 0;
+    uint64_t fallbacks = 0;
+    for (size_t i = 0; i < num_chains; i++) {
+        if (chains[i]->blocks) {
+            high_water = max(high_water, chains[i]->blocks->GetHighWater());
+            fallbacks += chains[i]->blocks->GetFallbacks();
+        }
+        all.insert(all.end(), chains[i]->latency_ns.begin(), chains[i]->latency_ns.end());
+        for (size_t s = 0; s < chains[i]->executor->GetNumStages(); s++) {
+            ThreadUsage u = chains[i]->executor->GetStageUsage(s).usage;
+            stage_usage.cpu_ns += u.cpu_ns;
+            stage_usage.voluntary_switches += u.voluntary_switches;
+            stage_usage.involuntary_switches += u.involuntary_switches;
+            stage_usage.minor_faults += u.minor_faults;
+            stage_usage.major_faults += u.major_faults;
+        }
+    }
+    // Whole-process CPU includes the scheduling and the threads themselves,
+    // stage CPU only the work inside ProcessBlock().
+    tasks = sampler.Sample();
+    int64_t process_ns = -process_before.cpu_ns;
+    for (size_t i = 0; i < tasks.size(); i++) process_ns += tasks[i].usage.cpu_ns;
+    double audio_s = pushed * BLOCK_SIZE_MS / 1000.0;
+    double blocks = max<double>(1, pushed * num_chains);
+    if (all.empty()) return false;
+    sort(all.begin(), all.end());
+    size_t misses = all.end() - upper_bound(all.begin(), all.end(), (int64_t)BLOCK_SIZE_MS * 1000000);
+    size_t threads = pooled ? num_workers : mode == "lockstep" ? 1 : num_chains * 3;
+    cout << setw(7) << num_chains << setw(9) << mode << setw(9) << threads
+         << setw(11) << all[all.size() / 2] / 1000
+         << setw(11) << all[all.size() * 99 / 100] / 1000
+         << setw(11) << all.back() / 1000
+         << setw(9) << misses
+         << setw(10) << 100.0 * stage_usage.cpu_ns / 1e9 / audio_s / num_chains
+         << setw(10) << 100.0 * process_ns / 1e9 / audio_s / num_chains
+         << setw(9) << stage_usage.voluntary_switches / blocks
+         << setw(9) << stage_usage.involuntary_switches / blocks
+         << setw(9) << block_allocations / blocks << setw(9) << rss_growth
+         << setw(9) << stage_usage.minor_faults + stage_usage.major_faults;
+    if (block_pool) cout << setw(5) << high_water << setw(9) << fallbacks;
+    cout << endl;
+    return true;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // Configures signal handling.
+    struct sigaction sig_int_handler;
+    sig_int_handler.sa_handler = SignalHandler;
+    sigemptyset(&sig_int_handler.sa_mask);
+    sig_int_handler.sa_flags = 0;
+    sigaction(SIGINT, &sig_int_handler, NULL);
+    sigaction(SIGTERM, &sig_int_handler, NULL);
+
+    // parse opts
+    int c;
+    string file_path = "athing.wav";
+    string mode = "both";
+    size_t max_chains = 16;
+    size_t num_workers = thread::hardware_concurrency();
+    int duration_s = 5;
+    bool block_pool = true;
+    bool lock_memory = false;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"chains",       1, NULL, 'n'},
+        {"workers",      1, NULL, 'w'},
+        {"duration",     1, NULL, 'd'},
+        {"mode",         1, NULL, 'm'},
+        {"alloc",        1, NULL, 'a'},
+        {"lock",         0, NULL, 'L'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:n:w:d:m:a:hL", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            file_path = string(optarg);
+            break;
+        case 'n':
+            max_chains = stoi(optarg);
+            break;
+        case 'w':
+            num_workers = stoi(optarg);
+            break;
+        case 'd':
+            duration_s = stoi(optarg);
+            break;
+        case 'm':
+            mode = string(optarg);
+            break;
+        case 'a':
+            block_pool = string(optarg) != "heap";
+            break;
+        case 'L':
+            lock_memory = true;
+            break;
+        default:
+            return 0;
+        }
+    }
+    if (num_workers == 0) num_workers = 1;
+    unique_ptr<MemoryLock> memory_lock;
+    if (lock_memory) {
+        string error;
+        memory_lock.reset(MemoryLock::Create(MemoryLockOptions(), &error));
+        if (!memory_lock) {
+            cout << "Error : " << error << endl;
+            return -1;
+        }
+        cout << memory_lock->Summary() << endl;
+    }
+
+    cout << fixed << setprecision(2);
+    cout << "block: " << BLOCK_SIZE_MS << " ms, workers: " << num_workers << ", latency in us" << endl;
+    cout << setw(7) << "chains" << setw(9) << "mode" << setw(9) << "threads" << setw(11) << "p50"
+         << setw(11) << "p99" << setw(11) << "max" << setw(9) << "misses" << setw(10) << "stage%"
+         << setw(10) << "proc%" << setw(9) << "vcsw/b" << setw(9) << "ivcsw/b" << setw(9) << "alloc/b"
+         << setw(9) << "rss+kB" << setw(9) << "faults";
+    if (block_pool) cout << setw(5) << "hw" << setw(9) << "fallback";
+    cout << endl;
+    cout << "(stage% and proc% are CPU per chain in % of one core; csw per block over all stages;" << endl;
+    cout << " alloc/b is operator new calls per block, faults the page faults taken inside stages," << endl;
+    cout << " hw the most pooled blocks one chain had out)" << endl;
+
+    for (size_t n = 1; n <= max_chains && !stop; n *= 2) {
+        bool all = mode == "all", both = all || mode == "both";
+        if ((both || mode == "threads") && !RunPoint(file_path, n, "threads", num_workers, duration_s, block_pool)) return -1;
+        if ((both || mode == "pool") && !RunPoint(file_path, n, "pool", num_workers, duration_s, block_pool)) return -1;
+        if ((all || mode == "lockstep") && !RunPoint(file_path, n, "lockstep", num_workers, duration_s, block_pool)) return -1;
+    }
+
+    return 0;
+}
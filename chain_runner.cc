@@ -0,0 +1,644 @@
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <csignal>
+#include <map>
+#include <sstream>
+#include <vector>
+#include <respeaker.h>
+#include <chain_nodes/pulse_collector_node.h>
+#include <chain_nodes/file_collector_node.h>
+#include <chain_nodes/vep_aec_beamforming_node.h>
+#include <chain_nodes/snowboy_1b_doa_kws_node.h>
+#include <chain_nodes/snips_1b_doa_kws_node.h>
+#include "agc_stage.h"
+#include "async_log.h"
+#include "capture_clock.h"
+#include "capture_log_sink.h"
+#include "chain_config.h"
+#include "channel_health.h"
+#include "hotword_clips.h"
+#include "interleaved_wav_reader.h"
+#include "memory_lock.h"
+#include "replay_window.h"
+#include "thread_stats.h"
+extern "C"
+{
+#include <sndfile.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+using namespace std;
+using namespace respeaker;
+using namespace respeaker_ext;
+static bool stop = false;
+void SignalHandler(int signal){
+  cerr << "Caught signal " << signal << ", terminating..." << endl;
+  stop = true;
+}
+static void help(const char *argv0) {
+    cout << "chain_runner [options]" << endl;
+    cout << "Builds a collector -> beamformer -> kws chain from a config file and runs it. See configs/ for" << endl;
+    cout << "the chains the pulse_snowboy_*, TestRecording*, beamforming and manual_beamtest demos build." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -c, --config=CONFIG_FILE                 The chain description (ini)" << endl;
+    cout << "  -o, --set=SECTION.KEY=VALUE              Override one config value, may be repeated" << endl;
+    cout << "  -n, --dry-run                            Print the topology and exit" << endl;
+    cout << "  -u, --usage=SECONDS                      Print per-thread CPU, context switches and page faults every SECONDS" << endl;
+    cout << "With [memory] lock = true the process is mlocked and pre-faulted before the chain is built, and the" << endl;
+    cout << "page faults each thread took after steady_after_s are printed at exit." << endl;
+    cout << "With a file collector, [collector] start/duration or windows = START[+DURATION],... replay only those" << endl;
+    cout << "stretches of the file, each after preroll_s seconds of warm-up; times are seconds or [h:]mm:ss." << endl;
+    cout << "[collector] type = dumps replays a directory of per-channel beamformer dumps (dir = anusha) as the" << endl;
+    cout << "8-channel capture they came from." << endl;
+    cout << "A [health] section checks the chain's output channels for dead, clipping, DC-offset, duplicated and" << endl;
+    cout << "uncorrelated mics every window_ms; leave out [beamformer] to watch the raw mics." << endl;
+    cout << "An [agc] section levels the chain's output to target_dbfs, for chains whose KWS node does not." << endl;
+}
+
+// One librespeaker node with the knobs the config sets on it.
+struct NodeSpec {
+    string name;
+    ChainNode *node;
+    string description;
+    int core;
+    int priority;
+    // librespeaker queues are unbounded, so this is an alert bound: depths
+    // above it are counted and reported. 0 disables the check.
+    size_t max_queue;
+    size_t high_water;
+    uint64_t overruns;
+};
+
+static NodeSpec ReadNodeKnobs(const ChainConfig &config, const string &section, const string &name) {
+    NodeSpec spec;
+    spec.name = name;
+    spec.node = NULL;
+    spec.core = config.GetInt(section, "core", -1);
+    spec.priority = config.GetInt(section, "priority", 0);
+    spec.max_queue = config.GetSize(section, "max_queue", 0);
+    spec.high_water = 0;
+    spec.overruns = 0;
+    return spec;
+}
+
+static void PrintTopology(const ChainConfig &config, const vector<NodeSpec> &nodes, int block_size_ms,
+                          const string &log_path, const CaptureLogOptions &log_options, const string &events_path) {
+    cout << "chain: " << config.GetString("chain", "name", config.GetPath()) << " (" << config.GetPath()
+         << "), block " << block_size_ms << " ms" << endl;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        cout << "  " << (i == 0 ? "   " : "-> ") << left << setw(13) << nodes[i].name << setw(62) << nodes[i].description
+             << right << " core " << setw(2) << (nodes[i].core >= 0 ? to_string(nodes[i].core) : "-") << "  prio "
+             << setw(2) << (nodes[i].priority > 0 ? to_string(nodes[i].priority) : "-") << "  queue <= "
+             << (nodes[i].max_queue > 0 ? to_string(nodes[i].max_queue) : "-") << endl;
+    }
+    cout << "  output log: ";
+    if (log_path.empty()) {
+        cout << "off" << endl;
+    }
+    else {
+        cout << log_path << (log_options.flac_level >= 0 ? " (flac " + to_string(log_options.flac_level) + ")" : " (wav)");
+        if (log_options.segment_seconds > 0) cout << ", " << log_options.segment_seconds << " s segments";
+        if (log_options.segment_bytes > 0) cout << ", " << (log_options.segment_bytes >> 20) << " MB segments";
+        cout << (log_options.drop_when_full ? ", drops when behind" : ", waits when behind") << endl;
+    }
+    if (!events_path.empty()) cout << "  hotword events: " << events_path << endl;
+}
+
+int main(int argc, char *argv[]) {
+    // Configures signal handling.
+    struct sigaction sig_int_handler;
+    sig_int_handler.sa_handler = SignalHandler;
+    sigemptyset(&sig_int_handler.sa_mask);
+    sig_int_handler.sa_flags = 0;
+    sigaction(SIGINT, &sig_int_handler, NULL);
+    sigaction(SIGTERM, &sig_int_handler, NULL);
+    // parse opts
+    int c;
+    string config_path;
+    vector<string> overrides;
+    bool dry_run = false;
+    int usage_seconds = 0;
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"config",       1, NULL, 'c'},
+        {"set",          1, NULL, 'o'},
+        {"dry-run",      0, NULL, 'n'},
+        {"usage",        1, NULL, 'u'},
+        {NULL,           0, NULL,  0}
+    };
+    while ((c = getopt_long(argc, argv, "c:o:u:hn", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'c':
+            config_path = string(optarg);
+            break;
+        case 'o':
+            overrides.push_back(string(optarg));
+            break;
+        case 'n':
+            dry_run = true;
+            break;
+        case 'u':
+            usage_seconds = stoi(optarg);
+            break;
+        default:
+            return 0;
+        }
+    }
+    string error;
+    unique_ptr<ChainConfig> config(ChainConfig::Load(config_path, &error));
+    if (!config) {
+        cout << "Error : " << error << endl;
+        return -1;
+    }
+    for (size_t i = 0; i < overrides.size(); i++) {
+        if (!config->Set(overrides[i])) {
+            cout << "Error : override must look like section.key=value: " << overrides[i] << endl;
+            return -1;
+        }
+    }
+
+    // [memory] comes first so the nodes, their models and every buffer
+    // allocated after start-up live in locked, pre-faulted memory.
+    bool lock_memory = config->GetBool("memory", "lock", false);
+    MemoryLockOptions lock_options;
+    lock_options.heap_reserve_bytes = config->GetSize("memory", "heap_reserve_mb", 32) << 20;
+    lock_options.stack_bytes = config->GetSize("memory", "stack_kb", 512) << 10;
+    lock_options.thread_stack_bytes = config->GetSize("memory", "thread_stack_kb", 0) << 10;
+    lock_options.huge_pages = config->GetBool("memory", "huge_pages", false);
+    int steady_after_s = config->GetInt("memory", "steady_after_s", 5);
+    unique_ptr<MemoryLock> memory_lock;
+    if (lock_memory && !dry_run) {
+        memory_lock.reset(MemoryLock::Create(lock_options, &error));
+        if (!memory_lock) {
+            cout << "Error : " << error << endl;
+            return -1;
+        }
+    }
+
+    // [collector]
+    unique_ptr<ChainNode> collector;
+    vector<NodeSpec> nodes;
+    int block_size_ms = config->GetInt("collector", "block_size_ms", 8);
+    string collector_type = config->GetString("collector", "type", "pulse");
+    NodeSpec collector_spec = ReadNodeKnobs(*config, "collector", "collector");
+    unique_ptr<ReplayPlan> replay;
+    unique_ptr<InterleavedWavReader> dumps;
+    unique_ptr<WavPipeFeeder> dump_feeder;
+    string replay_path;
+    bool keep_replay = false;
+    if (collector_type == "file") {
+        string file_path = config->GetString("collector", "file", "");
+        bool blocking = config->GetBool("collector", "blocking", false);
+        // start/duration is the one-window shorthand for windows.
+        string windows_spec = config->GetString("collector", "windows", "");
+        string start = config->GetString("collector", "start", "");
+        string duration = config->GetString("collector", "duration", "");
+        if (!start.empty()) windows_spec += "," + start + (duration.empty() ? "" : "+" + duration);
+        collector_spec.description = "FileCollectorNode " + file_path + (blocking ? " blocking" : "");
+        if (!windows_spec.empty()) {
+            vector<ReplayWindow> windows;
+            double preroll_s = config->GetDouble("collector", "preroll_s", 2.0);
+            if (ParseReplayWindows(windows_spec, &windows, &error)) {
+                replay.reset(ReplayPlan::Create(file_path, windows, preroll_s, &error));
+            }
+            if (!replay) {
+                cout << "Error : " << error << endl;
+                return -1;
+            }
+            ostringstream desc;
+            desc << " " << replay->GetSegments().size() << " window(s), "
+                 << double(replay->GetNumFrames()) / replay->GetRate() << " of "
+                 << double(replay->GetSourceFrames()) / replay->GetRate() << " s, pre-roll " << preroll_s << " s";
+            collector_spec.description += desc.str();
+            // The excerpt is deleted at exit unless replay_file names it.
+            replay_path = config->GetString("collector", "replay_file", "");
+            keep_replay = !replay_path.empty();
+            if (!keep_replay) replay_path = "/tmp/chain_runner_replay_" + to_string(getpid()) + ".wav";
+            if (!dry_run) {
+                if (!replay->Extract(replay_path, &error)) {
+                    cout << "Error : " << error << endl;
+                    return -1;
+                }
+                file_path = replay_path;
+            }
+        }
+        if (!dry_run) collector.reset(FileCollectorNode::Create(file_path, block_size_ms, blocking));
+    }
+    else if (collector_type == "dumps") {
+        // Per-channel dumps, interleaved on the fly and streamed to the
+        // FileCollectorNode through a named pipe, so no merged copy is
+        // written. files lists the channels in order ("-" for silence); by
+        // default dir's in_0..in_5, ref_in and a silent channel 7.
+        string dir = config->GetString("collector", "dir", "");
+        string files_spec = config->GetString("collector", "files", "");
+        bool blocking = config->GetBool("collector", "blocking", false);
+        vector<string> paths;
+        stringstream files_in(files_spec);
+        string item;
+        while (getline(files_in, item, ',')) {
+            item.erase(0, item.find_first_not_of(' '));
+            item.erase(item.find_last_not_of(' ') + 1);
+            paths.push_back(item == "-" ? "" : (dir.empty() || item[0] == '/' ? item : dir + "/" + item));
+        }
+        if (paths.empty()) paths = InterleavedWavReader::DumpLayout(dir.empty() ? "." : dir);
+        dumps.reset(InterleavedWavReader::Create(paths, block_size_ms, false, &error));
+        if (!dumps) {
+            cout << "Error : " << error << endl;
+            return -1;
+        }
+        ostringstream desc;
+        desc << "FileCollectorNode <- " << paths.size() << " dumps in " << (dir.empty() ? "." : dir) << ", "
+             << dumps->GetNumChannels() << " ch, " << double(dumps->GetNumFrames()) / dumps->GetRate() << " s"
+             << (blocking ? " blocking" : "");
+        collector_spec.description = desc.str();
+        if (!dry_run) {
+            string fifo_path = "/tmp/chain_runner_dumps_" + to_string(getpid()) + ".wav";
+            dump_feeder.reset(WavPipeFeeder::Create(dumps.get(), fifo_path, &error));
+            if (!dump_feeder) {
+                cout << "Error : " << error << endl;
+                return -1;
+            }
+            collector.reset(FileCollectorNode::Create(fifo_path, block_size_ms, blocking));
+        }
+    }
+    else if (collector_type == "pulse") {
+        string source = config->GetString("collector", "source", "default");
+        bool resample = config->GetBool("collector", "resample_48k", true);
+        collector_spec.description = "PulseCollectorNode " + source + (resample ? " 48k->16k" : " 16k");
+        if (!dry_run) {
+            collector.reset(resample ? PulseCollectorNode::Create_48Kto16K(source, block_size_ms)
+                                     : PulseCollectorNode::Create(source, 16000, block_size_ms));
+        }
+    }
+    else {
+        cout << "Error : collector.type must be pulse, file or dumps" << endl;
+        return -1;
+    }
+    collector_spec.node = collector.get();
+    nodes.push_back(collector_spec);
+
+    // [beamformer]
+    unique_ptr<VepAecBeamformingNode> beamformer;
+    if (config->HasSection("beamformer")) {
+        NodeSpec spec = ReadNodeKnobs(*config, "beamformer", "vep_1beam");
+        string mic_type = config->GetString("beamformer", "mic_type", "CIRCULAR_6MIC_7BEAM");
+        bool single_beam = config->GetBool("beamformer", "single_beam", true);
+        int ref_channel = config->GetInt("beamformer", "ref_channel", 6);
+        bool dump = config->GetBool("beamformer", "dump", false);
+        int angle = config->GetInt("beamformer", "angle_for_mic0", -1);
+        ostringstream desc;
+        desc << "VepAecBeamformingNode " << mic_type << (single_beam ? " 1-beam" : " all-beams") << " ref " << ref_channel;
+        if (angle >= 0) desc << " mic0 " << angle;
+        if (dump) desc << " dump";
+        spec.description = desc.str();
+        if (!dry_run) {
+            beamformer.reset(VepAecBeamformingNode::Create(StringToMicType(mic_type), single_beam, ref_channel, dump));
+            if (angle >= 0) beamformer->SetAngleForMic0(angle);
+        }
+        spec.node = beamformer.get();
+        nodes.push_back(spec);
+    }
+
+    // [kws]
+    unique_ptr<Snowboy1bDoaKwsNode> snowboy_kws;
+    unique_ptr<Snips1bDoaKwsNode> snips_kws;
+    HotwordDetectionNode *hotword_node = NULL;
+    DirectionManagerNode *direction_node = NULL;
+    string engine = config->GetString("kws", "engine", "none");
+    if (config->HasSection("kws") && engine != "none") {
+        NodeSpec spec = ReadNodeKnobs(*config, "kws", engine == "snips" ? "snips_kws" : "snowboy_kws");
+        string sensitivity = config->GetString("kws", "sensitivity", "0.5");
+        string agc = config->GetString("kws", "agc", "off");
+        bool enable_agc = agc != "off";
+        int agc_level = enable_agc ? min(31, abs(atoi(agc.c_str()))) : 0;
+        bool auto_state_transfer = config->GetBool("kws", "auto_state_transfer", false);
+        string model;
+        if (engine == "snips") {
+            model = config->GetString("kws", "model", "/usr/share/respeaker/snips/model");
+            if (!dry_run) {
+                snips_kws.reset(Snips1bDoaKwsNode::Create(model, stof(sensitivity), enable_agc, false));
+                hotword_node = snips_kws.get();
+                direction_node = snips_kws.get();
+                spec.node = snips_kws.get();
+            }
+        }
+        else if (engine == "snowboy" || engine == "alexa") {
+            string resource = config->GetString("kws", "resource", "/usr/share/respeaker/snowboy/resources/common.res");
+            model = config->GetString("kws", "model", engine == "alexa"
+                                      ? "/usr/share/respeaker/snowboy/resources/alexa_02092017.umdl"
+                                      : "/usr/share/respeaker/snowboy/resources/snowboy.umdl");
+            int underclocking = config->GetInt("kws", "underclocking", 10);
+            if (!dry_run) {
+                snowboy_kws.reset(Snowboy1bDoaKwsNode::Create(resource, model, sensitivity, underclocking, enable_agc, false));
+                hotword_node = snowboy_kws.get();
+                direction_node = snowboy_kws.get();
+                spec.node = snowboy_kws.get();
+            }
+        }
+        else {
+            cout << "Error : kws.engine must be snowboy, alexa, snips or none" << endl;
+            return -1;
+        }
+        if (hotword_node) {
+            if (!auto_state_transfer) hotword_node->DisableAutoStateTransfer();
+            if (enable_agc) hotword_node->SetAgcTargetLevelDbfs(agc_level);
+        }
+        spec.description = string(engine == "snips" ? "Snips1bDoaKwsNode " : "Snowboy1bDoaKwsNode ") + model.substr(model.rfind('/') + 1) + " sens " + sensitivity +
+                           (enable_agc ? " agc -" + to_string(agc_level) : " agc off");
+        nodes.push_back(spec);
+    }
+
+    // [output]
+    string log_path = config->GetString("output", "log", "");
+    CaptureLogOptions log_options;
+    log_options.flac_level = config->GetInt("output", "flac", -1);
+    log_options.drop_when_full = config->GetBool("output", "drop_when_full", collector_type != "file");
+    log_options.segment_seconds = config->GetDouble("output", "segment_seconds", 0);
+    log_options.segment_bytes = static_cast<uint64_t>(config->GetSize("output", "segment_mb", 0)) << 20;
+    // Detections for clip_extract, by default next to the log.
+    string events_path = config->GetString("output", "events", log_path.empty() ? "" : log_path.substr(0, log_path.rfind('.')) + ".events.tsv");
+
+    // [chain]
+    int print_every = config->GetInt("chain", "print_every", 5);
+    int direction = config->GetInt("chain", "direction", -1);
+
+    // [health]
+    unique_ptr<ChannelHealthStage> health;
+    ChannelHealthOptions health_options;
+    int health_report_every = 0;
+    if (config->HasSection("health")) {
+        health_options.num_mics = config->GetSize("health", "mics", 6);
+        health_options.window_ms = static_cast<int>(min<size_t>(config->GetSize("health", "window_ms", health_options.window_ms), INT_MAX));
+        health_options.hold_windows = static_cast<int>(min<size_t>(config->GetSize("health", "hold_windows", health_options.hold_windows), INT_MAX));
+        health_options.clip_ratio = config->GetDouble("health", "clip_ratio", health_options.clip_ratio);
+        health_options.dc_limit = config->GetDouble("health", "dc_limit", health_options.dc_limit);
+        health_options.dead_dbfs = config->GetDouble("health", "dead_dbfs", health_options.dead_dbfs);
+        health_options.weak_margin_db = config->GetDouble("health", "weak_margin_db", health_options.weak_margin_db);
+        health_options.min_correlation = config->GetDouble("health", "min_correlation", health_options.min_correlation);
+        health_report_every = config->GetInt("health", "report_every", 0);
+        health.reset(ChannelHealthStage::Create(health_options));
+        if (!health) {
+            cout << "Error : health.window_ms must be positive" << endl;
+            return -1;
+        }
+    }
+
+    // [agc]
+    unique_ptr<AgcStage> agc;
+    if (config->HasSection("agc")) {
+        AgcOptions agc_options;
+        agc_options.target_dbfs = config->GetDouble("agc", "target_dbfs", agc_options.target_dbfs);
+        agc_options.max_gain_db = config->GetDouble("agc", "max_gain_db", agc_options.max_gain_db);
+        agc_options.min_gain_db = config->GetDouble("agc", "min_gain_db", agc_options.min_gain_db);
+        agc_options.gate_dbfs = config->GetDouble("agc", "gate_dbfs", agc_options.gate_dbfs);
+        agc_options.limit_dbfs = config->GetDouble("agc", "limit_dbfs", agc_options.limit_dbfs);
+        agc_options.level_ms = config->GetDouble("agc", "level_ms", agc_options.level_ms);
+        agc.reset(AgcStage::Create(agc_options));
+        if (!agc) {
+            cout << "Error : bad [agc] settings" << endl;
+            return -1;
+        }
+    }
+
+    PrintTopology(*config, nodes, block_size_ms, log_path, log_options, events_path);
+    if (health) {
+        cout << "  health: first " << health_options.num_mics << " channels are mics, " << health_options.window_ms
+             << " ms windows" << endl;
+    }
+    if (agc) cout << "  agc: output to " << config->GetDouble("agc", "target_dbfs", -10) << " dBFS" << endl;
+    cout << "  memory: ";
+    if (lock_memory) {
+        cout << "locked, " << (lock_options.heap_reserve_bytes >> 20) << " MB heap reserve"
+             << (lock_options.huge_pages ? " on huge pages" : "");
+        if (lock_options.thread_stack_bytes > 0) cout << ", " << (lock_options.thread_stack_bytes >> 10) << " kB thread stacks";
+        cout << ", faults counted from " << steady_after_s << " s" << endl;
+    }
+    else {
+        cout << "not locked" << endl;
+    }
+    vector<string> unused = config->UnusedKeys();
+    for (size_t i = 0; i < unused.size(); i++) cout << "warning: unknown key " << unused[i] << endl;
+    const vector<string> &invalid = config->Errors();
+    for (size_t i = 0; i < invalid.size(); i++) cout << "Error : " << config->GetPath() << ": " << invalid[i] << endl;
+    if (!invalid.empty()) return -1;
+    if (dry_run) return 0;
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!nodes[i].node) {
+            cout << "Can not create " << nodes[i].name << endl;
+            return -1;
+        }
+        if (i > 0) nodes[i].node->Uplink(nodes[i - 1].node);
+        if (nodes[i].priority > 0) nodes[i].node->SetThreadPriority(nodes[i].priority);
+        if (nodes[i].core >= 0) nodes[i].node->BindToCore(nodes[i].core);
+    }
+    unique_ptr<ReSpeaker> respeaker(ReSpeaker::Create());
+    respeaker->RegisterChainByHead(collector.get());
+    respeaker->RegisterOutputNode(nodes.back().node);
+    if (direction_node) respeaker->RegisterDirectionManagerNode(direction_node);
+    if (hotword_node) respeaker->RegisterHotwordDetectionNode(hotword_node);
+
+    ProcessThreadSampler thread_sampler;
+    thread_sampler.Label(ProcessThreadSampler::CurrentTid(), "main");
+    thread_sampler.MarkKnownThreads();
+    if (!respeaker->Start(&stop)) {
+        cout << "Can not start the respeaker node chain." << endl;
+        return -1;
+    }
+    vector<string> names;
+    for (size_t i = 0; i < nodes.size(); i++) names.push_back(nodes[i].name);
+    if (!thread_sampler.LabelNewThreads(names) && usage_seconds > 0) {
+        cout << "node threads not matched to nodes, usage shows thread names" << endl;
+    }
+    ThreadUsageReport usage_report(&thread_sampler);
+    usage_report.Prime();
+    if (direction >= 0) respeaker->SetDirection(direction);
+    if (memory_lock) cout << memory_lock->Summary() << endl;
+
+    string data;
+    size_t num_channels = respeaker->GetNumOutputChannels();
+    int rate = respeaker->GetNumOutputRate();
+    cout << "num channels: " << num_channels << ", rate: " << rate << endl;
+    unique_ptr<CaptureLogSink> log_sink;
+    if (!log_path.empty()) {
+        if (log_options.flac_level >= 0 && log_path.size() > 4 && log_path.substr(log_path.size() - 4) == ".wav") {
+            log_path.replace(log_path.size() - 4, 4, ".flac");
+        }
+        log_sink.reset(CaptureLogSink::Create(log_path, rate, num_channels, log_options));
+        if (!log_sink)
+        {
+            cout << "Error : Not able to open output file." << endl;
+            return -1 ;
+        }
+    }
+    unique_ptr<HotwordEventLog> event_log;
+    if (hotword_node && !events_path.empty()) {
+        event_log.reset(HotwordEventLog::Create(events_path));
+        if (!event_log) {
+            cout << "Error : Not able to open " << events_path << endl;
+            return -1;
+        }
+    }
+    CaptureTimeline timeline(rate);
+    LatencyReport latency_report;
+    HotwordEvent event;
+    event.rate = rate;
+    unique_ptr<AsyncLog> async_log(AsyncLog::Create());
+    async_log->AttachThread();
+    // The health stage runs on this thread, on the output blocks as they are
+    // polled; alerts go out through the async log.
+    AudioBlock health_block, agc_block;
+    HealthReport health_report;
+    if (health && !health->Prepare(num_channels, rate, block_size_ms)) {
+        cout << "Error : can not watch " << num_channels << " channels at " << rate << " Hz" << endl;
+        return -1;
+    }
+    if (health) {
+        AsyncLog *log = async_log.get();
+        health->SetAlertCallback([log, rate](const HealthAlert &alert, const HealthReport &) {
+            log->Log(alert.raised ? kLogWarn : kLogInfo, "health: ch {} {} {} at {} s ({})", alert.channel,
+                     HealthFaultName(alert.fault), alert.raised ? "raised" : "cleared", double(alert.frame) / rate,
+                     alert.value);
+        });
+    }
+    if (agc) {
+        agc->Prepare(num_channels, rate, block_size_ms);
+        agc_block.num_channels = num_channels;
+        agc_block.rate = rate;
+    }
+    int tick = 0;
+    int hotword_index = 0, hotword_count = 0, preroll_hotwords = 0;
+    int replay_window = -1;
+    while (!stop)
+    {
+        if (hotword_node) {
+            data = respeaker->DetectHotword(hotword_index);
+        }
+        else {
+            data = respeaker->Listen();
+        }
+        event.block_frames = data.size() / (sizeof(int16_t) * num_channels);
+        timeline.Stamp(event.block_frames, &event.sample_index, &event.capture_ns);
+        if (health && !data.empty()) {
+            uint64_t windows = health->GetWindows();
+            health_block.data.swap(data);
+            health_block.num_channels = num_channels;
+            health_block.rate = rate;
+            health_block.sample_index = event.sample_index;
+            health->ProcessBlock(&health_block);
+            health_block.data.swap(data);
+            if (health_report_every > 0 && health->GetWindows() != windows &&
+                health->GetWindows() % health_report_every == 0 && health->GetReport(&health_report)) {
+                double lowest = 1;
+                for (size_t c = 0; c < health_report.num_mics; c++) lowest = min(lowest, health_report.channels[c].correlation);
+                async_log->Info("health: median mic {} dBFS, lowest mic correlation {}", health_report.median_mic_dbfs,
+                                lowest);
+            }
+        }
+        // After the health checks, which judge the levels as captured.
+        if (agc && !data.empty()) {
+            agc_block.data.swap(data);
+            agc->ProcessBlock(&agc_block);
+            agc_block.data.swap(data);
+        }
+        bool in_preroll = false;
+        if (replay) {
+            // Report recording positions, not positions in the excerpt.
+            int64_t replay_index = static_cast<int64_t>(event.sample_index) * replay->GetRate() / rate;
+            const ReplaySegment *segment = replay->Locate(replay_index);
+            if (segment && segment->window != replay_window) {
+                replay_window = segment->window;
+                cout << "window " << replay_window << ": " << double(segment->source_begin + segment->preroll_frames) / replay->GetRate()
+                     << " s + " << double(segment->frames - segment->preroll_frames) / replay->GetRate() << " s" << endl;
+            }
+            in_preroll = replay->InPreroll(replay_index);
+            if (segment) event.sample_index = static_cast<uint64_t>(replay->ToSource(replay_index)) * rate / replay->GetRate();
+        }
+        if (hotword_node && hotword_index >= 1 && in_preroll) {
+            preroll_hotwords++;
+            cout << "hotword during pre-roll at sample " << event.sample_index << ", not counted" << endl;
+        }
+        else if (hotword_node && hotword_index >= 1) {
+            hotword_count++;
+            event.count = hotword_count;
+            event.detect_ns = MonotonicNs();
+            latency_report.Add(event.LatencyMs());
+            cout << "hotword_count = " << hotword_count << ", " << event << endl;
+            if (event_log) event_log->Add(event);
+        }
+        if (log_sink) {
+            log_sink->Write(data);
+        }
+        map<string, size_t> depths;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            size_t depth = nodes[i].node->GetQueueDeepth();
+            depths[nodes[i].name] = depth;
+            nodes[i].high_water = max(nodes[i].high_water, depth);
+            if (nodes[i].max_queue > 0 && depth > nodes[i].max_queue && nodes[i].overruns++ == 0) {
+                cout << "warning: " << nodes[i].name << " queue at " << depth << ", above " << nodes[i].max_queue << endl;
+            }
+        }
+        tick++;
+        if (lock_memory && tick == steady_after_s * 1000 / block_size_ms) {
+            usage_report.MarkSteadyState();
+            cout << "steady state: counting page faults from here" << endl;
+        }
+        if (print_every > 0 && tick % print_every == 0) {
+            static const char *const kDepthFormats[] = {"", "{}: {}", "{}: {}, {}: {}", "{}: {}, {}: {}, {}: {}"};
+            LogArg args[AsyncLog::kMaxArgs];
+            size_t num_nodes = min<size_t>(nodes.size(), AsyncLog::kMaxArgs / 2);
+            for (size_t i = 0; i < num_nodes; i++) {
+                args[2 * i] = LogArg(nodes[i].name.c_str());
+                args[2 * i + 1] = LogArg(depths[nodes[i].name]);
+            }
+            async_log->Write(kLogInfo, MonotonicNs(), 0, kDepthFormats[num_nodes], args, 2 * num_nodes);
+        }
+        if (usage_seconds > 0 && tick % (usage_seconds * 1000 / block_size_ms) == 0) {
+            usage_report.Print(cout, depths);
+        }
+    }
+    async_log.reset();
+    if (usage_seconds > 0) {
+        usage_report.Print(cout);
+    }
+    if (hotword_node) latency_report.Print(cout);
+    if (lock_memory) usage_report.PrintFaults(cout);
+    cout << "stopping the respeaker worker thread..." << endl;
+    respeaker->Stop();
+    if (dump_feeder) {
+        cout << "dumps streamed: " << dump_feeder->GetFramesWritten() << " of " << dumps->GetNumFrames() << " frames" << endl;
+        dump_feeder.reset();
+    }
+    cout << "cleanup done." << endl;
+    cout << "hotwords: " << hotword_count << ", blocks: " << tick << endl;
+    if (health) {
+        cout << "health: " << health->GetWindows() << " windows";
+        for (size_t c = 0; c < num_channels; c++) {
+            uint32_t faults = health->GetActiveFaults(c);
+            for (uint32_t fault = 1; fault <= kHealthUncorrelated; fault <<= 1) {
+                if (faults & fault) cout << ", ch " << c << " " << HealthFaultName(fault);
+            }
+        }
+        cout << endl;
+    }
+    if (replay) {
+        cout << "replayed " << replay->GetSegments().size() << " window(s), " << preroll_hotwords
+             << " hotwords in pre-roll" << endl;
+        if (!keep_replay) unlink(replay_path.c_str());
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        cout << "  " << nodes[i].name << ": queue high-water " << nodes[i].high_water;
+        if (nodes[i].max_queue > 0) cout << ", " << nodes[i].overruns << " blocks above " << nodes[i].max_queue;
+        cout << endl;
+    }
+    if (log_sink) {
+        CloseAndReport(log_sink.get());
+    }
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef CHAIN_STAGE_H_
+#define CHAIN_STAGE_H_
+
+#include <string>
+
+#include "audio_block.h"
+
+namespace respeaker_ext {
+
+// A processing step that runs on blocks after they leave (or before they are
+// fed to) a librespeaker node chain. Stages are not thread-safe: an executor
+// guarantees that ProcessBlock() of one stage is never entered concurrently
+// and sees blocks in sequence order.
+class ChainStage {
+public:
+    virtual ~ChainStage() {}
+
+    virtual std::string Name() const = 0;
+
+    // Called once before the first block. Returns false if the stage can not
+    // handle the upstream format.
+    virtual bool Prepare(size_t num_channels, int rate, int block_size_ms) { return true; }
+
+    virtual size_t GetNumOutputChannels(size_t num_input_channels) const { return num_input_channels; }
+    virtual int GetOutputRate(int input_rate) const { return input_rate; }
+
+    // Whether ProcessBlock() accepts kFloat32Planar blocks. Stages that
+    // return false only ever see kInt16Interleaved.
+    virtual bool SupportsFloatPlanar() const { return false; }
+
+    // Processes the block in place. A stage may change block->num_channels
+    // (e.g. a beamformer) or block->rate (a resampler), in which case it must
+    // resize the payload to match. The output keeps the input's format.
+    virtual void ProcessBlock(AudioBlock *block) = 0;
+};
+
+// Produces blocks for the head of an in-process chain.
+class BlockSource {
+public:
+    virtual ~BlockSource() {}
+
+    // Fills the next block. Returns false when the source is exhausted.
+    virtual bool Read(AudioBlock *block) = 0;
+
+    virtual size_t GetNumChannels() const = 0;
+    virtual int GetRate() const = 0;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // CHAIN_STAGE_H_
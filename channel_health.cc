@@ -0,0 +1,310 @@
+#include <cstring>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "capture_clock.h"
+#include "channel_health.h"
+#include "hotword_clips.h"
+#include "interleaved_wav_reader.h"
+#include "work_stealing_pool.h"
+
+extern "C"
+{
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+
+static void help(const char *argv0) {
+    cout << "channel_health [options]" << endl;
+    cout << "Checks every mic of a recording for dead, weak, clipping, DC-offset, duplicated and uncorrelated" << endl;
+    cout << "channels, window by window, with the same code as the health stage of a live chain. Windows are" << endl;
+    cout << "worked out in parallel straight from the memory-mapped files." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=PATH                          A wav, or a directory of beamformer dumps (in_0..in_5, ref_in)," << endl;
+    cout << "                                           may be repeated; channels are numbered in order, default is anusha" << endl;
+    cout << "  -m, --mics=N                             The first N channels are the array, default is 6 for dumps" << endl;
+    cout << "                                           and 8-channel files (6 mics + 2 references), else all" << endl;
+    cout << "  -w, --window=MS                          Window length, default is 1000" << endl;
+    cout << "  -H, --hold=WINDOWS                       Windows a fault must hold to raise or clear an alert, default is 3" << endl;
+    cout << "  -o, --out=TSV_FILE                       Write every window's figures as a table" << endl;
+    cout << "  -j, --jobs=N                             Windows worked out in parallel, default is one per core" << endl;
+    cout << "  -s, --stream                             Also run the stage block by block as a chain would, report its CPU" << endl;
+    cout << "                                           per block and check it raises the same alerts" << endl;
+}
+
+static int64_t ThreadCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static string Clock(double seconds) {
+    ostringstream out;
+    out << setw(2) << setfill('0') << static_cast<int>(seconds / 60) << ":" << fixed << setprecision(1) << setw(4)
+        << fmod(seconds, 60.0);
+    return out.str();
+}
+
+static string FaultList(uint32_t faults) {
+    string list;
+    for (uint32_t fault = 1; fault <= kHealthUncorrelated; fault <<= 1) {
+        if (!(faults & fault)) continue;
+        if (!list.empty()) list += ",";
+        list += HealthFaultName(fault);
+    }
+    return list.empty() ? "-" : list;
+}
+
+static void PrintAlert(const HealthAlert &alert, int rate) {
+    cout << "  " << Clock(double(alert.frame) / rate) << "  ch " << alert.channel << "  "
+         << (alert.raised ? "raised " : "cleared") << "  " << setw(12) << left << HealthFaultName(alert.fault) << right
+         << " (" << alert.value << ")" << endl;
+}
+
+static bool SameAlerts(const vector<HealthAlert> &a, const vector<HealthAlert> &b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].channel != b[i].channel || a[i].fault != b[i].fault || a[i].raised != b[i].raised ||
+            a[i].frame != b[i].frame) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    vector<string> inputs;
+    string out_path;
+    int num_mics = -1;
+    size_t jobs = max(1u, thread::hardware_concurrency());
+    bool stream = false;
+    ChannelHealthOptions options;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"mics",         1, NULL, 'm'},
+        {"window",       1, NULL, 'w'},
+        {"hold",         1, NULL, 'H'},
+        {"out",          1, NULL, 'o'},
+        {"jobs",         1, NULL, 'j'},
+        {"stream",       0, NULL, 's'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:m:w:H:o:j:hs", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            inputs.push_back(string(optarg));
+            break;
+        case 'm':
+            num_mics = max(0, stoi(optarg));
+            break;
+        case 'w':
+            options.window_ms = max(BLOCK_SIZE_MS, stoi(optarg) / BLOCK_SIZE_MS * BLOCK_SIZE_MS);
+            break;
+        case 'H':
+            options.hold_windows = max(1, stoi(optarg));
+            break;
+        case 'o':
+            out_path = string(optarg);
+            break;
+        case 'j':
+            jobs = max(1, stoi(optarg));
+            break;
+        case 's':
+            stream = true;
+            break;
+        default:
+            return 0;
+        }
+    }
+    if (inputs.empty()) inputs.push_back("anusha");
+
+    // A dump directory stands for its per-channel files.
+    vector<string> paths;
+    bool dumps = false;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        struct stat st;
+        if (stat(inputs[i].c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            vector<string> layout = InterleavedWavReader::DumpLayout(inputs[i]);
+            for (size_t j = 0; j < layout.size(); j++) {
+                if (!layout[j].empty()) paths.push_back(layout[j]);
+            }
+            dumps = true;
+        }
+        else {
+            paths.push_back(inputs[i]);
+        }
+    }
+
+    // Channel ch of the recording is channel source_channel[ch] of wavs[source[ch]].
+    string error;
+    vector<unique_ptr<MappedWav>> wavs;
+    vector<size_t> source, source_channel;
+    int64_t num_frames = -1;
+    for (size_t i = 0; i < paths.size(); i++) {
+        wavs.push_back(unique_ptr<MappedWav>(MappedWav::Open(paths[i], &error)));
+        if (!wavs.back()) {
+            cout << "Error : " << error << endl;
+            return -1;
+        }
+        if (wavs.back()->GetRate() != wavs[0]->GetRate()) {
+            cout << "Error : " << paths[i] << " is not at the rate of " << paths[0] << endl;
+            return -1;
+        }
+        for (int ch = 0; ch < wavs.back()->GetNumChannels(); ch++) {
+            source.push_back(i);
+            source_channel.push_back(ch);
+        }
+        num_frames = num_frames < 0 ? wavs.back()->GetNumFrames() : min(num_frames, wavs.back()->GetNumFrames());
+    }
+    size_t num_channels = source.size();
+    // Dumps and 8-channel captures are the 6-mic collector's layout, the
+    // mics then the playback references, which must not count as mics.
+    options.num_mics = num_mics >= 0 ? num_mics : (dumps || num_channels == 8 ? 6 : 0);
+    int rate = wavs[0]->GetRate();
+    size_t block_frames = static_cast<size_t>(rate) * BLOCK_SIZE_MS / 1000;
+    size_t window_frames = static_cast<size_t>(rate) * options.window_ms / 1000;
+    size_t num_windows = num_frames / window_frames;
+    if (num_windows == 0) {
+        cout << "Error : the recording is shorter than one window" << endl;
+        return -1;
+    }
+    size_t mics = options.num_mics ? min<size_t>(options.num_mics, num_channels) : num_channels;
+    cout << num_channels << " ch at " << rate << " Hz, " << double(num_frames) / rate << " s, mics are ch 0-"
+         << mics - 1 << endl;
+
+    // One task per window, each with its own sums, fed in blocks the size a
+    // chain would see so the figures match the stage's to the bit. Every
+    // window also goes into a running total for the whole recording.
+    vector<HealthAccumulator> windows(num_windows + 1);
+    vector<HealthReport> reports(num_windows);
+    int64_t start_ns = MonotonicNs();
+    {
+        WorkStealingPool pool(jobs);
+        for (size_t w = 0; w <= num_windows; w++) {
+            pool.Submit([&, w] {
+                vector<float> planar(num_channels * block_frames);
+                HealthAccumulator &sums = windows[w];
+                sums.Reset(num_channels, options.num_mics);
+                size_t begin = w * window_frames;
+                size_t end = w < num_windows ? begin + window_frames : num_frames;
+                for (size_t frame = begin; frame < end; frame += block_frames) {
+                    size_t frames = min(block_frames, end - frame);
+                    for (size_t ch = 0; ch < num_channels; ch++) {
+                        const MappedWav &wav = *wavs[source[ch]];
+                        simd::DeinterleaveToFloat(wav.Frames() + frame * wav.GetNumChannels(), wav.GetNumChannels(),
+                                                  source_channel[ch], frames, 1.0f / 32768, &planar[ch * frames]);
+                    }
+                    sums.Add(&planar[0], frames, options.clip_level);
+                }
+                if (w == num_windows) return;    // the tail only counts in the total
+                reports[w].rate = rate;
+                reports[w].begin_frame = begin;
+                sums.Evaluate(options, &reports[w]);
+            });
+        }
+    }    // the pool drains before it is destroyed
+    double elapsed_ms = (MonotonicNs() - start_ns) / 1e6;
+    cout << num_windows << " windows of " << options.window_ms << " ms on " << jobs << " threads in " << elapsed_ms
+         << " ms, " << double(num_frames) / rate * 1000 / elapsed_ms << "x real time" << endl;
+
+    HealthAlarms alarms;
+    alarms.Reset(num_channels, options.hold_windows);
+    vector<HealthAlert> alerts;
+    for (size_t w = 0; w < num_windows; w++) alarms.Update(reports[w], &alerts);
+    cout << "alerts (hold " << options.hold_windows << " windows):" << endl;
+    for (size_t i = 0; i < alerts.size(); i++) PrintAlert(alerts[i], rate);
+    if (alerts.empty()) cout << "  none" << endl;
+
+    HealthAccumulator total = windows[0];
+    for (size_t w = 1; w < windows.size(); w++) total.Merge(windows[w]);
+    HealthReport whole;
+    total.Evaluate(options, &whole);
+    cout << "whole recording, median mic " << fixed << setprecision(1) << whole.median_mic_dbfs << " dBFS:" << endl;
+    cout << setw(4) << "ch" << setw(10) << "rms dBFS" << setw(11) << "peak dBFS" << setw(9) << "dc %" << setw(9)
+         << "clip %" << setw(8) << "corr" << setw(6) << "with" << "  faults (whole / still raised)" << endl;
+    for (size_t ch = 0; ch < num_channels; ch++) {
+        const ChannelHealth &health = whole.channels[ch];
+        cout << setw(4) << ch << setw(10) << health.rms_dbfs << setw(11) << health.peak_dbfs << setw(9) << setprecision(3)
+             << 100 * health.dc << setw(9) << 100 * health.clip_ratio << setw(8) << health.correlation << setw(6);
+        if (health.partner >= 0) cout << health.partner;
+        else cout << "-";
+        cout << setprecision(1) << "  " << FaultList(health.faults) << " / " << FaultList(alarms.GetActive(ch)) << endl;
+    }
+    cout << "mic correlation:" << endl << setprecision(3);
+    for (size_t a = 0; a < whole.num_mics; a++) {
+        cout << setw(4) << a;
+        for (size_t b = 0; b < whole.num_mics; b++) cout << setw(7) << whole.Correlation(a, b);
+        cout << endl;
+    }
+    cout << setprecision(1);
+
+    if (!out_path.empty()) {
+        ofstream out(out_path.c_str());
+        out << "# window\tseconds\tchannel\trms_dbfs\tpeak_dbfs\tdc\tclip_ratio\tcorrelation\tpartner\tfaults" << endl;
+        out << setprecision(6) << defaultfloat;
+        for (size_t w = 0; w < num_windows; w++) {
+            for (size_t ch = 0; ch < num_channels; ch++) {
+                const ChannelHealth &health = reports[w].channels[ch];
+                out << w << "\t" << double(reports[w].begin_frame) / rate << "\t" << ch << "\t" << health.rms_dbfs
+                    << "\t" << health.peak_dbfs << "\t" << health.dc << "\t" << health.clip_ratio << "\t"
+                    << health.correlation << "\t" << health.partner << "\t" << FaultList(health.faults) << endl;
+            }
+        }
+        cout << "windows written to " << out_path << endl;
+    }
+
+    if (!stream) return 0;
+
+    // The live path: blocks through the stage one at a time on this thread.
+    unique_ptr<InterleavedWavReader> reader(InterleavedWavReader::Create(paths, BLOCK_SIZE_MS, false, &error));
+    unique_ptr<ChannelHealthStage> stage(ChannelHealthStage::Create(options));
+    if (!reader || !stage || !stage->Prepare(num_channels, rate, BLOCK_SIZE_MS)) {
+        cout << "Error : " << (reader ? "can not prepare the health stage" : error) << endl;
+        return -1;
+    }
+    vector<HealthAlert> stream_alerts;
+    stage->SetAlertCallback([&stream_alerts](const HealthAlert &alert, const HealthReport &) {
+        stream_alerts.push_back(alert);
+    });
+    AudioBlock block;
+    int64_t cpu_ns = 0;
+    size_t blocks = 0;
+    while (reader->Read(&block)) {
+        int64_t before = ThreadCpuNs();
+        stage->ProcessBlock(&block);
+        cpu_ns += ThreadCpuNs() - before;
+        blocks++;
+    }
+    double block_us = cpu_ns / 1e3 / max<size_t>(blocks, 1);
+    cout << "stage: " << setprecision(2) << block_us << " us CPU per " << BLOCK_SIZE_MS << " ms block ("
+         << setprecision(3) << block_us / (BLOCK_SIZE_MS * 10.0) << "% of a core), " << stage->GetWindows()
+         << " windows, alerts " << (SameAlerts(alerts, stream_alerts) ? "match" : "DIFFER from") << " the parallel run"
+         << endl;
+    return SameAlerts(alerts, stream_alerts) ? 0 : 1;
+}
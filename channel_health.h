@@ -0,0 +1,360 @@
+#ifndef CHANNEL_HEALTH_H_
+#define CHANNEL_HEALTH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "chain_stage.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+enum HealthFault {
+    kHealthDead = 1,            // a mic at (near) digital silence
+    kHealthWeak = 2,            // a mic far below the other mics
+    kHealthClipping = 4,
+    kHealthDc = 8,
+    kHealthDuplicate = 16,      // a mic that is a copy of another one
+    kHealthUncorrelated = 32,   // a mic that does not hear what the others hear
+};
+
+inline const char *HealthFaultName(uint32_t fault) {
+    switch (fault) {
+    case kHealthDead: return "dead";
+    case kHealthWeak: return "weak";
+    case kHealthClipping: return "clipping";
+    case kHealthDc: return "dc offset";
+    case kHealthDuplicate: return "duplicate";
+    case kHealthUncorrelated: return "uncorrelated";
+    default: return "?";
+    }
+}
+
+// Thresholds, all taken per window. The first num_mics channels are the
+// array; the channels after them (reference, padding) are only checked for
+// clipping and DC, since silence or a different signal is normal there.
+struct ChannelHealthOptions {
+    size_t num_mics = 0;            // 0 = every channel is a mic
+    int window_ms = 1000;
+    int hold_windows = 3;           // windows a fault must hold, or be gone, to raise or clear it
+    float clip_level = 0.999f;      // of full scale
+    float clip_ratio = 1e-3f;       // of the window's samples
+    float dc_limit = 0.02f;         // of full scale, about -34 dBFS
+    float dead_dbfs = -80.0f;
+    float weak_margin_db = 20.0f;   // below the median mic
+    float duplicate_correlation = 0.9999f;
+    float min_correlation = 0.3f;
+    float active_dbfs = -50.0f;     // median mic level needed to judge correlation
+};
+
+// Per-channel figures of one window; levels are dB relative to full scale.
+struct ChannelHealth {
+    double rms_dbfs = -200;     // DC removed
+    double peak_dbfs = -200;
+    double dc = 0;
+    double clip_ratio = 0;
+    double correlation = 0;     // highest with another mic, 0 for non-mics
+    int partner = -1;           // the mic it is highest with
+    uint32_t faults = 0;        // HealthFault bits seen in this window
+};
+
+struct HealthReport {
+    uint64_t begin_frame = 0;
+    uint64_t frames = 0;
+    int rate = 0;
+    double median_mic_dbfs = -200;
+    std::vector<ChannelHealth> channels;
+    std::vector<double> correlation;    // num_mics x num_mics, row-major
+    size_t num_mics = 0;
+
+    double Correlation(size_t a, size_t b) const { return correlation[a * num_mics + b]; }
+};
+
+// A fault raised or cleared on a channel.
+struct HealthAlert {
+    int channel = 0;
+    uint32_t fault = 0;
+    bool raised = false;
+    uint64_t frame = 0;         // first frame of the window that decided it
+    double value = 0;           // the figure the fault is judged on
+};
+
+// Sums over a window of float planar audio. Everything is a sum or a
+// maximum, so windows cut into pieces and accumulated apart (on different
+// threads, say) merge into exactly what one pass would have given.
+class HealthAccumulator {
+public:
+    void Reset(size_t num_channels, size_t num_mics) {
+        channels_.assign(num_channels, Sums());
+        num_mics_ = std::min(num_mics ? num_mics : num_channels, num_channels);
+        cross_.assign(num_mics_ * num_mics_, 0.0);
+        frames_ = 0;
+    }
+
+    // planar holds num_channels runs of frames floats, the layout of a
+    // kFloat32Planar AudioBlock.
+    void Add(const float *planar, size_t frames, float clip_level) {
+        for (size_t c = 0; c < channels_.size(); c++) {
+            const float *x = planar + c * frames;
+            Sums &sums = channels_[c];
+            float sum = 0, sum_sq = 0;
+            simd::Moments(x, frames, clip_level, &sum, &sum_sq, &sums.peak, &sums.clipped);
+            sums.sum += sum;
+            sums.sum_sq += sum_sq;
+            for (size_t d = c + 1; d < num_mics_ && c < num_mics_; d++) {
+                cross_[c * num_mics_ + d] += simd::Dot(x, planar + d * frames, frames);
+            }
+        }
+        frames_ += frames;
+    }
+
+    void Merge(const HealthAccumulator &other) {
+        for (size_t c = 0; c < channels_.size(); c++) {
+            channels_[c].sum += other.channels_[c].sum;
+            channels_[c].sum_sq += other.channels_[c].sum_sq;
+            channels_[c].peak = std::max(channels_[c].peak, other.channels_[c].peak);
+            channels_[c].clipped += other.channels_[c].clipped;
+        }
+        for (size_t i = 0; i < cross_.size(); i++) cross_[i] += other.cross_[i];
+        frames_ += other.frames_;
+    }
+
+    // Fills report (sized on first use, reused after) with the window's
+    // figures and the faults they show.
+    void Evaluate(const ChannelHealthOptions &options, HealthReport *report) const {
+        size_t num_channels = channels_.size();
+        report->channels.resize(num_channels);
+        report->num_mics = num_mics_;
+        report->correlation.resize(num_mics_ * num_mics_);
+        report->frames = frames_;
+        double n = std::max<uint64_t>(frames_, 1);
+        for (size_t c = 0; c < num_channels; c++) {
+            const Sums &sums = channels_[c];
+            ChannelHealth &health = report->channels[c];
+            health.dc = sums.sum / n;
+            health.rms_dbfs = Dbfs(std::sqrt(Variance(c)));
+            health.peak_dbfs = Dbfs(sums.peak);
+            health.clip_ratio = sums.clipped / n;
+            health.correlation = 0;
+            health.partner = -1;
+            health.faults = 0;
+            if (health.clip_ratio >= options.clip_ratio) health.faults |= kHealthClipping;
+            if (std::fabs(health.dc) >= options.dc_limit) health.faults |= kHealthDc;
+        }
+        if (num_mics_ == 0) return;
+
+        for (size_t a = 0; a < num_mics_; a++) {
+            report->correlation[a * num_mics_ + a] = 1;
+            for (size_t b = a + 1; b < num_mics_; b++) {
+                double covariance = cross_[a * num_mics_ + b] / n - report->channels[a].dc * report->channels[b].dc;
+                double scale = std::sqrt(Variance(a) * Variance(b));
+                double r = scale > 1e-20 ? covariance / scale : 0;
+                report->correlation[a * num_mics_ + b] = report->correlation[b * num_mics_ + a] = r;
+            }
+        }
+        levels_.resize(num_mics_);
+        for (size_t c = 0; c < num_mics_; c++) levels_[c] = report->channels[c].rms_dbfs;
+        std::nth_element(levels_.begin(), levels_.begin() + num_mics_ / 2, levels_.end());
+        report->median_mic_dbfs = levels_[num_mics_ / 2];
+        for (size_t c = 0; c < num_mics_; c++) {
+            ChannelHealth &health = report->channels[c];
+            for (size_t d = 0; d < num_mics_; d++) {
+                if (d != c && (health.partner < 0 || report->Correlation(c, d) > health.correlation)) {
+                    health.correlation = report->Correlation(c, d);
+                    health.partner = d;
+                }
+            }
+            bool dead = health.rms_dbfs < options.dead_dbfs;
+            if (dead) health.faults |= kHealthDead;
+            else if (report->median_mic_dbfs - health.rms_dbfs > options.weak_margin_db) health.faults |= kHealthWeak;
+            if (num_mics_ < 2 || dead) continue;
+            if (health.correlation >= options.duplicate_correlation) health.faults |= kHealthDuplicate;
+            if (report->median_mic_dbfs >= options.active_dbfs && health.correlation < options.min_correlation) {
+                health.faults |= kHealthUncorrelated;
+            }
+        }
+    }
+
+    uint64_t GetFrames() const { return frames_; }
+
+private:
+    struct Sums {
+        double sum = 0, sum_sq = 0;
+        float peak = 0;
+        uint32_t clipped = 0;
+    };
+
+    double Variance(size_t c) const {
+        double n = std::max<uint64_t>(frames_, 1), mean = channels_[c].sum / n;
+        return std::max(0.0, channels_[c].sum_sq / n - mean * mean);
+    }
+
+    static double Dbfs(double level) { return level > 1e-10 ? 20 * std::log10(level) : -200; }
+
+    std::vector<Sums> channels_;
+    std::vector<double> cross_;    // upper triangle of the mics' products
+    size_t num_mics_ = 0;
+    uint64_t frames_ = 0;
+    mutable std::vector<double> levels_;
+};
+
+// Turns per-window faults into alerts: a fault is raised once it was seen
+// hold_windows windows in a row and cleared once it was absent as long, so a
+// single loud click or a pause in speech does not flap.
+class HealthAlarms {
+public:
+    void Reset(size_t num_channels, int hold_windows) {
+        hold_ = std::max(1, hold_windows);
+        state_.assign(num_channels, Channel());
+    }
+
+    // Appends what changed in this window to alerts.
+    void Update(const HealthReport &report, std::vector<HealthAlert> *alerts) {
+        for (size_t c = 0; c < state_.size() && c < report.channels.size(); c++) {
+            const ChannelHealth &health = report.channels[c];
+            Channel &channel = state_[c];
+            for (int bit = 0; bit < kNumFaults; bit++) {
+                uint32_t fault = 1u << bit;
+                bool seen = (health.faults & fault) != 0, active = (channel.active & fault) != 0;
+                channel.streak[bit] = seen == active ? 0 : channel.streak[bit] + 1;
+                if (channel.streak[bit] < hold_) continue;
+                channel.streak[bit] = 0;
+                channel.active ^= fault;
+                HealthAlert alert;
+                alert.channel = c;
+                alert.fault = fault;
+                alert.raised = seen;
+                alert.frame = report.begin_frame;
+                alert.value = Value(health, fault);
+                alerts->push_back(alert);
+            }
+        }
+    }
+
+    uint32_t GetActive(size_t channel) const { return state_[channel].active; }
+
+    // The figure a fault is judged on: dBFS for levels, a ratio otherwise.
+    static double Value(const ChannelHealth &health, uint32_t fault) {
+        switch (fault) {
+        case kHealthDead:
+        case kHealthWeak: return health.rms_dbfs;
+        case kHealthClipping: return health.clip_ratio;
+        case kHealthDc: return health.dc;
+        default: return health.correlation;
+        }
+    }
+
+private:
+    static const int kNumFaults = 6;
+
+    struct Channel {
+        uint32_t active = 0;
+        int streak[kNumFaults] = {0};
+    };
+
+    int hold_ = 1;
+    std::vector<Channel> state_;
+};
+
+// Watches every channel going through it and leaves the audio untouched. Per
+// block it adds the samples into the window's sums (a few SIMD passes per
+// channel, plus one dot product per mic pair); per window it works out the
+// levels and correlations, updates the alarms and publishes the report.
+// Alerts go to the callback on the stage's thread, so it must be cheap and
+// must not block, e.g. an AsyncLog call. Other threads read the latest
+// report with GetReport(); the stage only ever try-locks to publish it.
+class ChannelHealthStage : public ChainStage {
+public:
+    typedef std::function<void(const HealthAlert &, const HealthReport &)> AlertCallback;
+
+    static ChannelHealthStage *Create(const ChannelHealthOptions &options = ChannelHealthOptions()) {
+        if (options.window_ms <= 0) return nullptr;
+        return new ChannelHealthStage(options);
+    }
+
+    std::string Name() const override { return "health"; }
+    bool SupportsFloatPlanar() const override { return true; }
+
+    // Set before the first block.
+    void SetAlertCallback(AlertCallback callback) { callback_ = callback; }
+
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override {
+        window_frames_ = static_cast<uint64_t>(rate) * options_.window_ms / 1000;
+        accumulator_.Reset(num_channels, options_.num_mics);
+        alarms_.Reset(num_channels, options_.hold_windows);
+        report_.rate = rate;
+        accumulator_.Evaluate(options_, &report_);    // sizes the report
+        alerts_.reserve(num_channels * 6);
+        scratch_.resize(num_channels * (static_cast<size_t>(rate) * block_size_ms / 1000));
+        window_begin_ = 0;
+        windows_ = 0;
+        return window_frames_ > 0;
+    }
+
+    void ProcessBlock(AudioBlock *block) override {
+        size_t frames = block->NumFrames();
+        if (frames == 0) return;
+        if (accumulator_.GetFrames() == 0) window_begin_ = block->sample_index;
+        if (block->format == kFloat32Planar) {
+            accumulator_.Add(&block->planar[0], frames, options_.clip_level);
+        }
+        else {
+            scratch_.resize(frames * block->num_channels);
+            for (size_t c = 0; c < block->num_channels; c++) {
+                simd::DeinterleaveToFloat(block->Samples(), block->num_channels, c, frames, 1.0f / 32768,
+                                          &scratch_[c * frames]);
+            }
+            accumulator_.Add(&scratch_[0], frames, options_.clip_level);
+        }
+        if (accumulator_.GetFrames() >= window_frames_) CloseWindow();
+    }
+
+    // The report of the last whole window. False before the first one.
+    bool GetReport(HealthReport *report) const {
+        std::lock_guard<std::mutex> guard(published_lock_);
+        if (published_.channels.empty()) return false;
+        *report = published_;
+        return true;
+    }
+
+    uint32_t GetActiveFaults(size_t channel) const { return alarms_.GetActive(channel); }
+    uint64_t GetWindows() const { return windows_; }
+
+private:
+    explicit ChannelHealthStage(const ChannelHealthOptions &options)
+        : options_(options), window_frames_(0), window_begin_(0), windows_(0) {}
+
+    void CloseWindow() {
+        accumulator_.Evaluate(options_, &report_);
+        report_.begin_frame = window_begin_;
+        alerts_.clear();
+        alarms_.Update(report_, &alerts_);
+        for (size_t i = 0; i < alerts_.size() && callback_; i++) callback_(alerts_[i], report_);
+        {
+            // Same sizes every window, so the copy does not allocate.
+            std::unique_lock<std::mutex> lock(published_lock_, std::try_to_lock);
+            if (lock.owns_lock()) published_ = report_;
+        }
+        accumulator_.Reset(report_.channels.size(), options_.num_mics);
+        windows_++;
+    }
+
+    ChannelHealthOptions options_;
+    uint64_t window_frames_, window_begin_, windows_;
+    HealthAccumulator accumulator_;
+    HealthAlarms alarms_;
+    HealthReport report_;
+    std::vector<HealthAlert> alerts_;
+    std::vector<float> scratch_;
+    AlertCallback callback_;
+    mutable std::mutex published_lock_;
+    HealthReport published_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // CHANNEL_HEALTH_H_
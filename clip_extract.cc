@@ -0,0 +1,173 @@
+#include <cstring>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "capture_clock.h"
+#include "hotword_clips.h"
+#include "work_stealing_pool.h"
+
+extern "C"
+{
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+
+using namespace std;
+using namespace respeaker_ext;
+
+static void help(const char *argv0) {
+    cout << "clip_extract [options]" << endl;
+    cout << "Cuts a labelled clip around every detection out of each capture file, for false-accept and" << endl;
+    cout << "false-reject review sets. Files are memory-mapped and only the clips are read." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -e, --events=EVENTS_FILE                 The detections: a .events.tsv a session wrote, or its console log" << endl;
+    cout << "  -f, --file=WAV_FILE                      A 16-bit wav to cut from, may be repeated (e.g. the output log and" << endl;
+    cout << "                                           the beamformer's input dump), default is audio_test001.wav" << endl;
+    cout << "  -b, --before=SECONDS                     Context before each detection, default is 2" << endl;
+    cout << "  -a, --after=SECONDS                      Context after each detection, default is 1" << endl;
+    cout << "  -o, --out=DIR                            Where the clips go, default is clips" << endl;
+    cout << "  -l, --label=LABEL                        Clip name prefix and review label, default is hit" << endl;
+    cout << "  -j, --jobs=N                             Clips cut in parallel, default is one per core" << endl;
+}
+
+static string Stem(const string &path) {
+    size_t slash = path.rfind('/');
+    string name = slash == string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.rfind('.');
+    return dot == string::npos ? name : name.substr(0, dot);
+}
+
+int main(int argc, char *argv[]) {
+    // parse opts
+    int c;
+    string events_path, out_dir = "clips", label = "hit";
+    vector<string> files;
+    double before_s = 2.0, after_s = 1.0;
+    size_t jobs = max(1u, thread::hardware_concurrency());
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"events",       1, NULL, 'e'},
+        {"file",         1, NULL, 'f'},
+        {"before",       1, NULL, 'b'},
+        {"after",        1, NULL, 'a'},
+        {"out",          1, NULL, 'o'},
+        {"label",        1, NULL, 'l'},
+        {"jobs",         1, NULL, 'j'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "e:f:b:a:o:l:j:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'e':
+            events_path = string(optarg);
+            break;
+        case 'f':
+            files.push_back(string(optarg));
+            break;
+        case 'b':
+            before_s = stod(optarg);
+            break;
+        case 'a':
+            after_s = stod(optarg);
+            break;
+        case 'o':
+            out_dir = string(optarg);
+            break;
+        case 'l':
+            label = string(optarg);
+            break;
+        case 'j':
+            jobs = max(1, stoi(optarg));
+            break;
+        default:
+            return 0;
+        }
+    }
+    if (files.empty()) files.push_back("audio_test001.wav");
+
+    string error;
+    vector<HotwordMark> marks;
+    if (events_path.empty() || !HotwordEventLog::Load(events_path, &marks, &error)) {
+        cout << "Error : " << (events_path.empty() ? "no events file, see -e" : error) << endl;
+        return -1;
+    }
+    vector<unique_ptr<MappedWav>> wavs;
+    for (size_t i = 0; i < files.size(); i++) {
+        wavs.push_back(unique_ptr<MappedWav>(MappedWav::Open(files[i], &error)));
+        if (!wavs.back()) {
+            cout << "Error : " << error << endl;
+            return -1;
+        }
+        cout << files[i] << ": " << wavs.back()->GetNumChannels() << " ch, " << wavs.back()->GetRate() << " Hz, "
+             << double(wavs.back()->GetNumFrames()) / wavs.back()->GetRate() << " s" << endl;
+    }
+    if (mkdir(out_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        cout << "Error : can not create " << out_dir << endl;
+        return -1;
+    }
+
+    // One task per clip. Events are in seconds so files of any rate line up,
+    // as long as they start at the same capture sample.
+    vector<string> clip_paths(marks.size() * wavs.size());
+    vector<int64_t> clip_frames(clip_paths.size());
+    atomic<int> failed(0), skipped(0);
+    int64_t start_ns = MonotonicNs();
+    {
+        WorkStealingPool pool(jobs);
+        for (size_t m = 0; m < marks.size(); m++) {
+            for (size_t f = 0; f < wavs.size(); f++) {
+                size_t index = m * wavs.size() + f;
+                // The input's index keeps apart files of the same name
+                // from different directories.
+                ostringstream name;
+                name << out_dir << "/" << label << "_" << setw(3) << setfill('0') << marks[m].count << "_" << f << "_"
+                     << Stem(files[f]) << ".wav";
+                clip_paths[index] = name.str();
+                pool.Submit([&, m, f, index] {
+                    const MappedWav &wav = *wavs[f];
+                    int64_t begin = static_cast<int64_t>((marks[m].seconds - before_s) * wav.GetRate());
+                    int64_t end = static_cast<int64_t>((marks[m].seconds + after_s) * wav.GetRate());
+                    clip_frames[index] = wav.WriteClip(begin, end - max<int64_t>(0, begin), clip_paths[index]);
+                    if (clip_frames[index] < 0) failed++;
+                    else if (clip_frames[index] == 0) skipped++;
+                });
+            }
+        }
+    }    // the pool drains before it is destroyed
+    double elapsed_ms = (MonotonicNs() - start_ns) / 1e6;
+
+    // The review index: one row per clip, with an empty verdict column. A
+    // mark outside a file, or a clip that failed, gives no row.
+    string index_path = out_dir + "/" + label + ".tsv";
+    ofstream index(index_path.c_str());
+    index << "# clip\tlabel\tcount\tseconds\tbeam\tsource\tframes\tverdict" << endl;
+    for (size_t i = 0; i < clip_paths.size(); i++) {
+        const HotwordMark &mark = marks[i / wavs.size()];
+        if (clip_frames[i] < 0) {
+            cout << "Error : can not write " << clip_paths[i] << endl;
+            continue;
+        }
+        if (clip_frames[i] == 0) {
+            cout << "warning: detection " << mark.count << " at " << mark.seconds << " s is outside "
+                 << files[i % wavs.size()] << ", no clip" << endl;
+            continue;
+        }
+        index << clip_paths[i] << "\t" << label << "\t" << mark.count << "\t" << mark.seconds << "\t" << mark.beam
+              << "\t" << files[i % wavs.size()] << "\t" << clip_frames[i] << "\t" << endl;
+    }
+    cout << marks.size() << " detections, " << clip_paths.size() - failed - skipped << " clips in " << elapsed_ms << " ms on "
+         << jobs << " threads, index: " << index_path << endl;
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,124 @@
+#ifndef CONTROL_SOCKET_H_
+#define CONTROL_SOCKET_H_
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "rt_check.h"
+
+extern "C"
+{
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+namespace respeaker_ext {
+
+// A line-oriented command server on a Unix stream socket, for poking a
+// running demo without restarting it:
+//
+//   echo "sensitivity 0.6" | socat - UNIX-CONNECT:/tmp/kws.sock
+//
+// Each line is "<command> [argument]"; the handler's return string is sent
+// back followed by a newline. Handlers run on the socket's own thread, never
+// on the audio thread, so they may block (e.g. wait for a file to load).
+class ControlSocket {
+public:
+    typedef std::function<std::string(const std::string &argument)> Handler;
+
+    static ControlSocket *Create(const std::string &path) {
+        if (path.empty() || path.size() >= sizeof(sockaddr_un().sun_path)) return nullptr;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return nullptr;
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+            close(fd);
+            return nullptr;
+        }
+        return new ControlSocket(path, fd);
+    }
+
+    ~ControlSocket() {
+        stop_ = true;
+        if (thread_.joinable()) thread_.join();
+        close(fd_);
+        unlink(path_.c_str());
+    }
+
+    // Handlers must all be added before Start().
+    void AddHandler(const std::string &command, Handler handler) { handlers_[command] = handler; }
+
+    void Start() { thread_ = std::thread(&ControlSocket::Loop, this); }
+
+    const std::string &GetPath() const { return path_; }
+
+private:
+    ControlSocket(const std::string &path, int fd) : path_(path), fd_(fd), stop_(false) {}
+
+    std::string Dispatch(const std::string &line) {
+        std::istringstream in(line);
+        std::string command, argument;
+        in >> command;
+        std::getline(in >> std::ws, argument);
+        if (command == "help") {
+            std::string names;
+            for (auto it = handlers_.begin(); it != handlers_.end(); ++it) names += (names.empty() ? "" : " ") + it->first;
+            return "commands: " + names;
+        }
+        auto it = handlers_.find(command);
+        if (it == handlers_.end()) return "error unknown command '" + command + "', try help";
+        return it->second(argument);
+    }
+
+    // One client at a time; a client may send any number of lines.
+    void Loop() {
+        RtCheck::Exempt();
+        while (!stop_) {
+            pollfd p = {fd_, POLLIN, 0};
+            if (poll(&p, 1, 200) <= 0) continue;
+            int client = accept4(fd_, NULL, NULL, SOCK_CLOEXEC);
+            if (client < 0) continue;
+            std::string pending;
+            char buf[256];
+            while (!stop_) {
+                pollfd q = {client, POLLIN, 0};
+                int r = poll(&q, 1, 200);
+                if (r == 0) continue;
+                ssize_t n = r > 0 ? read(client, buf, sizeof(buf)) : -1;
+                if (n <= 0) break;
+                pending.append(buf, n);
+                size_t eol;
+                while ((eol = pending.find('\n')) != std::string::npos) {
+                    std::string line = pending.substr(0, eol);
+                    pending.erase(0, eol + 1);
+                    if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+                    if (line.empty()) continue;
+                    std::string reply = Dispatch(line) + "\n";
+                    if (send(client, reply.data(), reply.size(), MSG_NOSIGNAL) < 0) break;
+                }
+            }
+            close(client);
+        }
+    }
+
+    std::string path_;
+    int fd_;
+    std::atomic<bool> stop_;
+    std::map<std::string, Handler> handlers_;
+    std::thread thread_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // CONTROL_SOCKET_H_
@@ -0,0 +1,295 @@
+#ifndef DELAY_SUM_BEAMFORMER_H_
+#define DELAY_SUM_BEAMFORMER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "chain_stage.h"
+#include "mic_geometry.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+// Array shapes the delay-and-sum beamformer is compiled for. kNumMics and
+// kTaps are compile-time so the per-mic and per-tap loops unroll; kTaps must
+// cover the largest inter-mic delay at 16k plus the filter's own support.
+struct Circular6MicArray {
+    enum { kNumMics = 6, kTaps = 16 };
+    static const char *MicType() { return "CIRCULAR_6MIC_7BEAM"; }
+};
+
+struct Linear6MicArray {
+    enum { kNumMics = 6, kTaps = 24 };
+    static const char *MicType() { return "LINEAR_6MIC_8BEAM"; }
+};
+
+struct Circular4MicArray {
+    enum { kNumMics = 4, kTaps = 16 };
+    static const char *MicType() { return "CIRCULAR_4MIC_9BEAM"; }
+};
+
+struct Linear4MicArray {
+    enum { kNumMics = 4, kTaps = 16 };
+    static const char *MicType() { return "LINEAR_4MIC_1BEAM"; }
+};
+
+// The part of DelaySumBeamformerStage that does not depend on the array, so
+// callers can hold any instantiation.
+class DelaySumBeamformer : public ChainStage {
+public:
+    enum IdleMode {
+        // Every beam on every block; no gating.
+        kIdleAllBeams,
+        // The mic-average beam copied to every output.
+        kIdleOneBeam,
+        // Zeros on every output.
+        kIdleSilent,
+    };
+
+    // Outside kIdleAllBeams, a block counts as active when the mic average is
+    // margin_db above its noise floor, and all beams stay on for hold_ms after
+    // the last active block or direction change.
+    virtual void SetActivityGating(IdleMode idle_mode, float margin_db = 6.0f, int hold_ms = 500) = 0;
+
+    // Expands to all beams for hold_ms, e.g. from a GccPhatDoaStage callback
+    // when the direction moves. Safe to call from any thread.
+    virtual void NotifyDirectionChange() = 0;
+
+    virtual const std::vector<float> &GetBeamAngles() const = 0;
+
+    // Whether the last block ran every beam, and how many blocks did.
+    virtual bool IsExpanded() const = 0;
+    virtual uint64_t GetNumFullBlocks() const = 0;
+    virtual uint64_t GetNumIdleBlocks() const = 0;
+};
+
+// A fixed-beam filter-and-sum beamformer, for a chain that needs beams cheaply
+// and can do without AEC, noise suppression and adaptive nulling. It is not a
+// replacement for VepAecBeamformingNode: on the recordings in this repo its
+// best beam is about 8 dB under VEP's output SNR. Each beam steers a far-field
+// plane wave from its angle: every mic goes through a windowed-sinc
+// fractional-delay filter that lines it up with the array center, and the
+// filtered mics are averaged. The first kNumMics input channels are the mics
+// in MicGeometry order; further channels (the playback references) are
+// dropped. The output has one channel per beam, like VepAecBeamformingNode
+// with single-beam output off, and is delayed by (kTaps - 1) / 2 samples.
+//
+// With SetActivityGating() the full beam set only runs while someone may be
+// speaking. In silence the stage runs one cheap beam (the mic average, the
+// array's broadside beam) and copies it to every output, or outputs silence.
+// Voice activity on the mic average or a NotifyDirectionChange() switches back
+// to all beams at the next block boundary. Every beam filters the same shared mic
+// history, so a beam that comes back produces exactly the samples it would
+// have produced had it run all along, and the idle beam has the same delay.
+template <typename Array>
+class DelaySumBeamformerStage : public DelaySumBeamformer {
+public:
+    static const size_t kNumMics = Array::kNumMics;
+    static const size_t kTaps = Array::kTaps;
+
+    // beam_angles in degrees, in the convention of MicGeometry.
+    static DelaySumBeamformerStage *Create(const std::vector<float> &beam_angles, float mic0_angle = 0) {
+        MicGeometry geometry;
+        if (beam_angles.empty() || !MicGeometry::FromMicType(Array::MicType(), mic0_angle, &geometry)) return nullptr;
+        return new DelaySumBeamformerStage(geometry, beam_angles);
+    }
+
+    std::string Name() const override { return "delay_sum"; }
+    bool SupportsFloatPlanar() const override { return true; }
+    size_t GetNumOutputChannels(size_t num_input_channels) const override { return beam_angles_.size(); }
+
+    void SetActivityGating(IdleMode idle_mode, float margin_db, int hold_ms) override {
+        idle_mode_ = idle_mode;
+        margin_db_ = margin_db;
+        hold_ms_ = hold_ms;
+    }
+
+    void NotifyDirectionChange() override { direction_changed_.store(true, std::memory_order_relaxed); }
+
+    // Fails when the array is too wide for kTaps at this rate.
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override {
+        if (num_channels < kNumMics || rate <= 0) return false;
+        rate_ = rate;
+        const float kSpeedOfSound = 343.0f;
+        float center = (kTaps - 1) / 2.0f;
+        coeffs_.assign(beam_angles_.size() * kNumMics * kTaps, 0.0f);
+        for (size_t b = 0; b < beam_angles_.size(); b++) {
+            float a = beam_angles_[b] * M_PI / 180.0f;
+            for (size_t c = 0; c < kNumMics; c++) {
+                // A mic nearer the source hears it earlier and is delayed more.
+                float d = (geometry_.x[c] * cos(a) + geometry_.y[c] * sin(a)) / kSpeedOfSound * rate;
+                if (std::fabs(d) > center - 3) return false;
+                DesignFractionalDelay(center + d, 1.0f / kNumMics, &coeffs_[(b * kNumMics + c) * kTaps]);
+            }
+        }
+        center_taps_.resize(kTaps);
+        DesignFractionalDelay(center, 1.0f, &center_taps_[0]);
+        for (size_t c = 0; c < kNumMics; c++) history_[c].assign(kTaps - 1, 0.0f);
+        floor_primed_ = false;
+        power_ = 0.0f;
+        hold_frames_ = 0;
+        return true;
+    }
+
+    // Windowed sinc delaying by delay samples (0 <= delay <= kTaps - 1),
+    // low-passed at 90% of Nyquist, DC gain gain. Stored so that output n is
+    // the sum over k of taps[k] * x[n - (kTaps - 1) + k].
+    static void DesignFractionalDelay(float delay, float gain, float *taps) {
+        const double fc = 0.45, half = kTaps / 2.0;
+        double sum = 0;
+        for (size_t k = 0; k < kTaps; k++) {
+            double t = (kTaps - 1 - k) - delay;
+            double sinc = t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+            double w = std::fabs(t) >= half ? 0 : 0.42 + 0.5 * cos(M_PI * t / half) + 0.08 * cos(2 * M_PI * t / half);
+            taps[k] = static_cast<float>(sinc * w);
+            sum += sinc * w;
+        }
+        for (size_t k = 0; k < kTaps; k++) taps[k] = static_cast<float>(taps[k] * gain / sum);
+    }
+
+    const std::vector<float> &GetBeamAngles() const override { return beam_angles_; }
+    const MicGeometry &GetGeometry() const { return geometry_; }
+
+    bool IsExpanded() const override { return expanded_; }
+    uint64_t GetNumFullBlocks() const override { return num_full_blocks_; }
+    uint64_t GetNumIdleBlocks() const override { return num_idle_blocks_; }
+
+    void ProcessBlock(AudioBlock *block) override {
+        size_t ch = block->num_channels, frames = block->NumFrames();
+        if (frames == 0) return;
+        for (size_t c = 0; c < kNumMics; c++) {
+            std::vector<float> &h = history_[c];
+            h.resize(kTaps - 1 + frames);
+            if (block->format == kFloat32Planar) {
+                std::copy(block->Channel(c), block->Channel(c) + frames, &h[kTaps - 1]);
+            }
+            else {
+                simd::DeinterleaveToFloat(block->Samples(), ch, c, frames, 1.0f / 32768, &h[kTaps - 1]);
+            }
+        }
+
+        size_t num_beams = beam_angles_.size();
+        out_.assign(num_beams * frames, 0.0f);
+        expanded_ = idle_mode_ == kIdleAllBeams || UpdateActivity(frames);
+        if (expanded_) num_full_blocks_++;
+        else num_idle_blocks_++;
+        if (!expanded_ && idle_mode_ == kIdleOneBeam) {
+            MixHistory();
+            for (size_t k = 0; k < kTaps; k++) simd::Axpy(center_taps_[k], &mix_[k], &out_[0], frames);
+            for (size_t b = 1; b < num_beams; b++) std::copy(&out_[0], &out_[0] + frames, &out_[b * frames]);
+        }
+
+        // One Axpy per mic and tap runs along the block, so the vector width
+        // is spent on frames and the fixed mic and tap loops unroll.
+        for (size_t b = 0; expanded_ && b < num_beams; b++) {
+            float *y = &out_[b * frames];
+            const float *taps = &coeffs_[b * kNumMics * kTaps];
+            for (size_t c = 0; c < kNumMics; c++) {
+                const float *x = &history_[c][0];
+                for (size_t k = 0; k < kTaps; k++) simd::Axpy(taps[c * kTaps + k], x + k, y, frames);
+            }
+        }
+        for (size_t c = 0; c < kNumMics; c++) {
+            std::vector<float> &h = history_[c];
+            std::copy(h.end() - (kTaps - 1), h.end(), h.begin());
+            h.resize(kTaps - 1);
+        }
+
+        block->num_channels = num_beams;
+        if (block->format == kFloat32Planar) {
+            block->planar.swap(out_);
+        }
+        else {
+            block->data.resize(frames * num_beams * sizeof(int16_t));
+            for (size_t b = 0; b < num_beams; b++) {
+                simd::InterleaveFromFloat(&out_[b * frames], frames, 32768.0f, num_beams, b, block->Samples());
+            }
+        }
+    }
+
+private:
+    DelaySumBeamformerStage(const MicGeometry &geometry, const std::vector<float> &beam_angles)
+        : geometry_(geometry), beam_angles_(beam_angles), history_(kNumMics), idle_mode_(kIdleAllBeams),
+          margin_db_(6.0f), hold_ms_(500), rate_(16000), direction_changed_(false), floor_primed_(false),
+          floor_db_(0.0f), power_(0.0f), hold_frames_(0), expanded_(true), num_full_blocks_(0), num_idle_blocks_(0) {}
+
+    // Averages this block's mic samples into the tail of mix_ and tracks
+    // their level, smoothed over ~50 ms so single noisy blocks do not count,
+    // against a noise floor that falls at once and rises 5 dB/s. Returns
+    // whether all beams should run for this block. The kTaps - 1 samples of
+    // history the idle beam also filters are only mixed by MixHistory(),
+    // when that beam is output.
+    bool UpdateActivity(size_t frames) {
+        mix_.resize(kTaps - 1 + frames);
+        float *x = &mix_[kTaps - 1];
+        std::fill(x, x + frames, 0.0f);
+        for (size_t c = 0; c < kNumMics; c++) simd::Axpy(1.0f / kNumMics, &history_[c][kTaps - 1], x, frames);
+        float power = simd::Dot(x, x, frames) / frames;
+        power_ = floor_primed_ ? power_ + std::min(1.0f, frames / (0.05f * rate_)) * (power - power_) : power;
+        float level_db = 10.0f * log10(power_ + 1e-12f);
+        if (!floor_primed_ || level_db < floor_db_) {
+            floor_db_ = level_db;
+            floor_primed_ = true;
+        }
+        else {
+            floor_db_ += 5.0f * frames / rate_;
+        }
+        bool trigger = direction_changed_.exchange(false, std::memory_order_relaxed) || level_db > floor_db_ + margin_db_;
+        if (trigger) hold_frames_ = static_cast<int64_t>(hold_ms_) * rate_ / 1000;
+        else hold_frames_ = std::max<int64_t>(hold_frames_ - static_cast<int64_t>(frames), 0);
+        return trigger || hold_frames_ > 0;
+    }
+
+    void MixHistory() {
+        std::fill(&mix_[0], &mix_[0] + kTaps - 1, 0.0f);
+        for (size_t c = 0; c < kNumMics; c++) simd::Axpy(1.0f / kNumMics, &history_[c][0], &mix_[0], kTaps - 1);
+    }
+
+    MicGeometry geometry_;
+    std::vector<float> beam_angles_, coeffs_, center_taps_, mix_, out_;
+    std::vector<std::vector<float>> history_;
+    IdleMode idle_mode_;
+    float margin_db_;
+    int hold_ms_, rate_;
+    std::atomic<bool> direction_changed_;
+    bool floor_primed_;
+    float floor_db_, power_;
+    int64_t hold_frames_;
+    bool expanded_;
+    uint64_t num_full_blocks_, num_idle_blocks_;
+};
+
+// num_beams directions spread evenly: around the circle for a circular
+// array, over the front half-plane (0 to 180 degrees) for a linear one.
+inline std::vector<float> EvenBeamAngles(size_t num_beams, bool linear) {
+    std::vector<float> angles;
+    for (size_t i = 0; i < num_beams; i++) {
+        angles.push_back(linear ? (num_beams > 1 ? 180.0f * i / (num_beams - 1) : 90.0f) : 360.0f * i / num_beams);
+    }
+    return angles;
+}
+
+// Picks the instantiation for a librespeaker mic type name. Returns nullptr
+// for mic types with no compiled array.
+inline DelaySumBeamformer *CreateDelaySumBeamformer(const std::string &mic_type, const std::vector<float> &beam_angles,
+                                            float mic0_angle = 0) {
+    if (mic_type == Circular6MicArray::MicType())
+        return DelaySumBeamformerStage<Circular6MicArray>::Create(beam_angles, mic0_angle);
+    if (mic_type == Linear6MicArray::MicType())
+        return DelaySumBeamformerStage<Linear6MicArray>::Create(beam_angles, mic0_angle);
+    if (mic_type == Circular4MicArray::MicType())
+        return DelaySumBeamformerStage<Circular4MicArray>::Create(beam_angles, mic0_angle);
+    if (mic_type == Linear4MicArray::MicType())
+        return DelaySumBeamformerStage<Linear4MicArray>::Create(beam_angles, mic0_angle);
+    return nullptr;
+}
+
+// Whether mic_type names a linear array, for EvenBeamAngles().
+inline bool IsLinearMicType(const std::string &mic_type) { return mic_type.compare(0, 7, "LINEAR_") == 0; }
+
+}  // namespace respeaker_ext
+
+#endif  // DELAY_SUM_BEAMFORMER_H_
@@ -0,0 +1,454 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <respeaker.h>
+#include <chain_nodes/file_collector_node.h>
+#include <chain_nodes/vep_aec_beamforming_node.h>
+
+#include "delay_sum_beamformer.h"
+#include "multibeam_kws.h"
+#include "wav_block_reader.h"
+
+extern "C"
+{
+#include <sndfile.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+
+static void help(const char *argv0) {
+    cout << "delay_sum_bench [options]" << endl;
+    cout << "Runs the same mic recording through the in-repo delay-and-sum beamformer and VepAecBeamformingNode" << endl;
+    cout << "and compares CPU per block and output SNR. Delay-and-sum is fixed beams with no AEC or noise" << endl;
+    cout << "suppression: it is a cheap way to feed a multi-beam spotter, not a stand-in for VEP, whose output" << endl;
+    cout << "SNR is well above it. Both are timed as process CPU. SNR is estimated blind, as the ratio of loud (95th" << endl;
+    cout << "percentile) to quiet (10th percentile) 16 ms frame power, so it needs speech over steady noise." << endl;
+    cout << "A beam that outputs silence in pauses has no SNR this way and shows '-'. 'kept %' is the share of" << endl;
+    cout << "the ungated best beam's energy that falls in blocks where all beams ran. MultiBeamKwsStage runs on" << endl;
+    cout << "the ungated beams and on each idle mode's; 'lost' counts ungated detections an idle mode has none" << endl;
+    cout << "near, and the bench fails if any is lost." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=INPUT_FILE_NAME               A mic input; repeat for one mono file per mic, or give one" << endl;
+    cout << "                                           multichannel 16k file, default is vep_aec_beamforming_node_in_0..5.wav" << endl;
+    cout << "  -t, --type=MIC_TYPE                      The MICROPHONE TYPE, support: CIRCULAR_6MIC_7BEAM, LINEAR_6MIC_8BEAM," << endl;
+    cout << "                                           CIRCULAR_4MIC_9BEAM, LINEAR_4MIC_1BEAM, default is CIRCULAR_6MIC_7BEAM" << endl;
+    cout << "  -a, --angle=DEGREES                      The angle of mic 0, default is 0" << endl;
+    cout << "  -b, --beams=NUM                          Beams to form, default is one per mic" << endl;
+    cout << "  -i, --idle=MODE                          Beams run in silence: all, one or none; repeat to compare, default" << endl;
+    cout << "                                           is all three" << endl;
+    cout << "  -o, --hold=MS                            How long all beams stay on after activity, default is 500" << endl;
+    cout << "  -m, --model=MODEL_FILE_NAME              Template model from kws_enroll, default enrolls the loudest second of mic 0" << endl;
+    cout << "  -v, --vep-output=FILE_NAME               VepAecBeamformingNode's output for the same recording, default is" << endl;
+    cout << "                                           vep_aec_beamforming_node_out.wav" << endl;
+    cout << "  -l, --live                               Also run VepAecBeamformingNode on the recording for its CPU cost" << endl;
+    cout << "  -r, --repeat=TIMES                       Passes over the recording for the delay-and-sum timing, default is 20" << endl;
+}
+
+static double ProcessCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Loud-to-quiet frame power ratio of one channel of an interleaved buffer, or
+// NAN if the quiet frames are digital silence and there is no noise to compare.
+static double EstimateSnrDb(const vector<int16_t> &samples, size_t num_channels, size_t channel) {
+    const size_t kFrame = 256;
+    size_t frames = samples.size() / num_channels;
+    vector<double> power;
+    for (size_t start = 0; start + kFrame <= frames; start += kFrame) {
+        double sum = 0;
+        for (size_t n = start; n < start + kFrame; n++) {
+            double x = samples[n * num_channels + channel];
+            sum += x * x;
+        }
+        power.push_back(sum / kFrame + 1e-3);
+    }
+    if (power.size() < 10) return 0;
+    sort(power.begin(), power.end());
+    double quiet = power[power.size() / 10], loud = power[power.size() * 95 / 100];
+    if (quiet <= 1e-3) return NAN;
+    return 10 * log10(max(loud - quiet, 1e-3) / quiet);
+}
+
+// The beam with the highest SNR; a beam without one (NAN) only if all are.
+static size_t BestBeam(const vector<int16_t> &beams, size_t num_beams, double *best_snr) {
+    size_t best = 0;
+    *best_snr = NAN;
+    for (size_t b = 0; b < num_beams; b++) {
+        double snr = EstimateSnrDb(beams, num_beams, b);
+        if (snr > *best_snr || (std::isnan(*best_snr) && !std::isnan(snr))) {
+            *best_snr = snr;
+            best = b;
+        }
+    }
+    return best;
+}
+
+static string DbText(double db) {
+    if (std::isnan(db)) return "-";
+    ostringstream out;
+    out << fixed << setprecision(2) << db;
+    return out.str();
+}
+
+static bool LoadWav(const string &path, vector<int16_t> *samples, size_t *num_channels, int *rate) {
+    unique_ptr<WavBlockReader> reader(WavBlockReader::Create(path, BLOCK_SIZE_MS));
+    if (!reader) return false;
+    *num_channels = reader->GetNumChannels();
+    *rate = reader->GetRate();
+    AudioBlock block;
+    while (reader->Read(&block)) samples->insert(samples->end(), block.Samples(), block.Samples() + block.NumFrames() * block.num_channels);
+    return true;
+}
+
+// Writes the mics plus two silent reference channels, the layout
+// VepAecBeamformingNode expects from a 6-mic collector, and runs the node on
+// it through a FileCollectorNode. Returns process CPU seconds, which take in
+// the collector's file reads and the Listen() polling as well as the node, or
+// a negative value if the chain did not start.
+static double RunVepAec(const vector<int16_t> &mics, size_t num_mics, int rate, const string &mic_type,
+                        int mic0_angle, vector<int16_t> *output) {
+    const string path = "delay_sum_bench_in.wav";
+    size_t in_channels = num_mics + 2, frames = mics.size() / num_mics;
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.samplerate = rate;
+    info.channels = in_channels;
+    info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    SNDFILE *file = sf_open(path.c_str(), SFM_WRITE, &info);
+    if (!file) return -1;
+    vector<int16_t> frame(in_channels, 0);
+    for (size_t n = 0; n < frames; n++) {
+        copy(&mics[n * num_mics], &mics[n * num_mics] + num_mics, frame.begin());
+        sf_writef_short(file, &frame[0], 1);
+    }
+    sf_close(file);
+
+    bool stop = false;
+    unique_ptr<FileCollectorNode> collector(FileCollectorNode::Create(path, BLOCK_SIZE_MS, false));
+    unique_ptr<VepAecBeamformingNode> vep_1beam(VepAecBeamformingNode::Create(StringToMicType(mic_type), true, num_mics, false));
+    vep_1beam->SetAngleForMic0(mic0_angle);
+    vep_1beam->Uplink(collector.get());
+    unique_ptr<ReSpeaker> respeaker(ReSpeaker::Create());
+    respeaker->RegisterChainByHead(collector.get());
+    respeaker->RegisterOutputNode(vep_1beam.get());
+    double start = ProcessCpuSeconds();
+    if (!respeaker->Start(&stop)) return -1;
+    // The collector has no end-of-file signal, so stop once the whole
+    // recording came out or the chain went quiet for a second.
+    auto last = chrono::steady_clock::now();
+    while (output->size() < frames && chrono::steady_clock::now() - last < chrono::seconds(1)) {
+        string data = respeaker->Listen(false);
+        if (data.empty()) {
+            this_thread::sleep_for(chrono::milliseconds(2));
+            continue;
+        }
+        const int16_t *p = reinterpret_cast<const int16_t *>(data.data());
+        output->insert(output->end(), p, p + data.size() / sizeof(int16_t));
+        last = chrono::steady_clock::now();
+    }
+    double cpu = ProcessCpuSeconds() - start;
+    stop = true;
+    respeaker->Stop();
+    unlink(path.c_str());
+    return cpu;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    vector<string> files;
+    string mic_type = "CIRCULAR_6MIC_7BEAM";
+    string vep_output = "vep_aec_beamforming_node_out.wav";
+    int mic0_angle = 0;
+    size_t num_beams = 0;
+    bool live = false;
+    int repeat = 20;
+    vector<DelaySumBeamformer::IdleMode> idle_modes;
+    string model_path;
+    int hold_ms = 500;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"type",         1, NULL, 't'},
+        {"angle",        1, NULL, 'a'},
+        {"beams",        1, NULL, 'b'},
+        {"idle",         1, NULL, 'i'},
+        {"model",        1, NULL, 'm'},
+        {"hold",         1, NULL, 'o'},
+        {"vep-output",   1, NULL, 'v'},
+        {"live",         0, NULL, 'l'},
+        {"repeat",       1, NULL, 'r'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:t:a:b:i:m:o:v:r:hl", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            files.push_back(string(optarg));
+            break;
+        case 't':
+            mic_type = string(optarg);
+            break;
+        case 'a':
+            mic0_angle = stoi(optarg);
+            break;
+        case 'b':
+            num_beams = stoi(optarg);
+            break;
+        case 'i':
+            if (string(optarg) == "one") idle_modes.push_back(DelaySumBeamformer::kIdleOneBeam);
+            else if (string(optarg) == "none") idle_modes.push_back(DelaySumBeamformer::kIdleSilent);
+            else idle_modes.push_back(DelaySumBeamformer::kIdleAllBeams);
+            break;
+        case 'm':
+            model_path = string(optarg);
+            break;
+        case 'o':
+            hold_ms = stoi(optarg);
+            break;
+        case 'v':
+            vep_output = string(optarg);
+            break;
+        case 'l':
+            live = true;
+            break;
+        case 'r':
+            repeat = max(1, stoi(optarg));
+            break;
+        default:
+            return 0;
+        }
+    }
+    MicGeometry geometry;
+    if (!MicGeometry::FromMicType(mic_type, mic0_angle, &geometry)) {
+        cout << "Error : unknown mic type " << mic_type << endl;
+        return -1;
+    }
+    size_t num_mics = geometry.NumMics();
+    if (files.empty()) {
+        for (size_t i = 0; i < num_mics; i++) files.push_back("vep_aec_beamforming_node_in_" + to_string(i) + ".wav");
+    }
+    if (num_beams == 0) num_beams = num_mics;
+    if (idle_modes.empty()) {
+        idle_modes.push_back(DelaySumBeamformer::kIdleAllBeams);
+        idle_modes.push_back(DelaySumBeamformer::kIdleOneBeam);
+        idle_modes.push_back(DelaySumBeamformer::kIdleSilent);
+    }
+
+    // Gather the mics into one interleaved buffer, in memory so file I/O
+    // stays out of the timing.
+    vector<vector<int16_t>> channels;
+    int rate = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        vector<int16_t> samples;
+        size_t file_channels;
+        int file_rate;
+        if (!LoadWav(files[i], &samples, &file_channels, &file_rate) || (rate && file_rate != rate)) {
+            cout << "Error : Not able to open input file " << files[i] << " at the rate of the others" << endl;
+            return -1;
+        }
+        rate = file_rate;
+        for (size_t ch = 0; ch < file_channels && channels.size() < num_mics; ch++) {
+            channels.push_back(vector<int16_t>());
+            for (size_t n = ch; n < samples.size(); n += file_channels) channels.back().push_back(samples[n]);
+        }
+    }
+    if (channels.size() < num_mics) {
+        cout << "Error : " << mic_type << " needs " << num_mics << " mic channels, the inputs have " << channels.size() << endl;
+        return -1;
+    }
+    size_t frames = channels[0].size();
+    for (size_t i = 1; i < num_mics; i++) frames = min(frames, channels[i].size());
+    vector<int16_t> mics(frames * num_mics);
+    for (size_t n = 0; n < frames; n++) {
+        for (size_t i = 0; i < num_mics; i++) mics[n * num_mics + i] = channels[i][n];
+    }
+
+    size_t block_frames = rate * BLOCK_SIZE_MS / 1000;
+    vector<AudioBlock> blocks;
+    for (size_t start = 0; start + block_frames <= frames; start += block_frames) {
+        AudioBlock block;
+        block.num_channels = num_mics;
+        block.rate = rate;
+        block.sequence = blocks.size();
+        block.data.assign(reinterpret_cast<const char *>(&mics[start * num_mics]), block_frames * num_mics * sizeof(int16_t));
+        blocks.push_back(block);
+    }
+
+    shared_ptr<const KwsTemplateModel> model;
+    if (!model_path.empty()) {
+        model.reset(KwsTemplateModel::Load(model_path));
+    }
+    else {
+        // Enroll the loudest second of mic 0, which is speech rather than
+        // the lead-in silence.
+        size_t length = min<size_t>(rate, frames), best_start = 0;
+        double energy = 0, best_energy = -1;
+        for (size_t n = 0; n < frames; n++) {
+            energy += double(mics[n * num_mics]) * mics[n * num_mics];
+            if (n >= length) energy -= double(mics[(n - length) * num_mics]) * mics[(n - length) * num_mics];
+            if (n + 1 >= length && energy > best_energy) {
+                best_energy = energy;
+                best_start = n + 1 - length;
+            }
+        }
+        vector<int16_t> loudest;
+        for (size_t n = best_start; n < best_start + length; n++) loudest.push_back(mics[n * num_mics]);
+        model.reset(KwsTemplateModel::Enroll(&loudest[0], loudest.size()));
+    }
+    if (!model) {
+        cout << "Error : Not able to load the keyword model." << endl;
+        return -1;
+    }
+
+    size_t total_blocks = blocks.size() * repeat;
+    double audio_s = double(total_blocks) * BLOCK_SIZE_MS / 1000;
+    cout << fixed << setprecision(2);
+    cout << "audio: " << frames / double(rate) << " s of " << num_mics << " mics at " << rate << " Hz, " << mic_type << endl;
+    cout << setw(28) << "output" << setw(12) << "SNR dB" << setw(12) << "us/block" << setw(14) << "x realtime"
+         << setw(10) << "full %" << setw(10) << "kept %" << setw(8) << "hits" << setw(8) << "lost" << endl;
+    cout << setw(28) << "mic 0" << setw(12) << DbText(EstimateSnrDb(mics, num_mics, 0)) << endl;
+
+    vector<float> angles = EvenBeamAngles(num_beams, IsLinearMicType(mic_type));
+    // The ungated output: per block the energy of its best beam, for the
+    // kept column, and the blocks the spotter detected in.
+    vector<double> reference_energy(blocks.size(), 0);
+    vector<size_t> reference_hits;
+    {
+        unique_ptr<DelaySumBeamformer> beamformer(CreateDelaySumBeamformer(mic_type, angles, mic0_angle));
+        if (!beamformer || !beamformer->Prepare(num_mics, rate, BLOCK_SIZE_MS)) {
+            cout << "Error : no delay-and-sum beamformer for " << mic_type << " at " << rate << " Hz" << endl;
+            return -1;
+        }
+        unique_ptr<MultiBeamKwsStage> kws(MultiBeamKwsStage::Create(model, 0.5f));
+        if (!kws->Prepare(num_beams, rate, BLOCK_SIZE_MS)) {
+            cout << "Error : the keyword model does not fit the beams at " << rate << " Hz" << endl;
+            return -1;
+        }
+        vector<int16_t> beams;
+        AudioBlock block;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            block = blocks[i];
+            beamformer->ProcessBlock(&block);
+            beams.insert(beams.end(), block.Samples(), block.Samples() + block.NumFrames() * num_beams);
+            kws->ProcessBlock(&block);
+            if (kws->Detected()) reference_hits.push_back(i);
+        }
+        double best_snr;
+        size_t best = BestBeam(beams, num_beams, &best_snr);
+        for (size_t n = 0; n < beams.size() / num_beams; n++) {
+            double x = beams[n * num_beams + best];
+            reference_energy[n / block_frames] += x * x;
+        }
+    }
+    double reference_total = 0;
+    for (size_t i = 0; i < blocks.size(); i++) reference_total += reference_energy[i];
+    // A gated detection may land a few blocks off the ungated one, where a
+    // beam's window refilled after the switch back.
+    const size_t kMatchBlocks = 250 / BLOCK_SIZE_MS;
+    int total_lost = 0;
+    for (size_t m = 0; m < idle_modes.size(); m++) {
+        unique_ptr<DelaySumBeamformer> beamformer(CreateDelaySumBeamformer(mic_type, angles, mic0_angle));
+        if (!beamformer || !beamformer->Prepare(num_mics, rate, BLOCK_SIZE_MS)) {
+            cout << "Error : no delay-and-sum beamformer for " << mic_type << " at " << rate << " Hz" << endl;
+            return -1;
+        }
+        beamformer->SetActivityGating(idle_modes[m], 6.0f, hold_ms);
+        unique_ptr<MultiBeamKwsStage> kws(MultiBeamKwsStage::Create(model, 0.5f));
+        kws->Prepare(num_beams, rate, BLOCK_SIZE_MS);
+
+        // The first pass keeps the output and runs the spotter on it; the
+        // timed passes run the beamformer alone.
+        vector<int16_t> beams;
+        vector<size_t> hits;
+        double kept = 0;
+        AudioBlock block;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            block = blocks[i];
+            beamformer->ProcessBlock(&block);
+            beams.insert(beams.end(), block.Samples(), block.Samples() + block.NumFrames() * num_beams);
+            if (beamformer->IsExpanded()) kept += reference_energy[i];
+            kws->ProcessBlock(&block);
+            if (kws->Detected()) hits.push_back(i);
+        }
+        vector<size_t> lost;
+        for (size_t h = 0; h < reference_hits.size(); h++) {
+            size_t at = reference_hits[h];
+            vector<size_t>::iterator near = lower_bound(hits.begin(), hits.end(), at > kMatchBlocks ? at - kMatchBlocks : 0);
+            if (near == hits.end() || *near > at + kMatchBlocks) lost.push_back(at);
+        }
+        total_lost += lost.size();
+        double full = 100.0 * beamformer->GetNumFullBlocks() / max<uint64_t>(beamformer->GetNumFullBlocks() + beamformer->GetNumIdleBlocks(), 1);
+        // Process CPU, as for VEP, whose work is spread over the chain's
+        // node threads; nothing else runs here, so the two compare.
+        double start = ProcessCpuSeconds();
+        for (int r = 0; r < repeat; r++) {
+            for (size_t i = 0; i < blocks.size(); i++) {
+                block = blocks[i];
+                beamformer->ProcessBlock(&block);
+            }
+        }
+        double delay_sum_s = ProcessCpuSeconds() - start;
+
+        double best_snr;
+        size_t best = BestBeam(beams, num_beams, &best_snr);
+        const char *idle_names[] = {"all", "one", "none"};
+        string label = "delay_sum idle " + string(idle_names[idle_modes[m]]);
+        if (!std::isnan(best_snr)) label += ", best " + to_string(int(angles[best]));
+        cout << setw(28) << label
+             << setw(12) << DbText(best_snr) << setw(12) << delay_sum_s * 1e6 / total_blocks << setw(14) << audio_s / delay_sum_s
+             << setw(10) << setprecision(1) << full << setw(10) << 100 * kept / max(reference_total, 1.0) << setprecision(2)
+             << setw(8) << hits.size() << setw(8) << lost.size() << endl;
+        for (size_t h = 0; h < lost.size(); h++) {
+            cout << setw(28) << "lost detection at" << setw(12) << lost[h] * BLOCK_SIZE_MS / 1000.0 << " s" << endl;
+        }
+    }
+
+    vector<int16_t> recorded;
+    size_t recorded_channels;
+    int recorded_rate;
+    if (LoadWav(vep_output, &recorded, &recorded_channels, &recorded_rate) && !recorded.empty()) {
+        cout << setw(28) << "vep_aec (recorded)" << setw(12) << DbText(EstimateSnrDb(recorded, recorded_channels, 0)) << endl;
+    }
+    if (live) {
+        vector<int16_t> vep_out;
+        double vep_s = RunVepAec(mics, num_mics, rate, mic_type, mic0_angle, &vep_out);
+        if (vep_s < 0) {
+            cout << "Error : can not start the VepAecBeamformingNode chain" << endl;
+            return -1;
+        }
+        size_t vep_blocks = max<size_t>(vep_out.size() / block_frames, 1);
+        cout << setw(28) << "vep_aec (live)" << setw(12) << DbText(EstimateSnrDb(vep_out, 1, 0)) << setw(12)
+             << vep_s * 1e6 / vep_blocks << setw(14) << vep_blocks * BLOCK_SIZE_MS / 1000.0 / vep_s << endl;
+    }
+    if (total_lost > 0) {
+        cout << "Error : gating lost " << total_lost << " of the ungated run's detections" << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <vector>
+
+#include "gcc_phat_doa.h"
+#include "wav_block_reader.h"
+
+extern "C"
+{
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+
+static void help(const char *argv0) {
+    cout << "doa_angle_check [options]" << endl;
+    cout << "Runs GccPhatDoaStage over per-mic dumps (vep_aec_beamforming_node_in_N.wav), reports the" << endl;
+    cout << "spread of the published angles, and the CPU load relative to real time. AngleTest holds one" << endl;
+    cout << "talker at a fixed position, so a correct estimator keeps most estimates near one angle; with" << endl;
+    cout << "--angle that angle is also checked against ground truth." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -d, --dir=DUMP_DIR                       The dump directory, default is AngleTest" << endl;
+    cout << "  -t, --type=MIC_TYPE                      The MICROPHONE TYPE, support: CIRCULAR_6MIC_7BEAM, LINEAR_6MIC_8BEAM," << endl;
+    cout << "                                           LINEAR_4MIC_1BEAM, CIRCULAR_4MIC_9BEAM, CIRCULAR_8MIC, default is CIRCULAR_6MIC_7BEAM" << endl;
+    cout << "  -r, --mic0=DEGREES                       Angle of mic 0, as SetAngleForMic0(), default is 30 (what" << endl;
+    cout << "                                           AngleTest/TestRecording3.cc recorded with)" << endl;
+    cout << "  -a, --angle=DEGREES                      The true talker angle in the array frame, if known" << endl;
+    cout << "  -e, --tolerance=DEGREES                  Largest accepted error, default is 20" << endl;
+    cout << "  -p, --publish=MS                         Publish interval, default is 100" << endl;
+}
+
+static double ThreadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int AngleError(int a, int b) {
+    int d = abs(a - b) % 360;
+    return d > 180 ? 360 - d : d;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    string dir = "AngleTest", mic_type = "CIRCULAR_6MIC_7BEAM";
+    float mic0_angle = 30;
+    int expected = -1, tolerance = 20, publish_ms = 100;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"dir",          1, NULL, 'd'},
+        {"type",         1, NULL, 't'},
+        {"mic0",         1, NULL, 'r'},
+        {"angle",        1, NULL, 'a'},
+        {"tolerance",    1, NULL, 'e'},
+        {"publish",      1, NULL, 'p'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "d:t:r:a:e:p:h", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'd':
+            dir = string(optarg);
+            break;
+        case 't':
+            mic_type = string(optarg);
+            break;
+        case 'r':
+            mic0_angle = stof(optarg);
+            break;
+        case 'a':
+            expected = stoi(optarg);
+            break;
+        case 'e':
+            tolerance = stoi(optarg);
+            break;
+        case 'p':
+            publish_ms = stoi(optarg);
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    MicGeometry geometry;
+    if (!MicGeometry::FromMicType(mic_type, mic0_angle, &geometry)) {
+        cout << "Error : Unknown mic type " << mic_type << endl;
+        return -1;
+    }
+    size_t num_mics = geometry.NumMics();
+
+    // Dumps hold 6 mics; larger geometries reuse them cyclically, which keeps
+    // the load realistic though not the angle.
+    vector<vector<AudioBlock>> inputs;
+    for (size_t i = 0; i < min<size_t>(num_mics, 6); i++) {
+        string path = dir + "/vep_aec_beamforming_node_in_" + to_string(i) + ".wav";
+        unique_ptr<WavBlockReader> reader(WavBlockReader::Create(path, BLOCK_SIZE_MS));
+        if (!reader) {
+            cout << "Error : Not able to open " << path << endl;
+            return -1;
+        }
+        inputs.push_back(vector<AudioBlock>());
+        AudioBlock block;
+        while (reader->Read(&block)) inputs.back().push_back(block);
+    }
+    size_t num_blocks = inputs[0].size();
+    for (size_t i = 1; i < inputs.size(); i++) num_blocks = min(num_blocks, inputs[i].size());
+    int rate = inputs[0][0].rate;
+
+    vector<AudioBlock> blocks(num_blocks);
+    for (size_t b = 0; b < num_blocks; b++) {
+        size_t frames = inputs[0][b].NumFrames();
+        blocks[b].num_channels = num_mics;
+        blocks[b].rate = rate;
+        blocks[b].sequence = b;
+        blocks[b].data.resize(frames * num_mics * sizeof(int16_t));
+        for (size_t m = 0; m < num_mics; m++) {
+            const int16_t *src = inputs[m % inputs.size()][b].Samples();
+            for (size_t n = 0; n < frames; n++) blocks[b].Samples()[n * num_mics + m] = src[n];
+        }
+    }
+
+    vector<DoaEstimate> published;
+    unique_ptr<GccPhatDoaStage> doa(GccPhatDoaStage::Create(geometry, publish_ms,
+        [&published](const DoaEstimate &estimate) { published.push_back(estimate); }));
+    if (!doa || !doa->Prepare(num_mics, rate, BLOCK_SIZE_MS)) {
+        cout << "Error : Not able to create the DOA stage." << endl;
+        return -1;
+    }
+
+    double start = ThreadCpuSeconds();
+    for (size_t b = 0; b < num_blocks; b++) doa->ProcessBlock(&blocks[b]);
+    double cpu = ThreadCpuSeconds() - start;
+    double audio_s = (double)num_blocks * BLOCK_SIZE_MS / 1000;
+
+    map<int, int> histogram;
+    int valid = 0;
+    for (size_t i = 0; i < published.size(); i++) {
+        if (!published[i].valid) continue;
+        valid++;
+        histogram[(published[i].angle + 5) / 10 * 10 % 360]++;
+    }
+
+    cout << dir << ", " << mic_type << ": " << fixed << setprecision(1) << audio_s << " s, " << doa->GetTables().NumPairs()
+         << " pairs, " << setprecision(2) << cpu * 1e6 / num_blocks << " us per block, "
+         << setprecision(2) << 100 * cpu / audio_s << "% of one core" << endl;
+    int mode = -1, mode_count = 0;
+    for (map<int, int>::iterator it = histogram.begin(); it != histogram.end(); ++it) {
+        cout << "  " << setw(3) << it->first << " deg: " << string(it->second * 60 / max(valid, 1), '#') << " " << it->second << endl;
+        if (it->second > mode_count) {
+            mode = it->first;
+            mode_count = it->second;
+        }
+    }
+    if (valid == 0) {
+        cout << "FAIL: no valid estimate published" << endl;
+        return 1;
+    }
+    int within = 0;
+    for (size_t i = 0; i < published.size(); i++) {
+        if (published[i].valid && AngleError(published[i].angle, mode) <= tolerance) within++;
+    }
+    double consistency = (double)within / valid;
+    bool pass = consistency >= 0.5;
+    cout << "most frequent angle " << mode << " deg, " << setprecision(1) << 100 * consistency << "% of " << valid
+         << " estimates within " << tolerance << " deg of it" << endl;
+    if (expected >= 0) {
+        int error = AngleError(mode, expected);
+        cout << "error against the expected " << expected << " deg: " << error << " deg" << endl;
+        pass = pass && error <= tolerance;
+    }
+    cout << (pass ? "PASS" : "FAIL") << endl;
+    return pass ? 0 : 1;
+}
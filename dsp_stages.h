@@ -0,0 +1,203 @@
+#ifndef DSP_STAGES_H_
+#define DSP_STAGES_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "chain_stage.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+// Integer-factor decimation, e.g. the 48k to 16k step that
+// PulseCollectorNode::Create_48Kto16K does inside the library. Each channel
+// goes through a Blackman-windowed sinc low-pass and every factor-th output
+// is kept; only the kept outputs are computed. Any block size works, samples
+// that do not fill a whole output stay in the channel's history.
+class ResampleStage : public ChainStage {
+public:
+    static ResampleStage *Create(int output_rate = 16000, int taps_per_phase = 16) {
+        if (output_rate <= 0 || taps_per_phase <= 0) return nullptr;
+        return new ResampleStage(output_rate, taps_per_phase);
+    }
+
+    std::string Name() const override { return "resample"; }
+    int GetOutputRate(int input_rate) const override { return output_rate_; }
+    bool SupportsFloatPlanar() const override { return true; }
+
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override {
+        if (rate % output_rate_ != 0) return false;
+        factor_ = rate / output_rate_;
+        taps_ = DesignTaps(factor_, taps_per_phase_);
+        size_t taps = taps_.size();
+        history_.assign(num_channels, std::vector<float>(taps - 1, 0.0f));
+        return true;
+    }
+
+    // Blackman-windowed sinc cut off at 90% of the output Nyquist, unity DC
+    // gain. Returned reversed so each output is one dot product over the
+    // history.
+    static std::vector<float> DesignTaps(size_t factor, int taps_per_phase) {
+        size_t taps = static_cast<size_t>(taps_per_phase * factor);
+        double fc = 0.45 / factor;
+        std::vector<float> h(taps);
+        double sum = 0;
+        for (size_t i = 0; i < taps; i++) {
+            double t = i - (taps - 1) / 2.0;
+            double sinc = t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+            double w = 0.42 - 0.5 * cos(2 * M_PI * i / (taps - 1)) + 0.08 * cos(4 * M_PI * i / (taps - 1));
+            h[taps - 1 - i] = static_cast<float>(sinc * w);
+            sum += sinc * w;
+        }
+        for (size_t i = 0; i < taps; i++) h[i] /= static_cast<float>(sum);
+        return h;
+    }
+
+    void ProcessBlock(AudioBlock *block) override {
+        size_t ch = block->num_channels, frames = block->NumFrames();
+        if (frames == 0) return;
+        size_t out_frames = 0;
+        for (size_t c = 0; c < ch; c++) {
+            std::vector<float> &h = history_[c];
+            size_t old = h.size();
+            h.resize(old + frames);
+            if (block->format == kFloat32Planar) {
+                std::copy(block->Channel(c), block->Channel(c) + frames, &h[old]);
+            }
+            else {
+                simd::DeinterleaveToFloat(block->Samples(), ch, c, frames, 1.0f / 32768, &h[old]);
+            }
+            out_frames = (h.size() - (taps_.size() - 1)) / factor_;
+        }
+
+        out_.resize(out_frames * ch);
+        for (size_t c = 0; c < ch; c++) {
+            std::vector<float> &h = history_[c];
+            float *y = &out_[c * out_frames];
+            for (size_t m = 0; m < out_frames; m++) y[m] = simd::Dot(&taps_[0], &h[m * factor_], taps_.size());
+            h.erase(h.begin(), h.begin() + out_frames * factor_);
+        }
+
+        block->rate = output_rate_;
+        block->sample_index /= factor_;
+        if (block->format == kFloat32Planar) {
+            block->planar.swap(out_);
+        }
+        else {
+            block->data.resize(out_frames * ch * sizeof(int16_t));
+            for (size_t c = 0; c < ch; c++) {
+                simd::InterleaveFromFloat(&out_[c * out_frames], out_frames, 32768.0f, ch, c, block->Samples());
+            }
+        }
+    }
+
+private:
+    ResampleStage(int output_rate, int taps_per_phase)
+        : output_rate_(output_rate), taps_per_phase_(taps_per_phase), factor_(1) {}
+
+    int output_rate_, taps_per_phase_;
+    size_t factor_;
+    std::vector<float> taps_, out_;
+    std::vector<std::vector<float>> history_;
+};
+
+// A fixed linear mix of the input channels, the shape of a fixed beam or a
+// mic mixdown: output o is the sum over c of weights[o * num_inputs + c]
+// times input c.
+class ChannelMixStage : public ChainStage {
+public:
+    static ChannelMixStage *Create(const std::vector<float> &weights, size_t num_inputs) {
+        if (num_inputs == 0 || weights.empty() || weights.size() % num_inputs != 0) return nullptr;
+        return new ChannelMixStage(weights, num_inputs);
+    }
+
+    // Equal-weight average of the first num_mics channels into one output.
+    static ChannelMixStage *CreateMixdown(size_t num_mics, size_t num_inputs) {
+        if (num_mics == 0 || num_mics > num_inputs) return nullptr;
+        std::vector<float> weights(num_inputs, 0.0f);
+        std::fill(weights.begin(), weights.begin() + num_mics, 1.0f / num_mics);
+        return new ChannelMixStage(weights, num_inputs);
+    }
+
+    std::string Name() const override { return "channel_mix"; }
+    bool SupportsFloatPlanar() const override { return true; }
+    size_t GetNumOutputChannels(size_t num_input_channels) const override { return num_outputs_; }
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override { return num_channels == num_inputs_; }
+
+    const std::vector<float> &GetWeights() const { return weights_; }
+    size_t GetNumInputs() const { return num_inputs_; }
+
+    void ProcessBlock(AudioBlock *block) override {
+        size_t frames = block->NumFrames();
+        if (frames == 0) return;
+        out_.assign(frames * num_outputs_, 0.0f);
+        if (block->format == kFloat32Planar) {
+            for (size_t o = 0; o < num_outputs_; o++) {
+                for (size_t c = 0; c < num_inputs_; c++) {
+                    float w = weights_[o * num_inputs_ + c];
+                    if (w != 0.0f) simd::Axpy(w, block->Channel(c), &out_[o * frames], frames);
+                }
+            }
+            block->num_channels = num_outputs_;
+            block->planar.swap(out_);
+            return;
+        }
+        in_.resize(frames);
+        for (size_t c = 0; c < num_inputs_; c++) {
+            simd::DeinterleaveToFloat(block->Samples(), num_inputs_, c, frames, 1.0f, &in_[0]);
+            for (size_t o = 0; o < num_outputs_; o++) {
+                float w = weights_[o * num_inputs_ + c];
+                if (w != 0.0f) simd::Axpy(w, &in_[0], &out_[o * frames], frames);
+            }
+        }
+        block->num_channels = num_outputs_;
+        block->data.resize(frames * num_outputs_ * sizeof(int16_t));
+        for (size_t o = 0; o < num_outputs_; o++) {
+            simd::InterleaveFromFloat(&out_[o * frames], frames, 1.0f, num_outputs_, o, block->Samples());
+        }
+    }
+
+private:
+    ChannelMixStage(const std::vector<float> &weights, size_t num_inputs)
+        : weights_(weights), num_inputs_(num_inputs), num_outputs_(weights.size() / num_inputs) {}
+
+    std::vector<float> weights_, in_, out_;
+    size_t num_inputs_, num_outputs_;
+};
+
+// Fixed gain in dB. On int16 blocks the result saturates at full scale; on
+// float32 planar blocks it is kept as is and only clipped by the final
+// conversion, so a later stage that attenuates gets the headroom back.
+class GainStage : public ChainStage {
+public:
+    static GainStage *Create(float gain_db) { return new GainStage(gain_db); }
+
+    std::string Name() const override { return "gain"; }
+    bool SupportsFloatPlanar() const override { return true; }
+
+    void SetGainDb(float gain_db) { gain_ = pow(10.0f, gain_db / 20.0f); }
+    float GetGain() const { return gain_; }
+
+    void ProcessBlock(AudioBlock *block) override {
+        if (block->NumFrames() == 0) return;
+        if (block->format == kFloat32Planar) {
+            simd::Scale(gain_, &block->planar[0], block->planar.size());
+            return;
+        }
+        size_t n = block->NumFrames() * block->num_channels;
+        scratch_.resize(n);
+        simd::DeinterleaveToFloat(block->Samples(), 1, 0, n, gain_, &scratch_[0]);
+        simd::InterleaveFromFloat(&scratch_[0], n, 1.0f, 1, 0, block->Samples());
+    }
+
+private:
+    explicit GainStage(float gain_db) { SetGainDb(gain_db); }
+
+    float gain_;
+    std::vector<float> scratch_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // DSP_STAGES_H_
@@ -0,0 +1,111 @@
+#ifndef FFT_H_
+#define FFT_H_
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace respeaker_ext {
+
+// Real FFT of a power-of-two size, computed as a half-size complex FFT on
+// split real/imaginary arrays. Twiddles are laid out per stage so every
+// butterfly loop walks contiguous memory and vectorizes. Create one per size
+// and reuse it; Forward() and Inverse() only touch the caller's buffers and
+// the object's scratch, so an instance must not be shared between threads.
+class Fft {
+public:
+    explicit Fft(size_t size) : n_(size), m_(size / 2) {
+        bitrev_.resize(m_);
+        size_t bits = 0;
+        while ((size_t(1) << bits) < m_) bits++;
+        for (size_t i = 0; i < m_; i++) {
+            size_t r = 0;
+            for (size_t b = 0; b < bits; b++) {
+                if (i & (size_t(1) << b)) r |= size_t(1) << (bits - 1 - b);
+            }
+            bitrev_[i] = r;
+        }
+        for (size_t len = 2; len <= m_; len <<= 1) {
+            for (size_t j = 0; j < len / 2; j++) {
+                stage_cos_.push_back(cos(2 * M_PI * j / len));
+                stage_sin_.push_back(-sin(2 * M_PI * j / len));
+            }
+        }
+        for (size_t k = 0; k <= m_; k++) {
+            split_cos_.push_back(cos(2 * M_PI * k / n_));
+            split_sin_.push_back(-sin(2 * M_PI * k / n_));
+        }
+        zr_.resize(m_);
+        zi_.resize(m_);
+    }
+
+    size_t Size() const { return n_; }
+    size_t NumBins() const { return m_ + 1; }
+
+    // x has Size() samples; re and im receive NumBins() bins, unscaled.
+    void Forward(const float *x, float *re, float *im) {
+        for (size_t k = 0; k < m_; k++) {
+            zr_[bitrev_[k]] = x[2 * k];
+            zi_[bitrev_[k]] = x[2 * k + 1];
+        }
+        Butterflies(&zr_[0], &zi_[0]);
+        for (size_t k = 0; k <= m_; k++) {
+            size_t a = k % m_, b = (m_ - k) % m_;
+            float er = 0.5f * (zr_[a] + zr_[b]), ei = 0.5f * (zi_[a] - zi_[b]);
+            float orr = 0.5f * (zi_[a] + zi_[b]), oi = -0.5f * (zr_[a] - zr_[b]);
+            re[k] = er + split_cos_[k] * orr - split_sin_[k] * oi;
+            im[k] = ei + split_cos_[k] * oi + split_sin_[k] * orr;
+        }
+    }
+
+    // Inverse of Forward(), including the 1/Size() scaling.
+    void Inverse(const float *re, const float *im, float *x) {
+        for (size_t k = 0; k < m_; k++) {
+            size_t b = m_ - k;
+            float er = 0.5f * (re[k] + re[b]), ei = 0.5f * (im[k] - im[b]);
+            float dr = 0.5f * (re[k] - re[b]), di = 0.5f * (im[k] + im[b]);
+            // Fo = D * conj(W^k)
+            float orr = dr * split_cos_[k] + di * split_sin_[k];
+            float oi = di * split_cos_[k] - dr * split_sin_[k];
+            // Z = Fe + i * Fo, conjugated so the forward butterflies invert it.
+            zr_[bitrev_[k]] = er - oi;
+            zi_[bitrev_[k]] = -(ei + orr);
+        }
+        Butterflies(&zr_[0], &zi_[0]);
+        float scale = 1.0f / m_;
+        for (size_t k = 0; k < m_; k++) {
+            x[2 * k] = zr_[k] * scale;
+            x[2 * k + 1] = -zi_[k] * scale;
+        }
+    }
+
+private:
+    void Butterflies(float *re, float *im) {
+        const float *wc = &stage_cos_[0], *ws = &stage_sin_[0];
+        for (size_t len = 2; len <= m_; len <<= 1) {
+            size_t half = len / 2;
+            for (size_t start = 0; start < m_; start += len) {
+                float *ar = re + start, *ai = im + start, *br = ar + half, *bi = ai + half;
+                for (size_t j = 0; j < half; j++) {
+                    float tr = br[j] * wc[j] - bi[j] * ws[j];
+                    float ti = br[j] * ws[j] + bi[j] * wc[j];
+                    br[j] = ar[j] - tr;
+                    bi[j] = ai[j] - ti;
+                    ar[j] += tr;
+                    ai[j] += ti;
+                }
+            }
+            wc += half;
+            ws += half;
+        }
+    }
+
+    size_t n_, m_;
+    std::vector<size_t> bitrev_;
+    std::vector<float> stage_cos_, stage_sin_, split_cos_, split_sin_;
+    std::vector<float> zr_, zi_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // FFT_H_
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "fixed_point_stages.h"
+#include "wav_block_reader.h"
+
+extern "C"
+{
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+
+static void help(const char *argv0) {
+    cout << "fixed_point_bench [options]" << endl;
+    cout << "Runs resample (to 16k) -> 6-mic mixdown -> gain over each recording with float and with Q15" << endl;
+    cout << "stages, compares the int16 outputs sample by sample and reports per-stage throughput. The float" << endl;
+    cout << "path's conversions to and from float planar are timed as a row of their own." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=INPUT_FILE_NAME               An 8-chl 48k wav file, may be repeated," << endl;
+    cout << "                                           default is a.wav athing.wav t.wav te.wav" << endl;
+    cout << "  -g, --gain=DB                            Gain of the last stage, default is 12" << endl;
+    cout << "  -r, --repeat=TIMES                       Passes over each file for the timing, default is 10" << endl;
+    cout << "  -t, --tolerance=LSB                      Largest accepted difference ahead of the gain stage, default is 2;" << endl;
+    cout << "                                           the output may differ by that times the gain, plus one" << endl;
+}
+
+static double ThreadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct ChainRun {
+    vector<int16_t> output;
+    vector<double> stage_seconds;
+    double total_seconds = 0;
+};
+
+// Runs the blocks through the stages in this thread. Float stages get
+// float32 planar blocks, converted once on each end; Q15 stages get int16.
+static bool RunChain(StageArithmetic arithmetic, const vector<AudioBlock> &blocks, size_t num_channels, int rate,
+                     float gain_db, int repeat, ChainRun *run) {
+    vector<float> mixdown(num_channels, 0.0f);
+    fill(mixdown.begin(), mixdown.begin() + 6, 1.0f / 6);
+    unique_ptr<ChainStage> resample(CreateResampleStage(16000, arithmetic));
+    unique_ptr<ChainStage> mix(CreateChannelMixStage(mixdown, num_channels, arithmetic));
+    unique_ptr<ChainStage> gain(CreateGainStage(gain_db, arithmetic));
+    vector<ChainStage *> stages = {resample.get(), mix.get(), gain.get()};
+    for (size_t i = 0; i < stages.size(); i++) {
+        if (!stages[i] || !stages[i]->Prepare(num_channels, rate, BLOCK_SIZE_MS)) return false;
+        num_channels = stages[i]->GetNumOutputChannels(num_channels);
+        rate = stages[i]->GetOutputRate(rate);
+    }
+
+    // The last entry is the format conversions on both ends of the chain.
+    run->stage_seconds.assign(stages.size() + 1, 0.0);
+    double &convert_seconds = run->stage_seconds.back();
+    AudioBlock block;
+    for (int r = 0; r < repeat; r++) {
+        for (size_t b = 0; b < blocks.size(); b++) {
+            block = blocks[b];
+            double start = ThreadCpuSeconds();
+            if (arithmetic == kFloatArithmetic) ConvertToFloatPlanar(&block);
+            convert_seconds += ThreadCpuSeconds() - start;
+            for (size_t i = 0; i < stages.size(); i++) {
+                double t = ThreadCpuSeconds();
+                stages[i]->ProcessBlock(&block);
+                run->stage_seconds[i] += ThreadCpuSeconds() - t;
+            }
+            double t = ThreadCpuSeconds();
+            ConvertToInt16Interleaved(&block);
+            convert_seconds += ThreadCpuSeconds() - t;
+            run->total_seconds += ThreadCpuSeconds() - start;
+            if (r == 0) run->output.insert(run->output.end(), block.Samples(), block.Samples() + block.NumFrames() * block.num_channels);
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    vector<string> sources;
+    float gain_db = 12;
+    int repeat = 10, tolerance = 2;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"gain",         1, NULL, 'g'},
+        {"repeat",       1, NULL, 'r'},
+        {"tolerance",    1, NULL, 't'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:g:r:t:h", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            sources.push_back(string(optarg));
+            break;
+        case 'g':
+            gain_db = stof(optarg);
+            break;
+        case 'r':
+            repeat = max(1, stoi(optarg));
+            break;
+        case 't':
+            tolerance = stoi(optarg);
+            break;
+        default:
+            return 0;
+        }
+    }
+    if (sources.empty()) sources = {"a.wav", "athing.wav", "t.wav", "te.wav"};
+
+    const char *stage_names[] = {"resample", "mixdown", "gain", "convert"};
+    int limit = static_cast<int>(tolerance * max(1.0, pow(10.0, gain_db / 20.0))) + 1;
+    bool pass = true;
+    cout << fixed << setprecision(2);
+    for (size_t f = 0; f < sources.size(); f++) {
+        unique_ptr<WavBlockReader> reader(WavBlockReader::Create(sources[f], BLOCK_SIZE_MS));
+        if (!reader || reader->GetNumChannels() < 6 || reader->GetRate() % 16000 != 0) {
+            cout << "Error : " << sources[f] << " must be a 16k-multiple wav with at least 6 channels" << endl;
+            return -1;
+        }
+        vector<AudioBlock> blocks;
+        AudioBlock block;
+        while (reader->Read(&block)) blocks.push_back(block);
+
+        ChainRun float_run, q15_run;
+        if (!RunChain(kFloatArithmetic, blocks, reader->GetNumChannels(), reader->GetRate(), gain_db, repeat, &float_run) ||
+            !RunChain(kFixedQ15Arithmetic, blocks, reader->GetNumChannels(), reader->GetRate(), gain_db, repeat, &q15_run)) {
+            cout << "Error : could not build the chain for " << sources[f] << endl;
+            return -1;
+        }
+
+        size_t n = min(float_run.output.size(), q15_run.output.size()), exact = 0;
+        double err = 0, sig = 0;
+        int worst = 0;
+        for (size_t i = 0; i < n; i++) {
+            int d = q15_run.output[i] - float_run.output[i];
+            worst = max(worst, abs(d));
+            exact += d == 0;
+            err += double(d) * d;
+            sig += double(float_run.output[i]) * float_run.output[i];
+        }
+        bool ok = worst <= limit && n > 0;
+        pass = pass && ok;
+        cout << sources[f] << ": " << n << " samples, " << 100.0 * exact / max<size_t>(n, 1) << "% bit-exact, rms error "
+             << sqrt(err / max<size_t>(n, 1)) << " LSB, worst " << worst << " LSB";
+        if (err > 0) cout << ", SNR " << 10 * log10(sig / err) << " dB";
+        cout << (ok ? "  ok" : "  FAIL") << " (limit " << limit << ")" << endl;
+
+        size_t total_blocks = blocks.size() * repeat;
+        double audio_seconds = total_blocks * BLOCK_SIZE_MS / 1000.0;
+        cout << "  " << setw(10) << "us/block" << setw(12) << "float" << setw(12) << "q15" << setw(10) << "speedup" << endl;
+        for (size_t i = 0; i < float_run.stage_seconds.size(); i++) {
+            cout << "  " << setw(10) << stage_names[i] << setw(12) << float_run.stage_seconds[i] * 1e6 / total_blocks
+                 << setw(12) << q15_run.stage_seconds[i] * 1e6 / total_blocks << setw(9)
+                 << float_run.stage_seconds[i] / q15_run.stage_seconds[i] << "x" << endl;
+        }
+        cout << "  " << setw(10) << "total" << setw(12) << float_run.total_seconds * 1e6 / total_blocks << setw(12)
+             << q15_run.total_seconds * 1e6 / total_blocks << setw(9) << float_run.total_seconds / q15_run.total_seconds
+             << "x   (" << audio_seconds / q15_run.total_seconds << "x realtime in Q15)" << endl;
+    }
+    cout << (pass ? "PASS" : "FAIL") << endl;
+    return pass ? 0 : 1;
+}
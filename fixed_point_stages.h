@@ -0,0 +1,200 @@
+#ifndef FIXED_POINT_STAGES_H_
+#define FIXED_POINT_STAGES_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "dsp_stages.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+// Q15 counterparts of the stages in dsp_stages.h for boards without a fast
+// FPU. Samples stay int16 (Q15) end to end, coefficients are Q15 and sums are
+// 32-bit Q30 accumulators, rounded once per output sample. Results track the
+// float stages to within an LSB or two; fixed_point_bench measures both that
+// and the throughput.
+
+enum StageArithmetic {
+    kFloatArithmetic,
+    kFixedQ15Arithmetic,
+};
+
+// Build with -DRESPEAKER_EXT_FIXED_POINT to make the Create*Stage() helpers
+// below default to Q15, the way -DWEBRTC_NS_FIXED selects the fixed-point
+// noise suppressor.
+#if defined(RESPEAKER_EXT_FIXED_POINT)
+const StageArithmetic kDefaultStageArithmetic = kFixedQ15Arithmetic;
+#else
+const StageArithmetic kDefaultStageArithmetic = kFloatArithmetic;
+#endif
+
+class Q15ResampleStage : public ChainStage {
+public:
+    static Q15ResampleStage *Create(int output_rate = 16000, int taps_per_phase = 16) {
+        if (output_rate <= 0 || taps_per_phase <= 0) return nullptr;
+        return new Q15ResampleStage(output_rate, taps_per_phase);
+    }
+
+    std::string Name() const override { return "resample_q15"; }
+    int GetOutputRate(int input_rate) const override { return output_rate_; }
+
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override {
+        if (rate % output_rate_ != 0) return false;
+        factor_ = rate / output_rate_;
+        std::vector<float> h = ResampleStage::DesignTaps(factor_, taps_per_phase_);
+        // Round the taps, then put the rounding error on the centre tap so
+        // the DC gain is exactly one.
+        taps_.resize(h.size());
+        int32_t sum = 0;
+        for (size_t i = 0; i < h.size(); i++) {
+            taps_[i] = static_cast<int16_t>(lrint(h[i] * 32768.0f));
+            sum += taps_[i];
+        }
+        taps_[h.size() / 2] += static_cast<int16_t>(32768 - sum);
+        history_.assign(num_channels, std::vector<int16_t>(taps_.size() - 1, 0));
+        return true;
+    }
+
+    void ProcessBlock(AudioBlock *block) override {
+        size_t ch = block->num_channels, frames = block->NumFrames();
+        if (frames == 0) return;
+        size_t out_frames = 0;
+        const int16_t *s = block->Samples();
+        for (size_t c = 0; c < ch; c++) {
+            std::vector<int16_t> &h = history_[c];
+            size_t old = h.size();
+            h.resize(old + frames);
+            for (size_t n = 0; n < frames; n++) h[old + n] = s[n * ch + c];
+            out_frames = (h.size() - (taps_.size() - 1)) / factor_;
+        }
+
+        // Every channel's input is in its history by now, so the shorter
+        // output can be written in place.
+        int16_t *d = block->Samples();
+        for (size_t c = 0; c < ch; c++) {
+            std::vector<int16_t> &h = history_[c];
+            for (size_t m = 0; m < out_frames; m++) {
+                d[m * ch + c] = simd::RoundQ30ToQ15(simd::DotQ15(&taps_[0], &h[m * factor_], taps_.size()));
+            }
+            h.erase(h.begin(), h.begin() + out_frames * factor_);
+        }
+        block->rate = output_rate_;
+        block->sample_index /= factor_;
+        block->data.resize(out_frames * ch * sizeof(int16_t));
+    }
+
+private:
+    Q15ResampleStage(int output_rate, int taps_per_phase)
+        : output_rate_(output_rate), taps_per_phase_(taps_per_phase), factor_(1) {}
+
+    int output_rate_, taps_per_phase_;
+    size_t factor_;
+    std::vector<int16_t> taps_;
+    std::vector<std::vector<int16_t>> history_;
+};
+
+class Q15ChannelMixStage : public ChainStage {
+public:
+    // Every weight must be in (-1, 1) and each output's sum of |weights|
+    // below 2, which keeps the Q30 accumulator in range.
+    static Q15ChannelMixStage *Create(const std::vector<float> &weights, size_t num_inputs) {
+        if (num_inputs == 0 || weights.empty() || weights.size() % num_inputs != 0) return nullptr;
+        std::vector<int16_t> q(weights.size());
+        for (size_t o = 0; o < weights.size() / num_inputs; o++) {
+            float total = 0;
+            for (size_t c = 0; c < num_inputs; c++) {
+                float w = weights[o * num_inputs + c];
+                if (w <= -1.0f || w >= 1.0f) return nullptr;
+                total += std::fabs(w);
+                q[o * num_inputs + c] = static_cast<int16_t>(lrint(w * 32768.0f));
+            }
+            if (total >= 2.0f) return nullptr;
+        }
+        return new Q15ChannelMixStage(q, num_inputs);
+    }
+
+    std::string Name() const override { return "channel_mix_q15"; }
+    size_t GetNumOutputChannels(size_t num_input_channels) const override { return num_outputs_; }
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override { return num_channels == num_inputs_; }
+
+    void ProcessBlock(AudioBlock *block) override {
+        size_t frames = block->NumFrames();
+        if (frames == 0) return;
+        const int16_t *s = block->Samples();
+        out_.resize(frames * num_outputs_);
+        acc_.resize(frames);
+        for (size_t o = 0; o < num_outputs_; o++) {
+            std::fill(acc_.begin(), acc_.end(), 0);
+            for (size_t c = 0; c < num_inputs_; c++) {
+                int32_t w = weights_[o * num_inputs_ + c];
+                if (w == 0) continue;
+                const int16_t *x = s + c;
+                for (size_t n = 0; n < frames; n++) acc_[n] += w * x[n * num_inputs_];
+            }
+            for (size_t n = 0; n < frames; n++) out_[n * num_outputs_ + o] = simd::RoundQ30ToQ15(acc_[n]);
+        }
+        block->num_channels = num_outputs_;
+        block->data.assign(reinterpret_cast<const char *>(&out_[0]), out_.size() * sizeof(int16_t));
+    }
+
+private:
+    Q15ChannelMixStage(const std::vector<int16_t> &weights, size_t num_inputs)
+        : weights_(weights), num_inputs_(num_inputs), num_outputs_(weights.size() / num_inputs) {}
+
+    std::vector<int16_t> weights_, out_;
+    std::vector<int32_t> acc_;
+    size_t num_inputs_, num_outputs_;
+};
+
+class Q15GainStage : public ChainStage {
+public:
+    static Q15GainStage *Create(float gain_db) {
+        if (gain_db > 84.0f) return nullptr;
+        return new Q15GainStage(gain_db);
+    }
+
+    std::string Name() const override { return "gain_q15"; }
+
+    // The gain is a Q15 mantissa times 2^shift; for gains above 0.5 the
+    // mantissa is in [0.5, 1) and keeps full precision.
+    void SetGainDb(float gain_db) {
+        double gain = pow(10.0, gain_db / 20.0);
+        shift_ = 0;
+        while (shift_ < 14 && lrint(gain / (1 << shift_) * 32768.0) > 32767) shift_++;
+        mantissa_ = static_cast<int16_t>(std::min(32767L, lrint(gain / (1 << shift_) * 32768.0)));
+    }
+
+    void ProcessBlock(AudioBlock *block) override {
+        simd::ScaleQ15(mantissa_, shift_, block->Samples(), block->NumFrames() * block->num_channels);
+    }
+
+private:
+    explicit Q15GainStage(float gain_db) { SetGainDb(gain_db); }
+
+    int16_t mantissa_;
+    int shift_;
+};
+
+// Chain construction helpers: the same stage in float or Q15 arithmetic.
+inline ChainStage *CreateResampleStage(int output_rate, StageArithmetic arithmetic = kDefaultStageArithmetic,
+                                       int taps_per_phase = 16) {
+    if (arithmetic == kFixedQ15Arithmetic) return Q15ResampleStage::Create(output_rate, taps_per_phase);
+    return ResampleStage::Create(output_rate, taps_per_phase);
+}
+
+inline ChainStage *CreateChannelMixStage(const std::vector<float> &weights, size_t num_inputs,
+                                         StageArithmetic arithmetic = kDefaultStageArithmetic) {
+    if (arithmetic == kFixedQ15Arithmetic) return Q15ChannelMixStage::Create(weights, num_inputs);
+    return ChannelMixStage::Create(weights, num_inputs);
+}
+
+inline ChainStage *CreateGainStage(float gain_db, StageArithmetic arithmetic = kDefaultStageArithmetic) {
+    if (arithmetic == kFixedQ15Arithmetic) return Q15GainStage::Create(gain_db);
+    return GainStage::Create(gain_db);
+}
+
+}  // namespace respeaker_ext
+
+#endif  // FIXED_POINT_STAGES_H_
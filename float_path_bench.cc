@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "chain_executor.h"
+#include "dsp_stages.h"
+#include "gcc_phat_doa.h"
+#include "mic_geometry.h"
+#include "ref_delay_estimator.h"
+#include "wav_block_reader.h"
+
+extern "C"
+{
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+
+static void help(const char *argv0) {
+    cout << "float_path_bench [options]" << endl;
+    cout << "Runs a 48k 8-chl recording through resample -> -gain -> ref delay -> +gain -> doa twice: once" << endl;
+    cout << "requantizing to int16 after every stage, once carried as float32 planar and converted only at" << endl;
+    cout << "the sink. Reports CPU per block, conversions, and how far the int16 output is from the float one." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=INPUT_FILE_NAME               The 8-chl 48k input wav file, default is a.wav" << endl;
+    cout << "  -g, --gain=DB                            Headroom taken by the first gain stage and made up by the second, default is 12" << endl;
+    cout << "  -r, --repeat=TIMES                       Passes over the file, default is 20" << endl;
+}
+
+static double ProcessCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct RunResult {
+    double cpu_seconds;
+    uint64_t conversions;
+    vector<int16_t> output;
+};
+
+static RunResult Run(const vector<AudioBlock> &blocks, size_t num_channels, int rate, float gain_db, int repeat,
+                     SampleFormat format) {
+    MicGeometry geometry;
+    MicGeometry::FromMicType("CIRCULAR_6MIC_7BEAM", 0, &geometry);
+    unique_ptr<ResampleStage> resample(ResampleStage::Create(16000));
+    unique_ptr<GainStage> cut(GainStage::Create(-gain_db));
+    unique_ptr<RefDelayCompensationStage> ref_delay(RefDelayCompensationStage::Create(6));
+    unique_ptr<GainStage> boost(GainStage::Create(gain_db));
+    unique_ptr<GccPhatDoaStage> doa(GccPhatDoaStage::Create(geometry));
+    vector<ChainStage *> stages = {resample.get(), cut.get(), ref_delay.get(), boost.get(), doa.get()};
+
+    RunResult result;
+    WorkStealingPool pool(1);
+    PooledExecutor executor(&pool);
+    executor.SetSampleFormat(format);
+    bool keep = true;
+    if (!executor.Prepare(stages, num_channels, rate, BLOCK_SIZE_MS, [&result, &keep](const ChainExecutor::BlockPtr &b) {
+            if (keep) result.output.insert(result.output.end(), b->Samples(), b->Samples() + b->NumFrames() * b->num_channels);
+        })) {
+        cout << "Error : chain rejected the input format" << endl;
+        exit(-1);
+    }
+
+    double start = ProcessCpuSeconds();
+    for (int r = 0; r < repeat; r++) {
+        keep = r == 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            executor.Push(ChainExecutor::BlockPtr(new AudioBlock(blocks[i])));
+        }
+        executor.WaitIdle();
+    }
+    result.cpu_seconds = ProcessCpuSeconds() - start;
+    result.conversions = executor.GetNumConversions();
+    return result;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    string source = "a.wav";
+    float gain_db = 12;
+    int repeat = 20;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"gain",         1, NULL, 'g'},
+        {"repeat",       1, NULL, 'r'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:g:r:h", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            source = string(optarg);
+            break;
+        case 'g':
+            gain_db = stof(optarg);
+            break;
+        case 'r':
+            repeat = max(1, stoi(optarg));
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    unique_ptr<WavBlockReader> reader(WavBlockReader::Create(source, BLOCK_SIZE_MS));
+    if (!reader || reader->GetNumChannels() < 7 || reader->GetRate() % 16000 != 0) {
+        cout << "Error : " << source << " must be a 48k (or 32k) wav with 6 mics and a reference" << endl;
+        return -1;
+    }
+    vector<AudioBlock> blocks;
+    AudioBlock block;
+    while (reader->Read(&block)) blocks.push_back(block);
+    double audio_seconds = blocks.size() * BLOCK_SIZE_MS / 1000.0 * repeat;
+
+    RunResult int16_run = Run(blocks, reader->GetNumChannels(), reader->GetRate(), gain_db, repeat, kInt16Interleaved);
+    RunResult float_run = Run(blocks, reader->GetNumChannels(), reader->GetRate(), gain_db, repeat, kFloat32Planar);
+
+    size_t total_blocks = blocks.size() * repeat;
+    cout << fixed << setprecision(2);
+    cout << setw(10) << "format" << setw(14) << "us/block" << setw(14) << "x realtime" << setw(16) << "exec conv/blk" << endl;
+    const RunResult *runs[] = {&int16_run, &float_run};
+    const char *names[] = {"int16", "float32"};
+    for (int i = 0; i < 2; i++) {
+        cout << setw(10) << names[i] << setw(14) << runs[i]->cpu_seconds * 1e6 / total_blocks << setw(14)
+             << audio_seconds / runs[i]->cpu_seconds << setw(16) << double(runs[i]->conversions) / total_blocks << endl;
+    }
+
+    // The float32 run quantizes once, so it is the reference.
+    size_t n = min(int16_run.output.size(), float_run.output.size());
+    double err = 0, sig = 0;
+    int worst = 0;
+    for (size_t i = 0; i < n; i++) {
+        int d = int16_run.output[i] - float_run.output[i];
+        worst = max(worst, abs(d));
+        err += double(d) * d;
+        sig += double(float_run.output[i]) * float_run.output[i];
+    }
+    cout << endl << "int16 vs float32 output over " << n << " samples: rms error " << sqrt(err / max<size_t>(n, 1))
+         << " LSB, worst " << worst << " LSB";
+    if (err > 0) cout << ", SNR " << 10 * log10(sig / err) << " dB";
+    cout << endl;
+    cout << "CPU saved by the float32 path: " << 100 * (1 - float_run.cpu_seconds / int16_run.cpu_seconds) << "%" << endl;
+    return 0;
+}
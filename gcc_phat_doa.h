@@ -0,0 +1,275 @@
+#ifndef GCC_PHAT_DOA_H_
+#define GCC_PHAT_DOA_H_
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "chain_stage.h"
+#include "fft.h"
+#include "mic_geometry.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+struct DoaEstimate {
+    uint64_t sequence;   // last block folded into the estimate
+    int angle;           // degrees, [0, 360)
+    float confidence;    // spatial spectrum peak over its mean, ~1 when diffuse
+    bool valid;          // false when every block of the interval was gated as silence
+};
+
+// Pair/lag tables for one geometry, rate and FFT size. Built once and shared
+// by every DOA stage running the same array.
+class GccPhatTables {
+public:
+    GccPhatTables(const MicGeometry &geometry, int rate, size_t fft_size, int angle_step_deg, int low_hz, int high_hz,
+                  int lag_steps_per_sample = 4)
+        : num_mics_(geometry.NumMics()), angle_step_(angle_step_deg), lag_resolution_(lag_steps_per_sample) {
+        const float c = 343.0f;
+        first_bin_ = std::max<size_t>(1, low_hz * fft_size / rate);
+        last_bin_ = std::min<size_t>(fft_size / 2, high_hz * fft_size / rate);
+        size_t band = last_bin_ - first_bin_;
+
+        for (size_t i = 0; i < num_mics_; i++) {
+            for (size_t j = i + 1; j < num_mics_; j++) pairs_.push_back(std::make_pair(i, j));
+        }
+        max_lag_ = static_cast<int>(ceil(geometry.MaxPairDistance() / c * rate)) + 1;
+        num_lags_ = 2 * max_lag_ * lag_resolution_ + 1;
+
+        // Correlation basis: r(l) = sum_k Cr[k] cos(w_k l) - Ci[k] sin(w_k l).
+        cos_.resize(num_lags_ * band);
+        sin_.resize(num_lags_ * band);
+        for (size_t g = 0; g < num_lags_; g++) {
+            float lag = LagOf(g);
+            for (size_t k = 0; k < band; k++) {
+                float w = 2 * M_PI * (first_bin_ + k) / fft_size;
+                cos_[g * band + k] = cos(w * lag);
+                sin_[g * band + k] = sin(w * lag);
+            }
+        }
+
+        // For every angle and pair, the grid lag where the correlation of the
+        // pair peaks for a far-field source at that angle. Mic m hears the
+        // source -(p_m . u) / c late relative to the center; GCC of (i, j)
+        // peaks at the negative of how much j lags i.
+        num_angles_ = 360 / angle_step_;
+        used_.assign(pairs_.size() * num_lags_, false);
+        table_.resize(num_angles_ * pairs_.size());
+        for (size_t a = 0; a < num_angles_; a++) {
+            float theta = a * angle_step_ * M_PI / 180.0f;
+            float ux = cos(theta), uy = sin(theta);
+            for (size_t p = 0; p < pairs_.size(); p++) {
+                size_t i = pairs_[p].first, j = pairs_[p].second;
+                float di = -(geometry.x[i] * ux + geometry.y[i] * uy) / c * rate;
+                float dj = -(geometry.x[j] * ux + geometry.y[j] * uy) / c * rate;
+                size_t g = static_cast<size_t>(lround((-(dj - di) + max_lag_) * lag_resolution_));
+                table_[a * pairs_.size() + p] = g;
+                used_[p * num_lags_ + g] = true;
+            }
+        }
+    }
+
+    size_t NumMics() const { return num_mics_; }
+    size_t NumPairs() const { return pairs_.size(); }
+    size_t NumLags() const { return num_lags_; }
+    size_t NumAngles() const { return num_angles_; }
+    int AngleStep() const { return angle_step_; }
+    size_t FirstBin() const { return first_bin_; }
+    size_t BandBins() const { return last_bin_ - first_bin_; }
+    const std::pair<size_t, size_t> &Pair(size_t p) const { return pairs_[p]; }
+    bool Used(size_t pair, size_t lag) const { return used_[pair * num_lags_ + lag]; }
+    const float *Cos(size_t lag) const { return &cos_[lag * BandBins()]; }
+    const float *Sin(size_t lag) const { return &sin_[lag * BandBins()]; }
+    size_t LagIndex(size_t angle, size_t pair) const { return table_[angle * pairs_.size() + pair]; }
+
+private:
+    float LagOf(size_t g) const { return static_cast<float>(g) / lag_resolution_ - max_lag_; }
+
+    size_t num_mics_;
+    int angle_step_;
+    int lag_resolution_;
+    size_t first_bin_, last_bin_;
+    std::vector<std::pair<size_t, size_t> > pairs_;
+    int max_lag_;
+    size_t num_lags_, num_angles_;
+    std::vector<float> cos_, sin_;
+    std::vector<size_t> table_;
+    std::vector<bool> used_;
+};
+
+// Direction of arrival from GCC-PHAT over every mic pair, independent of any
+// keyword spotter. Each block slides a 32 ms window per mic, one FFT per mic
+// gives the whitened cross spectra of all pairs, and each pair's correlation
+// is evaluated only at the quarter-sample lags the angle table needs, as
+// SIMD dot products against the cached basis. The per-angle sums over pairs
+// (steered response power) are accumulated and published every publish_ms.
+// Blocks near the noise floor are left out of the accumulation.
+class GccPhatDoaStage : public ChainStage {
+public:
+    typedef std::function<void(const DoaEstimate &)> Callback;
+
+    static GccPhatDoaStage *Create(const MicGeometry &geometry, int publish_ms = 100, Callback callback = Callback(),
+                                   int angle_step_deg = 2) {
+        if (geometry.NumMics() < 2 || 360 % angle_step_deg != 0) return nullptr;
+        return new GccPhatDoaStage(geometry, publish_ms, callback, angle_step_deg);
+    }
+
+    std::string Name() const override { return "gcc_phat_doa"; }
+    bool SupportsFloatPlanar() const override { return true; }
+
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override {
+        if (num_channels < geometry_.NumMics()) return false;
+        size_t fft_size = 1;
+        while (fft_size < static_cast<size_t>(rate * 32 / 1000)) fft_size <<= 1;
+        if (!tables_ || rate != rate_) {
+            tables_.reset(new GccPhatTables(geometry_, rate, fft_size, angle_step_, 300, 3800));
+        }
+        rate_ = rate;
+        fft_.reset(new Fft(fft_size));
+        window_.resize(fft_size);
+        for (size_t i = 0; i < fft_size; i++) window_[i] = 0.5f - 0.5f * cos(2 * M_PI * i / (fft_size - 1));
+        size_t mics = geometry_.NumMics(), bins = fft_->NumBins();
+        history_.assign(mics * fft_size, 0.0f);
+        re_.resize(mics * bins);
+        im_.resize(mics * bins);
+        frame_.resize(fft_size);
+        cr_.resize(tables_->BandBins());
+        ci_.resize(tables_->BandBins());
+        corr_.resize(tables_->NumPairs() * tables_->NumLags());
+        spectrum_.assign(tables_->NumAngles(), 0.0f);
+        publish_frames_ = static_cast<size_t>(rate) * publish_ms_ / 1000;
+        frames_since_publish_ = 0;
+        accumulated_ = 0;
+        return true;
+    }
+
+    void ProcessBlock(AudioBlock *block) override {
+        size_t mics = geometry_.NumMics(), n = fft_->Size(), frames = std::min(block->NumFrames(), n);
+        size_t bins = fft_->NumBins(), first = tables_->FirstBin(), band = tables_->BandBins();
+
+        // Slide each mic's window and transform it.
+        float energy = 0;
+        for (size_t m = 0; m < mics; m++) {
+            float *h = &history_[m * n];
+            std::copy(h + frames, h + n, h);
+            if (block->format == kFloat32Planar) {
+                const float *x = block->Channel(m) + block->NumFrames() - frames;
+                std::copy(x, x + frames, h + n - frames);
+            }
+            else {
+                simd::DeinterleaveToFloat(block->Samples() + (block->NumFrames() - frames) * block->num_channels,
+                                          block->num_channels, m, frames, 1.0f / 32768, h + n - frames);
+            }
+            energy += simd::Dot(h + n - frames, h + n - frames, frames);
+            simd::Multiply(h, &window_[0], &frame_[0], n);
+            fft_->Forward(&frame_[0], &re_[m * bins], &im_[m * bins]);
+        }
+        float level_db = 10.0f * log10(energy / (frames * mics) + 1e-12f);
+        bool active = Active(level_db);
+
+        if (active) {
+            for (size_t p = 0; p < tables_->NumPairs(); p++) {
+                size_t i = tables_->Pair(p).first, j = tables_->Pair(p).second;
+                const float *ar = &re_[i * bins + first], *ai = &im_[i * bins + first];
+                const float *br = &re_[j * bins + first], *bi = &im_[j * bins + first];
+                for (size_t k = 0; k < band; k++) {
+                    float r = ar[k] * br[k] + ai[k] * bi[k];
+                    float im = ai[k] * br[k] - ar[k] * bi[k];
+                    float inv = 1.0f / (sqrt(r * r + im * im) + 1e-12f);
+                    cr_[k] = r * inv;
+                    ci_[k] = im * inv;
+                }
+                for (size_t g = 0; g < tables_->NumLags(); g++) {
+                    if (!tables_->Used(p, g)) continue;
+                    corr_[p * tables_->NumLags() + g] =
+                        simd::Dot(&cr_[0], tables_->Cos(g), band) - simd::Dot(&ci_[0], tables_->Sin(g), band);
+                }
+            }
+            for (size_t a = 0; a < tables_->NumAngles(); a++) {
+                float sum = 0;
+                for (size_t p = 0; p < tables_->NumPairs(); p++) {
+                    sum += corr_[p * tables_->NumLags() + tables_->LagIndex(a, p)];
+                }
+                spectrum_[a] += sum;
+            }
+            accumulated_++;
+        }
+
+        frames_since_publish_ += block->NumFrames();
+        if (frames_since_publish_ >= publish_frames_) {
+            Publish(block->sequence);
+            frames_since_publish_ = 0;
+        }
+    }
+
+    const DoaEstimate &GetEstimate() const { return estimate_; }
+    const GccPhatTables &GetTables() const { return *tables_; }
+
+private:
+    GccPhatDoaStage(const MicGeometry &geometry, int publish_ms, Callback callback, int angle_step_deg)
+        : geometry_(geometry), publish_ms_(publish_ms), callback_(callback), angle_step_(angle_step_deg), rate_(0),
+          floor_db_(0.0f), floor_primed_(false), hangover_(0) {
+        estimate_.sequence = 0;
+        estimate_.angle = 0;
+        estimate_.confidence = 0.0f;
+        estimate_.valid = false;
+    }
+
+    // Noise floor tracking as in MultiBeamKwsStage: falls at once, rises
+    // slowly; blocks within 6 dB of it (after a 200 ms hangover) are silence.
+    bool Active(float level_db) {
+        if (!floor_primed_ || level_db < floor_db_) {
+            floor_db_ = level_db;
+            floor_primed_ = true;
+        }
+        else {
+            floor_db_ += 0.04f;
+        }
+        if (level_db > floor_db_ + 6.0f) hangover_ = 25;
+        else if (hangover_ > 0) hangover_--;
+        return hangover_ > 0;
+    }
+
+    void Publish(uint64_t sequence) {
+        estimate_.sequence = sequence;
+        estimate_.valid = accumulated_ > 0;
+        if (estimate_.valid) {
+            size_t best = 0;
+            float sum = 0;
+            for (size_t a = 0; a < spectrum_.size(); a++) {
+                if (spectrum_[a] > spectrum_[best]) best = a;
+                sum += spectrum_[a];
+            }
+            // Correlations may be negative; measure the peak over the mean
+            // after shifting the minimum to zero.
+            float low = *std::min_element(spectrum_.begin(), spectrum_.end());
+            float mean = sum / spectrum_.size() - low;
+            estimate_.angle = static_cast<int>(best) * angle_step_;
+            estimate_.confidence = mean > 0 ? (spectrum_[best] - low) / mean : 0.0f;
+        }
+        std::fill(spectrum_.begin(), spectrum_.end(), 0.0f);
+        accumulated_ = 0;
+        if (callback_) callback_(estimate_);
+    }
+
+    MicGeometry geometry_;
+    int publish_ms_;
+    Callback callback_;
+    int angle_step_;
+    int rate_;
+    std::unique_ptr<GccPhatTables> tables_;
+    std::unique_ptr<Fft> fft_;
+    std::vector<float> window_, history_, re_, im_, frame_, cr_, ci_, corr_, spectrum_;
+    size_t publish_frames_, frames_since_publish_, accumulated_;
+    float floor_db_;
+    bool floor_primed_;
+    int hangover_;
+    DoaEstimate estimate_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // GCC_PHAT_DOA_H_
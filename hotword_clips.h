@@ -0,0 +1,218 @@
+#ifndef HOTWORD_CLIPS_H_
+#define HOTWORD_CLIPS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "capture_clock.h"
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sndfile.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace respeaker_ext {
+
+// Where a detection sits in a capture, as read back from an events file.
+struct HotwordMark {
+    int count = 0;
+    int beam = -1;
+    double seconds = 0;
+};
+
+// Appends detections to a tab-separated file next to the capture log, one
+// line per hotword, flushed as it is written so a killed session keeps them:
+//
+//   # count  sample  seconds  beam  latency_ms
+//   1        523264  32.704   -1    41.2
+class HotwordEventLog {
+public:
+    static HotwordEventLog *Create(const std::string &path) {
+        FILE *file = fopen(path.c_str(), "w");
+        if (!file) return nullptr;
+        fprintf(file, "# count\tsample\tseconds\tbeam\tlatency_ms\n");
+        fflush(file);
+        return new HotwordEventLog(file, path);
+    }
+
+    ~HotwordEventLog() { fclose(file_); }
+
+    void Add(const HotwordEvent &event) {
+        fprintf(file_, "%d\t%llu\t%.4f\t%d\t%.1f\n", event.count, static_cast<unsigned long long>(event.sample_index),
+                event.CaptureSeconds(), event.beam, event.LatencyMs());
+        fflush(file_);
+    }
+
+    const std::string &GetPath() const { return path_; }
+
+    // Reads an events file, or a console log of chain_runner or the pulse
+    // demos: lines like "hotword_count = 3, hotword 3 at sample S (T s)".
+    // Console lines without a time are skipped.
+    static bool Load(const std::string &path, std::vector<HotwordMark> *marks, std::string *error) {
+        std::ifstream in(path.c_str());
+        if (!in) {
+            if (error) *error = "can not open " + path;
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            HotwordMark mark;
+            unsigned long long sample;
+            double latency;
+            size_t at = line.find("hotword_count = ");
+            if (at != std::string::npos) {
+                size_t open = line.find(" (", at), close = line.find(" s)", at);
+                if (open == std::string::npos || close == std::string::npos || close < open) continue;
+                mark.count = atoi(line.c_str() + at + 16);
+                mark.seconds = atof(line.c_str() + open + 2);
+                size_t beam = line.find(", beam ", close);
+                if (beam != std::string::npos) mark.beam = atoi(line.c_str() + beam + 7);
+            }
+            else if (line.empty() || line[0] == '#' ||
+                     sscanf(line.c_str(), "%d %llu %lf %d %lf", &mark.count, &sample, &mark.seconds, &mark.beam,
+                            &latency) < 3) {
+                continue;
+            }
+            marks->push_back(mark);
+        }
+        return true;
+    }
+
+private:
+    HotwordEventLog(FILE *file, const std::string &path) : file_(file), path_(path) {}
+
+    FILE *file_;
+    std::string path_;
+};
+
+// A 16-bit PCM wav (RIFF or RF64) mapped read-only. Cutting a clip touches
+// only the pages of that clip; nothing is decoded and the rest of the file is
+// never read. A data chunk whose size was never patched, as left by a
+// session that was killed, is taken to run to the end of the file.
+class MappedWav {
+public:
+    static MappedWav *Open(const std::string &path, std::string *error) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            if (error) *error = "can not open " + path;
+            return nullptr;
+        }
+        struct stat st;
+        void *map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 12) map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            if (error) *error = "can not map " + path;
+            return nullptr;
+        }
+        // Clips are far apart; read-ahead of the whole file would defeat the point.
+        madvise(map, st.st_size, MADV_RANDOM);
+        MappedWav *wav = new MappedWav(path, static_cast<const uint8_t *>(map), st.st_size);
+        if (!wav->Parse(error)) {
+            delete wav;
+            return nullptr;
+        }
+        return wav;
+    }
+
+    ~MappedWav() { munmap(const_cast<uint8_t *>(base_), size_); }
+
+    // Writes frames [begin, begin + frames), clamped to the file, as a wav.
+    // Returns the number of frames written, 0 if nothing of the range is in
+    // the file (and no file is written), or -1.
+    int64_t WriteClip(int64_t begin, int64_t frames, const std::string &out_path) const {
+        begin = std::max<int64_t>(0, std::min(begin, num_frames_));
+        frames = std::min(frames, num_frames_ - begin);
+        if (frames <= 0) return 0;
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        info.samplerate = rate_;
+        info.channels = channels_;
+        info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+        SNDFILE *out = sf_open(out_path.c_str(), SFM_WRITE, &info);
+        if (!out) return -1;
+        sf_count_t written = sf_writef_short(out, Frames() + begin * channels_, frames);
+        sf_close(out);
+        return written == frames ? frames : -1;
+    }
+
+    const int16_t *Frames() const { return reinterpret_cast<const int16_t *>(data_); }
+    int64_t GetNumFrames() const { return num_frames_; }
+    int GetNumChannels() const { return channels_; }
+    int GetRate() const { return rate_; }
+    const std::string &GetPath() const { return path_; }
+
+private:
+    MappedWav(const std::string &path, const uint8_t *base, size_t size)
+        : path_(path), base_(base), size_(size), data_(NULL), num_frames_(0), channels_(0), rate_(0) {}
+
+    static uint32_t U32(const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24; }
+    static uint16_t U16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+    bool Parse(std::string *error) {
+        bool rf64 = memcmp(base_, "RF64", 4) == 0;
+        if ((!rf64 && memcmp(base_, "RIFF", 4) != 0) || memcmp(base_ + 8, "WAVE", 4) != 0) {
+            if (error) *error = path_ + " is not a wav file";
+            return false;
+        }
+        uint64_t data_size64 = 0;
+        int bits = 0, format = 0;
+        for (size_t pos = 12; pos + 8 <= size_;) {
+            const uint8_t *chunk = base_ + pos;
+            uint64_t chunk_size = U32(chunk + 4);
+            // Only the data chunk may be cut short; the fields read from the
+            // others must lie in the file.
+            if (memcmp(chunk, "data", 4) != 0 && chunk_size > size_ - pos - 8) {
+                if (error) *error = path_ + " is truncated";
+                return false;
+            }
+            if (memcmp(chunk, "ds64", 4) == 0 && chunk_size >= 16) {
+                data_size64 = U32(chunk + 16) | static_cast<uint64_t>(U32(chunk + 20)) << 32;
+            }
+            else if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16) {
+                format = U16(chunk + 8);
+                channels_ = U16(chunk + 10);
+                rate_ = U32(chunk + 12);
+                bits = U16(chunk + 22);
+                // WAVE_FORMAT_EXTENSIBLE: the real format is the GUID's first two bytes.
+                if (format == 0xFFFE && chunk_size >= 40) format = U16(chunk + 32);
+            }
+            else if (memcmp(chunk, "data", 4) == 0) {
+                uint64_t available = size_ - pos - 8;
+                if (rf64 && chunk_size == 0xFFFFFFFF) chunk_size = data_size64;
+                if (chunk_size == 0 || chunk_size > available) chunk_size = available;
+                if (format != 1 || bits != 16 || channels_ == 0 || rate_ <= 0) {
+                    if (error) *error = path_ + " is not 16-bit PCM";
+                    return false;
+                }
+                data_ = chunk + 8;
+                num_frames_ = chunk_size / (2 * channels_);
+                return true;
+            }
+            pos += 8 + chunk_size + (chunk_size & 1);
+        }
+        if (error) *error = path_ + " has no data chunk";
+        return false;
+    }
+
+    std::string path_;
+    const uint8_t *base_;
+    size_t size_;
+    const uint8_t *data_;
+    int64_t num_frames_;
+    int channels_, rate_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // HOTWORD_CLIPS_H_
@@ -0,0 +1,267 @@
+#ifndef INTERLEAVED_WAV_READER_H_
+#define INTERLEAVED_WAV_READER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture_clock.h"
+#include "chain_stage.h"
+#include "rt_check.h"
+#include "wav_block_reader.h"
+
+extern "C"
+{
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sndfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace respeaker_ext {
+
+// Streams several wav files in lockstep as one interleaved stream, e.g. the
+// per-channel dumps VepAecBeamformingNode writes (in_0..in_5 and ref_in,
+// 16 kHz mono) put back into the 8-channel layout the collector delivered.
+// Each file contributes all of its channels, in order; an empty path is a
+// silent channel. Blocks are assembled on the fly from one read per file,
+// nothing is merged on disk. The stream ends with the shortest file (or,
+// with loop, restarts all files together there, so they stay aligned).
+class InterleavedWavReader : public BlockSource {
+public:
+    static InterleavedWavReader *Create(const std::vector<std::string> &paths, int block_size_ms, bool loop,
+                                        std::string *error) {
+        InterleavedWavReader *reader = new InterleavedWavReader(loop);
+        for (size_t i = 0; i < paths.size(); i++) {
+            Input input;
+            input.file = nullptr;
+            input.channels = 1;
+            if (!paths[i].empty()) {
+                SF_INFO info;
+                memset(&info, 0, sizeof(info));
+                input.file = sf_open(paths[i].c_str(), SFM_READ, &info);
+                if (!input.file) {
+                    if (error) *error = "can not open " + paths[i];
+                    delete reader;
+                    return nullptr;
+                }
+                if (reader->rate_ && info.samplerate != reader->rate_) {
+                    if (error) *error = paths[i] + " is not at the rate of the files before it";
+                    sf_close(input.file);
+                    delete reader;
+                    return nullptr;
+                }
+                reader->rate_ = info.samplerate;
+                input.channels = info.channels;
+                reader->num_frames_ = reader->num_frames_ < 0 ? info.frames : std::min<int64_t>(reader->num_frames_, info.frames);
+            }
+            reader->inputs_.push_back(input);
+            reader->num_channels_ += input.channels;
+        }
+        if (reader->rate_ == 0) {
+            if (error) *error = "no input files, only silent channels";
+            delete reader;
+            return nullptr;
+        }
+        reader->frames_per_block_ = static_cast<sf_count_t>(reader->rate_) * block_size_ms / 1000;
+        return reader;
+    }
+
+    // The layout a 6-mic collector delivers, rebuilt from a dump directory:
+    // in_0..in_5, then ref_in as channel 6 (the beamformer's reference) and
+    // a silent channel 7.
+    static std::vector<std::string> DumpLayout(const std::string &dir, size_t num_mics = 6) {
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < num_mics; i++) paths.push_back(dir + "/vep_aec_beamforming_node_in_" + std::to_string(i) + ".wav");
+        paths.push_back(dir + "/vep_aec_beamforming_node_ref_in.wav");
+        paths.push_back("");
+        return paths;
+    }
+
+    ~InterleavedWavReader() {
+        for (size_t i = 0; i < inputs_.size(); i++) {
+            if (inputs_[i].file) sf_close(inputs_[i].file);
+        }
+    }
+
+    bool Read(AudioBlock *block) override {
+        if (num_frames_ <= 0) return false;
+        sf_count_t want = frames_per_block_;
+        if (loop_ && next_frame_ % num_frames_ + want > num_frames_) want = num_frames_ - next_frame_ % num_frames_;
+        else if (!loop_) want = std::min<int64_t>(want, num_frames_ - next_frame_);
+        if (want <= 0) return false;
+        block->num_channels = num_channels_;
+        block->rate = rate_;
+        block->sequence = sequence_++;
+        block->sample_index = next_frame_;
+        block->capture_ns = MonotonicNs();
+        block->data.resize(want * num_channels_ * sizeof(int16_t));
+        int16_t *out = block->Samples();
+        size_t channel = 0;
+        for (size_t i = 0; i < inputs_.size(); i++) {
+            const Input &input = inputs_[i];
+            if (!input.file) {
+                for (sf_count_t n = 0; n < want; n++) out[n * num_channels_ + channel] = 0;
+            }
+            else {
+                scratch_.resize(want * input.channels);
+                sf_count_t got = sf_readf_short(input.file, &scratch_[0], want);
+                if (got < want) std::fill(scratch_.begin() + got * input.channels, scratch_.end(), 0);
+                for (sf_count_t n = 0; n < want; n++) {
+                    for (int c = 0; c < input.channels; c++) out[n * num_channels_ + channel + c] = scratch_[n * input.channels + c];
+                }
+            }
+            channel += input.channels;
+        }
+        next_frame_ += want;
+        if (loop_ && next_frame_ % num_frames_ == 0) {
+            for (size_t i = 0; i < inputs_.size(); i++) {
+                if (inputs_[i].file) sf_seek(inputs_[i].file, 0, SEEK_SET);
+            }
+        }
+        return true;
+    }
+
+    size_t GetNumChannels() const override { return num_channels_; }
+    int GetRate() const override { return rate_; }
+    int64_t GetNumFrames() const { return num_frames_; }
+
+private:
+    struct Input {
+        SNDFILE *file;
+        int channels;
+    };
+
+    explicit InterleavedWavReader(bool loop)
+        : loop_(loop), rate_(0), num_channels_(0), num_frames_(-1), sequence_(0), next_frame_(0),
+          frames_per_block_(0) {}
+
+    std::vector<Input> inputs_;
+    bool loop_;
+    int rate_;
+    size_t num_channels_;
+    int64_t num_frames_;
+    uint64_t sequence_;
+    int64_t next_frame_;    // signed like num_frames_, which it is compared with
+    sf_count_t frames_per_block_;
+    std::vector<int16_t> scratch_;
+};
+
+// Feeds an InterleavedWavReader into a named pipe as a 16-bit wav stream,
+// for readers that only take a path, like FileCollectorNode. The header is
+// written with the exact length, since a pipe can not be seeked back to
+// patch it. The reader has to read wav from a pipe (libsndfile does, as it
+// does not need to seek to play a wav through once). Destroying the feeder
+// stops it, whether or not anyone opened the pipe, and removes the pipe.
+class WavPipeFeeder {
+public:
+    static WavPipeFeeder *Create(InterleavedWavReader *source, const std::string &fifo_path, std::string *error) {
+        unlink(fifo_path.c_str());
+        if (mkfifo(fifo_path.c_str(), 0600) != 0) {
+            if (error) *error = "can not create the pipe " + fifo_path + ": " + strerror(errno);
+            return nullptr;
+        }
+        return new WavPipeFeeder(source, fifo_path);
+    }
+
+    ~WavPipeFeeder() {
+        stopping_.store(true);
+        // Lets a writer still waiting for a reader through open().
+        int fd = open(path_.c_str(), O_RDONLY | O_NONBLOCK);
+        thread_.join();
+        if (fd >= 0) close(fd);
+        unlink(path_.c_str());
+    }
+
+    const std::string &GetPath() const { return path_; }
+    uint64_t GetFramesWritten() const { return frames_written_.load(); }
+
+private:
+    WavPipeFeeder(InterleavedWavReader *source, const std::string &path)
+        : source_(source), path_(path), stopping_(false), frames_written_(0) {
+        thread_ = std::thread(&WavPipeFeeder::Feed, this);
+    }
+
+    void Feed() {
+        RtCheck::Exempt();
+        // A reader that goes away makes write() fail with EPIPE instead of
+        // killing the process.
+        sigset_t pipe_signal;
+        sigemptyset(&pipe_signal);
+        sigaddset(&pipe_signal, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipe_signal, NULL);
+        int fd = open(path_.c_str(), O_WRONLY);
+        if (fd < 0) return;
+        // Non-blocking from here, so a reader that stops reading without
+        // closing can not hold up the destructor.
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        uint32_t channels = source_->GetNumChannels(), rate = source_->GetRate();
+        uint32_t data_bytes = static_cast<uint32_t>(std::min<int64_t>(source_->GetNumFrames() * channels * 2, 0xFFFFFFF0LL - 36));
+        uint8_t header[44];
+        memcpy(header, "RIFF", 4);
+        Put32(header + 4, 36 + data_bytes);
+        memcpy(header + 8, "WAVEfmt ", 8);
+        Put32(header + 16, 16);
+        Put32(header + 20, 1 | channels << 16);    // PCM, channels
+        Put32(header + 24, rate);
+        Put32(header + 28, rate * channels * 2);
+        Put32(header + 32, channels * 2 | 16 << 16);    // block align, bits
+        memcpy(header + 36, "data", 4);
+        Put32(header + 40, data_bytes);
+        bool ok = WriteAll(fd, header, sizeof(header));
+        AudioBlock block;
+        while (ok && !stopping_.load() && source_->Read(&block)) {
+            ok = WriteAll(fd, block.data.data(), block.data.size());
+            if (ok) frames_written_ += block.NumFrames();
+        }
+        close(fd);
+    }
+
+    static void Put32(uint8_t *p, uint32_t v) {
+        for (int i = 0; i < 4; i++) p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+
+    bool WriteAll(int fd, const void *data, size_t size) {
+        const char *p = static_cast<const char *>(data);
+        while (size > 0) {
+            ssize_t n = write(fd, p, size);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                if (stopping_.load()) return false;
+                struct pollfd ready = {fd, POLLOUT, 0};
+                poll(&ready, 1, 100);
+                continue;
+            }
+            if (n <= 0) return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    InterleavedWavReader *source_;
+    std::string path_;
+    std::atomic<bool> stopping_;
+    std::atomic<uint64_t> frames_written_;
+    std::thread thread_;
+};
+
+// A wav file, or a directory of beamformer dumps, as a block source.
+inline BlockSource *OpenRecording(const std::string &path, int block_size_ms, bool loop, std::string *error) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        return InterleavedWavReader::Create(InterleavedWavReader::DumpLayout(path), block_size_ms, loop, error);
+    }
+    BlockSource *reader = WavBlockReader::Create(path, block_size_ms, loop);
+    if (!reader && error) *error = "can not open " + path;
+    return reader;
+}
+
+}  // namespace respeaker_ext
+
+#endif  // INTERLEAVED_WAV_READER_H_
@@ -0,0 +1,102 @@
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <vector>
+
+#include "kws_template_model.h"
+
+extern "C"
+{
+#include <sndfile.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+
+static void help(const char *argv0) {
+    cout << "kws_enroll [options]" << endl;
+    cout << "Builds a keyword template model from a mono 16k wav clip of the keyword." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=INPUT_FILE_NAME               The keyword clip" << endl;
+    cout << "  -s, --start=SECONDS                      Start of the keyword inside the clip, default is 0" << endl;
+    cout << "  -l, --length=SECONDS                     Length of the keyword, default is the rest of the clip" << endl;
+    cout << "  -o, --output=MODEL_FILE_NAME             The model file to write, default is keyword.tmpl" << endl;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    string file_path, model_path = "keyword.tmpl";
+    double start_s = 0, length_s = 0;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"start",        1, NULL, 's'},
+        {"length",       1, NULL, 'l'},
+        {"output",       1, NULL, 'o'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:s:l:o:h", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            file_path = string(optarg);
+            break;
+        case 's':
+            start_s = stod(optarg);
+            break;
+        case 'l':
+            length_s = stod(optarg);
+            break;
+        case 'o':
+            model_path = string(optarg);
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    SNDFILE *file;
+    SF_INFO sfinfo;
+    memset(&sfinfo, 0, sizeof(sfinfo));
+    if (! (file = sf_open(file_path.c_str(), SFM_READ, &sfinfo)))
+    {
+        cout << sf_strerror(file) << endl;
+        cout << "Error : Not able to open input file." << endl;
+        return -1;
+    }
+    if (sfinfo.channels != 1 || sfinfo.samplerate != 16000) {
+        cout << "Error : The clip must be mono 16k." << endl;
+        sf_close(file);
+        return -1;
+    }
+    sf_count_t first = (sf_count_t)(start_s * sfinfo.samplerate);
+    sf_count_t count = length_s > 0 ? (sf_count_t)(length_s * sfinfo.samplerate) : sfinfo.frames - first;
+    vector<int16_t> samples(count > 0 ? count : 0);
+    sf_seek(file, first, SEEK_SET);
+    samples.resize(samples.empty() ? 0 : sf_readf_short(file, &samples[0], samples.size()));
+    sf_close(file);
+
+    unique_ptr<KwsTemplateModel> model(samples.empty() ? nullptr : KwsTemplateModel::Enroll(&samples[0], samples.size()));
+    if (!model || model->NumFrames() == 0) {
+        cout << "Error : No keyword found in the clip." << endl;
+        return -1;
+    }
+    if (!model->Save(model_path)) {
+        cout << "Error : Not able to write " << model_path << endl;
+        return -1;
+    }
+    cout << "model: " << model_path << ", frames: " << model->NumFrames() << ", mel bands: " << model->NumMel() << endl;
+    return 0;
+}
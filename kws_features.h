@@ -0,0 +1,135 @@
+#ifndef KWS_FEATURES_H_
+#define KWS_FEATURES_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "fft.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+struct KwsFrontendConfig {
+    int rate = 16000;
+    int frame_ms = 25;
+    int hop_ms = 10;
+    size_t num_mel = 40;
+};
+
+// Log-mel filterbank features, computed for many frames at once. The frames
+// of a batch may come from different streams: each kernel (window + FFT,
+// mel projection, log) makes one pass over the whole batch, so the window,
+// twiddle and filter tables stay in cache and the per-call overhead is paid
+// once per batch instead of once per stream.
+class LogMelFrontend {
+public:
+    explicit LogMelFrontend(const KwsFrontendConfig &config = KwsFrontendConfig())
+        : config_(config),
+          frame_length_(config.rate * config.frame_ms / 1000),
+          hop_(config.rate * config.hop_ms / 1000),
+          fft_(FftSizeFor(frame_length_)) {
+        window_.resize(fft_.Size(), 0.0f);
+        for (size_t i = 0; i < frame_length_; i++) {
+            window_[i] = 0.5f - 0.5f * cos(2 * M_PI * i / (frame_length_ - 1));
+        }
+        BuildMelBank();
+    }
+
+    size_t FrameLength() const { return frame_length_; }
+    size_t Hop() const { return hop_; }
+    size_t NumMel() const { return config_.num_mel; }
+    const KwsFrontendConfig &Config() const { return config_; }
+
+    // frames[i] points at FrameLength() samples in [-1, 1). Writes
+    // num_frames * NumMel() features, frame-major.
+    void ComputeBatch(const float *const *frames, size_t num_frames, float *features) {
+        size_t bins = fft_.NumBins();
+        power_.resize(num_frames * bins);
+        windowed_.resize(fft_.Size());
+        re_.resize(bins);
+        im_.resize(bins);
+        for (size_t f = 0; f < num_frames; f++) {
+            simd::Multiply(frames[f], &window_[0], &windowed_[0], frame_length_);
+            fft_.Forward(&windowed_[0], &re_[0], &im_[0]);
+            simd::Power(&re_[0], &im_[0], &power_[f * bins], bins);
+        }
+        for (size_t m = 0; m < config_.num_mel; m++) {
+            const MelFilter &filter = filters_[m];
+            const float *weights = &mel_weights_[filter.offset];
+            for (size_t f = 0; f < num_frames; f++) {
+                features[f * config_.num_mel + m] =
+                    simd::Dot(&power_[f * bins + filter.first_bin], weights, filter.num_bins);
+            }
+        }
+        for (size_t i = 0; i < num_frames * config_.num_mel; i++) {
+            features[i] = log(features[i] + 1e-10f);
+        }
+    }
+
+private:
+    struct MelFilter {
+        size_t first_bin, num_bins, offset;
+    };
+
+    static size_t FftSizeFor(size_t length) {
+        size_t n = 2;
+        while (n < length) n <<= 1;
+        return n;
+    }
+
+    static float HzToMel(float hz) { return 2595.0f * log10(1.0f + hz / 700.0f); }
+    static float MelToHz(float mel) { return 700.0f * (pow(10.0f, mel / 2595.0f) - 1.0f); }
+
+    // Triangular filters between 20 Hz and Nyquist, stored as (first bin,
+    // weights) so the projection is a short dense dot product per filter.
+    void BuildMelBank() {
+        size_t bins = fft_.NumBins();
+        float low = HzToMel(20.0f), high = HzToMel(config_.rate / 2.0f);
+        std::vector<float> edges(config_.num_mel + 2);
+        for (size_t i = 0; i < edges.size(); i++) {
+            edges[i] = MelToHz(low + (high - low) * i / (edges.size() - 1)) * fft_.Size() / config_.rate;
+        }
+        for (size_t m = 0; m < config_.num_mel; m++) {
+            float left = edges[m], center = edges[m + 1], right = edges[m + 2];
+            MelFilter filter;
+            filter.first_bin = static_cast<size_t>(ceil(left));
+            size_t last_bin = std::min(bins - 1, static_cast<size_t>(floor(right)));
+            if (last_bin < filter.first_bin) last_bin = filter.first_bin;
+            filter.num_bins = last_bin - filter.first_bin + 1;
+            filter.offset = mel_weights_.size();
+            for (size_t b = filter.first_bin; b <= last_bin; b++) {
+                float w = b <= center ? (b - left) / (center - left) : (right - b) / (right - center);
+                mel_weights_.push_back(w > 0 ? w : 0);
+            }
+            filters_.push_back(filter);
+        }
+    }
+
+    KwsFrontendConfig config_;
+    size_t frame_length_, hop_;
+    Fft fft_;
+    std::vector<float> window_;
+    std::vector<MelFilter> filters_;
+    std::vector<float> mel_weights_;
+    std::vector<float> power_, windowed_, re_, im_;
+};
+
+// Mean-removes and L2-normalizes each frame in place, so that the dot product
+// of two frames is their cosine similarity.
+inline void NormalizeFeatureFrames(float *features, size_t num_frames, size_t num_mel) {
+    for (size_t f = 0; f < num_frames; f++) {
+        float *v = features + f * num_mel;
+        float mean = 0;
+        for (size_t i = 0; i < num_mel; i++) mean += v[i];
+        mean /= num_mel;
+        for (size_t i = 0; i < num_mel; i++) v[i] -= mean;
+        float norm = sqrt(simd::Dot(v, v, num_mel));
+        float inv = norm > 1e-6f ? 1.0f / norm : 0.0f;
+        for (size_t i = 0; i < num_mel; i++) v[i] *= inv;
+    }
+}
+
+}  // namespace respeaker_ext
+
+#endif  // KWS_FEATURES_H_
@@ -0,0 +1,170 @@
+#ifndef KWS_MODEL_SLOT_H_
+#define KWS_MODEL_SLOT_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kws_template_model.h"
+#include "rt_check.h"
+
+namespace respeaker_ext {
+
+// Holds the keyword model and threshold a running detector uses, and lets
+// either be replaced while audio flows. Loads happen on the slot's own
+// thread; the new model is published with an atomic shared_ptr store and a
+// generation bump. The audio thread calls Poll() once per block, which costs
+// one atomic load unless something changed, so the swap lands on a block
+// boundary with no gap and no file I/O on the audio thread.
+//
+// A model the detector has let go of is freed here, on the loader thread,
+// not by the detector's last reference on the audio thread.
+class KwsModelSlot {
+public:
+    // Loads the first model synchronously; a later model must match its
+    // feature size and rate, which the detector's front end was built for.
+    static KwsModelSlot *Create(const std::string &path, float sensitivity) {
+        std::shared_ptr<const KwsTemplateModel> model(KwsTemplateModel::Load(path));
+        if (!model) return nullptr;
+        return new KwsModelSlot(model, sensitivity);
+    }
+
+    ~KwsModelSlot() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        if (loader_.joinable()) loader_.join();
+    }
+
+    // Called on the audio thread at the start of a block. When the slot has
+    // changed since *generation, updates the three outputs and returns true.
+    bool Poll(uint64_t *generation, std::shared_ptr<const KwsTemplateModel> *model, float *threshold) const {
+        uint64_t current = generation_.load(std::memory_order_acquire);
+        if (current == *generation) return false;
+        *model = std::atomic_load(&model_);
+        *threshold = threshold_.load(std::memory_order_relaxed);
+        *generation = current;
+        return true;
+    }
+
+    // Queues a load of path and returns at once. The previous model stays in
+    // use until the new one has loaded and passed the checks.
+    void Reload(const std::string &path) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++requested_;
+            pending_.push_back(path);
+        }
+        cond_.notify_all();
+    }
+
+    // Like Reload(), but waits for the load and returns the result as the
+    // one-line status the control socket sends back.
+    std::string ReloadAndWait(const std::string &path) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t ticket = ++requested_;
+        pending_.push_back(path);
+        cond_.notify_all();
+        cond_.wait(lock, [this, ticket] { return completed_ >= ticket || stop_; });
+        return last_status_;
+    }
+
+    void SetSensitivity(float sensitivity) {
+        sensitivity_.store(sensitivity, std::memory_order_relaxed);
+        threshold_.store(KwsThresholdForSensitivity(sensitivity), std::memory_order_relaxed);
+        generation_.fetch_add(1, std::memory_order_release);
+    }
+
+    float GetSensitivity() const { return sensitivity_.load(std::memory_order_relaxed); }
+    uint64_t GetGeneration() const { return generation_.load(std::memory_order_acquire); }
+    std::shared_ptr<const KwsTemplateModel> GetModel() const { return std::atomic_load(&model_); }
+
+    std::string Status() const {
+        std::shared_ptr<const KwsTemplateModel> model = GetModel();
+        std::ostringstream out;
+        out << "ok model " << model->GetPath() << " (" << model->NumFrames() << " frames), sensitivity "
+            << GetSensitivity() << ", generation " << GetGeneration();
+        return out.str();
+    }
+
+private:
+    KwsModelSlot(std::shared_ptr<const KwsTemplateModel> model, float sensitivity)
+        : model_(model), num_mel_(model->NumMel()), rate_(model->GetRate()), generation_(1), stop_(false),
+          requested_(0), completed_(0) {
+        SetSensitivity(sensitivity);
+        loader_ = std::thread(&KwsModelSlot::LoaderLoop, this);
+    }
+
+    void LoaderLoop() {
+        RtCheck::Exempt();
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            // Wakes at least once a second to free models nobody uses.
+            cond_.wait_for(lock, std::chrono::seconds(1), [this] { return stop_ || !pending_.empty(); });
+            ReleaseRetired();
+            if (stop_ || pending_.empty()) continue;
+            std::string path = pending_.front();
+            pending_.pop_front();
+
+            lock.unlock();
+            std::shared_ptr<const KwsTemplateModel> model(KwsTemplateModel::Load(path));
+            std::string status;
+            if (!model) {
+                status = "error can not load " + path;
+            }
+            else if (model->NumMel() != num_mel_ || model->GetRate() != rate_) {
+                status = "error " + path + " was enrolled with a different front end";
+                model.reset();
+            }
+            lock.lock();
+
+            if (model) {
+                retired_.push_back(std::atomic_exchange(&model_, model));
+                generation_.fetch_add(1, std::memory_order_release);
+                status = Status();
+            }
+            last_status_ = status;
+            completed_++;
+            cond_.notify_all();
+        }
+        retired_.clear();
+    }
+
+    // A retired model is freed once only the slot refers to it, i.e. every
+    // detector has polled past it.
+    void ReleaseRetired() {
+        for (size_t i = 0; i < retired_.size();) {
+            if (retired_[i].use_count() == 1) retired_.erase(retired_.begin() + i);
+            else i++;
+        }
+    }
+
+    std::shared_ptr<const KwsTemplateModel> model_;
+    const size_t num_mel_;
+    const int rate_;
+    std::atomic<float> sensitivity_, threshold_;
+    std::atomic<uint64_t> generation_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_;
+    std::deque<std::string> pending_;
+    std::vector<std::shared_ptr<const KwsTemplateModel> > retired_;
+    uint64_t requested_, completed_;
+    std::string last_status_;
+    std::thread loader_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // KWS_MODEL_SLOT_H_
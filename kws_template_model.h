@@ -0,0 +1,224 @@
+#ifndef KWS_TEMPLATE_MODEL_H_
+#define KWS_TEMPLATE_MODEL_H_
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kws_features.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+// Removes the slowly varying part of the spectrum (channel and spectral
+// tilt) with a running per-band mean, then mean-removes and L2-normalizes the
+// frame so that the dot product of two frames is their cosine similarity.
+class KwsFeatureNormalizer {
+public:
+    explicit KwsFeatureNormalizer(size_t num_mel, float time_constant_frames = 100.0f)
+        : mean_(num_mel, 0.0f), alpha_(1.0f / time_constant_frames), primed_(false) {}
+
+    void Apply(float *frame) {
+        size_t num_mel = mean_.size();
+        if (!primed_) {
+            std::copy(frame, frame + num_mel, mean_.begin());
+            primed_ = true;
+        }
+        for (size_t i = 0; i < num_mel; i++) {
+            mean_[i] += alpha_ * (frame[i] - mean_[i]);
+            frame[i] -= mean_[i];
+        }
+        NormalizeFeatureFrames(frame, 1, num_mel);
+    }
+
+private:
+    std::vector<float> mean_;
+    float alpha_;
+    bool primed_;
+};
+
+// A keyword model made of the normalized log-mel frames of one enrolled
+// utterance. The score of a window of the same length is the mean per-frame
+// cosine similarity, computed as a single dot product over the flattened
+// frames.
+class KwsTemplateModel {
+public:
+    static KwsTemplateModel *Load(const std::string &path) {
+        std::ifstream in(path.c_str());
+        std::string magic;
+        int version = 0;
+        std::unique_ptr<KwsTemplateModel> model(new KwsTemplateModel);
+        if (!(in >> magic >> version >> model->num_frames_ >> model->num_mel_ >> model->rate_) ||
+            magic != "kws_template" || version != 1 || model->num_frames_ == 0 || model->num_mel_ == 0) {
+            return nullptr;
+        }
+        model->data_.resize(model->num_frames_ * model->num_mel_);
+        for (size_t i = 0; i < model->data_.size(); i++) {
+            if (!(in >> model->data_[i])) return nullptr;
+        }
+        model->path_ = path;
+        return model.release();
+    }
+
+    // Builds a model from a mono clip of the keyword. Frames more than 30 dB
+    // below the loudest one are trimmed from both ends.
+    static KwsTemplateModel *Enroll(const int16_t *samples, size_t num_samples,
+                                    const KwsFrontendConfig &config = KwsFrontendConfig()) {
+        LogMelFrontend frontend(config);
+        std::vector<float> audio(num_samples);
+        for (size_t i = 0; i < num_samples; i++) audio[i] = samples[i] / 32768.0f;
+        std::vector<const float *> frames;
+        for (size_t start = 0; start + frontend.FrameLength() <= num_samples; start += frontend.Hop()) {
+            frames.push_back(&audio[start]);
+        }
+        if (frames.empty()) return nullptr;
+        size_t num_mel = frontend.NumMel();
+        std::vector<float> features(frames.size() * num_mel);
+        frontend.ComputeBatch(&frames[0], frames.size(), &features[0]);
+
+        std::vector<float> level(frames.size(), 0.0f);
+        float peak = -1e30f;
+        for (size_t f = 0; f < frames.size(); f++) {
+            for (size_t m = 0; m < num_mel; m++) level[f] += features[f * num_mel + m] / num_mel;
+            peak = std::max(peak, level[f]);
+        }
+        const float floor = peak - 3.0f * log(10.0f);  // 30 dB in natural-log power
+        size_t first = 0, last = frames.size();
+        while (first < last && level[first] < floor) first++;
+        while (last > first && level[last - 1] < floor) last--;
+
+        // Normalize with the same running mean a KwsStream applies, so the
+        // template matches what a stream sees for the same audio.
+        KwsFeatureNormalizer normalizer(num_mel);
+        for (size_t f = 0; f < frames.size(); f++) normalizer.Apply(&features[f * num_mel]);
+
+        KwsTemplateModel *model = new KwsTemplateModel;
+        model->num_frames_ = last - first;
+        model->num_mel_ = num_mel;
+        model->rate_ = config.rate;
+        model->data_.assign(features.begin() + first * num_mel, features.begin() + last * num_mel);
+        return model;
+    }
+
+    bool Save(const std::string &path) const {
+        std::ofstream out(path.c_str());
+        out << "kws_template 1 " << num_frames_ << " " << num_mel_ << " " << rate_ << "\n";
+        for (size_t f = 0; f < num_frames_; f++) {
+            for (size_t m = 0; m < num_mel_; m++) out << data_[f * num_mel_ + m] << (m + 1 < num_mel_ ? " " : "\n");
+        }
+        return static_cast<bool>(out);
+    }
+
+    size_t NumFrames() const { return num_frames_; }
+    size_t NumMel() const { return num_mel_; }
+    int GetRate() const { return rate_; }
+    const std::string &GetPath() const { return path_; }
+
+    // Whether the template was enrolled with features of this front end's
+    // shape; scoring one against a window of another size is meaningless.
+    bool Fits(const KwsFrontendConfig &config) const { return num_mel_ == config.num_mel && rate_ == config.rate; }
+
+    // window holds NumFrames() normalized frames, oldest first.
+    float Score(const float *window) const {
+        return simd::Dot(window, &data_[0], data_.size()) / num_frames_;
+    }
+
+private:
+    KwsTemplateModel() : num_frames_(0), num_mel_(0), rate_(16000) {}
+
+    size_t num_frames_, num_mel_;
+    int rate_;
+    std::vector<float> data_;
+    std::string path_;
+};
+
+// Per-stream detector state: the sample backlog that has not formed a full
+// frame yet, the feature normalizer and the sliding window of normalized
+// features scored against the model. The window is stored twice over a ring
+// of 2 * NumFrames() so the last NumFrames() frames are always contiguous.
+class KwsStream {
+public:
+    explicit KwsStream(const LogMelFrontend &frontend)
+        : frame_length_(frontend.FrameLength()), hop_(frontend.Hop()), num_mel_(frontend.NumMel()),
+          normalizer_(frontend.NumMel()), window_frames_(0), head_(0), filled_(0), refractory_(0) {}
+
+    // Appends one channel of an interleaved int16 block.
+    void Append(const int16_t *samples, size_t num_frames, size_t num_channels, size_t channel) {
+        size_t old = backlog_.size();
+        backlog_.resize(old + num_frames);
+        simd::DeinterleaveToFloat(samples, num_channels, channel, num_frames, 1.0f / 32768, &backlog_[old]);
+    }
+
+    // Appends one channel of a float32 planar block.
+    void Append(const float *samples, size_t num_frames) {
+        backlog_.insert(backlog_.end(), samples, samples + num_frames);
+    }
+
+    // Moves every complete frame from the backlog into out (FrameLength()
+    // floats each) and returns how many were added.
+    size_t TakeFrames(std::vector<float> *out) {
+        size_t count = 0, start = 0;
+        for (; start + frame_length_ <= backlog_.size(); start += hop_, count++) {
+            out->insert(out->end(), backlog_.begin() + start, backlog_.begin() + start + frame_length_);
+        }
+        backlog_.erase(backlog_.begin(), backlog_.begin() + std::min(start, backlog_.size()));
+        return count;
+    }
+
+    // Normalizes one log-mel frame in place and adds it to the window, which
+    // holds the last window_frames frames (the model length). A null frame
+    // stands for a frame that was not computed and scores zero.
+    void PushFeatures(float *frame, size_t window_frames) {
+        if (window_frames != window_frames_) {
+            window_frames_ = window_frames;
+            window_.assign(2 * window_frames_ * num_mel_, 0.0f);
+            head_ = 0;
+            filled_ = 0;
+            refractory_ = 0;
+        }
+        float *slot = &window_[head_ * num_mel_];
+        if (frame) {
+            normalizer_.Apply(frame);
+            std::copy(frame, frame + num_mel_, slot);
+        }
+        else {
+            std::fill(slot, slot + num_mel_, 0.0f);
+        }
+        std::copy(slot, slot + num_mel_, &window_[(head_ + window_frames_) * num_mel_]);
+        head_ = (head_ + 1) % window_frames_;
+        if (filled_ < window_frames_) filled_++;
+        if (refractory_ > 0) refractory_--;
+    }
+
+    // Scores the current window. Returns false while the window is still
+    // filling. detected is set when the score crosses the threshold outside
+    // the refractory period that follows a detection.
+    bool Score(const KwsTemplateModel &model, float threshold, float *score, bool *detected) {
+        *detected = false;
+        if (filled_ < window_frames_ || window_frames_ != model.NumFrames() || model.NumMel() != num_mel_) return false;
+        *score = model.Score(&window_[head_ * num_mel_]);
+        if (*score >= threshold && refractory_ == 0) {
+            *detected = true;
+            refractory_ = window_frames_;
+        }
+        return true;
+    }
+
+private:
+    size_t frame_length_, hop_, num_mel_;
+    std::vector<float> backlog_;
+    KwsFeatureNormalizer normalizer_;
+    size_t window_frames_, head_, filled_, refractory_;
+    std::vector<float> window_;
+};
+
+// Snowboy-style sensitivity in [0, 1]: higher detects more.
+inline float KwsThresholdForSensitivity(float sensitivity) {
+    return 1.0f - std::min(1.0f, std::max(0.0f, sensitivity));
+}
+
+}  // namespace respeaker_ext
+
+#endif  // KWS_TEMPLATE_MODEL_H_
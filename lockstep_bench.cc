@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "chain_executor.h"
+#include "delay_sum_beamformer.h"
+#include "dsp_stages.h"
+#include "interleaved_wav_reader.h"
+#include "multibeam_kws.h"
+
+extern "C"
+{
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+
+static void help(const char *argv0) {
+    cout << "lockstep_bench [options]" << endl;
+    cout << "Runs the same recording through resample -> delay-and-sum -> multi-beam kws several times per executor" << endl;
+    cout << "and reports per-stage CPU, wall time, detections and an output digest. lockstep runs the chain on one" << endl;
+    cout << "thread a block at a time, so its stage CPU is the compute cost and its digest must not change between" << endl;
+    cout << "runs; threads and pool add the scheduling cost on top." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=INPUT_FILE_NAME               The multichannel mic input, or a directory of beamformer dumps" << endl;
+    cout << "                                           (e.g. anusha), default is athing.wav" << endl;
+    cout << "  -t, --type=MIC_TYPE                      The MICROPHONE TYPE, default is CIRCULAR_6MIC_7BEAM" << endl;
+    cout << "  -m, --model=MODEL_FILE_NAME              Template model from kws_enroll, default enrolls the loudest second of mic 0" << endl;
+    cout << "  -e, --executors=LIST                     Executors to compare: lockstep, threads, pool, default is all three" << endl;
+    cout << "  -r, --runs=TIMES                         Runs per executor, default is 5" << endl;
+    cout << "  -p, --realtime                           Push one block per block period instead of as fast as possible" << endl;
+}
+
+static int64_t NowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// FNV-1a over everything that reaches the sink, detections included.
+static uint64_t Fnv1a(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) hash = (hash ^ p[i]) * 1099511628211ULL;
+    return hash;
+}
+
+struct RunResult {
+    double wall_ms = 0;
+    vector<double> stage_us;    // CPU per block inside each stage
+    int hits = 0;
+    uint64_t digest = 14695981039346656037ULL;
+};
+
+static bool RunOnce(const string &executor_name, const vector<AudioBlock> &blocks, const string &mic_type,
+                    shared_ptr<const KwsTemplateModel> model, bool realtime, RunResult *result) {
+    size_t num_channels = blocks[0].num_channels;
+    int rate = blocks[0].rate;
+    unique_ptr<WorkStealingPool> pool;
+    unique_ptr<ChainExecutor> executor;
+    if (executor_name == "lockstep") {
+        executor.reset(new LockstepExecutor());
+    }
+    else if (executor_name == "threads") {
+        executor.reset(new ThreadPerNodeExecutor());
+    }
+    else if (executor_name == "pool") {
+        pool.reset(new WorkStealingPool(3));
+        executor.reset(new PooledExecutor(pool.get()));
+    }
+    else {
+        cout << "Error : unknown executor " << executor_name << endl;
+        return false;
+    }
+    executor->SetUsageInterval(1);
+
+    // Fresh stages every run, so no state carries over.
+    unique_ptr<ResampleStage> resample(ResampleStage::Create(16000));
+    size_t num_mics = num_channels;
+    unique_ptr<DelaySumBeamformer> beamformer(CreateDelaySumBeamformer(mic_type, EvenBeamAngles(6, IsLinearMicType(mic_type)), 0));
+    unique_ptr<MultiBeamKwsStage> kws(MultiBeamKwsStage::Create(model, 0.5f));
+    vector<ChainStage *> stages;
+    if (rate != 16000) stages.push_back(resample.get());
+    stages.push_back(beamformer.get());
+    stages.push_back(kws.get());
+    MultiBeamKwsStage *detector = kws.get();
+    // The sink runs on the thread that ran the last stage, right after it,
+    // so Detected() still belongs to this block.
+    bool prepared = beamformer && executor->Prepare(stages, num_mics, rate, BLOCK_SIZE_MS,
+        [result, detector](const ChainExecutor::BlockPtr &block) {
+            int detected = detector->Detected() ? detector->GetDetectedBeam() : -1;
+            if (detected >= 0) result->hits++;
+            result->digest = Fnv1a(result->digest, block->data.data(), block->data.size());
+            result->digest = Fnv1a(result->digest, &detected, sizeof(detected));
+        });
+    if (!prepared) {
+        cout << "Error : can not build the chain for " << mic_type << " from " << num_channels << " channels at "
+             << rate << " Hz" << endl;
+        return false;
+    }
+
+    int64_t start = NowNs();
+    auto next = chrono::steady_clock::now();
+    for (size_t b = 0; b < blocks.size(); b++) {
+        executor->Push(ChainExecutor::BlockPtr(new AudioBlock(blocks[b])));
+        if (realtime) {
+            next += chrono::milliseconds(BLOCK_SIZE_MS);
+            this_thread::sleep_until(next);
+        }
+    }
+    executor->WaitIdle();
+    result->wall_ms = (NowNs() - start) / 1e6;
+    for (size_t s = 0; s < executor->GetNumStages(); s++) {
+        NodeUsageCounter::Totals totals = executor->GetStageUsage(s);
+        result->stage_us.push_back(totals.usage.cpu_ns / 1e3 / max<uint64_t>(totals.blocks, 1));
+    }
+    return true;
+}
+
+static void MeanDev(const vector<double> &values, double *mean, double *dev) {
+    *mean = 0;
+    for (size_t i = 0; i < values.size(); i++) *mean += values[i] / values.size();
+    double var = 0;
+    for (size_t i = 0; i < values.size(); i++) var += (values[i] - *mean) * (values[i] - *mean) / values.size();
+    *dev = sqrt(var);
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    string file_path = "athing.wav", mic_type = "CIRCULAR_6MIC_7BEAM", model_path;
+    string executor_list = "lockstep,threads,pool";
+    int runs = 5;
+    bool realtime = false;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"type",         1, NULL, 't'},
+        {"model",        1, NULL, 'm'},
+        {"executors",    1, NULL, 'e'},
+        {"runs",         1, NULL, 'r'},
+        {"realtime",     0, NULL, 'p'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:t:m:e:r:hp", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            file_path = string(optarg);
+            break;
+        case 't':
+            mic_type = string(optarg);
+            break;
+        case 'm':
+            model_path = string(optarg);
+            break;
+        case 'e':
+            executor_list = string(optarg);
+            break;
+        case 'r':
+            runs = max(1, stoi(optarg));
+            break;
+        case 'p':
+            realtime = true;
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    // The whole recording is read up front so file I/O stays out of the runs.
+    string error;
+    unique_ptr<BlockSource> reader(OpenRecording(file_path, BLOCK_SIZE_MS, false, &error));
+    if (!reader) {
+        cout << "Error : " << error << endl;
+        return -1;
+    }
+    vector<AudioBlock> blocks;
+    AudioBlock block;
+    while (reader->Read(&block)) {
+        if (block.NumFrames() * 1000 == static_cast<size_t>(block.rate) * BLOCK_SIZE_MS) blocks.push_back(block);
+    }
+    if (blocks.empty()) {
+        cout << "Error : " << file_path << " is shorter than one block" << endl;
+        return -1;
+    }
+
+    shared_ptr<const KwsTemplateModel> model;
+    if (!model_path.empty()) {
+        model.reset(KwsTemplateModel::Load(model_path));
+    }
+    else {
+        // Mic 0 at 16k, then its loudest second, which is speech rather than
+        // the lead-in silence.
+        unique_ptr<ResampleStage> resample(ResampleStage::Create(16000));
+        resample->Prepare(blocks[0].num_channels, blocks[0].rate, BLOCK_SIZE_MS);
+        vector<int16_t> mic0;
+        for (size_t b = 0; b < blocks.size(); b++) {
+            block = blocks[b];
+            if (block.rate != 16000) resample->ProcessBlock(&block);
+            for (size_t n = 0; n < block.NumFrames(); n++) mic0.push_back(block.Samples()[n * block.num_channels]);
+        }
+        size_t length = min<size_t>(16000, mic0.size()), best_start = 0;
+        double energy = 0, best_energy = -1;
+        for (size_t n = 0; n < mic0.size(); n++) {
+            energy += double(mic0[n]) * mic0[n];
+            if (n >= length) energy -= double(mic0[n - length]) * mic0[n - length];
+            if (n + 1 >= length && energy > best_energy) {
+                best_energy = energy;
+                best_start = n + 1 - length;
+            }
+        }
+        model.reset(KwsTemplateModel::Enroll(&mic0[best_start], length));
+    }
+    if (!model) {
+        cout << "Error : Not able to load the keyword model." << endl;
+        return -1;
+    }
+    if (!model->Fits(KwsFrontendConfig())) {
+        cout << "Error : " << model_path << " was enrolled with a different front end" << endl;
+        return -1;
+    }
+
+    double audio_s = blocks.size() * BLOCK_SIZE_MS / 1000.0;
+    cout << fixed << setprecision(2);
+    cout << "audio: " << audio_s << " s, " << blocks[0].num_channels << " ch at " << blocks[0].rate << " Hz, "
+         << (realtime ? "pushed in real time" : "pushed as fast as possible") << ", stage CPU in us per block" << endl;
+    cout << setw(10) << "executor" << setw(5) << "run" << setw(11) << "wall ms" << setw(11) << "resample"
+         << setw(11) << "delay_sum" << setw(11) << "kws" << setw(7) << "hits" << setw(19) << "digest" << endl;
+
+    stringstream executors_in(executor_list);
+    string name;
+    uint64_t reference_digest = 0;
+    bool all_match = true;
+    while (getline(executors_in, name, ',')) {
+        vector<RunResult> results(runs);
+        for (int r = 0; r < runs; r++) {
+            if (!RunOnce(name, blocks, mic_type, model, realtime, &results[r])) return -1;
+            const RunResult &result = results[r];
+            // Pad the resample column when the input is already 16k.
+            size_t first = result.stage_us.size() == 3 ? 0 : 1;
+            cout << setw(10) << name << setw(5) << r << setw(11) << result.wall_ms;
+            for (size_t s = 0; s < 3; s++) {
+                if (s < first) cout << setw(11) << "-";
+                else cout << setw(11) << result.stage_us[s - first];
+            }
+            cout << setw(7) << result.hits << "   " << hex << setw(16) << setfill('0') << result.digest << dec
+                 << setfill(' ') << endl;
+            if (reference_digest == 0) reference_digest = result.digest;
+            all_match = all_match && result.digest == reference_digest;
+        }
+
+        // Spread over the runs: what run-to-run noise a regression has to beat.
+        vector<double> wall, total;
+        for (int r = 0; r < runs; r++) {
+            wall.push_back(results[r].wall_ms);
+            double sum = 0;
+            for (size_t s = 0; s < results[r].stage_us.size(); s++) sum += results[r].stage_us[s];
+            total.push_back(sum);
+        }
+        double wall_mean, wall_dev, total_mean, total_dev;
+        MeanDev(wall, &wall_mean, &wall_dev);
+        MeanDev(total, &total_mean, &total_dev);
+        cout << setw(10) << name << " wall " << wall_mean << " +- " << wall_dev << " ms, stages " << total_mean
+             << " +- " << total_dev << " us/block (" << setprecision(1) << 100 * total_dev / max(total_mean, 1e-9)
+             << "%), " << audio_s * 1000 / wall_mean << "x real time" << setprecision(2) << endl;
+    }
+    cout << "output " << (all_match ? "identical in every run" : "DIFFERS between runs") << endl;
+    return all_match ? 0 : 1;
+}
@@ -11,6 +11,8 @@
 #include <chain_nodes/vep_aec_beamforming_node.h>
 #include <chain_nodes/snowboy_1b_doa_kws_node.h>
 #include <chain_nodes/snips_1b_doa_kws_node.h>
+#include "async_log.h"
+#include "capture_log_sink.h"
 
 extern "C"
 {
@@ -22,6 +24,7 @@ extern "C"
 
 using namespace std;
 using namespace respeaker;
+using namespace respeaker_ext;
 
 #define BLOCK_SIZE_MS    8
 
@@ -44,6 +47,7 @@ static void help(const char *argv0) {
     cout << "  -t, --type=MIC_TYPE                      The MICROPHONE TYPE, support: CIRCULAR_6MIC_7BEAM, LINEAR_6MIC_8BEAM, LINEAR_4MIC_1BEAM, CIRCULAR_4MIC_9BEAM" << endl;
     cout << "  -g, --agc=NEGTIVE INTEGER                The target gain level of output, [-31, 0]" << endl;
     cout << "  -w, --wav                                Enable output wav log, default is false." << endl;
+    PrintCaptureLogHelp();
 }
 
 
@@ -62,6 +66,7 @@ int main(int argc, char *argv[]) {
     string file_path, kws, mic_type;
     bool enable_agc = false;
     bool enable_wav = true;
+    CaptureLogOptions log_options;
     int agc_level = 0;
 
 
@@ -72,10 +77,11 @@ int main(int argc, char *argv[]) {
         {"type",         1, NULL, 't'},
         {"agc",          1, NULL, 'g'},
         {"wav",          0, NULL, 'w'},
+        CAPTURE_LOG_LONG_OPTIONS,
         {NULL,           0, NULL,  0}
     };
 
-    while ((c = getopt_long(argc, argv, "f:k:g:t:hw", long_options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "f:k:g:t:" CAPTURE_LOG_SHORT_OPTIONS "hw", long_options, NULL)) != -1) {
 
         switch (c) {
         case 'h' :
@@ -100,6 +106,7 @@ int main(int argc, char *argv[]) {
             enable_wav = true;
             break;
         default:
+            if (ParseCaptureLogOption(c, optarg, &log_options)) break;
             return 0;
         }
     }
@@ -183,24 +190,19 @@ int main(int argc, char *argv[]) {
     }
 
     string data;
-    int frames;
     size_t num_channels = respeaker->GetNumOutputChannels();
     int rate = respeaker->GetNumOutputRate();
 
     cout << "num channels: " << num_channels << ", rate: " << rate << endl;
 
-    // init libsndfile
-    SNDFILE *file ;
-    SF_INFO sfinfo ;
+    // init the output log
+    unique_ptr<CaptureLogSink> log_sink;
     if (enable_wav) {
-
-        memset (&sfinfo, 0, sizeof (sfinfo));
-        sfinfo.samplerate   = rate ;
-        sfinfo.channels     = num_channels ;
-        sfinfo.format       = (SF_FORMAT_WAV | SF_FORMAT_PCM_16) ;
-        if (! (file = sf_open ("file_1beam_test.wav", SFM_WRITE, &sfinfo)))
+        string log_path = log_options.flac_level >= 0 ? "file_1beam_test.flac" : "file_1beam_test.wav";
+        log_options.drop_when_full = false;
+        log_sink.reset(CaptureLogSink::Create(log_path, rate, num_channels, log_options));
+        if (!log_sink)
         {
-            cout << sf_strerror(file) << endl;
             cout << "Error : Not able to open output file." << endl;
             return -1 ;
         }
@@ -209,6 +211,12 @@ int main(int argc, char *argv[]) {
 
     int angle;
     int hotword_index = 0, hotword_count=0;
+    // Progress goes through the async log, once a second, instead of a
+    // flushed "." per block on the thread that polls the chain.
+    unique_ptr<AsyncLog> async_log(AsyncLog::Create());
+    async_log->AttachThread();
+    LogRateLimit progress(1000);
+    uint64_t blocks = 0;
 
     while (!stop)
     {
@@ -220,13 +228,13 @@ int main(int argc, char *argv[]) {
         }
 
         if (enable_wav) {
-            frames = data.length() / (sizeof(int16_t) * num_channels);
-            sf_writef_short(file, (const int16_t *)(data.data()), frames);
+            log_sink->Write(data);
         }
-        cout << "." << flush;
+        async_log->Log(kLogInfo, &progress, "blocks: {}, hotwords: {}", ++blocks, hotword_count);
         // cout << "angle: " << angle <<endl;
     }
 
+    async_log.reset();
     cout << "stopping the respeaker worker thread..." << endl;
 
     respeaker->Stop();
@@ -234,8 +242,7 @@ int main(int argc, char *argv[]) {
     cout << "cleanup done." << endl;
 
     if (enable_wav) {
-        sf_close (file);
-        cout << "wav file closed." << endl;
+        CloseAndReport(log_sink.get());
     }
     
 
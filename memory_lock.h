@@ -0,0 +1,168 @@
+#ifndef MEMORY_LOCK_H_
+#define MEMORY_LOCK_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+extern "C"
+{
+#include <alloca.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+}
+
+namespace respeaker_ext {
+
+struct MemoryLockOptions {
+    // Heap faulted in (and locked) up front. Allocations made after start-up,
+    // block pools, executor rings, a reloaded keyword model, come out of it
+    // instead of new pages.
+    size_t heap_reserve_bytes = 32 << 20;
+    // Stack faulted in on the thread that calls Create().
+    size_t stack_bytes = 512 << 10;
+    // Default stack size for threads started afterwards, e.g. the node
+    // threads ReSpeaker::Start() creates. MCL_FUTURE locks a new thread's
+    // whole stack, so the 8 MB default costs 8 MB of RAM per thread; 0 keeps
+    // the default.
+    size_t thread_stack_bytes = 0;
+    // Ask for transparent huge pages on the heap reserve. Fewer TLB misses on
+    // large buffers; ignored (and reported) where THP is off.
+    bool huge_pages = false;
+};
+
+// Start-up mode that takes page faults out of steady state: malloc is told
+// never to return memory to the kernel, to mmap large blocks or to give
+// threads arenas of their own, a heap reserve and the caller's stack are
+// faulted in, and the whole process is locked with
+// mlockall(MCL_CURRENT | MCL_FUTURE), so memory mapped later is faulted in
+// when mapped rather than when first touched and nothing is ever paged out.
+// Create it before building the chain, so models and pools land in locked
+// memory. Needs CAP_IPC_LOCK or an RLIMIT_MEMLOCK (ulimit -l) above the
+// process size. Destroying it unlocks.
+class MemoryLock {
+public:
+    static MemoryLock *Create(const MemoryLockOptions &options, std::string *error) {
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+        // Per-thread arenas would be fresh mappings outside the reserve.
+        mallopt(M_ARENA_MAX, 1);
+        if (options.thread_stack_bytes > 0) {
+            pthread_attr_t attr;
+            if (pthread_getattr_default_np(&attr) == 0) {
+                pthread_attr_setstacksize(&attr, options.thread_stack_bytes);
+                pthread_setattr_default_np(&attr);
+                pthread_attr_destroy(&attr);
+            }
+        }
+
+        // The reserve is faulted before mlockall() so that madvise() still
+        // gets to choose the page size; with M_TRIM_THRESHOLD off, free()
+        // keeps it in the heap.
+        bool huge = false;
+        if (options.heap_reserve_bytes > 0) {
+            char *reserve = static_cast<char *>(malloc(options.heap_reserve_bytes));
+            if (!reserve) {
+                if (error) *error = "can not allocate the heap reserve";
+                return nullptr;
+            }
+            if (options.huge_pages) huge = AdviseHugePages(reserve, options.heap_reserve_bytes);
+            Prefault(reserve, options.heap_reserve_bytes);
+            free(reserve);
+        }
+        PrefaultStack(options.stack_bytes);
+
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            if (error) {
+                *error = std::string("mlockall failed: ") + strerror(errno) +
+                         (errno == ENOMEM || errno == EPERM ? " (raise ulimit -l or grant CAP_IPC_LOCK)" : "");
+            }
+            return nullptr;
+        }
+        return new MemoryLock(options, huge);
+    }
+
+    ~MemoryLock() { munlockall(); }
+
+    // Writes one byte per page so the range is mapped now.
+    static void Prefault(void *p, size_t bytes) {
+        volatile char *c = static_cast<volatile char *>(p);
+        size_t page = PageSize();
+        for (size_t i = 0; i < bytes; i += page) c[i] = c[i];
+    }
+
+    // Faults in bytes of the calling thread's stack below the current frame.
+    // Threads this code starts itself can call it first thing.
+    static void __attribute__((noinline)) PrefaultStack(size_t bytes) {
+        if (bytes == 0) return;
+        char *p = static_cast<char *>(alloca(bytes));
+        Prefault(p, bytes);
+    }
+
+    static size_t PageSize() {
+        static const size_t page = sysconf(_SC_PAGESIZE);
+        return page;
+    }
+
+    bool GetHugePages() const { return huge_; }
+
+    // Locked, resident and huge-page memory of the process, from
+    // /proc/self/status and /proc/self/smaps_rollup.
+    std::string Summary() const {
+        char line[160];
+        snprintf(line, sizeof(line), "memory locked: %ld kB locked, %ld kB resident, reserve %zu MB", StatusKb("VmLck:"),
+                 StatusKb("VmRSS:"), options_.heap_reserve_bytes >> 20);
+        std::string summary = line;
+        if (options_.huge_pages) {
+            snprintf(line, sizeof(line), ", huge pages %s (%ld kB)", huge_ ? "on" : "unavailable",
+                     FieldKb("/proc/self/smaps_rollup", "AnonHugePages:"));
+            summary += line;
+        }
+        return summary;
+    }
+
+private:
+    MemoryLock(const MemoryLockOptions &options, bool huge) : options_(options), huge_(huge) {}
+
+    // madvise() only takes whole 2 MB-aligned runs as huge pages.
+    static bool AdviseHugePages(char *p, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+        const size_t kHuge = 2 << 20;
+        uintptr_t begin = (reinterpret_cast<uintptr_t>(p) + kHuge - 1) & ~(kHuge - 1);
+        uintptr_t end = (reinterpret_cast<uintptr_t>(p) + bytes) & ~(kHuge - 1);
+        return end > begin && madvise(reinterpret_cast<void *>(begin), end - begin, MADV_HUGEPAGE) == 0;
+#else
+        return false;
+#endif
+    }
+
+    static long StatusKb(const char *field) { return FieldKb("/proc/self/status", field); }
+
+    static long FieldKb(const char *path, const char *field) {
+        FILE *f = fopen(path, "r");
+        if (!f) return 0;
+        char line[256];
+        long kb = 0;
+        size_t n = strlen(field);
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, field, n) == 0) {
+                kb = atol(line + n);
+                break;
+            }
+        }
+        fclose(f);
+        return kb;
+    }
+
+    MemoryLockOptions options_;
+    bool huge_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // MEMORY_LOCK_H_
@@ -0,0 +1,76 @@
+#ifndef MIC_GEOMETRY_H_
+#define MIC_GEOMETRY_H_
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace respeaker_ext {
+
+// Planar microphone positions in meters, mic 0 first, in the channel order
+// the collector delivers. Angles are in degrees, counter-clockwise from the
+// x axis, matching the convention of ReSpeaker::SetDirection().
+struct MicGeometry {
+    std::string name;
+    std::vector<float> x, y;
+
+    size_t NumMics() const { return x.size(); }
+
+    float MaxPairDistance() const {
+        float d = 0;
+        for (size_t i = 0; i < x.size(); i++) {
+            for (size_t j = i + 1; j < x.size(); j++) d = std::max(d, std::hypot(x[i] - x[j], y[i] - y[j]));
+        }
+        return d;
+    }
+
+    static MicGeometry Circular(const std::string &name, size_t num_mics, float radius, float mic0_angle = 0) {
+        MicGeometry g;
+        g.name = name;
+        for (size_t i = 0; i < num_mics; i++) {
+            float a = (mic0_angle + 360.0f * i / num_mics) * M_PI / 180.0f;
+            g.x.push_back(radius * cos(a));
+            g.y.push_back(radius * sin(a));
+        }
+        return g;
+    }
+
+    static MicGeometry Linear(const std::string &name, size_t num_mics, float spacing) {
+        MicGeometry g;
+        g.name = name;
+        for (size_t i = 0; i < num_mics; i++) {
+            g.x.push_back(spacing * (i - (num_mics - 1) / 2.0f));
+            g.y.push_back(0.0f);
+        }
+        return g;
+    }
+
+    // Nominal geometries of the librespeaker mic types. mic0_angle plays the
+    // role of VepAecBeamformingNode::SetAngleForMic0().
+    static bool FromMicType(const std::string &mic_type, float mic0_angle, MicGeometry *geometry) {
+        if (mic_type == "CIRCULAR_6MIC_7BEAM") {
+            *geometry = Circular(mic_type, 6, 0.0463f, mic0_angle);
+        }
+        else if (mic_type == "CIRCULAR_4MIC_9BEAM") {
+            *geometry = Circular(mic_type, 4, 0.0320f, mic0_angle);
+        }
+        else if (mic_type == "LINEAR_6MIC_8BEAM") {
+            *geometry = Linear(mic_type, 6, 0.0350f);
+        }
+        else if (mic_type == "LINEAR_4MIC_1BEAM") {
+            *geometry = Linear(mic_type, 4, 0.0457f);
+        }
+        else if (mic_type == "CIRCULAR_8MIC") {
+            *geometry = Circular(mic_type, 8, 0.0463f, mic0_angle);
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+};
+
+}  // namespace respeaker_ext
+
+#endif  // MIC_GEOMETRY_H_
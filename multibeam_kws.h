@@ -0,0 +1,202 @@
+#ifndef MULTIBEAM_KWS_H_
+#define MULTIBEAM_KWS_H_
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "capture_clock.h"
+#include "chain_stage.h"
+#include "kws_features.h"
+#include "kws_model_slot.h"
+#include "kws_template_model.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+// Keyword spotting over every beam of a multi-beam block (one channel per
+// beam, e.g. VepAecBeamformingNode created with single-beam output off).
+//
+// Features and scores are only computed for frames that can matter: a frame
+// of a beam is gated out when its energy is close to that beam's noise floor
+// or more than gate_db below the loudest beam. The gate costs one dot product
+// per frame, a fraction of the FFT it saves, and holds a beam open for one
+// model length so soft parts inside a word are not dropped. Frames that pass
+// go through the front end as one batch across all beams. Gated frames enter
+// the beam's window as empty frames, so the windows stay aligned in time.
+class MultiBeamKwsStage : public ChainStage {
+public:
+    static MultiBeamKwsStage *Create(std::shared_ptr<const KwsTemplateModel> model, float sensitivity,
+                                     float gate_db = 12.0f, float floor_margin_db = 3.0f) {
+        if (!model) return nullptr;
+        return new MultiBeamKwsStage(model, sensitivity, gate_db, floor_margin_db);
+    }
+
+    // Follows the slot's model and sensitivity as they change; the switch
+    // happens at the start of a block. The slot must outlive the stage.
+    static MultiBeamKwsStage *Create(const KwsModelSlot *slot, float gate_db = 12.0f, float floor_margin_db = 3.0f) {
+        if (!slot) return nullptr;
+        MultiBeamKwsStage *stage = new MultiBeamKwsStage(slot->GetModel(), slot->GetSensitivity(), gate_db, floor_margin_db);
+        stage->slot_ = slot;
+        return stage;
+    }
+
+    std::string Name() const override { return "multibeam_kws"; }
+    bool SupportsFloatPlanar() const override { return true; }
+
+    // Fails if the model was enrolled with another front end; a slot's
+    // later models are held to the first one's shape by the slot.
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override {
+        if (rate != frontend_.Config().rate || num_channels == 0 || !model_->Fits(frontend_.Config())) return false;
+        beams_.clear();
+        for (size_t i = 0; i < num_channels; i++) {
+            beams_.push_back(std::unique_ptr<Beam>(new Beam(frontend_)));
+        }
+        return true;
+    }
+
+    void ProcessBlock(AudioBlock *block) override {
+        // A model of another length resets each beam's window in
+        // PushFeatures(); the rest of the beam state carries over.
+        if (slot_) slot_->Poll(&slot_generation_, &model_, &threshold_);
+        size_t num_beams = beams_.size(), num_mel = frontend_.NumMel(), length = frontend_.FrameLength();
+        detected_ = false;
+        best_beam_ = -1;
+        best_score_ = -1.0f;
+
+        samples_.clear();
+        size_t frames_per_beam = 0;
+        for (size_t b = 0; b < num_beams; b++) {
+            if (block->format == kFloat32Planar) beams_[b]->stream.Append(block->Channel(b), block->NumFrames());
+            else beams_[b]->stream.Append(block->Samples(), block->NumFrames(), block->num_channels, b);
+            frames_per_beam = beams_[b]->stream.TakeFrames(&samples_);
+        }
+        size_t total = frames_per_beam * num_beams;
+        if (total == 0) return;
+
+        // Frames are beam-major: beam b owns [b * frames_per_beam, ...).
+        levels_.resize(total);
+        for (size_t f = 0; f < total; f++) {
+            const float *x = &samples_[f * length];
+            levels_[f] = 10.0f * log10(simd::Dot(x, x, length) / length + 1e-12f);
+        }
+        selected_.assign(total, false);
+        frame_ptrs_.clear();
+        int hangover = static_cast<int>(model_->NumFrames());
+        for (size_t i = 0; i < frames_per_beam; i++) {
+            float loudest = -1e30f;
+            for (size_t b = 0; b < num_beams; b++) loudest = std::max(loudest, levels_[b * frames_per_beam + i]);
+            for (size_t b = 0; b < num_beams; b++) {
+                size_t f = b * frames_per_beam + i;
+                bool active = beams_[b]->Active(levels_[f], floor_margin_db_, hangover);
+                if (active && levels_[f] >= loudest - gate_db_) {
+                    selected_[f] = true;
+                    frame_ptrs_.push_back(&samples_[f * length]);
+                }
+            }
+        }
+        features_.resize(frame_ptrs_.size() * num_mel);
+        if (!frame_ptrs_.empty()) frontend_.ComputeBatch(&frame_ptrs_[0], frame_ptrs_.size(), &features_[0]);
+
+        // frame_ptrs_ was filled frame-index-major, so walk in the same order.
+        size_t next_feature = 0;
+        for (size_t i = 0; i < frames_per_beam; i++) {
+            for (size_t b = 0; b < num_beams; b++) {
+                size_t f = b * frames_per_beam + i;
+                KwsStream &stream = beams_[b]->stream;
+                if (!selected_[f]) {
+                    stream.PushFeatures(nullptr, model_->NumFrames());
+                    num_gated_++;
+                    continue;
+                }
+                stream.PushFeatures(&features_[next_feature++ * num_mel], model_->NumFrames());
+                float score;
+                bool detected;
+                if (stream.Score(*model_, threshold_, &score, &detected)) {
+                    num_scored_++;
+                    if (score > best_score_) {
+                        best_score_ = score;
+                        best_beam_ = static_cast<int>(b);
+                    }
+                    if (detected && !detected_) {
+                        detected_ = true;
+                        detected_beam_ = static_cast<int>(b);
+                        event_.count++;
+                        event_.beam = detected_beam_;
+                        event_.rate = block->rate;
+                        event_.sample_index = block->sample_index;
+                        event_.block_frames = block->NumFrames();
+                        event_.capture_ns = block->capture_ns;
+                        event_.detect_ns = MonotonicNs();
+                    }
+                }
+            }
+        }
+    }
+
+    // Results of the last block.
+    bool Detected() const { return detected_; }
+    int GetDetectedBeam() const { return detected_beam_; }
+    int GetBestBeam() const { return best_beam_; }
+    // The latest detection with the capture stamps of its block.
+    const HotwordEvent &GetLastEvent() const { return event_; }
+    float GetBestScore() const { return best_score_; }
+
+    // Frames the model scored, i.e. those that passed the gate once the
+    // beam's window was full, versus frames gated out. Frames that passed
+    // while the window was still filling are in neither count.
+    uint64_t GetNumScored() const { return num_scored_; }
+    uint64_t GetNumGated() const { return num_gated_; }
+
+private:
+    struct Beam {
+        explicit Beam(const LogMelFrontend &frontend) : stream(frontend), floor_db(0.0f), hangover(0), primed(false) {}
+
+        // Tracks the noise floor (falls at once, rises 5 dB/s) and reports
+        // whether the frame is far enough above it. Once active, a beam stays
+        // active for one model length so the whole word is computed.
+        bool Active(float level_db, float margin_db, int hangover_frames) {
+            if (!primed || level_db < floor_db) {
+                floor_db = level_db;
+                primed = true;
+            }
+            else {
+                floor_db += 0.05f;
+            }
+            if (level_db > floor_db + margin_db) hangover = hangover_frames;
+            else if (hangover > 0) hangover--;
+            return hangover > 0;
+        }
+
+        KwsStream stream;
+        float floor_db;
+        int hangover;
+        bool primed;
+    };
+
+    MultiBeamKwsStage(std::shared_ptr<const KwsTemplateModel> model, float sensitivity, float gate_db,
+                      float floor_margin_db)
+        : model_(model), threshold_(KwsThresholdForSensitivity(sensitivity)), gate_db_(gate_db),
+          floor_margin_db_(floor_margin_db), detected_(false), detected_beam_(-1), best_beam_(-1),
+          best_score_(-1.0f), num_scored_(0), num_gated_(0), slot_(nullptr), slot_generation_(0) {}
+
+    LogMelFrontend frontend_;
+    std::shared_ptr<const KwsTemplateModel> model_;
+    float threshold_;
+    float gate_db_, floor_margin_db_;
+    std::vector<std::unique_ptr<Beam> > beams_;
+    std::vector<float> samples_, features_, levels_;
+    std::vector<bool> selected_;
+    std::vector<const float *> frame_ptrs_;
+    bool detected_;
+    int detected_beam_, best_beam_;
+    float best_score_;
+    uint64_t num_scored_, num_gated_;
+    HotwordEvent event_;
+    const KwsModelSlot *slot_;
+    uint64_t slot_generation_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // MULTIBEAM_KWS_H_
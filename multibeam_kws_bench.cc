@@ -0,0 +1,216 @@
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "multibeam_kws.h"
+#include "wav_block_reader.h"
+
+extern "C"
+{
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+
+static void help(const char *argv0) {
+    cout << "multibeam_kws_bench [options]" << endl;
+    cout << "Compares N separate single-beam detectors with one MultiBeamKwsStage over the same beams." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -f, --file=INPUT_FILE_NAME               A beam input; repeat for one mono file per beam, default is" << endl;
+    cout << "                                           vep_aec_beamforming_node_in_0..5.wav" << endl;
+    cout << "  -m, --model=MODEL_FILE_NAME              Template model from kws_enroll, default enrolls 1 s of the first input" << endl;
+    cout << "  -b, --beams=LIST                         Beam counts to compare, inputs are reused cyclically, default is 1,6,7,9" << endl;
+}
+
+static double ThreadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What running one detector per beam costs: a front end, window and scoring
+// pass per beam and per block.
+class SingleBeamKws {
+public:
+    explicit SingleBeamKws(shared_ptr<const KwsTemplateModel> model) : model_(model), stream_(frontend_), hits_(0) {}
+
+    void Process(const AudioBlock &block, size_t channel) {
+        stream_.Append(block.Samples(), block.NumFrames(), block.num_channels, channel);
+        samples_.clear();
+        size_t n = stream_.TakeFrames(&samples_);
+        if (n == 0) return;
+        vector<const float *> frames(n);
+        for (size_t i = 0; i < n; i++) frames[i] = &samples_[i * frontend_.FrameLength()];
+        features_.resize(n * frontend_.NumMel());
+        frontend_.ComputeBatch(&frames[0], n, &features_[0]);
+        for (size_t i = 0; i < n; i++) {
+            float score;
+            bool detected;
+            stream_.PushFeatures(&features_[i * frontend_.NumMel()], model_->NumFrames());
+            if (stream_.Score(*model_, KwsThresholdForSensitivity(0.5f), &score, &detected) && detected) hits_++;
+        }
+    }
+
+    int Hits() const { return hits_; }
+
+private:
+    LogMelFrontend frontend_;
+    shared_ptr<const KwsTemplateModel> model_;
+    KwsStream stream_;
+    vector<float> samples_, features_;
+    int hits_;
+};
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    vector<string> files;
+    string model_path, beam_list = "1,6,7,9";
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"file",         1, NULL, 'f'},
+        {"model",        1, NULL, 'm'},
+        {"beams",        1, NULL, 'b'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "f:m:b:h", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'f':
+            files.push_back(string(optarg));
+            break;
+        case 'm':
+            model_path = string(optarg);
+            break;
+        case 'b':
+            beam_list = string(optarg);
+            break;
+        default:
+            return 0;
+        }
+    }
+    if (files.empty()) {
+        for (int i = 0; i < 6; i++) files.push_back("vep_aec_beamforming_node_in_" + to_string(i) + ".wav");
+    }
+
+    // Load every input channel into memory so file I/O stays out of the timing.
+    vector<vector<AudioBlock>> inputs;
+    for (size_t i = 0; i < files.size(); i++) {
+        unique_ptr<WavBlockReader> reader(WavBlockReader::Create(files[i], BLOCK_SIZE_MS));
+        if (!reader || reader->GetRate() != 16000) {
+            cout << "Error : Not able to open 16k input file " << files[i] << endl;
+            return -1;
+        }
+        vector<AudioBlock> blocks;
+        AudioBlock block;
+        while (reader->Read(&block)) blocks.push_back(block);
+        inputs.push_back(blocks);
+    }
+    vector<size_t> channel_of;    // input channel feeding each mono source
+    vector<size_t> source_of;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        for (size_t ch = 0; ch < inputs[i][0].num_channels; ch++) {
+            source_of.push_back(i);
+            channel_of.push_back(ch);
+        }
+    }
+    size_t num_blocks = inputs[0].size();
+    for (size_t i = 1; i < inputs.size(); i++) num_blocks = min(num_blocks, inputs[i].size());
+
+    shared_ptr<const KwsTemplateModel> model;
+    if (!model_path.empty()) {
+        model.reset(KwsTemplateModel::Load(model_path));
+    }
+    else {
+        vector<int16_t> first;
+        for (size_t b = 0; b < num_blocks && first.size() < 16000; b++) {
+            const AudioBlock &block = inputs[0][b];
+            for (size_t n = 0; n < block.NumFrames(); n++) first.push_back(block.Samples()[n * block.num_channels]);
+        }
+        model.reset(KwsTemplateModel::Enroll(&first[0], first.size()));
+    }
+    if (!model) {
+        cout << "Error : Not able to load the keyword model." << endl;
+        return -1;
+    }
+    if (!model->Fits(KwsFrontendConfig())) {
+        cout << "Error : " << model_path << " was enrolled with a different front end" << endl;
+        return -1;
+    }
+
+    double audio_s = num_blocks * BLOCK_SIZE_MS / 1000.0;
+    cout << "audio: " << audio_s << " s, model frames: " << model->NumFrames() << ", cost in us per block" << endl;
+    cout << setw(7) << "beams" << setw(12) << "separate" << setw(12) << "multibeam" << setw(9) << "ratio"
+         << setw(11) << "computed %" << setw(10) << "hits" << endl;
+
+    stringstream beams_in(beam_list);
+    string item;
+    while (getline(beams_in, item, ',')) {
+        size_t num_beams = stoi(item);
+        if (num_beams == 0) continue;
+
+        // Interleave the sources into num_beams-channel blocks.
+        vector<AudioBlock> blocks(num_blocks);
+        for (size_t b = 0; b < num_blocks; b++) {
+            size_t frames = inputs[0][b].NumFrames();
+            blocks[b].num_channels = num_beams;
+            blocks[b].rate = 16000;
+            blocks[b].sequence = b;
+            blocks[b].data.resize(frames * num_beams * sizeof(int16_t));
+            for (size_t beam = 0; beam < num_beams; beam++) {
+                const AudioBlock &src = inputs[source_of[beam % source_of.size()]][b];
+                size_t ch = channel_of[beam % channel_of.size()];
+                for (size_t n = 0; n < frames; n++) {
+                    blocks[b].Samples()[n * num_beams + beam] = src.Samples()[n * src.num_channels + ch];
+                }
+            }
+        }
+
+        vector<unique_ptr<SingleBeamKws>> separate;
+        for (size_t beam = 0; beam < num_beams; beam++) separate.push_back(unique_ptr<SingleBeamKws>(new SingleBeamKws(model)));
+        double start = ThreadCpuSeconds();
+        for (size_t b = 0; b < num_blocks; b++) {
+            for (size_t beam = 0; beam < num_beams; beam++) separate[beam]->Process(blocks[b], beam);
+        }
+        double separate_s = ThreadCpuSeconds() - start;
+        int separate_hits = 0;
+        for (size_t beam = 0; beam < num_beams; beam++) separate_hits += separate[beam]->Hits();
+
+        unique_ptr<MultiBeamKwsStage> multibeam(MultiBeamKwsStage::Create(model, 0.5f));
+        multibeam->Prepare(num_beams, 16000, BLOCK_SIZE_MS);
+        int multibeam_hits = 0;
+        start = ThreadCpuSeconds();
+        for (size_t b = 0; b < num_blocks; b++) {
+            AudioBlock block = blocks[b];
+            multibeam->ProcessBlock(&block);
+            if (multibeam->Detected()) multibeam_hits++;
+        }
+        double multibeam_s = ThreadCpuSeconds() - start;
+        uint64_t scored = multibeam->GetNumScored(), gated = multibeam->GetNumGated();
+
+        cout << setw(7) << num_beams << fixed << setprecision(1)
+             << setw(12) << separate_s * 1e6 / num_blocks
+             << setw(12) << multibeam_s * 1e6 / num_blocks
+             << setw(9) << setprecision(2) << (multibeam_s > 0 ? separate_s / multibeam_s : 0)
+             << setw(11) << setprecision(1) << (scored + gated ? 100.0 * scored / (scored + gated) : 0)
+             << setw(5) << separate_hits << "/" << multibeam_hits << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <csignal>
+#include <chrono>
+#include <thread>
+#include <respeaker.h>
+#include <chain_nodes/pulse_collector_node.h>
+#include "gcc_phat_doa.h"
+extern "C"
+{
+#include <unistd.h>
+#include <getopt.h>
+}
+using namespace std;
+using namespace respeaker;
+using namespace respeaker_ext;
+#define BLOCK_SIZE_MS    8
+static bool stop = false;
+void SignalHandler(int signal){
+  cerr << "Caught signal " << signal << ", terminating..." << endl;
+  stop = true;
+}
+static void help(const char *argv0) {
+    cout << "pulse_doa_test [options]" << endl;
+    cout << "A demo application for librespeaker. Prints a continuous direction of arrival from the raw mic channels." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -s, --source=SOURCE_NAME                 The source (microphone) to connect to" << endl;
+    cout << "  -t, --type=MIC_TYPE                      The MICROPHONE TYPE, support: CIRCULAR_6MIC_7BEAM, LINEAR_6MIC_8BEAM, LINEAR_4MIC_1BEAM, CIRCULAR_4MIC_9BEAM" << endl;
+    cout << "  -r, --mic0=DEGREES                       Angle of mic 0, as SetAngleForMic0(), default is 0" << endl;
+    cout << "  -p, --publish=MS                         Publish interval, default is 100" << endl;
+}
+int main(int argc, char *argv[]) {
+    // Configures signal handling.
+    struct sigaction sig_int_handler;
+    sig_int_handler.sa_handler = SignalHandler;
+    sigemptyset(&sig_int_handler.sa_mask);
+    sig_int_handler.sa_flags = 0;
+    sigaction(SIGINT, &sig_int_handler, NULL);
+    sigaction(SIGTERM, &sig_int_handler, NULL);
+    // parse opts
+    int c;
+    string source = "default";
+    string mic_type = "CIRCULAR_6MIC_7BEAM";
+    float mic0_angle = 0;
+    int publish_ms = 100;
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"source",       1, NULL, 's'},
+        {"type",         1, NULL, 't'},
+        {"mic0",         1, NULL, 'r'},
+        {"publish",      1, NULL, 'p'},
+        {NULL,           0, NULL,  0}
+    };
+    while ((c = getopt_long(argc, argv, "s:t:r:p:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 's':
+            source = string(optarg);
+            break;
+        case 't':
+            mic_type = string(optarg);
+            break;
+        case 'r':
+            mic0_angle = stof(optarg);
+            break;
+        case 'p':
+            publish_ms = stoi(optarg);
+            break;
+        default:
+            return 0;
+        }
+    }
+    MicGeometry geometry;
+    if (!MicGeometry::FromMicType(mic_type, mic0_angle, &geometry)) {
+        cout << "Unknown mic type " << mic_type << endl;
+        return -1;
+    }
+    unique_ptr<PulseCollectorNode> collector;
+    unique_ptr<GccPhatDoaStage> doa;
+    unique_ptr<ReSpeaker> respeaker;
+    // The collector alone is the chain: its output carries every mic channel.
+    collector.reset(PulseCollectorNode::Create_48Kto16K(source, BLOCK_SIZE_MS));
+    respeaker.reset(ReSpeaker::Create());
+    respeaker->RegisterChainByHead(collector.get());
+    respeaker->RegisterOutputNode(collector.get());
+    if (!respeaker->Start(&stop)) {
+        cout << "Can not start the respeaker node chain." << endl;
+        return -1;
+    }
+    size_t num_channels = respeaker->GetNumOutputChannels();
+    int rate = respeaker->GetNumOutputRate();
+    cout << "num channels: " << num_channels << ", rate: " << rate << endl;
+    doa.reset(GccPhatDoaStage::Create(geometry, publish_ms, [](const DoaEstimate &estimate) {
+        if (estimate.valid) {
+            cout << "angle: " << estimate.angle << ", confidence: " << estimate.confidence << endl;
+        }
+    }));
+    if (!doa->Prepare(num_channels, rate, BLOCK_SIZE_MS)) {
+        cout << "The chain has fewer channels than the " << mic_type << " geometry." << endl;
+        respeaker->Stop();
+        return -1;
+    }
+    AudioBlock block;
+    block.num_channels = num_channels;
+    block.rate = rate;
+    while (!stop)
+    {
+        block.data = respeaker->Listen();
+        block.sequence++;
+        doa->ProcessBlock(&block);
+    }
+    cout << "stopping the respeaker worker thread..." << endl;
+    respeaker->Stop();
+    cout << "cleanup done." << endl;
+    return 0;
+}
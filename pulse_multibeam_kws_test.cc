@@ -0,0 +1,221 @@
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <iostream>
+#include <csignal>
+#include <chrono>
+#include <thread>
+#include <respeaker.h>
+#include <chain_nodes/pulse_collector_node.h>
+#include <chain_nodes/vep_aec_beamforming_node.h>
+#include "capture_clock.h"
+#include "control_socket.h"
+#include "delay_sum_beamformer.h"
+#include "multibeam_kws.h"
+extern "C"
+{
+#include <unistd.h>
+#include <getopt.h>
+}
+using namespace std;
+using namespace respeaker;
+using namespace respeaker_ext;
+#define BLOCK_SIZE_MS    8
+static bool stop = false;
+void SignalHandler(int signal){
+  cerr << "Caught signal " << signal << ", terminating..." << endl;
+  stop = true;
+}
+static void help(const char *argv0) {
+    cout << "pulse_multibeam_kws_test [options]" << endl;
+    cout << "A demo application for librespeaker. Spots the keyword on every beam and reports the best one." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -s, --source=SOURCE_NAME                 The source (microphone) to connect to" << endl;
+    cout << "  -t, --type=MIC_TYPE                      The MICROPHONE TYPE, support: CIRCULAR_6MIC_7BEAM, CIRCULAR_4MIC_9BEAM, default is CIRCULAR_6MIC_7BEAM" << endl;
+    cout << "  -m, --model=MODEL_FILE_NAME              Keyword template model from kws_enroll" << endl;
+    cout << "  -e, --sensitivity=SENSITIVITY            Detection sensitivity in [0, 1], default is 0.5" << endl;
+    cout << "  -b, --beamformer=NAME                    vep (VepAecBeamformingNode) or delay_sum (the in-repo fixed beams:" << endl;
+    cout << "                                           cheaper, but no AEC or noise suppression and a lower SNR)," << endl;
+    cout << "                                           default is vep" << endl;
+    cout << "  -i, --idle=MODE                          With delay_sum, the beams run in silence: all, one (a cheap beam" << endl;
+    cout << "                                           copied to every output) or none, default is one" << endl;
+    cout << "  -w, --wav                                Enable the wav log of VepAecBeamformingNode (-b vep only)," << endl;
+    cout << "                                           default is false." << endl;
+    cout << "  -c, --control=SOCKET_PATH                Accept 'model PATH', 'sensitivity VALUE' and 'status' on this" << endl;
+    cout << "                                           unix socket, to retune without restarting" << endl;
+}
+int main(int argc, char *argv[]) {
+    // Configures signal handling.
+    struct sigaction sig_int_handler;
+    sig_int_handler.sa_handler = SignalHandler;
+    sigemptyset(&sig_int_handler.sa_mask);
+    sig_int_handler.sa_flags = 0;
+    sigaction(SIGINT, &sig_int_handler, NULL);
+    sigaction(SIGTERM, &sig_int_handler, NULL);
+    // parse opts
+    int c;
+    string source = "default";
+    string mic_type = "CIRCULAR_6MIC_7BEAM";
+    string model_path;
+    float sensitivity = 0.5;
+    bool enable_wav = false;
+    string control_path;
+    string beamformer_name = "vep";
+    string idle_mode = "one";
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"source",       1, NULL, 's'},
+        {"type",         1, NULL, 't'},
+        {"model",        1, NULL, 'm'},
+        {"sensitivity",  1, NULL, 'e'},
+        {"beamformer",   1, NULL, 'b'},
+        {"idle",         1, NULL, 'i'},
+        {"wav",          0, NULL, 'w'},
+        {"control",      1, NULL, 'c'},
+        {NULL,           0, NULL,  0}
+    };
+    while ((c = getopt_long(argc, argv, "s:t:m:e:c:b:i:hw", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 's':
+            source = string(optarg);
+            break;
+        case 't':
+            mic_type = string(optarg);
+            break;
+        case 'm':
+            model_path = string(optarg);
+            break;
+        case 'e':
+            sensitivity = stof(optarg);
+            break;
+        case 'b':
+            beamformer_name = string(optarg);
+            break;
+        case 'i':
+            idle_mode = string(optarg);
+            break;
+        case 'w':
+            enable_wav = true;
+            break;
+        case 'c':
+            control_path = string(optarg);
+            break;
+        default:
+            return 0;
+        }
+    }
+    unique_ptr<KwsModelSlot> model_slot(KwsModelSlot::Create(model_path, sensitivity));
+    if (!model_slot) {
+        cout << "Can not load the keyword model " << model_path << endl;
+        return -1;
+    }
+    unique_ptr<ControlSocket> control;
+    if (!control_path.empty()) {
+        control.reset(ControlSocket::Create(control_path));
+        if (!control) {
+            cout << "Can not listen on " << control_path << endl;
+            return -1;
+        }
+        KwsModelSlot *slot = model_slot.get();
+        control->AddHandler("model", [slot](const string &path) { return slot->ReloadAndWait(path); });
+        control->AddHandler("sensitivity", [slot](const string &value) {
+            char *end = NULL;
+            float s = strtof(value.c_str(), &end);
+            if (value.empty() || *end != '\0' || s < 0 || s > 1) return string("error sensitivity must be in [0, 1]");
+            slot->SetSensitivity(s);
+            return slot->Status();
+        });
+        control->AddHandler("status", [slot](const string &) { return slot->Status(); });
+        control->Start();
+    }
+    unique_ptr<PulseCollectorNode> collector;
+    unique_ptr<VepAecBeamformingNode> vep_beams;
+    unique_ptr<DelaySumBeamformer> delay_sum;
+    unique_ptr<MultiBeamKwsStage> multibeam_kws;
+    unique_ptr<ReSpeaker> respeaker;
+    collector.reset(PulseCollectorNode::Create_48Kto16K(source, BLOCK_SIZE_MS));
+    respeaker.reset(ReSpeaker::Create());
+    respeaker->RegisterChainByHead(collector.get());
+    if (beamformer_name == "delay_sum") {
+        // The raw mics come out of the chain and are beamformed in-process.
+        MicGeometry geometry;
+        MicGeometry::FromMicType(mic_type, 0, &geometry);
+        delay_sum.reset(CreateDelaySumBeamformer(mic_type, EvenBeamAngles(geometry.NumMics(), IsLinearMicType(mic_type))));
+        if (!delay_sum) {
+            cout << "No delay-and-sum beamformer for " << mic_type << endl;
+            return -1;
+        }
+        if (idle_mode == "one") delay_sum->SetActivityGating(DelaySumBeamformer::kIdleOneBeam);
+        else if (idle_mode == "none") delay_sum->SetActivityGating(DelaySumBeamformer::kIdleSilent);
+        respeaker->RegisterOutputNode(collector.get());
+    }
+    else {
+        // single beam output off: one output channel per beam
+        vep_beams.reset(VepAecBeamformingNode::Create(StringToMicType(mic_type), false, 6, enable_wav));
+        vep_beams->Uplink(collector.get());
+        respeaker->RegisterOutputNode(vep_beams.get());
+    }
+    if (!respeaker->Start(&stop)) {
+        cout << "Can not start the respeaker node chain." << endl;
+        return -1;
+    }
+    size_t num_channels = respeaker->GetNumOutputChannels();
+    int rate = respeaker->GetNumOutputRate();
+    size_t num_beams = num_channels;
+    if (delay_sum) {
+        if (!delay_sum->Prepare(num_channels, rate, BLOCK_SIZE_MS)) {
+            cout << "The delay-and-sum beamformer does not fit " << num_channels << " channels at " << rate << endl;
+            respeaker->Stop();
+            return -1;
+        }
+        num_beams = delay_sum->GetNumOutputChannels(num_channels);
+    }
+    cout << "num beams: " << num_beams << ", rate: " << rate << endl;
+    multibeam_kws.reset(MultiBeamKwsStage::Create(model_slot.get()));
+    if (!multibeam_kws->Prepare(num_beams, rate, BLOCK_SIZE_MS)) {
+        cout << "The keyword model does not match the chain output." << endl;
+        respeaker->Stop();
+        return -1;
+    }
+    AudioBlock block;
+    block.num_channels = num_channels;
+    block.rate = rate;
+    CaptureTimeline timeline(rate);
+    LatencyReport latency_report;
+    int tick = 0;
+    int hotword_count = 0;
+    while (!stop)
+    {
+        block.data = respeaker->Listen();
+        block.num_channels = num_channels;
+        block.sequence++;
+        timeline.Stamp(block.NumFrames(), &block.sample_index, &block.capture_ns);
+        if (delay_sum) delay_sum->ProcessBlock(&block);
+        multibeam_kws->ProcessBlock(&block);
+        if (multibeam_kws->Detected()) {
+            hotword_count++;
+            latency_report.Add(multibeam_kws->GetLastEvent().LatencyMs());
+            cout << "hotword_count = " << hotword_count << ", beam = " << multibeam_kws->GetDetectedBeam() << ", "
+                 << multibeam_kws->GetLastEvent() << endl;
+        }
+        if (tick++ % 125 == 0) {
+            cout << "best beam: " << multibeam_kws->GetBestBeam() << ", score: " << multibeam_kws->GetBestScore() <<
+            ", collector: " << collector->GetQueueDeepth();
+            if (vep_beams) cout << ", vep_beams: " << vep_beams->GetQueueDeepth();
+            if (delay_sum) cout << ", all beams: " << (delay_sum->IsExpanded() ? "on" : "off");
+            cout << endl;
+        }
+    }
+    latency_report.Print(cout);
+    if (delay_sum) {
+        cout << "blocks with all beams: " << delay_sum->GetNumFullBlocks() << ", with the idle beam: "
+             << delay_sum->GetNumIdleBlocks() << endl;
+    }
+    cout << "stopping the respeaker worker thread..." << endl;
+    respeaker->Stop();
+    cout << "cleanup done." << endl;
+    return 0;
+}
@@ -0,0 +1,288 @@
+#ifndef REF_DELAY_ESTIMATOR_H_
+#define REF_DELAY_ESTIMATOR_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "chain_stage.h"
+#include "fft.h"
+#include "simd_utils.h"
+
+namespace respeaker_ext {
+
+// Estimates how far the microphone signal lags the playback reference. Both
+// signals are kept over a sliding window; every update_ms the window pair goes
+// through one FFT each, the PHAT-weighted cross spectrum is folded into a
+// running average and one inverse FFT gives the correlation. An update is
+// spread over the blocks that follow it, one of the three FFTs (of 2x the
+// window) per block, on a snapshot of the window taken when it starts, so no
+// single block pays for all of it. Updates where the reference is silent are
+// skipped and keep the last estimate.
+class RefDelayEstimator {
+public:
+    RefDelayEstimator(int rate, int max_delay_ms = 250, int update_ms = 128, float smoothing = 0.2f)
+        : rate_(rate), max_lag_(rate * max_delay_ms / 1000), window_(NextPow2(2 * max_lag_)),
+          update_interval_(rate * update_ms / 1000), smoothing_(smoothing), fft_(2 * window_),
+          mic_(window_, 0.0f), ref_(window_, 0.0f), since_update_(0), filled_(0), step_(kIdle),
+          delay_(0.0f), confidence_(0.0f), valid_(false), num_updates_(0) {
+        size_t bins = fft_.NumBins();
+        sr_.assign(bins, 0.0f);
+        si_.assign(bins, 0.0f);
+        mic_padded_.assign(fft_.Size(), 0.0f);
+        ref_padded_.assign(fft_.Size(), 0.0f);
+        mr_.resize(bins);
+        mi_.resize(bins);
+        rr_.resize(bins);
+        ri_.resize(bins);
+        corr_.resize(fft_.Size());
+    }
+
+    // Adds num_frames samples of each signal, in [-1, 1).
+    void Process(const float *mic, const float *ref, size_t num_frames) {
+        for (size_t i = 0; i < num_frames; i++) {
+            mic_[write_] = mic[i];
+            ref_[write_] = ref[i];
+            write_ = (write_ + 1) % window_;
+        }
+        filled_ = std::min(window_, filled_ + num_frames);
+        since_update_ += num_frames;
+        if (step_ != kIdle) {
+            Step();
+        }
+        else if (since_update_ >= update_interval_ && filled_ == window_) {
+            since_update_ = 0;
+            StartUpdate();
+        }
+    }
+
+    // Positive when the microphone lags the reference.
+    float GetDelaySamples() const { return delay_; }
+    float GetDelayMs() const { return delay_ * 1000.0f / rate_; }
+    // Correlation peak over its mean magnitude; above ~5 is a clear peak.
+    float GetConfidence() const { return confidence_; }
+    bool IsValid() const { return valid_; }
+    uint64_t GetNumUpdates() const { return num_updates_; }
+
+private:
+    static size_t NextPow2(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    enum UpdateStep { kIdle, kMicFft, kRefFft, kCorrelate };
+
+    // Oldest sample first, zero padded to twice the window.
+    void Snapshot(const std::vector<float> &ring, std::vector<float> *padded) {
+        std::copy(ring.begin() + write_, ring.end(), padded->begin());
+        std::copy(ring.begin(), ring.begin() + write_, padded->begin() + (window_ - write_));
+    }
+
+    void StartUpdate() {
+        float ref_energy = simd::Dot(&ref_[0], &ref_[0], window_) / window_;
+        float mic_energy = simd::Dot(&mic_[0], &mic_[0], window_) / window_;
+        if (ref_energy < 1e-7f || mic_energy < 1e-9f) return;  // below about -70 dBFS
+        Snapshot(mic_, &mic_padded_);
+        Snapshot(ref_, &ref_padded_);
+        step_ = kMicFft;
+        Step();
+    }
+
+    // One FFT's worth of the update in progress.
+    void Step() {
+        switch (step_) {
+        case kMicFft:
+            fft_.Forward(&mic_padded_[0], &mr_[0], &mi_[0]);
+            step_ = kRefFft;
+            return;
+        case kRefFft:
+            fft_.Forward(&ref_padded_[0], &rr_[0], &ri_[0]);
+            step_ = kCorrelate;
+            return;
+        case kCorrelate:
+            Correlate();
+            step_ = kIdle;
+            return;
+        case kIdle:
+            return;
+        }
+    }
+
+    void Correlate() {
+        size_t bins = fft_.NumBins();
+        float a = num_updates_ == 0 ? 1.0f : smoothing_;
+        for (size_t k = 0; k < bins; k++) {
+            // mic * conj(ref), whitened
+            float cr = mr_[k] * rr_[k] + mi_[k] * ri_[k];
+            float ci = mi_[k] * rr_[k] - mr_[k] * ri_[k];
+            float inv = 1.0f / (sqrt(cr * cr + ci * ci) + 1e-12f);
+            sr_[k] += a * (cr * inv - sr_[k]);
+            si_[k] += a * (ci * inv - si_[k]);
+        }
+        fft_.Inverse(&sr_[0], &si_[0], &corr_[0]);
+        num_updates_++;
+
+        // Lag l >= 0 sits at index l, lag -l at index N - l.
+        size_t n = corr_.size();
+        long best = 0;
+        float peak = -1e30f, sum = 0;
+        for (long lag = -static_cast<long>(max_lag_); lag <= static_cast<long>(max_lag_); lag++) {
+            float v = corr_[lag >= 0 ? lag : n + lag];
+            sum += fabs(v);
+            if (v > peak) {
+                peak = v;
+                best = lag;
+            }
+        }
+        float mean = sum / (2 * max_lag_ + 1);
+        confidence_ = mean > 0 ? peak / mean : 0.0f;
+
+        // Parabolic interpolation around the peak.
+        float offset = 0.0f;
+        if (best > -static_cast<long>(max_lag_) && best < static_cast<long>(max_lag_)) {
+            float l = corr_[best - 1 >= 0 ? best - 1 : n + best - 1];
+            float r = corr_[best + 1 >= 0 ? best + 1 : n + best + 1];
+            float denom = l - 2 * peak + r;
+            if (denom < 0) offset = 0.5f * (l - r) / denom;
+        }
+        delay_ = best + offset;
+        valid_ = true;
+    }
+
+    int rate_;
+    size_t max_lag_, window_, update_interval_;
+    float smoothing_;
+    Fft fft_;
+    std::vector<float> mic_, ref_;
+    size_t write_ = 0;
+    size_t since_update_, filled_;
+    UpdateStep step_;
+    std::vector<float> mic_padded_, ref_padded_, mr_, mi_, rr_, ri_, sr_, si_, corr_;
+    float delay_, confidence_;
+    bool valid_;
+    uint64_t num_updates_;
+};
+
+// Aligns the playback reference with the microphones before the block reaches
+// an AEC. Channels [0, ref_channel) are microphones, ref_channel and above
+// are reference. The estimate is applied once it has been confident and
+// stable for a few updates: a lagging microphone delays the reference by the
+// estimate minus a small causal margin (AEC filters need the reference to
+// lead), a leading microphone delays the microphones instead. Delay changes
+// take effect at block boundaries.
+class RefDelayCompensationStage : public ChainStage {
+public:
+    static RefDelayCompensationStage *Create(size_t ref_channel, int max_delay_ms = 250, int margin_ms = 2,
+                                             float min_confidence = 5.0f) {
+        return new RefDelayCompensationStage(ref_channel, max_delay_ms, margin_ms, min_confidence);
+    }
+
+    std::string Name() const override { return "ref_delay"; }
+    bool SupportsFloatPlanar() const override { return true; }
+
+    bool Prepare(size_t num_channels, int rate, int block_size_ms) override {
+        if (ref_channel_ == 0 || ref_channel_ >= num_channels) return false;
+        num_channels_ = num_channels;
+        rate_ = rate;
+        estimator_.reset(new RefDelayEstimator(rate, max_delay_ms_));
+        history_frames_ = rate * max_delay_ms_ / 1000 + 1;
+        history_.assign(history_frames_ * num_channels, 0.0f);
+        history_pos_ = 0;
+        return true;
+    }
+
+    void ProcessBlock(AudioBlock *block) override {
+        size_t frames = block->NumFrames(), ch = block->num_channels;
+        if (frames == 0) return;
+        mic_.assign(frames, 0.0f);
+        ref_.resize(frames);
+        if (block->format == kFloat32Planar) {
+            for (size_t c = 0; c < ref_channel_; c++) simd::Axpy(1.0f / ref_channel_, block->Channel(c), &mic_[0], frames);
+            std::copy(block->Channel(ref_channel_), block->Channel(ref_channel_) + frames, ref_.begin());
+        }
+        else {
+            const int16_t *s = block->Samples();
+            for (size_t n = 0; n < frames; n++) {
+                float acc = 0;
+                for (size_t c = 0; c < ref_channel_; c++) acc += s[n * ch + c];
+                mic_[n] = acc / (32768.0f * ref_channel_);
+                ref_[n] = s[n * ch + ref_channel_] / 32768.0f;
+            }
+        }
+        estimator_->Process(&mic_[0], &ref_[0], frames);
+        UpdateTarget();
+
+        // Sample n of channel c is at s[n * frame_stride + c * channel_stride].
+        if (block->format == kFloat32Planar) ApplyDelays(&block->planar[0], frames, 1, frames);
+        else ApplyDelays(block->Samples(), frames, ch, 1);
+    }
+
+    const RefDelayEstimator *GetEstimator() const { return estimator_.get(); }
+    size_t GetRefDelayFrames() const { return ref_delay_; }
+    size_t GetMicDelayFrames() const { return mic_delay_; }
+
+private:
+    RefDelayCompensationStage(size_t ref_channel, int max_delay_ms, int margin_ms, float min_confidence)
+        : ref_channel_(ref_channel), max_delay_ms_(max_delay_ms), margin_ms_(margin_ms),
+          min_confidence_(min_confidence), num_channels_(0), rate_(16000), history_frames_(0), history_pos_(0),
+          ref_delay_(0), mic_delay_(0), candidate_(0), stable_updates_(0), last_update_(0) {}
+
+    // Per-channel integer delay through one interleaved history ring. The
+    // ring holds samples at block scale, so int16 blocks come back exactly.
+    template <typename T>
+    void ApplyDelays(T *s, size_t frames, size_t frame_stride, size_t channel_stride) {
+        size_t ch = num_channels_;
+        for (size_t n = 0; n < frames; n++) {
+            float *slot = &history_[history_pos_ * ch];
+            for (size_t c = 0; c < ch; c++) slot[c] = s[n * frame_stride + c * channel_stride];
+            for (size_t c = 0; c < ch; c++) {
+                size_t d = c < ref_channel_ ? mic_delay_ : ref_delay_;
+                if (d == 0) continue;
+                size_t from = (history_pos_ + history_frames_ - d) % history_frames_;
+                s[n * frame_stride + c * channel_stride] = static_cast<T>(history_[from * ch + c]);
+            }
+            history_pos_ = (history_pos_ + 1) % history_frames_;
+        }
+    }
+
+    void UpdateTarget() {
+        if (estimator_->GetNumUpdates() == last_update_) return;
+        last_update_ = estimator_->GetNumUpdates();
+        if (estimator_->GetConfidence() < min_confidence_) {
+            stable_updates_ = 0;
+            return;
+        }
+        long delay = lround(estimator_->GetDelaySamples());
+        if (labs(delay - candidate_) > 1) {
+            candidate_ = delay;
+            stable_updates_ = 0;
+            return;
+        }
+        if (++stable_updates_ < 3) return;
+        long margin = rate_ * margin_ms_ / 1000;
+        long max_frames = static_cast<long>(history_frames_) - 1;
+        ref_delay_ = static_cast<size_t>(std::min(max_frames, std::max(0L, candidate_ - margin)));
+        mic_delay_ = static_cast<size_t>(std::min(max_frames, std::max(0L, -candidate_)));
+    }
+
+    size_t ref_channel_;
+    int max_delay_ms_, margin_ms_;
+    float min_confidence_;
+    size_t num_channels_;
+    int rate_;
+    std::unique_ptr<RefDelayEstimator> estimator_;
+    std::vector<float> mic_, ref_;
+    std::vector<float> history_;
+    size_t history_frames_, history_pos_;
+    size_t ref_delay_, mic_delay_;
+    long candidate_;
+    int stable_updates_;
+    uint64_t last_update_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // REF_DELAY_ESTIMATOR_H_
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "ref_delay_estimator.h"
+#include "wav_block_reader.h"
+
+extern "C"
+{
+#include <unistd.h>
+#include <getopt.h>
+}
+
+
+using namespace std;
+using namespace respeaker_ext;
+
+#define BLOCK_SIZE_MS    8
+
+
+static void help(const char *argv0) {
+    cout << "ref_delay_tool [options]" << endl;
+    cout << "Estimates the echo-reference delay from VepAecBeamformingNode dumps" << endl;
+    cout << "(vep_aec_beamforming_node_in_N.wav against vep_aec_beamforming_node_ref_in.wav)." << endl << endl;
+    cout << "  -h, --help                               Show this help" << endl;
+    cout << "  -d, --dir=DUMP_DIR                       A dump directory, may be repeated, default is anusha and nilanjan" << endl;
+    cout << "  -n, --mics=NUM_MICS                      Number of in_N.wav files, default is 6" << endl;
+    cout << "  -m, --max-delay=MS                       Largest delay searched, default is 250" << endl;
+    cout << "  -s, --simulate=MS                        Replace the reference by in_0 advanced by MS, to check the estimator" << endl;
+    cout << "  -v, --verbose                            Print every estimator update" << endl;
+}
+
+static double ThreadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool RunDir(const string &dir, int num_mics, int max_delay_ms, int simulate_ms, bool verbose) {
+    vector<unique_ptr<WavBlockReader>> mics;
+    for (int i = 0; i < num_mics; i++) {
+        string path = dir + "/vep_aec_beamforming_node_in_" + to_string(i) + ".wav";
+        mics.push_back(unique_ptr<WavBlockReader>(WavBlockReader::Create(path, BLOCK_SIZE_MS)));
+        if (!mics.back()) {
+            cout << "Error : Not able to open " << path << endl;
+            return false;
+        }
+    }
+    string ref_path = dir + "/vep_aec_beamforming_node_ref_in.wav";
+    unique_ptr<WavBlockReader> ref(WavBlockReader::Create(simulate_ms > 0 ? dir + "/vep_aec_beamforming_node_in_0.wav" : ref_path,
+                                                          BLOCK_SIZE_MS));
+    if (!ref) {
+        cout << "Error : Not able to open " << ref_path << endl;
+        return false;
+    }
+    int rate = mics[0]->GetRate();
+
+    // A simulated reference leads the mics: read in_0 ahead by simulate_ms.
+    vector<float> pending_ref;
+    size_t lead = (size_t)rate * simulate_ms / 1000;
+    AudioBlock block;
+    while (pending_ref.size() < lead && ref->Read(&block)) {
+        for (size_t n = 0; n < block.NumFrames(); n++) pending_ref.push_back(block.Samples()[n] / 32768.0f);
+    }
+    pending_ref.erase(pending_ref.begin(), pending_ref.begin() + min(lead, pending_ref.size()));
+
+    RefDelayEstimator estimator(rate, max_delay_ms);
+    vector<float> mic, ref_samples;
+    vector<float> confident;
+    double cpu = 0, worst = 0, ref_energy = 0;
+    size_t blocks = 0, samples = 0;
+    uint64_t last_update = 0;
+    while (true) {
+        size_t frames = 0;
+        mic.clear();
+        bool ok = true;
+        for (int i = 0; i < num_mics && ok; i++) {
+            if (!mics[i]->Read(&block)) {
+                ok = false;
+                break;
+            }
+            frames = block.NumFrames();
+            mic.resize(frames, 0.0f);
+            for (size_t n = 0; n < frames; n++) mic[n] += block.Samples()[n] / (32768.0f * num_mics);
+        }
+        while (ok && pending_ref.size() < frames) {
+            if (!ref->Read(&block)) {
+                ok = false;
+                break;
+            }
+            for (size_t n = 0; n < block.NumFrames(); n++) pending_ref.push_back(block.Samples()[n] / 32768.0f);
+        }
+        if (!ok) break;
+        ref_samples.assign(pending_ref.begin(), pending_ref.begin() + frames);
+        pending_ref.erase(pending_ref.begin(), pending_ref.begin() + frames);
+        for (size_t n = 0; n < frames; n++) ref_energy += ref_samples[n] * ref_samples[n];
+        samples += frames;
+
+        double start = ThreadCpuSeconds();
+        estimator.Process(&mic[0], &ref_samples[0], frames);
+        double elapsed = ThreadCpuSeconds() - start;
+        cpu += elapsed;
+        worst = max(worst, elapsed);
+        blocks++;
+
+        if (estimator.GetNumUpdates() != last_update) {
+            last_update = estimator.GetNumUpdates();
+            if (estimator.GetConfidence() >= 5.0f) confident.push_back(estimator.GetDelayMs());
+            if (verbose) {
+                cout << "  t = " << fixed << setprecision(2) << (double)samples / rate << " s, delay = "
+                     << setprecision(2) << estimator.GetDelayMs() << " ms, confidence = " << setprecision(1)
+                     << estimator.GetConfidence() << endl;
+            }
+        }
+    }
+
+    double ref_dbfs = samples ? 10 * log10(ref_energy / samples + 1e-12) : -120;
+    cout << dir << ": " << fixed << setprecision(1) << (double)samples / rate << " s, reference level "
+         << ref_dbfs << " dBFS, " << estimator.GetNumUpdates() << " updates, "
+         << setprecision(2) << (blocks ? cpu * 1e6 / blocks : 0) << " us per block, worst block " << worst * 1e6
+         << " us" << endl;
+    if (estimator.GetNumUpdates() == 0) {
+        cout << "  no estimate: the reference is silent (no playback during the capture)" << endl;
+    }
+    else if (confident.empty()) {
+        cout << "  no confident estimate, last delay = " << setprecision(2) << estimator.GetDelayMs()
+             << " ms, confidence = " << setprecision(1) << estimator.GetConfidence() << endl;
+    }
+    else {
+        sort(confident.begin(), confident.end());
+        cout << "  delay = " << setprecision(2) << confident[confident.size() / 2] << " ms (median of "
+             << confident.size() << " confident updates, range " << confident.front() << " .. "
+             << confident.back() << " ms)" << endl;
+    }
+    return true;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    // parse opts
+    int c;
+    vector<string> dirs;
+    int num_mics = 6;
+    int max_delay_ms = 250;
+    int simulate_ms = 0;
+    bool verbose = false;
+
+    static const struct option long_options[] = {
+        {"help",         0, NULL, 'h'},
+        {"dir",          1, NULL, 'd'},
+        {"mics",         1, NULL, 'n'},
+        {"max-delay",    1, NULL, 'm'},
+        {"simulate",     1, NULL, 's'},
+        {"verbose",      0, NULL, 'v'},
+        {NULL,           0, NULL,  0}
+    };
+
+    while ((c = getopt_long(argc, argv, "d:n:m:s:hv", long_options, NULL)) != -1) {
+
+        switch (c) {
+        case 'h' :
+            help(argv[0]);
+            return 0;
+        case 'd':
+            dirs.push_back(string(optarg));
+            break;
+        case 'n':
+            num_mics = stoi(optarg);
+            break;
+        case 'm':
+            max_delay_ms = stoi(optarg);
+            break;
+        case 's':
+            simulate_ms = stoi(optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            return 0;
+        }
+    }
+    if (dirs.empty()) {
+        dirs.push_back("anusha");
+        dirs.push_back("nilanjan");
+    }
+
+    for (size_t i = 0; i < dirs.size(); i++) {
+        if (!RunDir(dirs[i], num_mics, max_delay_ms, simulate_ms, verbose)) return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+#ifndef REPLAY_WINDOW_H_
+#define REPLAY_WINDOW_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <sndfile.h>
+}
+
+namespace respeaker_ext {
+
+// A stretch of a recording to replay. duration_s <= 0 runs to the end.
+struct ReplayWindow {
+    double start_s = 0;
+    double duration_s = 0;
+};
+
+// Takes seconds ("1234.5") or [h:]mm:ss ("20:34", "1:02:03.5").
+inline bool ParseReplayTime(const std::string &text, double *seconds) {
+    double total = 0;
+    size_t begin = 0;
+    for (int fields = 0; fields < 3; fields++) {
+        size_t colon = text.find(':', begin);
+        std::string field = text.substr(begin, colon == std::string::npos ? std::string::npos : colon - begin);
+        char *end = nullptr;
+        double value = strtod(field.c_str(), &end);
+        if (field.empty() || *end != '\0' || value < 0) return false;
+        total = total * 60 + value;
+        if (colon == std::string::npos) {
+            *seconds = total;
+            return true;
+        }
+        begin = colon + 1;
+    }
+    return false;
+}
+
+// Parses "START[+DURATION],START[+DURATION],...", e.g. "20:00+30,1500+10".
+inline bool ParseReplayWindows(const std::string &spec, std::vector<ReplayWindow> *windows, std::string *error) {
+    std::stringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        item.erase(std::remove(item.begin(), item.end(), ' '), item.end());
+        if (item.empty()) continue;
+        ReplayWindow window;
+        size_t plus = item.find('+');
+        if (!ParseReplayTime(item.substr(0, plus), &window.start_s) ||
+            (plus != std::string::npos && !ParseReplayTime(item.substr(plus + 1), &window.duration_s))) {
+            if (error) *error = "bad replay window " + item + ", expected START[+DURATION]";
+            return false;
+        }
+        windows->push_back(window);
+    }
+    return true;
+}
+
+// One window as laid out in the replay: pre-roll frames of warm-up audio
+// right before the window, then the window itself.
+struct ReplaySegment {
+    int window;
+    int64_t source_begin;    // first pre-roll frame in the recording
+    int64_t preroll_frames;
+    int64_t frames;          // pre-roll included
+    int64_t replay_begin;    // where the segment starts in the replay
+};
+
+// Replays chosen windows of a long recording instead of all of it. The
+// windows are seeked to directly (a wav seek is an offset computation, a
+// flac one a seek-table lookup), each one led by a short pre-roll so the
+// beamformer's adaptive filters and the detector's feature history have
+// settled by the time the window starts; nothing is reset between windows,
+// the pre-roll overwrites what is left of the previous one. Indexes into
+// the replay map back to recording time for reports.
+class ReplayPlan {
+public:
+    static ReplayPlan *Create(const std::string &path, const std::vector<ReplayWindow> &windows, double preroll_s,
+                              std::string *error) {
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        SNDFILE *file = sf_open(path.c_str(), SFM_READ, &info);
+        if (!file) {
+            if (error) *error = "can not open " + path;
+            return nullptr;
+        }
+        sf_close(file);
+        if (!info.seekable) {
+            if (error) *error = path + " is not seekable";
+            return nullptr;
+        }
+        ReplayPlan *plan = new ReplayPlan(path, info);
+        for (size_t i = 0; i < windows.size(); i++) {
+            int64_t start = static_cast<int64_t>(windows[i].start_s * info.samplerate);
+            int64_t end = windows[i].duration_s > 0
+                              ? std::min<int64_t>(info.frames, start + windows[i].duration_s * info.samplerate)
+                              : info.frames;
+            if (start >= end) {
+                if (error) {
+                    char message[96];
+                    snprintf(message, sizeof(message), "replay window %zu starts at %.3f s, past the end (%.3f s)", i,
+                             windows[i].start_s, double(info.frames) / info.samplerate);
+                    *error = message;
+                }
+                delete plan;
+                return nullptr;
+            }
+            ReplaySegment segment;
+            segment.window = i;
+            segment.source_begin = std::max<int64_t>(0, start - static_cast<int64_t>(preroll_s * info.samplerate));
+            segment.preroll_frames = start - segment.source_begin;
+            segment.frames = end - segment.source_begin;
+            segment.replay_begin = plan->num_frames_;
+            plan->segments_.push_back(segment);
+            plan->num_frames_ += segment.frames;
+        }
+        if (plan->segments_.empty()) {
+            if (error) *error = "no replay windows";
+            delete plan;
+            return nullptr;
+        }
+        return plan;
+    }
+
+    // Copies the segments, back to back, into a 16-bit wav that a
+    // FileCollectorNode can play. Reads only the windows, so the cost is
+    // their length, not the recording's.
+    bool Extract(const std::string &out_path, std::string *error) const {
+        SF_INFO in_info = info_;
+        SNDFILE *in = sf_open(path_.c_str(), SFM_READ, &in_info);
+        if (!in) {
+            if (error) *error = "can not open " + path_;
+            return false;
+        }
+        SF_INFO out_info;
+        memset(&out_info, 0, sizeof(out_info));
+        out_info.samplerate = info_.samplerate;
+        out_info.channels = info_.channels;
+        out_info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+        SNDFILE *out = sf_open(out_path.c_str(), SFM_WRITE, &out_info);
+        if (!out) {
+            if (error) *error = "can not create " + out_path;
+            sf_close(in);
+            return false;
+        }
+        const sf_count_t kChunkFrames = 4096;
+        std::vector<short> chunk(kChunkFrames * info_.channels);
+        bool ok = true;
+        for (size_t i = 0; i < segments_.size() && ok; i++) {
+            ok = sf_seek(in, segments_[i].source_begin, SEEK_SET) == segments_[i].source_begin;
+            for (int64_t left = segments_[i].frames; ok && left > 0;) {
+                sf_count_t want = std::min<int64_t>(kChunkFrames, left);
+                sf_count_t got = sf_readf_short(in, &chunk[0], want);
+                ok = got == want && sf_writef_short(out, &chunk[0], got) == got;
+                left -= got;
+            }
+        }
+        sf_close(out);
+        sf_close(in);
+        if (!ok && error) *error = "short read or write copying " + path_ + " to " + out_path;
+        return ok;
+    }
+
+    // The segment replay frame index falls in, or nullptr past the end.
+    const ReplaySegment *Locate(int64_t replay_index) const {
+        if (replay_index < 0 || replay_index >= num_frames_) return nullptr;
+        size_t lo = 0, hi = segments_.size();
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (segments_[mid].replay_begin <= replay_index) {
+                lo = mid;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return &segments_[lo];
+    }
+
+    int64_t ToSource(int64_t replay_index) const {
+        const ReplaySegment *segment = Locate(replay_index);
+        return segment ? segment->source_begin + (replay_index - segment->replay_begin) : -1;
+    }
+
+    // Whether the frame is warm-up audio ahead of a window. Detections there
+    // belong to the audio before the window and are not reported as hits.
+    bool InPreroll(int64_t replay_index) const {
+        const ReplaySegment *segment = Locate(replay_index);
+        return segment && replay_index - segment->replay_begin < segment->preroll_frames;
+    }
+
+    const std::vector<ReplaySegment> &GetSegments() const { return segments_; }
+    int64_t GetNumFrames() const { return num_frames_; }
+    int64_t GetSourceFrames() const { return info_.frames; }
+    int GetRate() const { return info_.samplerate; }
+
+private:
+    ReplayPlan(const std::string &path, const SF_INFO &info) : path_(path), info_(info), num_frames_(0) {}
+
+    std::string path_;
+    SF_INFO info_;
+    std::vector<ReplaySegment> segments_;
+    int64_t num_frames_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // REPLAY_WINDOW_H_
@@ -0,0 +1,52 @@
+#ifndef RT_CHECK_H_
+#define RT_CHECK_H_
+
+extern "C"
+{
+#include <dlfcn.h>
+}
+
+namespace respeaker_ext {
+
+// In-process side of the real-time checker (rt_checker.cc, loaded with
+// LD_PRELOAD). Code marks the sections that must not allocate, take a
+// contended lock, sleep or do I/O; the checker reports each such call made
+// inside a marked section with its stack. Without the checker preloaded the
+// lookup fails once and every mark is a no-op.
+class RtCheck {
+public:
+    // Marks (or unmarks) the calling thread as real-time. Marks nest.
+    static void Enter() {
+        MarkFn f = Lookup();
+        if (f) f(1);
+    }
+    static void Leave() {
+        MarkFn f = Lookup();
+        if (f) f(0);
+    }
+    // Never checks the calling thread again, whatever the mode or marks.
+    // For helper threads whose job is to block, sleep or write, which the
+    // checker would otherwise flag in RTCHECK_THREADS=spawned mode.
+    static void Exempt() {
+        MarkFn f = Lookup();
+        if (f) f(-1);
+    }
+
+private:
+    typedef void (*MarkFn)(int);
+
+    static MarkFn Lookup() {
+        static MarkFn mark = reinterpret_cast<MarkFn>(dlsym(RTLD_DEFAULT, "rtcheck_mark_thread"));
+        return mark;
+    }
+};
+
+class RtCheckScope {
+public:
+    RtCheckScope() { RtCheck::Enter(); }
+    ~RtCheckScope() { RtCheck::Leave(); }
+};
+
+}  // namespace respeaker_ext
+
+#endif  // RT_CHECK_H_
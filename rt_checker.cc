@@ -0,0 +1,461 @@
+// Real-time safety checker, loaded with LD_PRELOAD in front of a demo:
+//
+//   RTCHECK_THREADS=spawned LD_PRELOAD=./librt_checker.so ./manual_beamtest -f a.wav
+//
+// On threads marked real-time it flags heap calls (malloc, free, ...), mutex
+// locks that have to wait, sleeps, and file or console I/O. Each distinct
+// call site is counted and printed with its stack when the process exits.
+//
+// Which threads are real-time:
+//   RTCHECK_THREADS=spawned   every thread created with pthread_create, i.e.
+//                             the librespeaker node threads (the default)
+//   RTCHECK_THREADS=all       those plus the main thread (the polling loop)
+//   RTCHECK_THREADS=marked    only code inside RtCheckScope (rt_check.h)
+// Helper threads that are meant to block, sleep or write (the log writers, the
+// async log drain, model loaders, control sockets, wav feeders) call
+// RtCheck::Exempt() first and are never checked.
+// RTCHECK_GRACE_MS (default 1000) ignores calls in the first milliseconds
+// after a thread is first marked, while nodes set themselves up.
+// RTCHECK_ABORT=1 aborts on the first violation, for a core dump.
+//
+// Waiting on a condition variable is not flagged: it is how a node waits for
+// its next block. The checker's own bookkeeping never allocates.
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+extern "C"
+{
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void *__libc_memalign(size_t, size_t);
+void __libc_free(void *);
+}
+
+namespace {
+
+enum Kind { kAlloc, kFree, kLockWait, kSleep, kIo, kNumKinds };
+const char *const kKindNames[kNumKinds] = {"alloc", "free", "lock wait", "sleep", "i/o"};
+
+const int kMaxFrames = 16;
+const int kMaxSites = 256;
+
+struct Site {
+    std::atomic<uint64_t> count;
+    uint64_t hash;
+    int kind;
+    int num_frames;
+    void *frames[kMaxFrames];
+    const char *call;
+    char thread[16];
+};
+
+Site sites[kMaxSites];
+std::atomic<int> num_sites(0);
+std::atomic<uint64_t> dropped_sites(0);
+std::atomic<uint64_t> totals[kNumKinds];
+std::atomic_flag site_lock = ATOMIC_FLAG_INIT;
+
+enum Mode { kSpawned, kAll, kMarked };
+Mode mode = kSpawned;
+int64_t grace_ns = 1000000000LL;
+bool abort_on_violation = false;
+bool ready = false;
+
+// Per-thread state lives in initial-exec TLS so touching it never allocates.
+__thread int realtime_depth __attribute__((tls_model("initial-exec"))) = 0;
+__thread int in_checker __attribute__((tls_model("initial-exec"))) = 0;
+__thread int64_t marked_at_ns __attribute__((tls_model("initial-exec"))) = 0;
+__thread int exempt __attribute__((tls_model("initial-exec"))) = 0;
+
+int64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 1 marks, 0 unmarks, -1 exempts the thread for good.
+void MarkThread(int realtime) {
+    if (realtime < 0) {
+        exempt = 1;
+        realtime_depth = 0;
+    }
+    else if (realtime) {
+        if (realtime_depth++ == 0 && marked_at_ns == 0) marked_at_ns = NowNs();
+    }
+    else if (realtime_depth > 0) {
+        realtime_depth--;
+    }
+}
+
+// Called at the top of every hook; returns true when the call must be
+// recorded.
+bool Checking() {
+    if (!ready || in_checker || exempt || realtime_depth == 0) return false;
+    return NowNs() - marked_at_ns >= grace_ns;
+}
+
+void Record(Kind kind, const char *call) {
+    in_checker = 1;
+    void *frames[kMaxFrames + 2];
+    int n = backtrace(frames, kMaxFrames + 2);
+    // Skip Record() and the hook itself.
+    void **stack = frames + 2;
+    n = n > 2 ? n - 2 : 0;
+    uint64_t hash = 1469598103934665603ULL ^ kind;
+    for (int i = 0; i < n; i++) hash = (hash ^ reinterpret_cast<uintptr_t>(stack[i])) * 1099511628211ULL;
+
+    totals[kind].fetch_add(1, std::memory_order_relaxed);
+    while (site_lock.test_and_set(std::memory_order_acquire)) {}
+    int count = num_sites.load(std::memory_order_relaxed), i = 0;
+    for (; i < count; i++) {
+        if (sites[i].hash == hash) break;
+    }
+    if (i == count) {
+        if (count < kMaxSites) {
+            Site &site = sites[count];
+            site.hash = hash;
+            site.kind = kind;
+            site.call = call;
+            site.num_frames = n;
+            memcpy(site.frames, stack, n * sizeof(void *));
+            pthread_getname_np(pthread_self(), site.thread, sizeof(site.thread));
+            num_sites.store(count + 1, std::memory_order_relaxed);
+        }
+        else {
+            dropped_sites.fetch_add(1, std::memory_order_relaxed);
+            i = -1;
+        }
+    }
+    if (i >= 0) sites[i].count.fetch_add(1, std::memory_order_relaxed);
+    site_lock.clear(std::memory_order_release);
+
+    if (abort_on_violation) {
+        char line[128];
+        int len = snprintf(line, sizeof(line), "rt_checker: %s in %s on a real-time thread, aborting\n", kKindNames[kind], call);
+        ::write(2, line, len);
+        backtrace_symbols_fd(stack, n, 2);
+        abort();
+    }
+    in_checker = 0;
+}
+
+template <typename F>
+F Next(const char *name) {
+    in_checker++;
+    F f = reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+    in_checker--;
+    return f;
+}
+
+void Report() {
+    ready = false;
+    char line[256];
+    int count = num_sites.load();
+    int len = snprintf(line, sizeof(line), "\nrt_checker: %d call sites on real-time threads (mode %s, grace %lld ms)\n",
+                       count, mode == kAll ? "all" : mode == kMarked ? "marked" : "spawned",
+                       static_cast<long long>(grace_ns / 1000000));
+    ::write(2, line, len);
+    for (int k = 0; k < kNumKinds; k++) {
+        len = snprintf(line, sizeof(line), "  %-10s %llu calls\n", kKindNames[k],
+                       static_cast<unsigned long long>(totals[k].load()));
+        ::write(2, line, len);
+    }
+    if (dropped_sites.load()) {
+        len = snprintf(line, sizeof(line), "  (%llu calls from sites past the first %d not shown)\n",
+                       static_cast<unsigned long long>(dropped_sites.load()), kMaxSites);
+        ::write(2, line, len);
+    }
+    // Most frequent first; a selection sort over at most kMaxSites indices.
+    int order[kMaxSites];
+    for (int i = 0; i < count; i++) order[i] = i;
+    for (int i = 0; i < count; i++) {
+        for (int j = i + 1; j < count; j++) {
+            if (sites[order[j]].count.load() > sites[order[i]].count.load()) {
+                int t = order[i];
+                order[i] = order[j];
+                order[j] = t;
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        const Site &site = sites[order[i]];
+        len = snprintf(line, sizeof(line), "\n#%d %s: %s x%llu on thread '%s'\n", i + 1, kKindNames[site.kind],
+                       site.call, static_cast<unsigned long long>(site.count.load()), site.thread);
+        ::write(2, line, len);
+        backtrace_symbols_fd(const_cast<void *const *>(site.frames), site.num_frames, 2);
+    }
+}
+
+__attribute__((constructor)) void Init() {
+    const char *threads = getenv("RTCHECK_THREADS");
+    if (threads && strcmp(threads, "all") == 0) mode = kAll;
+    else if (threads && strcmp(threads, "marked") == 0) mode = kMarked;
+    const char *grace = getenv("RTCHECK_GRACE_MS");
+    if (grace) grace_ns = atoll(grace) * 1000000LL;
+    abort_on_violation = getenv("RTCHECK_ABORT") && atoi(getenv("RTCHECK_ABORT"));
+    // backtrace() loads libgcc_s on first use, which allocates; do it now.
+    void *frames[2];
+    backtrace(frames, 2);
+    if (mode == kAll) MarkThread(1);
+    atexit(Report);
+    ready = true;
+}
+
+struct StartArgs {
+    void *(*routine)(void *);
+    void *arg;
+};
+
+void *StartRealtime(void *p) {
+    StartArgs args = *static_cast<StartArgs *>(p);
+    __libc_free(p);
+    MarkThread(1);
+    return args.routine(args.arg);
+}
+
+}  // namespace
+
+#define RTCHECK(kind, call) \
+    do { if (Checking()) Record(kind, call); } while (0)
+
+extern "C" {
+
+__attribute__((visibility("default"))) void rtcheck_mark_thread(int realtime) { MarkThread(realtime); }
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*routine)(void *), void *arg) {
+    typedef int (*Fn)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *);
+    static Fn next = Next<Fn>("pthread_create");
+    if (mode == kMarked) return next(thread, attr, routine, arg);
+    StartArgs *args = static_cast<StartArgs *>(__libc_malloc(sizeof(StartArgs)));
+    args->routine = routine;
+    args->arg = arg;
+    int r = next(thread, attr, StartRealtime, args);
+    if (r != 0) __libc_free(args);
+    return r;
+}
+
+void *malloc(size_t size) {
+    RTCHECK(kAlloc, "malloc");
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    RTCHECK(kAlloc, "calloc");
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    RTCHECK(kAlloc, "realloc");
+    return __libc_realloc(p, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    RTCHECK(kAlloc, "memalign");
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    RTCHECK(kAlloc, "aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    RTCHECK(kAlloc, "posix_memalign");
+    *out = __libc_memalign(alignment, size);
+    return *out ? 0 : ENOMEM;
+}
+
+void free(void *p) {
+    if (p) RTCHECK(kFree, "free");
+    __libc_free(p);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    typedef int (*Fn)(pthread_mutex_t *);
+    static Fn trylock = Next<Fn>("pthread_mutex_trylock");
+    static Fn lock = Next<Fn>("pthread_mutex_lock");
+    if (!Checking()) return lock(mutex);
+    if (trylock(mutex) == 0) return 0;
+    Record(kLockWait, "pthread_mutex_lock");
+    return lock(mutex);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+    typedef int (*Fn)(const struct timespec *, struct timespec *);
+    static Fn next = Next<Fn>("nanosleep");
+    RTCHECK(kSleep, "nanosleep");
+    return next(req, rem);
+}
+
+int usleep(useconds_t usec) {
+    typedef int (*Fn)(useconds_t);
+    static Fn next = Next<Fn>("usleep");
+    RTCHECK(kSleep, "usleep");
+    return next(usec);
+}
+
+ssize_t write(int fd, const void *buf, size_t n) {
+    typedef ssize_t (*Fn)(int, const void *, size_t);
+    static Fn next = Next<Fn>("write");
+    RTCHECK(kIo, "write");
+    return next(fd, buf, n);
+}
+
+ssize_t read(int fd, void *buf, size_t n) {
+    typedef ssize_t (*Fn)(int, void *, size_t);
+    static Fn next = Next<Fn>("read");
+    RTCHECK(kIo, "read");
+    return next(fd, buf, n);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int count) {
+    typedef ssize_t (*Fn)(int, const struct iovec *, int);
+    static Fn next = Next<Fn>("writev");
+    RTCHECK(kIo, "writev");
+    return next(fd, iov, count);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t n, off_t offset) {
+    typedef ssize_t (*Fn)(int, const void *, size_t, off_t);
+    static Fn next = Next<Fn>("pwrite");
+    RTCHECK(kIo, "pwrite");
+    return next(fd, buf, n, offset);
+}
+
+ssize_t pwrite64(int fd, const void *buf, size_t n, off64_t offset) {
+    typedef ssize_t (*Fn)(int, const void *, size_t, off64_t);
+    static Fn next = Next<Fn>("pwrite64");
+    RTCHECK(kIo, "pwrite64");
+    return next(fd, buf, n, offset);
+}
+
+// The mode argument is only there with O_CREAT or O_TMPFILE.
+#define RTCHECK_OPEN_MODE(flags, mode_bits)                                 \
+    int mode_bits = 0;                                                      \
+    if ((flags) & (O_CREAT | O_TMPFILE)) {                                  \
+        va_list ap;                                                         \
+        va_start(ap, flags);                                                \
+        mode_bits = va_arg(ap, int);                                        \
+        va_end(ap);                                                         \
+    }
+
+int open(const char *path, int flags, ...) {
+    typedef int (*Fn)(const char *, int, ...);
+    static Fn next = Next<Fn>("open");
+    RTCHECK_OPEN_MODE(flags, mode_bits);
+    RTCHECK(kIo, "open");
+    return next(path, flags, mode_bits);
+}
+
+int open64(const char *path, int flags, ...) {
+    typedef int (*Fn)(const char *, int, ...);
+    static Fn next = Next<Fn>("open64");
+    RTCHECK_OPEN_MODE(flags, mode_bits);
+    RTCHECK(kIo, "open64");
+    return next(path, flags, mode_bits);
+}
+
+int openat(int dir, const char *path, int flags, ...) {
+    typedef int (*Fn)(int, const char *, int, ...);
+    static Fn next = Next<Fn>("openat");
+    RTCHECK_OPEN_MODE(flags, mode_bits);
+    RTCHECK(kIo, "openat");
+    return next(dir, path, flags, mode_bits);
+}
+
+FILE *fopen(const char *path, const char *mode_string) {
+    typedef FILE *(*Fn)(const char *, const char *);
+    static Fn next = Next<Fn>("fopen");
+    RTCHECK(kIo, "fopen");
+    return next(path, mode_string);
+}
+
+// std::cout goes through these when synced with stdio (the default).
+size_t fwrite(const void *p, size_t size, size_t n, FILE *f) {
+    typedef size_t (*Fn)(const void *, size_t, size_t, FILE *);
+    static Fn next = Next<Fn>("fwrite");
+    RTCHECK(kIo, "fwrite");
+    return next(p, size, n, f);
+}
+
+int fputs(const char *s, FILE *f) {
+    typedef int (*Fn)(const char *, FILE *);
+    static Fn next = Next<Fn>("fputs");
+    RTCHECK(kIo, "fputs");
+    return next(s, f);
+}
+
+int puts(const char *s) {
+    typedef int (*Fn)(const char *);
+    static Fn next = Next<Fn>("puts");
+    RTCHECK(kIo, "puts");
+    return next(s);
+}
+
+int putc(int c, FILE *f) {
+    typedef int (*Fn)(int, FILE *);
+    static Fn next = Next<Fn>("putc");
+    RTCHECK(kIo, "putc");
+    return next(c, f);
+}
+
+int fputc(int c, FILE *f) {
+    typedef int (*Fn)(int, FILE *);
+    static Fn next = Next<Fn>("fputc");
+    RTCHECK(kIo, "fputc");
+    return next(c, f);
+}
+
+int putchar(int c) {
+    typedef int (*Fn)(int);
+    static Fn next = Next<Fn>("putchar");
+    RTCHECK(kIo, "putchar");
+    return next(c);
+}
+
+int fflush(FILE *f) {
+    typedef int (*Fn)(FILE *);
+    static Fn next = Next<Fn>("fflush");
+    RTCHECK(kIo, "fflush");
+    return next(f);
+}
+
+int vfprintf(FILE *f, const char *format, va_list ap) {
+    typedef int (*Fn)(FILE *, const char *, va_list);
+    static Fn next = Next<Fn>("vfprintf");
+    RTCHECK(kIo, "vfprintf");
+    return next(f, format, ap);
+}
+
+int fprintf(FILE *f, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int r = vfprintf(f, format, ap);
+    va_end(ap);
+    return r;
+}
+
+int printf(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int r = vfprintf(stdout, format, ap);
+    va_end(ap);
+    return r;
+}
+
+}  // extern "C"
@@ -0,0 +1,297 @@
+#ifndef SIMD_UTILS_H_
+#define SIMD_UTILS_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESPEAKER_EXT_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RESPEAKER_EXT_SSE2 1
+#endif
+
+namespace respeaker_ext {
+namespace simd {
+
+// Small float kernels shared by the DSP stages. Each has a NEON and an SSE2
+// path with a scalar tail; other targets get the scalar loop, which GCC
+// vectorizes at -O3.
+
+inline float Dot(const float *a, const float *b, size_t n) {
+    size_t i = 0;
+    float sum = 0;
+#if defined(RESPEAKER_EXT_NEON)
+    float32x4_t acc = vdupq_n_f32(0);
+    for (; i + 4 <= n; i += 4) acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    float32x2_t s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vget_lane_f32(vpadd_f32(s, s), 0);
+#elif defined(RESPEAKER_EXT_SSE2)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+// y[i] += a * x[i]
+inline void Axpy(float a, const float *x, float *y, size_t n) {
+    size_t i = 0;
+#if defined(RESPEAKER_EXT_NEON)
+    float32x4_t va = vdupq_n_f32(a);
+    for (; i + 4 <= n; i += 4) vst1q_f32(y + i, vmlaq_f32(vld1q_f32(y + i), va, vld1q_f32(x + i)));
+#elif defined(RESPEAKER_EXT_SSE2)
+    __m128 va = _mm_set1_ps(a);
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+#endif
+    for (; i < n; i++) y[i] += a * x[i];
+}
+
+// x[i] *= a
+inline void Scale(float a, float *x, size_t n) {
+    size_t i = 0;
+#if defined(RESPEAKER_EXT_NEON)
+    float32x4_t va = vdupq_n_f32(a);
+    for (; i + 4 <= n; i += 4) vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), va));
+#elif defined(RESPEAKER_EXT_SSE2)
+    __m128 va = _mm_set1_ps(a);
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), va));
+#endif
+    for (; i < n; i++) x[i] *= a;
+}
+
+// out[i] = a[i] * b[i]
+inline void Multiply(const float *a, const float *b, float *out, size_t n) {
+    size_t i = 0;
+#if defined(RESPEAKER_EXT_NEON)
+    for (; i + 4 <= n; i += 4) vst1q_f32(out + i, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+#elif defined(RESPEAKER_EXT_SSE2)
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+#endif
+    for (; i < n; i++) out[i] = a[i] * b[i];
+}
+
+// out[i] = re[i]^2 + im[i]^2
+inline void Power(const float *re, const float *im, float *out, size_t n) {
+    size_t i = 0;
+#if defined(RESPEAKER_EXT_NEON)
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t r = vld1q_f32(re + i), m = vld1q_f32(im + i);
+        vst1q_f32(out + i, vmlaq_f32(vmulq_f32(r, r), m, m));
+    }
+#elif defined(RESPEAKER_EXT_SSE2)
+    for (; i + 4 <= n; i += 4) {
+        __m128 r = _mm_loadu_ps(re + i), m = _mm_loadu_ps(im + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m)));
+    }
+#endif
+    for (; i < n; i++) out[i] = re[i] * re[i] + im[i] * im[i];
+}
+
+// x[i] *= gain + i * step, a gain ramped linearly across the buffer.
+inline void Ramp(float gain, float step, float *x, size_t n) {
+    size_t i = 0;
+#if defined(RESPEAKER_EXT_NEON)
+    const float offsets[4] = {0, 1, 2, 3};
+    float32x4_t vg = vmlaq_n_f32(vdupq_n_f32(gain), vld1q_f32(offsets), step), vstep = vdupq_n_f32(4 * step);
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), vg));
+        vg = vaddq_f32(vg, vstep);
+    }
+#elif defined(RESPEAKER_EXT_SSE2)
+    __m128 vg = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(_mm_set_ps(3, 2, 1, 0), _mm_set1_ps(step)));
+    __m128 vstep = _mm_set1_ps(4 * step);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), vg));
+        vg = _mm_add_ps(vg, vstep);
+    }
+#endif
+    for (; i < n; i++) x[i] *= gain + i * step;
+}
+
+// Sum, sum of squares and peak |x| of x, plus how many samples reach
+// clip_level in magnitude. Added to what *sum, *sum_sq, *peak and *clipped
+// already hold, so a caller can run several buffers into one set.
+inline void Moments(const float *x, size_t n, float clip_level, float *sum, float *sum_sq, float *peak,
+                    uint32_t *clipped) {
+    size_t i = 0;
+    float s = 0, s2 = 0, p = *peak;
+    uint32_t count = 0;
+#if defined(RESPEAKER_EXT_NEON)
+    float32x4_t vs = vdupq_n_f32(0), vs2 = vdupq_n_f32(0), vp = vdupq_n_f32(0), vclip = vdupq_n_f32(clip_level);
+    uint32x4_t vcount = vdupq_n_u32(0);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t v = vld1q_f32(x + i), a = vabsq_f32(v);
+        vs = vaddq_f32(vs, v);
+        vs2 = vmlaq_f32(vs2, v, v);
+        vp = vmaxq_f32(vp, a);
+        vcount = vsubq_u32(vcount, vcgeq_f32(a, vclip));    // all-ones lanes are -1
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vs);
+    s = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    vst1q_f32(lanes, vs2);
+    s2 = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    vst1q_f32(lanes, vp);
+    p = std::max(std::max(p, std::max(lanes[0], lanes[1])), std::max(lanes[2], lanes[3]));
+    uint32_t counts[4];
+    vst1q_u32(counts, vcount);
+    count = counts[0] + counts[1] + counts[2] + counts[3];
+#elif defined(RESPEAKER_EXT_SSE2)
+    __m128 vs = _mm_setzero_ps(), vs2 = _mm_setzero_ps(), vp = _mm_setzero_ps(), vclip = _mm_set1_ps(clip_level);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128i vcount = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(x + i), a = _mm_andnot_ps(sign, v);
+        vs = _mm_add_ps(vs, v);
+        vs2 = _mm_add_ps(vs2, _mm_mul_ps(v, v));
+        vp = _mm_max_ps(vp, a);
+        vcount = _mm_sub_epi32(vcount, _mm_castps_si128(_mm_cmpge_ps(a, vclip)));    // all-ones lanes are -1
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vs);
+    s = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm_storeu_ps(lanes, vs2);
+    s2 = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm_storeu_ps(lanes, vp);
+    p = std::max(std::max(p, std::max(lanes[0], lanes[1])), std::max(lanes[2], lanes[3]));
+    uint32_t counts[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(counts), vcount);
+    count = counts[0] + counts[1] + counts[2] + counts[3];
+#endif
+    for (; i < n; i++) {
+        float a = x[i] < 0 ? -x[i] : x[i];
+        s += x[i];
+        s2 += x[i] * x[i];
+        p = std::max(p, a);
+        count += a >= clip_level;
+    }
+    *sum += s;
+    *sum_sq += s2;
+    *peak = p;
+    *clipped += count;
+}
+
+// Gathers one channel of an interleaved int16 buffer into floats scaled by
+// scale.
+inline void DeinterleaveToFloat(const int16_t *in, size_t num_channels, size_t channel, size_t num_frames,
+                                float scale, float *out) {
+    const int16_t *p = in + channel;
+    for (size_t i = 0; i < num_frames; i++, p += num_channels) out[i] = *p * scale;
+}
+
+// Saturating float to int16 conversion; the inverse of
+// DeinterleaveToFloat() with scale 1/32768 when num_channels is 1.
+inline void FloatToInt16(const float *in, float scale, int16_t *out, size_t n) {
+    size_t i = 0;
+#if defined(RESPEAKER_EXT_NEON)
+    float32x4_t vs = vdupq_n_f32(scale);
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t lo = vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i), vs));
+        int32x4_t hi = vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i + 4), vs));
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+#elif defined(RESPEAKER_EXT_SSE2)
+    // cvttps returns INT_MIN on overflow, so clamp before converting.
+    __m128 vs = _mm_set1_ps(scale), top = _mm_set1_ps(32767.f), bottom = _mm_set1_ps(-32768.f);
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), vs), bottom), top);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), vs), bottom), top);
+        __m128i lo = _mm_cvttps_epi32(a);
+        __m128i hi = _mm_cvttps_epi32(b);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < n; i++) {
+        float v = in[i] * scale;
+        out[i] = v >= 32767.f ? 32767 : (v <= -32768.f ? -32768 : static_cast<int16_t>(v));
+    }
+}
+
+// Scatters floats scaled by scale into one channel of an interleaved int16
+// buffer, rounding to nearest and saturating.
+inline void InterleaveFromFloat(const float *in, size_t num_frames, float scale, size_t num_channels,
+                                size_t channel, int16_t *out) {
+    int16_t *p = out + channel;
+    for (size_t i = 0; i < num_frames; i++, p += num_channels) {
+        float v = in[i] * scale;
+        v += v >= 0 ? 0.5f : -0.5f;
+        *p = v >= 32767.f ? 32767 : (v <= -32768.f ? -32768 : static_cast<int16_t>(v));
+    }
+}
+
+// Q15 kernels for the fixed-point stages. Products of two Q15 values are Q30
+// and are summed in 32 bits. With one operand any int16 signal, the sum can
+// not overflow as long as the other, the taps, has sum |tap| below 2.0 (65536
+// in Q15); FIR taps with unity DC gain do. Either operand may be the taps.
+inline int32_t DotQ15(const int16_t *a, const int16_t *b, size_t n) {
+    size_t i = 0;
+    int32_t sum = 0;
+#if defined(RESPEAKER_EXT_NEON)
+    int32x4_t acc = vdupq_n_s32(0);
+    for (; i + 4 <= n; i += 4) acc = vmlal_s16(acc, vld1_s16(a + i), vld1_s16(b + i));
+    int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    sum = vget_lane_s32(vpadd_s32(s, s), 0);
+#elif defined(RESPEAKER_EXT_SSE2)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; i++) sum += static_cast<int32_t>(a[i]) * b[i];
+    return sum;
+}
+
+// Rounds a Q30 accumulator back to a saturated Q15 sample.
+inline int16_t RoundQ30ToQ15(int32_t acc) {
+    int32_t v = (acc + (1 << 14)) >> 15;
+    return v > 32767 ? 32767 : (v < -32768 ? -32768 : static_cast<int16_t>(v));
+}
+
+// x[i] = saturate(round(x[i] * mantissa * 2^shift / 2^15)), mantissa in Q15,
+// 0 <= shift <= 14. Gains up to 2^shift come from the shift, so the
+// mantissa keeps full precision.
+inline void ScaleQ15(int16_t mantissa, int shift, int16_t *x, size_t n) {
+    size_t i = 0;
+    int right = 15 - shift;
+    int32_t round = 1 << (right - 1);
+#if defined(RESPEAKER_EXT_NEON)
+    int16x4_t vm = vdup_n_s16(mantissa);
+    int32x4_t vshift = vdupq_n_s32(-right);
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(x + i);
+        int32x4_t lo = vrshlq_s32(vmull_s16(vget_low_s16(v), vm), vshift);
+        int32x4_t hi = vrshlq_s32(vmull_s16(vget_high_s16(v), vm), vshift);
+        vst1q_s16(x + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+#elif defined(RESPEAKER_EXT_SSE2)
+    __m128i vm = _mm_set1_epi16(mantissa), vround = _mm_set1_epi32(round);
+    __m128i vright = _mm_cvtsi32_si128(right);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+        __m128i plo = _mm_mullo_epi16(v, vm), phi = _mm_mulhi_epi16(v, vm);
+        __m128i lo = _mm_sra_epi32(_mm_add_epi32(_mm_unpacklo_epi16(plo, phi), vround), vright);
+        __m128i hi = _mm_sra_epi32(_mm_add_epi32(_mm_unpackhi_epi16(plo, phi), vround), vright);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(x + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < n; i++) {
+        int32_t v = (static_cast<int32_t>(x[i]) * mantissa + round) >> right;
+        x[i] = v > 32767 ? 32767 : (v < -32768 ? -32768 : static_cast<int16_t>(v));
+    }
+}
+
+}  // namespace simd
+}  // namespace respeaker_ext
+
+#endif  // SIMD_UTILS_H_
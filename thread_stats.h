@@ -0,0 +1,363 @@
+#ifndef THREAD_STATS_H_
+#define THREAD_STATS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+}
+
+namespace respeaker_ext {
+
+// CPU time, context switches and page faults of one thread. Used both as a
+// point-in-time reading and as the difference of two readings.
+struct ThreadUsage {
+    int64_t cpu_ns = 0;
+    int64_t voluntary_switches = 0;
+    int64_t involuntary_switches = 0;
+    int64_t minor_faults = 0;
+    int64_t major_faults = 0;
+
+    // The calling thread, from CLOCK_THREAD_CPUTIME_ID and
+    // getrusage(RUSAGE_THREAD). Costs one vDSO call and one syscall.
+    static ThreadUsage Current() {
+        ThreadUsage u;
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        u.cpu_ns = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        struct rusage ru;
+        if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+            u.voluntary_switches = ru.ru_nvcsw;
+            u.involuntary_switches = ru.ru_nivcsw;
+            u.minor_faults = ru.ru_minflt;
+            u.major_faults = ru.ru_majflt;
+        }
+        return u;
+    }
+
+    ThreadUsage operator-(const ThreadUsage &o) const {
+        ThreadUsage d;
+        d.cpu_ns = cpu_ns - o.cpu_ns;
+        d.voluntary_switches = voluntary_switches - o.voluntary_switches;
+        d.involuntary_switches = involuntary_switches - o.involuntary_switches;
+        d.minor_faults = minor_faults - o.minor_faults;
+        d.major_faults = major_faults - o.major_faults;
+        return d;
+    }
+};
+
+// Per-second rates over an interval, CPU as percent of one core.
+struct UsageRates {
+    double cpu_percent = 0;
+    double voluntary_per_s = 0;
+    double involuntary_per_s = 0;
+    double minor_faults_per_s = 0;
+    double major_faults_per_s = 0;
+
+    static UsageRates Between(const ThreadUsage &before, const ThreadUsage &after, double seconds) {
+        UsageRates r;
+        if (seconds <= 0) return r;
+        ThreadUsage d = after - before;
+        r.cpu_percent = 100.0 * d.cpu_ns / 1e9 / seconds;
+        r.voluntary_per_s = d.voluntary_switches / seconds;
+        r.involuntary_per_s = d.involuntary_switches / seconds;
+        r.minor_faults_per_s = d.minor_faults / seconds;
+        r.major_faults_per_s = d.major_faults / seconds;
+        return r;
+    }
+};
+
+// Running totals of the usage a node spent on its blocks. The thread that
+// runs the node adds one delta per block; any thread may read.
+class NodeUsageCounter {
+public:
+    struct Totals {
+        uint64_t blocks = 0;
+        ThreadUsage usage;
+    };
+
+    void Add(const ThreadUsage &delta) {
+        blocks_.fetch_add(1, std::memory_order_relaxed);
+        cpu_ns_.fetch_add(delta.cpu_ns, std::memory_order_relaxed);
+        voluntary_.fetch_add(delta.voluntary_switches, std::memory_order_relaxed);
+        involuntary_.fetch_add(delta.involuntary_switches, std::memory_order_relaxed);
+        minor_.fetch_add(delta.minor_faults, std::memory_order_relaxed);
+        major_.fetch_add(delta.major_faults, std::memory_order_relaxed);
+    }
+
+    Totals Get() const {
+        Totals t;
+        t.blocks = blocks_.load(std::memory_order_relaxed);
+        t.usage.cpu_ns = cpu_ns_.load(std::memory_order_relaxed);
+        t.usage.voluntary_switches = voluntary_.load(std::memory_order_relaxed);
+        t.usage.involuntary_switches = involuntary_.load(std::memory_order_relaxed);
+        t.usage.minor_faults = minor_.load(std::memory_order_relaxed);
+        t.usage.major_faults = major_.load(std::memory_order_relaxed);
+        return t;
+    }
+
+private:
+    std::atomic<uint64_t> blocks_{0};
+    std::atomic<int64_t> cpu_ns_{0}, voluntary_{0}, involuntary_{0}, minor_{0}, major_{0};
+};
+
+// Reads the usage of every thread in the process from /proc/self/task, which
+// covers the node threads librespeaker starts and does not expose. Threads
+// are matched to nodes by label: LabelNewThreads() names the threads that
+// appeared since MarkKnownThreads(), oldest first, which for
+// ReSpeaker::Start() is one thread per node from the head of the chain on.
+// If the count does not match (a node that starts helper threads, e.g. a
+// PulseAudio client) nothing is labelled rather than guessing. Threads
+// without a label show their comm name.
+class ProcessThreadSampler {
+public:
+    struct TaskSample {
+        pid_t tid;
+        std::string label;
+        int processor;
+        ThreadUsage usage;
+    };
+
+    void MarkKnownThreads() {
+        std::lock_guard<std::mutex> guard(lock_);
+        known_.clear();
+        std::vector<pid_t> tids = ListTids();
+        known_.insert(tids.begin(), tids.end());
+    }
+
+    // Returns false, labelling nothing, unless exactly names.size() threads
+    // are new.
+    bool LabelNewThreads(const std::vector<std::string> &names) {
+        std::lock_guard<std::mutex> guard(lock_);
+        std::vector<pid_t> tids = ListTids(), fresh;
+        for (size_t i = 0; i < tids.size(); i++) {
+            if (!known_.count(tids[i])) fresh.push_back(tids[i]);
+        }
+        known_.insert(fresh.begin(), fresh.end());
+        if (fresh.size() != names.size()) return false;
+        for (size_t i = 0; i < fresh.size(); i++) labels_[fresh[i]] = names[i];
+        return true;
+    }
+
+    void Label(pid_t tid, const std::string &name) {
+        std::lock_guard<std::mutex> guard(lock_);
+        labels_[tid] = name;
+    }
+
+    // The calling thread's id, for Label().
+    static pid_t CurrentTid() { return static_cast<pid_t>(syscall(SYS_gettid)); }
+
+    std::vector<TaskSample> Sample() {
+        std::vector<TaskSample> samples;
+        std::vector<pid_t> tids = ListTids();
+        std::lock_guard<std::mutex> guard(lock_);
+        for (size_t i = 0; i < tids.size(); i++) {
+            TaskSample s;
+            s.tid = tids[i];
+            if (!ReadTask(s.tid, &s)) continue;
+            std::map<pid_t, std::string>::const_iterator it = labels_.find(s.tid);
+            if (it != labels_.end()) s.label = it->second;
+            samples.push_back(s);
+        }
+        return samples;
+    }
+
+private:
+    static std::vector<pid_t> ListTids() {
+        std::vector<pid_t> tids;
+        DIR *dir = opendir("/proc/self/task");
+        if (!dir) return tids;
+        while (struct dirent *entry = readdir(dir)) {
+            if (entry->d_name[0] >= '0' && entry->d_name[0] <= '9') tids.push_back(atoi(entry->d_name));
+        }
+        closedir(dir);
+        std::sort(tids.begin(), tids.end());
+        return tids;
+    }
+
+    static bool ReadFile(const std::string &path, char *buffer, size_t size) {
+        FILE *f = fopen(path.c_str(), "r");
+        if (!f) return false;
+        size_t n = fread(buffer, 1, size - 1, f);
+        fclose(f);
+        buffer[n] = '\0';
+        return n > 0;
+    }
+
+    // stat gives the name, faults, tick-resolution times and the last CPU;
+    // schedstat, where the kernel has it, gives run time in ns; status
+    // gives the context switches.
+    static bool ReadTask(pid_t tid, TaskSample *s) {
+        char path[64], buffer[4096];
+        snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+        if (!ReadFile(path, buffer, sizeof(buffer))) return false;
+        char *name = strchr(buffer, '('), *name_end = strrchr(buffer, ')');
+        if (!name || !name_end) return false;
+        s->label.assign(name + 1, name_end);
+        // Fields after the name, numbered as in proc(5): 3 is state.
+        std::vector<long long> fields(3, 0);
+        for (char *p = name_end + 2; *p;) {
+            char *end;
+            long long v = strtoll(p, &end, 10);
+            if (end == p) v = 0, end = strchr(p, ' ') ? strchr(p, ' ') : p + strlen(p);
+            fields.push_back(v);
+            p = *end ? end + 1 : end;
+        }
+        if (fields.size() < 40) return false;
+        static const long ticks = sysconf(_SC_CLK_TCK);
+        s->usage.minor_faults = fields[10];
+        s->usage.major_faults = fields[12];
+        s->usage.cpu_ns = (fields[14] + fields[15]) * (1000000000LL / ticks);
+        s->processor = static_cast<int>(fields[39]);
+
+        snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", tid);
+        long long run_ns;
+        if (ReadFile(path, buffer, sizeof(buffer)) && sscanf(buffer, "%lld", &run_ns) == 1) s->usage.cpu_ns = run_ns;
+
+        snprintf(path, sizeof(path), "/proc/self/task/%d/status", tid);
+        if (ReadFile(path, buffer, sizeof(buffer))) {
+            const char *v = strstr(buffer, "\nvoluntary_ctxt_switches:");
+            const char *nv = strstr(buffer, "\nnonvoluntary_ctxt_switches:");
+            if (v) s->usage.voluntary_switches = atoll(v + strlen("\nvoluntary_ctxt_switches:"));
+            if (nv) s->usage.involuntary_switches = atoll(nv + strlen("\nnonvoluntary_ctxt_switches:"));
+        }
+        return true;
+    }
+
+    std::mutex lock_;
+    std::set<pid_t> known_;
+    std::map<pid_t, std::string> labels_;
+};
+
+// Prints one row per thread with the rates since the previous Print() and
+// the totals since the first, next to each node's queue depth when given
+// (keyed by label). Rows are sorted by CPU, busiest first; idle unlabelled
+// threads are left out.
+class ThreadUsageReport {
+public:
+    explicit ThreadUsageReport(ProcessThreadSampler *sampler) : sampler_(sampler), last_wall_(0) {}
+
+    // Takes the baseline without printing.
+    void Prime() {
+        last_wall_ = WallSeconds();
+        std::vector<ProcessThreadSampler::TaskSample> samples = sampler_->Sample();
+        for (size_t i = 0; i < samples.size(); i++) {
+            first_[samples[i].tid] = samples[i].usage;
+            last_[samples[i].tid] = samples[i].usage;
+        }
+    }
+
+    // Starts the window PrintFaults() covers, e.g. once start-up is over.
+    void MarkSteadyState() {
+        steady_.clear();
+        std::vector<ProcessThreadSampler::TaskSample> samples = sampler_->Sample();
+        for (size_t i = 0; i < samples.size(); i++) steady_[samples[i].tid] = samples[i].usage;
+    }
+
+    // One row per thread with the minor and major faults since
+    // MarkSteadyState() (or Prime()), faulting threads first. Threads started
+    // after the mark count from zero. Returns the process total, which is 0
+    // when steady state is fault-free.
+    int64_t PrintFaults(std::ostream &out) {
+        const std::map<pid_t, ThreadUsage> &base = steady_.empty() ? first_ : steady_;
+        std::vector<ProcessThreadSampler::TaskSample> samples = sampler_->Sample();
+        std::vector<std::pair<ThreadUsage, const ProcessThreadSampler::TaskSample *>> rows;
+        for (size_t i = 0; i < samples.size(); i++) {
+            std::map<pid_t, ThreadUsage>::const_iterator it = base.find(samples[i].tid);
+            ThreadUsage since = it != base.end() ? samples[i].usage - it->second : samples[i].usage;
+            rows.push_back(std::make_pair(since, &samples[i]));
+        }
+        std::sort(rows.begin(), rows.end(),
+                  [](const std::pair<ThreadUsage, const ProcessThreadSampler::TaskSample *> &a,
+                     const std::pair<ThreadUsage, const ProcessThreadSampler::TaskSample *> &b) {
+                      return a.first.minor_faults + a.first.major_faults > b.first.minor_faults + b.first.major_faults;
+                  });
+        out << std::setw(18) << "thread" << std::setw(8) << "tid" << std::setw(10) << "minflt" << std::setw(10)
+            << "majflt" << std::endl;
+        int64_t total = 0;
+        for (size_t i = 0; i < rows.size(); i++) {
+            const ThreadUsage &u = rows[i].first;
+            out << std::setw(18) << rows[i].second->label.substr(0, 17) << std::setw(8) << rows[i].second->tid
+                << std::setw(10) << u.minor_faults << std::setw(10) << u.major_faults << std::endl;
+            total += u.minor_faults + u.major_faults;
+        }
+        out << "page faults since " << (steady_.empty() ? "start" : "steady state") << ": " << total << std::endl;
+        return total;
+    }
+
+    void Print(std::ostream &out, const std::map<std::string, size_t> &queue_depths = std::map<std::string, size_t>()) {
+        double now = WallSeconds();
+        double seconds = last_wall_ > 0 ? now - last_wall_ : 0;
+        last_wall_ = now;
+        std::vector<ProcessThreadSampler::TaskSample> samples = sampler_->Sample();
+        std::vector<std::pair<UsageRates, const ProcessThreadSampler::TaskSample *>> rows;
+        for (size_t i = 0; i < samples.size(); i++) {
+            const ProcessThreadSampler::TaskSample &s = samples[i];
+            if (!first_.count(s.tid)) first_[s.tid] = s.usage;
+            UsageRates r = last_.count(s.tid) ? UsageRates::Between(last_[s.tid], s.usage, seconds) : UsageRates();
+            last_[s.tid] = s.usage;
+            if (r.cpu_percent < 0.05 && !queue_depths.count(s.label)) continue;
+            rows.push_back(std::make_pair(r, &s));
+        }
+        std::sort(rows.begin(), rows.end(),
+                  [](const std::pair<UsageRates, const ProcessThreadSampler::TaskSample *> &a,
+                     const std::pair<UsageRates, const ProcessThreadSampler::TaskSample *> &b) {
+                      return a.first.cpu_percent > b.first.cpu_percent;
+                  });
+
+        std::ios::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(1);
+        out << std::setw(18) << "thread" << std::setw(8) << "tid" << std::setw(5) << "cpu" << std::setw(8) << "cpu%"
+            << std::setw(9) << "vcsw/s" << std::setw(9) << "ivcsw/s" << std::setw(9) << "minflt/s" << std::setw(9)
+            << "majflt/s" << std::setw(10) << "cpu s" << std::setw(7) << "queue" << std::endl;
+        double total = 0;
+        for (size_t i = 0; i < rows.size(); i++) {
+            const UsageRates &r = rows[i].first;
+            const ProcessThreadSampler::TaskSample &s = *rows[i].second;
+            ThreadUsage since = s.usage - first_[s.tid];
+            std::map<std::string, size_t>::const_iterator depth = queue_depths.find(s.label);
+            out << std::setw(18) << s.label.substr(0, 17) << std::setw(8) << s.tid << std::setw(5) << s.processor
+                << std::setw(8) << r.cpu_percent << std::setw(9) << r.voluntary_per_s << std::setw(9)
+                << r.involuntary_per_s << std::setw(9) << r.minor_faults_per_s << std::setw(9) << r.major_faults_per_s
+                << std::setw(10) << since.cpu_ns / 1e9 << std::setw(7);
+            if (depth != queue_depths.end()) out << depth->second;
+            else out << "-";
+            out << std::endl;
+            total += r.cpu_percent;
+        }
+        out << "process total " << total << "% of one core" << std::endl;
+        out.flags(flags);
+    }
+
+private:
+    static double WallSeconds() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    ProcessThreadSampler *sampler_;
+    double last_wall_;
+    std::map<pid_t, ThreadUsage> first_, last_, steady_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // THREAD_STATS_H_
@@ -0,0 +1,74 @@
+#ifndef WAV_BLOCK_READER_H_
+#define WAV_BLOCK_READER_H_
+
+#include <cstring>
+#include <string>
+
+#include "capture_clock.h"
+#include "chain_stage.h"
+
+extern "C"
+{
+#include <sndfile.h>
+}
+
+namespace respeaker_ext {
+
+// Reads a wav file block by block, like FileCollectorNode but without a
+// thread of its own. If loop is set, the file restarts at EOF instead of
+// ending the stream. Blocks are stamped as captured when they are read, with
+// the sample index counting on across loops.
+class WavBlockReader : public BlockSource {
+public:
+    static WavBlockReader *Create(const std::string &path, int block_size_ms, bool loop = false) {
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        SNDFILE *file = sf_open(path.c_str(), SFM_READ, &info);
+        if (!file) {
+            return nullptr;
+        }
+        return new WavBlockReader(file, info, block_size_ms, loop);
+    }
+
+    ~WavBlockReader() { sf_close(file_); }
+
+    bool Read(AudioBlock *block) override {
+        block->num_channels = info_.channels;
+        block->rate = info_.samplerate;
+        block->sequence = sequence_++;
+        block->sample_index = next_frame_;
+        block->capture_ns = MonotonicNs();
+        block->data.resize(frames_per_block_ * info_.channels * sizeof(int16_t));
+        sf_count_t got = sf_readf_short(file_, block->Samples(), frames_per_block_);
+        if (got < frames_per_block_ && loop_ && info_.frames > 0) {
+            sf_seek(file_, 0, SEEK_SET);
+            got += sf_readf_short(file_, block->Samples() + got * info_.channels, frames_per_block_ - got);
+        }
+        if (got <= 0) {
+            return false;
+        }
+        block->data.resize(got * info_.channels * sizeof(int16_t));
+        next_frame_ += got;
+        return true;
+    }
+
+    size_t GetNumChannels() const override { return info_.channels; }
+    int GetRate() const override { return info_.samplerate; }
+    int64_t GetNumFrames() const { return info_.frames; }
+    size_t GetFramesPerBlock() const { return frames_per_block_; }
+
+private:
+    WavBlockReader(SNDFILE *file, const SF_INFO &info, int block_size_ms, bool loop)
+        : file_(file), info_(info), loop_(loop), sequence_(0), next_frame_(0),
+          frames_per_block_(static_cast<sf_count_t>(info.samplerate) * block_size_ms / 1000) {}
+
+    SNDFILE *file_;
+    SF_INFO info_;
+    bool loop_;
+    uint64_t sequence_, next_frame_;
+    sf_count_t frames_per_block_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // WAV_BLOCK_READER_H_
@@ -0,0 +1,213 @@
+#ifndef WORK_STEALING_POOL_H_
+#define WORK_STEALING_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace respeaker_ext {
+
+// Fixed-size pool of worker threads. Each worker owns a deque: tasks submitted
+// from a worker go to the back of its own deque and are popped from the back
+// (cache-warm), idle workers steal from the front of the others. Tasks
+// submitted from outside the pool are spread round-robin.
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Task;
+
+    explicit WorkStealingPool(size_t num_workers)
+        : pending_(0), stopping_(false), next_worker_(0) {
+        if (num_workers == 0) num_workers = 1;
+        for (size_t i = 0; i < num_workers; i++) {
+            workers_.push_back(std::unique_ptr<Worker>(new Worker));
+        }
+        for (size_t i = 0; i < num_workers; i++) {
+            threads_.push_back(std::thread(&WorkStealingPool::WorkerLoop, this, i));
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> guard(wake_lock_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (size_t i = 0; i < threads_.size(); i++) {
+            threads_[i].join();
+        }
+    }
+
+    void Submit(Task task) { Push(std::move(task), false); }
+
+    // Like Submit, but from a worker the task goes to the front of its deque:
+    // behind everything else the worker has queued, and first in line for a
+    // thief. For a task re-submitting itself to give way to others.
+    void Yield(Task task) { Push(std::move(task), true); }
+
+    size_t GetNumWorkers() const { return workers_.size(); }
+
+    // Number of tasks waiting to run, over all workers.
+    size_t GetQueueDeepth() const { return pending_.load(std::memory_order_relaxed); }
+
+    // Number of tasks a worker took from another worker's deque.
+    uint64_t GetStealCount() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    void Push(Task task, bool front) {
+        size_t index;
+        if (CurrentPool() == this) {
+            index = CurrentWorker();
+        }
+        else {
+            index = next_worker_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+        }
+        {
+            std::lock_guard<std::mutex> guard(workers_[index]->lock);
+            if (front) {
+                workers_[index]->tasks.push_front(std::move(task));
+            }
+            else {
+                workers_[index]->tasks.push_back(std::move(task));
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(wake_lock_);
+            pending_++;
+        }
+        wake_.notify_one();
+    }
+
+    static WorkStealingPool *&CurrentPool() {
+        static thread_local WorkStealingPool *pool = nullptr;
+        return pool;
+    }
+
+    static size_t &CurrentWorker() {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    bool PopLocal(size_t index, Task *task) {
+        std::lock_guard<std::mutex> guard(workers_[index]->lock);
+        if (workers_[index]->tasks.empty()) return false;
+        *task = std::move(workers_[index]->tasks.back());
+        workers_[index]->tasks.pop_back();
+        return true;
+    }
+
+    bool Steal(size_t thief, Task *task) {
+        for (size_t i = 1; i < workers_.size(); i++) {
+            Worker *victim = workers_[(thief + i) % workers_.size()].get();
+            std::lock_guard<std::mutex> guard(victim->lock);
+            if (!victim->tasks.empty()) {
+                *task = std::move(victim->tasks.front());
+                victim->tasks.pop_front();
+                steals_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerLoop(size_t index) {
+        CurrentPool() = this;
+        CurrentWorker() = index;
+        Task task;
+        while (true) {
+            if (PopLocal(index, &task) || Steal(index, &task)) {
+                pending_.fetch_sub(1);
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(wake_lock_);
+            wake_.wait(guard, [this] { return pending_.load() > 0 || stopping_; });
+            if (stopping_ && pending_.load() == 0) break;
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::mutex wake_lock_;
+    std::condition_variable wake_;
+    std::atomic<size_t> pending_;
+    std::atomic<uint64_t> steals_{0};
+    bool stopping_;
+    std::atomic<size_t> next_worker_;
+};
+
+// Runs the tasks posted to it one at a time and in posting order, on whichever
+// pool worker is free. One strand per node gives each node the ordering a
+// dedicated node thread would have, without owning the thread.
+class SerialStrand {
+public:
+    explicit SerialStrand(WorkStealingPool *pool, size_t batch = 8)
+        : pool_(pool), batch_(batch), scheduled_(false) {}
+
+    void Post(WorkStealingPool::Task task) {
+        bool schedule = false;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            queue_.push_back(std::move(task));
+            if (!scheduled_) {
+                scheduled_ = true;
+                schedule = true;
+            }
+        }
+        if (schedule) {
+            pool_->Submit([this] { Drain(); });
+        }
+    }
+
+    size_t GetQueueDeepth() {
+        std::lock_guard<std::mutex> guard(lock_);
+        return queue_.size();
+    }
+
+    bool IsIdle() {
+        std::lock_guard<std::mutex> guard(lock_);
+        return !scheduled_;
+    }
+
+private:
+    // Runs up to batch_ tasks, then yields the worker so one busy node can not
+    // starve the strands of other chains. A plain Submit would put the drain
+    // back where the worker pops next, and it would run again at once.
+    void Drain() {
+        for (size_t n = 0; n < batch_; n++) {
+            WorkStealingPool::Task task;
+            {
+                std::lock_guard<std::mutex> guard(lock_);
+                if (queue_.empty()) {
+                    scheduled_ = false;
+                    return;
+                }
+                task = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            task();
+        }
+        pool_->Yield([this] { Drain(); });
+    }
+
+    WorkStealingPool *pool_;
+    size_t batch_;
+    std::mutex lock_;
+    std::deque<WorkStealingPool::Task> queue_;
+    bool scheduled_;
+};
+
+}  // namespace respeaker_ext
+
+#endif  // WORK_STEALING_POOL_H_